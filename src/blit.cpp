@@ -0,0 +1,192 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "blit.h"
+#include "display.h"
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <chrono>
+
+ad_blit_cache_s blit_cache;
+
+static const float AD_ASPECT_16x9 = (16.0f / 9.0f);
+
+// Within this much of 16:9 a surface counts as 16:9 (720p, 1080p, 1366x768 ...)
+static const float AD_ASPECT_EPSILON = 0.01f;
+
+bool
+AD_Blit_Fit (uint32_t src_w, uint32_t src_h, const RECT& dest, RECT& fixed)
+{
+  if ((! config.render.aspect_correction) || src_w == 0 || src_h == 0)
+    return false;
+
+  const LONG dest_w = dest.right  - dest.left;
+  const LONG dest_h = dest.bottom - dest.top;
+
+  if (dest_w <= 0 || dest_h <= 0 || display.height == 0)
+    return false;
+
+  const float src_aspect  = (float)src_w  / (float)src_h;
+  const float dest_aspect = (float)dest_w / (float)dest_h;
+
+  // Only targets shaped like the backbuffer are ever shown to the player
+  //   (a 2:1 target on a 21:9 display isn't one)
+  if (fabsf (dest_aspect - (float)display.width / (float)display.height) > AD_ASPECT_EPSILON)
+    return false;
+
+  if (fabsf (src_aspect - AD_ASPECT_16x9) > AD_ASPECT_EPSILON)
+    return false;
+
+  if (fabsf (dest_aspect - src_aspect) <= AD_ASPECT_EPSILON)
+    return false;
+
+  fixed = dest;
+
+  // Pillarbox
+  if (dest_aspect > src_aspect) {
+    LONG width = (LONG)floorf ((float)dest_h * src_aspect + 0.5f);
+
+    fixed.left  = dest.left + (dest_w - width) / 2;
+    fixed.right = fixed.left + width;
+  }
+
+  // Letterbox
+  else {
+    LONG height = (LONG)floorf ((float)dest_w / src_aspect + 0.5f);
+
+    fixed.top    = dest.top + (dest_h - height) / 2;
+    fixed.bottom = fixed.top + height;
+  }
+
+  return true;
+}
+
+
+bool
+ad_blit_cache_s::fit (uint32_t src_w, uint32_t src_h, const RECT& dest, RECT& fixed)
+{
+  uint32_t key = ( src_w * 73856093U ) ^ ( src_h * 19349663U ) ^
+                 ( (uint32_t)dest.right * 83492791U ) ^ (uint32_t)dest.bottom ^
+                 ( (uint32_t)dest.left  * 2654435769U ) ^ (uint32_t)dest.top;
+
+  entry_s& entry = entries [(key ^ (key >> 16)) & (NUM_ENTRIES - 1)];
+
+  if ( entry.generation == display.generation && entry.src_w == src_w &&
+                                                 entry.src_h == src_h &&
+       entry.aspect_correction == config.render.aspect_correction &&
+       memcmp (&entry.dest, &dest, sizeof (RECT)) == 0 ) {
+    ++hits;
+
+    if (entry.correct)
+      fixed = entry.fixed;
+
+    return entry.correct;
+  }
+
+  ++misses;
+
+  entry.src_w      = src_w;
+  entry.src_h      = src_h;
+  entry.dest       = dest;
+  entry.generation = display.generation;
+  entry.aspect_correction
+                   = config.render.aspect_correction;
+  entry.correct    = AD_Blit_Fit (src_w, src_h, dest, entry.fixed);
+
+  if (entry.correct)
+    fixed = entry.fixed;
+
+  return entry.correct;
+}
+
+void
+ad_blit_cache_s::clear (void)
+{
+  memset (entries, 0, sizeof (entries));
+
+  hits   = 0;
+  misses = 0;
+}
+
+
+ad_blit_bench_s
+AD_Blit_Benchmark (const ad_blit_call_s* calls, size_t count)
+{
+  typedef std::chrono::steady_clock clock;
+
+  // Enough repetitions to get past timer resolution on a few dozen blits
+  const int passes = 1024;
+
+  ad_blit_cache_s cache;
+  ad_blit_bench_s result = { };
+
+  // Correctness: the cache must agree with the math on every call, also
+  //   when it is cold, so compare while filling it.
+  for (size_t i = 0; i < count; i++) {
+    RECT direct = { }, cached = { };
+
+    bool a = AD_Blit_Fit (calls [i].src_w, calls [i].src_h, calls [i].dest, direct);
+    bool b = cache.fit   (calls [i].src_w, calls [i].src_h, calls [i].dest, cached);
+
+    if (a)
+      ++result.corrected;
+
+    if (a != b || (a && memcmp (&direct, &cached, sizeof (RECT)) != 0)) {
+      if (result.mismatches++ == 0)
+        result.first_mismatch = calls [i];
+    }
+  }
+
+  double        ns_per_call [2];
+  volatile LONG sink = 0;
+
+  for (int pass = 0; pass < 2; pass++) {
+    clock::time_point start = clock::now ();
+
+    for (int rep = 0; rep < passes; rep++) {
+      for (size_t i = 0; i < count; i++) {
+        RECT fixed = { };
+
+        if (pass == 0)
+          AD_Blit_Fit (calls [i].src_w, calls [i].src_h, calls [i].dest, fixed);
+        else
+          cache.fit   (calls [i].src_w, calls [i].src_h, calls [i].dest, fixed);
+
+        sink += fixed.right;
+      }
+    }
+
+    ns_per_call [pass] =
+      std::chrono::duration <double, std::nano> (clock::now () - start).count () /
+        ((double)passes * (double)(count > 0 ? count : 1));
+  }
+
+  result.math_ns   = ns_per_call [0];
+  result.cached_ns = ns_per_call [1];
+  result.hits      = cache.hits;
+  result.misses    = cache.misses;
+
+  return result;
+}
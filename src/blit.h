@@ -0,0 +1,87 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__BLIT_H__
+#define __AD__BLIT_H__
+
+#include <Windows.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Letterbox / pillarbox correction for 16:9 StretchRect blits (movies,
+//   fades) onto targets shaped like a non-16:9 backbuffer.
+//
+//  * Returns false if the blit needs no correction; otherwise fixed is the
+//      largest rect with the source's aspect ratio centered inside dest.
+//
+bool AD_Blit_Fit (uint32_t src_w, uint32_t src_h, const RECT& dest, RECT& fixed);
+
+//
+// Remembers AD_Blit_Fit's answer per (source size, dest rect, display
+//   generation, AspectCorrection), so that the same blits every frame skip
+//     the float math.
+//
+struct ad_blit_cache_s {
+  bool fit   (uint32_t src_w, uint32_t src_h, const RECT& dest, RECT& fixed);
+  void clear (void);
+
+  int  hits   = 0;
+  int  misses = 0;
+
+protected:
+  enum { NUM_ENTRIES = 16 };     // Power-of-two, direct-mapped
+
+  struct entry_s {
+    uint32_t src_w, src_h;
+    RECT     dest;
+    uint32_t generation;         // display.generation it was computed for
+    bool     aspect_correction;  //   ... and config.render.aspect_correction
+    bool     correct;
+    RECT     fixed;
+  } entries [NUM_ENTRIES] = { };
+};
+
+extern ad_blit_cache_s blit_cache;
+
+// One StretchRect as the correction sees it
+struct ad_blit_call_s {
+  uint32_t src_w, src_h;
+  RECT     dest;
+};
+
+//
+// Replays recorded blits through AD_Blit_Fit and a fresh ad_blit_cache_s:
+//   any disagreement between the two, and the cost per call of both.
+//
+struct ad_blit_bench_s {
+  size_t         corrected;
+  size_t         mismatches;
+  ad_blit_call_s first_mismatch;
+  double         math_ns;        // Per call
+  double         cached_ns;      // Per call
+  int            hits;
+  int            misses;
+};
+
+ad_blit_bench_s AD_Blit_Benchmark (const ad_blit_call_s* calls, size_t count);
+
+#endif /* __AD__BLIT_H__ */
@@ -39,6 +39,11 @@ struct {
   ad::ParameterBool*    allow_background;
   ad::ParameterFloat*   foreground_fps;
   ad::ParameterFloat*   background_fps;
+  ad::ParameterBool*    limiter_post;
+  ad::ParameterFloat*   limiter_spin_ms;
+  ad::ParameterBool*    background_mode;
+  ad::ParameterInt*     background_drop;
+  ad::ParameterBool*    background_cache;
 } render;
 
 struct {
@@ -127,6 +132,56 @@ AD_LoadConfig (std::wstring name) {
       L"AgDrag.Render",
         L"BackgroundFPS" );
 
+  render.limiter_post =
+    static_cast <ad::ParameterBool *>
+      (g_ParameterFactory.create_parameter <bool> (
+        L"Limit framerate after Present")
+      );
+  render.limiter_post->register_to_ini (
+    dll_ini,
+      L"AgDrag.Render",
+        L"LimiterPostPresent" );
+
+  render.limiter_spin_ms =
+    static_cast <ad::ParameterFloat *>
+      (g_ParameterFactory.create_parameter <float> (
+        L"Framerate limiter spin-wait")
+      );
+  render.limiter_spin_ms->register_to_ini (
+    dll_ini,
+      L"AgDrag.Render",
+        L"LimiterSpinMs" );
+
+  render.background_mode =
+    static_cast <ad::ParameterBool *>
+      (g_ParameterFactory.create_parameter <bool> (
+        L"Skip fixups while inactive")
+      );
+  render.background_mode->register_to_ini (
+    dll_ini,
+      L"AgDrag.Render",
+        L"BackgroundMode" );
+
+  render.background_drop =
+    static_cast <ad::ParameterInt *>
+      (g_ParameterFactory.create_parameter <int> (
+        L"Drop every Nth background frame")
+      );
+  render.background_drop->register_to_ini (
+    dll_ini,
+      L"AgDrag.Render",
+        L"BackgroundDropEvery" );
+
+  render.background_cache =
+    static_cast <ad::ParameterBool *>
+      (g_ParameterFactory.create_parameter <bool> (
+        L"Present the last drawn frame for dropped ones")
+      );
+  render.background_cache->register_to_ini (
+    dll_ini,
+      L"AgDrag.Render",
+        L"BackgroundCache" );
+
 
   scaling.mouse_y_offset = 
     static_cast <ad::ParameterFloat *>
@@ -250,6 +305,21 @@ AD_LoadConfig (std::wstring name) {
   if (render.background_fps->load ())
     config.render.background_fps = render.background_fps->get_value ();
 
+  if (render.limiter_post->load ())
+    config.render.limiter_post = render.limiter_post->get_value ();
+
+  if (render.limiter_spin_ms->load ())
+    config.render.limiter_spin_ms = render.limiter_spin_ms->get_value ();
+
+  if (render.background_mode->load ())
+    config.render.background_mode = render.background_mode->get_value ();
+
+  if (render.background_drop->load ())
+    config.render.background_drop = render.background_drop->get_value ();
+
+  if (render.background_cache->load ())
+    config.render.background_cache = render.background_cache->get_value ();
+
 
   if (scaling.hud_x_offset->load ())
     config.scaling.hud_x_offset = scaling.hud_x_offset->get_value ();
@@ -307,6 +377,21 @@ AD_SaveConfig (std::wstring name, bool close_config) {
   render.background_fps->set_value    (config.render.background_fps);
   render.background_fps->store        ();
 
+  render.limiter_post->set_value       (config.render.limiter_post);
+  render.limiter_post->store           ();
+
+  render.limiter_spin_ms->set_value    (config.render.limiter_spin_ms);
+  render.limiter_spin_ms->store        ();
+
+  render.background_mode->set_value   (config.render.background_mode);
+  render.background_mode->store       ();
+
+  render.background_drop->set_value   (config.render.background_drop);
+  render.background_drop->store       ();
+
+  render.background_cache->set_value  (config.render.background_cache);
+  render.background_cache->store      ();
+
 
   if (! config.scaling.locked) {
     scaling.mouse_y_offset->set_value   (config.scaling.mouse_y_offset);
@@ -34,9 +34,16 @@ struct ad_config_s
     float    aspect_ratio      = (16.0f / 9.0f);
     bool     center_ui         = true;
     bool     fix_minimap       = true;
+    bool     fix_scissor       = true;
+    bool     fix_blits         = true;
     bool     allow_background  = true;
     float    foreground_fps    =  0.0f; // Unlimited
     float    background_fps    = 15.0f;
+    bool     limiter_post      = false; // Wait after Present instead of before
+    float    limiter_spin_ms   = 2.0f;  // Busy-wait the end of every frame
+    bool     background_mode   = false; // No fixups while the window is inactive
+    int      background_drop   = 0;     //   ... and drop the draws of every Nth frame
+    bool     background_cache  = true;  //   ... presenting the last drawn frame instead
   } render;
 
   struct {
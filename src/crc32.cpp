@@ -0,0 +1,440 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "crc32.h"
+
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+# define AD_TARGET_PCLMUL
+# define AD_ALIGN16       __declspec (align (16))
+#else
+# include <cpuid.h>
+# include <immintrin.h>
+# define AD_TARGET_PCLMUL __attribute__ ((target ("sse4.1,pclmul")))
+# define AD_ALIGN16       __attribute__ ((aligned (16)))
+#endif
+
+static uint32_t crc32_tab[] = {
+  0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+  0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+  0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+  0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+  0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+  0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+  0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+  0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+  0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+  0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+  0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+  0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+  0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+  0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+  0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+  0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+  0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+  0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+  0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+  0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+  0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+  0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+  0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+  0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+  0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+  0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+  0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+  0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+  0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+  0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+  0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+  0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+  0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+  0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+  0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+  0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+  0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+  0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+  0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+  0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+  0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+  0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+  0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+// crc32_tab extended to slice-by-16; [0] is crc32_tab itself
+static uint32_t crc32_slice [16][256];
+
+static struct ad_crc32_engine_s {
+  bool              pclmul = false;
+  ad_crc32_kernel_t best   = AD_CRC32_SLICE16;
+
+  ad_crc32_engine_s (void)
+  {
+    memcpy (crc32_slice [0], crc32_tab, sizeof (crc32_tab));
+
+    for (int i = 0; i < 256; i++) {
+      uint32_t crc = crc32_slice [0][i];
+
+      for (int slice = 1; slice < 16; slice++) {
+        crc                    = crc32_slice [0][crc & 0xFF] ^ (crc >> 8);
+        crc32_slice [slice][i] = crc;
+      }
+    }
+
+    // CPUID.01h:ECX  -  Bit 1 = PCLMULQDQ, Bit 19 = SSE4.1
+    uint32_t ecx = 0;
+
+#ifdef _MSC_VER
+    int regs [4];
+    __cpuid (regs, 1);
+    ecx = (uint32_t)regs [2];
+#else
+    unsigned int eax_, ebx_, ecx_, edx_;
+    if (__get_cpuid (1, &eax_, &ebx_, &ecx_, &edx_))
+      ecx = ecx_;
+#endif
+
+    pclmul = ( (ecx & (1UL <<  1)) != 0 &&
+               (ecx & (1UL << 19)) != 0 );
+
+    if (pclmul)
+      best = AD_CRC32_PCLMUL;
+  }
+} crc32_engine;
+
+
+//
+// All of the kernels below operate on the raw (pre-inverted) CRC register
+//
+static uint32_t
+AD_CRC32_Bytewise_Raw (uint32_t crc, const uint8_t* p, size_t size)
+{
+  while (size--)
+    crc = crc32_tab [(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+  return crc;
+}
+
+static inline uint32_t
+AD_CRC32_Load32 (const uint8_t* p)
+{
+  uint32_t val;
+  memcpy (&val, p, sizeof (uint32_t)); // x86 is little-endian; unaligned OK
+
+  return val;
+}
+
+static uint32_t
+AD_CRC32_Slice8_Raw (uint32_t crc, const uint8_t* p, size_t size)
+{
+  while (size >= 8) {
+    uint32_t one = AD_CRC32_Load32 (p) ^ crc;
+    uint32_t two = AD_CRC32_Load32 (p + 4);
+
+    crc = crc32_slice [7][ one        & 0xFF] ^
+          crc32_slice [6][(one >>  8) & 0xFF] ^
+          crc32_slice [5][(one >> 16) & 0xFF] ^
+          crc32_slice [4][ one >> 24        ] ^
+          crc32_slice [3][ two        & 0xFF] ^
+          crc32_slice [2][(two >>  8) & 0xFF] ^
+          crc32_slice [1][(two >> 16) & 0xFF] ^
+          crc32_slice [0][ two >> 24        ];
+
+    p    += 8;
+    size -= 8;
+  }
+
+  return AD_CRC32_Bytewise_Raw (crc, p, size);
+}
+
+static uint32_t
+AD_CRC32_Slice16_Raw (uint32_t crc, const uint8_t* p, size_t size)
+{
+  while (size >= 16) {
+    uint32_t one   = AD_CRC32_Load32 (p) ^ crc;
+    uint32_t two   = AD_CRC32_Load32 (p +  4);
+    uint32_t three = AD_CRC32_Load32 (p +  8);
+    uint32_t four  = AD_CRC32_Load32 (p + 12);
+
+    crc = crc32_slice [15][ one          & 0xFF] ^
+          crc32_slice [14][(one   >>  8) & 0xFF] ^
+          crc32_slice [13][(one   >> 16) & 0xFF] ^
+          crc32_slice [12][ one   >> 24        ] ^
+          crc32_slice [11][ two          & 0xFF] ^
+          crc32_slice [10][(two   >>  8) & 0xFF] ^
+          crc32_slice  [9][(two   >> 16) & 0xFF] ^
+          crc32_slice  [8][ two   >> 24        ] ^
+          crc32_slice  [7][ three        & 0xFF] ^
+          crc32_slice  [6][(three >>  8) & 0xFF] ^
+          crc32_slice  [5][(three >> 16) & 0xFF] ^
+          crc32_slice  [4][ three >> 24        ] ^
+          crc32_slice  [3][ four         & 0xFF] ^
+          crc32_slice  [2][(four  >>  8) & 0xFF] ^
+          crc32_slice  [1][(four  >> 16) & 0xFF] ^
+          crc32_slice  [0][ four  >> 24        ];
+
+    p    += 16;
+    size -= 16;
+  }
+
+  return AD_CRC32_Slice8_Raw (crc, p, size);
+}
+
+
+//
+// Carry-less multiplication folding, after Gopal et al. "Fast CRC Computation
+//   for Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009).
+//
+//  * Constants are for the bit-reflected 0x04C11DB7 polynomial.
+//  * size MUST be >= 64 and a multiple of 16.
+//
+static AD_ALIGN16 const uint64_t crc32_k1k2 [2] = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+static AD_ALIGN16 const uint64_t crc32_k3k4 [2] = { 0x01751997d0ULL, 0x00ccaa009eULL };
+static AD_ALIGN16 const uint64_t crc32_k5   [2] = { 0x0163cd6124ULL, 0x0000000000ULL };
+static AD_ALIGN16 const uint64_t crc32_poly [2] = { 0x01db710641ULL, 0x01f7011641ULL };
+
+AD_TARGET_PCLMUL
+static uint32_t
+AD_CRC32_PCLMUL_Raw (uint32_t crc, const uint8_t* p, size_t size)
+{
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+  __m128i y5, y6, y7, y8;
+
+  x1 = _mm_loadu_si128 ((const __m128i *)(p + 0x00));
+  x2 = _mm_loadu_si128 ((const __m128i *)(p + 0x10));
+  x3 = _mm_loadu_si128 ((const __m128i *)(p + 0x20));
+  x4 = _mm_loadu_si128 ((const __m128i *)(p + 0x30));
+
+  x1 = _mm_xor_si128 (x1, _mm_cvtsi32_si128 ((int)crc));
+
+  x0 = _mm_load_si128 ((const __m128i *)crc32_k1k2);
+
+  p    += 64;
+  size -= 64;
+
+  // Fold by 4 (512 bits in flight)
+  while (size >= 64) {
+    x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128 (x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128 (x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128 (x4, x0, 0x00);
+
+    x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128 (x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128 (x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128 (x4, x0, 0x11);
+
+    y5 = _mm_loadu_si128 ((const __m128i *)(p + 0x00));
+    y6 = _mm_loadu_si128 ((const __m128i *)(p + 0x10));
+    y7 = _mm_loadu_si128 ((const __m128i *)(p + 0x20));
+    y8 = _mm_loadu_si128 ((const __m128i *)(p + 0x30));
+
+    x1 = _mm_xor_si128 (_mm_xor_si128 (x1, x5), y5);
+    x2 = _mm_xor_si128 (_mm_xor_si128 (x2, x6), y6);
+    x3 = _mm_xor_si128 (_mm_xor_si128 (x3, x7), y7);
+    x4 = _mm_xor_si128 (_mm_xor_si128 (x4, x8), y8);
+
+    p    += 64;
+    size -= 64;
+  }
+
+  // Fold 512 bits into 128
+  x0 = _mm_load_si128 ((const __m128i *)crc32_k3k4);
+
+  x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+  x1 = _mm_xor_si128        (_mm_xor_si128 (x1, x2), x5);
+
+  x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+  x1 = _mm_xor_si128        (_mm_xor_si128 (x1, x3), x5);
+
+  x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+  x1 = _mm_xor_si128        (_mm_xor_si128 (x1, x4), x5);
+
+  // Single 128-bit folds for what remains
+  while (size >= 16) {
+    x2 = _mm_loadu_si128 ((const __m128i *)p);
+
+    x5 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128 (x1, x0, 0x11);
+    x1 = _mm_xor_si128        (_mm_xor_si128 (x1, x2), x5);
+
+    p    += 16;
+    size -= 16;
+  }
+
+  // Fold 128 bits into 64
+  x2 = _mm_clmulepi64_si128 (x1, x0, 0x10);
+  x3 = _mm_setr_epi32       (~0, 0, ~0, 0);
+  x1 = _mm_srli_si128       (x1, 8);
+  x1 = _mm_xor_si128        (x1, x2);
+
+  x0 = _mm_loadl_epi64      ((const __m128i *)crc32_k5);
+
+  x2 = _mm_srli_si128       (x1, 4);
+  x1 = _mm_and_si128        (x1, x3);
+  x1 = _mm_clmulepi64_si128 (x1, x0, 0x00);
+  x1 = _mm_xor_si128        (x1, x2);
+
+  // Barrett reduction to 32 bits
+  x0 = _mm_load_si128 ((const __m128i *)crc32_poly);
+
+  x2 = _mm_and_si128        (x1, x3);
+  x2 = _mm_clmulepi64_si128 (x2, x0, 0x10);
+  x2 = _mm_and_si128        (x2, x3);
+  x2 = _mm_clmulepi64_si128 (x2, x0, 0x00);
+  x1 = _mm_xor_si128        (x1, x2);
+
+  return (uint32_t)_mm_extract_epi32 (x1, 1);
+}
+
+
+bool
+AD_CRC32_Supported (ad_crc32_kernel_t kernel)
+{
+  if (kernel == AD_CRC32_PCLMUL)
+    return crc32_engine.pclmul;
+
+  return true;
+}
+
+ad_crc32_kernel_t
+AD_CRC32_Best (void)
+{
+  return crc32_engine.best;
+}
+
+uint32_t
+AD_CRC32_Kernel ( ad_crc32_kernel_t kernel,
+                  uint32_t          crc,
+                  const void*       buf,
+                  size_t            size )
+{
+  const uint8_t* p = (const uint8_t *)buf;
+
+  crc = crc ^ ~0U;
+
+  switch (kernel) {
+    case AD_CRC32_PCLMUL:
+      if (crc32_engine.pclmul && size >= 64) {
+        size_t bulk = size & ~(size_t)15;
+
+        crc   = AD_CRC32_PCLMUL_Raw (crc, p, bulk);
+        p    += bulk;
+        size -= bulk;
+      }
+
+      crc = AD_CRC32_Slice8_Raw   (crc, p, size);
+      break;
+
+    case AD_CRC32_SLICE16:
+      crc = AD_CRC32_Slice16_Raw  (crc, p, size);
+      break;
+
+    case AD_CRC32_SLICE8:
+      crc = AD_CRC32_Slice8_Raw   (crc, p, size);
+      break;
+
+    default:
+      crc = AD_CRC32_Bytewise_Raw (crc, p, size);
+      break;
+  }
+
+  return crc ^ ~0U;
+}
+
+uint32_t
+crc32 (uint32_t crc, const void* buf, size_t size)
+{
+  return AD_CRC32_Kernel (crc32_engine.best, crc, buf, size);
+}
+
+//
+// Benchmark
+//
+static volatile uint32_t bench_sink;
+
+int
+AD_CRC32_Benchmark (ad_crc32_bench_s* results, int max_results)
+{
+  static const size_t sizes [] = { 256, 1024, 4096, 16384, 65536 };
+
+  typedef std::chrono::steady_clock clock;
+
+  // Blobs start one byte past a 16-byte boundary, like most of what
+  //   CreateVertexShader / CreatePixelShader are handed
+  std::vector <uint8_t> data (65536 + 1);
+
+  uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+  for (size_t i = 0; i < data.size (); i++) {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    data [i] = (uint8_t)x;
+  }
+
+  const uint8_t* blob  = &data [1];
+  int            count = 0;
+
+  for (size_t s = 0; s < sizeof (sizes) / sizeof (sizes [0]) && count < max_results; s++) {
+    ad_crc32_bench_s& r = results [count++];
+
+    // ~64 MiB hashed per measurement
+    const int      iterations = (int)(67108864 / sizes [s]);
+    const uint32_t expected   = AD_CRC32_Kernel (AD_CRC32_BYTEWISE, 0, blob, sizes [s]);
+
+    r.size  = sizes [s];
+    r.agree = true;
+
+    for (int k = AD_CRC32_BYTEWISE; k <= AD_CRC32_PCLMUL; k++) {
+      const ad_crc32_kernel_t kernel = (ad_crc32_kernel_t)k;
+
+      r.gibs [k] = 0.0;
+
+      if (! AD_CRC32_Supported (kernel))
+        continue;
+
+      r.agree &= (AD_CRC32_Kernel (kernel, 0, blob, sizes [s]) == expected);
+
+      // Chained, so no pass can be skipped or hoisted out of the loop
+      uint32_t crc = 0;
+
+      clock::time_point start = clock::now ();
+
+      for (int i = 0; i < iterations; i++)
+        crc = AD_CRC32_Kernel (kernel, crc, blob, sizes [s]);
+
+      const double secs =
+        std::chrono::duration <double> (clock::now () - start).count ();
+
+      r.gibs [k] = (double)sizes [s] * iterations / secs / 1073741824.0;
+      bench_sink = crc;
+    }
+  }
+
+  return count;
+}
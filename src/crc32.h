@@ -0,0 +1,69 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__CRC32_H__
+#define __AD__CRC32_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// CRC-32 (reflected polynomial 0xEDB88320, the zlib / PNG variant).
+//
+//   All of the shader signatures (e.g. those in AgDrag.shaders.ini) are
+//     computed with this, so every kernel below must agree bit-for-bit.
+//
+//  * crc32 (...) picks the fastest kernel the CPU supports at runtime;
+//      the individual kernels are exposed for verification and timing.
+//
+uint32_t crc32 (uint32_t crc, const void* buf, size_t size);
+
+enum ad_crc32_kernel_t {
+  AD_CRC32_BYTEWISE = 0, // One table lookup per byte (portable)
+  AD_CRC32_SLICE8   = 1, // Slice-by-8  (portable)
+  AD_CRC32_SLICE16  = 2, // Slice-by-16 (portable)
+  AD_CRC32_PCLMUL   = 3  // Carry-less multiply folding (SSE4.1 + PCLMULQDQ)
+};
+
+uint32_t          AD_CRC32_Kernel    ( ad_crc32_kernel_t kernel,
+                                       uint32_t          crc,
+                                       const void*       buf,
+                                       size_t            size );
+
+bool              AD_CRC32_Supported (ad_crc32_kernel_t kernel);
+
+// The kernel crc32 (...) dispatches bulk data to
+ad_crc32_kernel_t AD_CRC32_Best      (void);
+
+//
+// Shader-sized blobs (256 B - 64 KiB) timed through every kernel; results[]
+//   is filled in and the count returned.  Kernels this CPU doesn't support
+//     report 0 GiB/s.
+//
+struct ad_crc32_bench_s {
+  size_t size;                   // Bytes per blob
+  double gibs  [4];              // Indexed by ad_crc32_kernel_t
+  bool   agree;                  // Every supported kernel == bytewise
+};
+
+int AD_CRC32_Benchmark (ad_crc32_bench_s* results, int max_results);
+
+#endif /* __AD__CRC32_H__ */
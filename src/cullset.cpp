@@ -0,0 +1,367 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include <Windows.h>
+
+#include "cullset.h"
+#include "ini.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <map>
+
+ad_cull_sets_s cull_sets;
+
+//
+// Written to AgDrag.cull.ini the first time the game is started; one
+//   (disabled) set per category to start experimenting with.
+//
+static const wchar_t* AD_DEFAULT_CULL_SETS =
+  L"[UI]\n"
+  L"Category=ui\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[Menus]\n"
+  L"Category=menu\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[DepthOfField]\n"
+  L"Category=dof\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[Fullscreen]\n"
+  L"Category=fullscreen\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[Minimap]\n"
+  L"Category=minimap\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[Text]\n"
+  L"Category=text\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[Backgrounds]\n"
+  L"Category=background\n"
+  L"Enable=false\n";
+
+static const wchar_t* ad_cull_categories [AD_CULL_NUM_CATEGORIES] = {
+  L"ui", L"menu", L"dof", L"fullscreen", L"minimap", L"text", L"background"
+};
+
+static inline uint32_t
+AD_CullSlot (uint32_t crc32, uint32_t shift)
+{
+  // Fibonacci hashing
+  return (crc32 * 2654435769U) >> shift;
+}
+
+uint32_t
+ad_cull_sets_s::stage_s::find (uint32_t crc32) const
+{
+  uint32_t sets = 0;
+
+  if (! table.empty ()) {
+    const uint32_t mask = (uint32_t)table.size () - 1;
+          uint32_t idx  = AD_CullSlot (crc32, shift);
+
+    while (table [idx].sets != 0) {
+      if (table [idx].crc32 == crc32) {
+        sets = table [idx].sets;
+        break;
+      }
+
+      idx = (idx + 1) & mask;
+    }
+  }
+
+  for (size_t i = 0; i < ranges.size (); i++) {
+    if (crc32 >= ranges [i].lo && crc32 <= ranges [i].hi)
+      sets |= ranges [i].sets;
+  }
+
+  return sets;
+}
+
+void
+ad_cull_sets_s::stage_s::insert (uint32_t crc32, uint32_t sets)
+{
+  const uint32_t mask = (uint32_t)table.size () - 1;
+        uint32_t idx  = AD_CullSlot (crc32, shift);
+
+  while (table [idx].sets != 0 && table [idx].crc32 != crc32)
+    idx = (idx + 1) & mask;
+
+  table [idx].crc32  = crc32;
+  table [idx].sets  |= sets;
+}
+
+//
+// Parses a comma-separated list of CRCs and lo-hi ranges
+//
+static bool
+AD_ParseCullList ( const std::wstring&                           str,
+                   std::vector <uint32_t>&                       crcs,
+                   std::vector <std::pair <uint32_t, uint32_t>>& ranges )
+{
+  const wchar_t* wszTerm = str.c_str ();
+
+  while (*wszTerm != L'\0') {
+    while (*wszTerm == L' ' || *wszTerm == L',')
+      ++wszTerm;
+
+    if (*wszTerm == L'\0')
+      break;
+
+    wchar_t* end = nullptr;
+    uint32_t lo  = wcstoul (wszTerm, &end, 16);
+
+    if (end == wszTerm)
+      return false;
+
+    wszTerm = end;
+
+    if (*wszTerm == L'-') {
+      uint32_t hi = wcstoul (++wszTerm, &end, 16);
+
+      if (end == wszTerm || hi < lo)
+        return false;
+
+      wszTerm = end;
+
+      ranges.push_back (std::make_pair (lo, hi));
+    }
+
+    else
+      crcs.push_back (lo);
+  }
+
+  return true;
+}
+
+static bool
+AD_ParseCullCategories (const std::wstring& str, uint32_t& categories)
+{
+  categories = 0;
+
+  std::wstring list = str + L",";
+  size_t       pos  = 0;
+
+  while (pos < list.size ()) {
+    size_t       comma = list.find (L',', pos);
+    std::wstring name  = list.substr (pos, comma - pos);
+
+    pos = comma + 1;
+
+    while (! name.empty () && name [0]                 == L' ') name.erase (0, 1);
+    while (! name.empty () && name [name.size () - 1] == L' ') name.erase (name.size () - 1);
+
+    if (name.empty ())
+      continue;
+
+    bool known = false;
+
+    for (int i = 0; i < AD_CULL_NUM_CATEGORIES; i++) {
+      if (! _wcsicmp (name.c_str (), ad_cull_categories [i])) {
+        categories |= (1UL << i);
+        known       = true;
+      }
+    }
+
+    if (! known)
+      return false;
+  }
+
+  return true;
+}
+
+uint32_t
+ad_cull_sets_s::bind (uint32_t vs_crc32, uint32_t ps_crc32, ad_shader_role_t ps_role) const
+{
+  if (enabled == 0)
+    return 0;
+
+  uint32_t sets = vs.find (vs_crc32) | ps.find (ps_crc32);
+
+  if (ps_role == AD_SHADER_ROLE_TEXT)
+    sets |= by_category [5];
+  else if (ps_role == AD_SHADER_ROLE_BACKGROUND)
+    sets |= by_category [6];
+
+  return sets & enabled;
+}
+
+void
+ad_cull_sets_s::count (uint32_t mask, uint32_t prims)
+{
+  for (size_t i = 0; i < sets.size (); i++) {
+    if (mask & (1UL << i)) {
+      sets [i].culled.draws += 1;
+      sets [i].culled.prims += prims;
+    }
+  }
+}
+
+void
+ad_cull_sets_s::end_frame (void)
+{
+  if (report) {
+    dll_log.Log (L" [CullSets] Last frame:");
+
+    for (size_t i = 0; i < sets.size (); i++) {
+      dll_log.Log ( L"   %-24s %s  %6d draws, %9d primitives",
+                      sets [i].name.c_str (), sets [i].enable ? L"on " : L"off",
+                        sets [i].culled.draws, sets [i].culled.prims );
+    }
+
+    report = false;
+  }
+
+  enabled         = 0;
+  draw_categories = 0;
+
+  for (size_t i = 0; i < sets.size (); i++) {
+    sets [i].culled_last_frame = sets [i].culled;
+    sets [i].culled            = set_s::counts_s ();
+
+    if (sets [i].enable) {
+      enabled         |= (1UL << i);
+      draw_categories |= (sets [i].categories & AD_CULL_DRAW_CATEGORIES);
+    }
+  }
+}
+
+bool
+ad_cull_sets_s::load (const wchar_t* filename)
+{
+  ad::INI::File* cull_ini = new ad::INI::File ((wchar_t *)filename);
+
+  if (cull_ini->get_sections ().empty ()) {
+    cull_ini->import (AD_DEFAULT_CULL_SETS);
+    cull_ini->write  (filename);
+
+    dll_log.Log (L" [CullSets] Created %s from the built-in sets.", filename);
+  }
+
+  std::map <uint32_t, uint32_t> members [2];
+  std::vector <range_s>         ranges  [2];
+
+  sets.clear ();
+  memset (by_category, 0, sizeof (by_category));
+
+  const std::map <std::wstring, ad::INI::File::Section>& sections =
+    cull_ini->get_sections ();
+
+  for ( std::map <std::wstring, ad::INI::File::Section>::const_iterator it = sections.begin ();
+          it != sections.end ();
+            ++it ) {
+    if (sets.size () >= MAX_SETS) {
+      dll_log.Log (L" [CullSets] More than %d sets; ignoring the rest.", MAX_SETS);
+      break;
+    }
+
+    ad::INI::File::Section& section = cull_ini->get_section (it->first);
+
+    set_s    set;
+    uint32_t bit = 1UL << sets.size ();
+    bool     ok  = true;
+
+    set.name       = it->first;
+    set.enable     = section.contains_key (L"Enable") &&
+                       ( section.get_value (L"Enable") == L"true" ||
+                         section.get_value (L"Enable") == L"1" );
+    set.categories = 0;
+
+    std::vector <uint32_t>                       crcs  [2];
+    std::vector <std::pair <uint32_t, uint32_t>> spans [2];
+
+    if (section.contains_key (L"VS"))
+      ok &= AD_ParseCullList (section.get_value (L"VS"), crcs [0], spans [0]);
+
+    if (section.contains_key (L"PS"))
+      ok &= AD_ParseCullList (section.get_value (L"PS"), crcs [1], spans [1]);
+
+    if (section.contains_key (L"Category"))
+      ok &= AD_ParseCullCategories (section.get_value (L"Category"), set.categories);
+
+    if ((! ok) || (crcs [0].empty () && crcs [1].empty () && spans [0].empty () &&
+                   spans [1].empty () && set.categories == 0)) {
+      dll_log.Log (L" [CullSets] Ignoring malformed set [%s]", it->first.c_str ());
+      continue;
+    }
+
+    for (int stage = 0; stage < 2; stage++) {
+      for (size_t i = 0; i < crcs [stage].size (); i++)
+        members [stage][crcs [stage][i]] |= bit;
+
+      for (size_t i = 0; i < spans [stage].size (); i++) {
+        range_s range = { spans [stage][i].first, spans [stage][i].second, bit };
+        ranges [stage].push_back (range);
+      }
+    }
+
+    for (int i = 0; i < AD_CULL_NUM_CATEGORIES; i++) {
+      if (set.categories & (1UL << i))
+        by_category [i] |= bit;
+    }
+
+    // Console variable names are narrow; section names are plain ASCII
+    set.var_name = "Cull.";
+
+    for (size_t i = 0; i < set.name.size (); i++)
+      set.var_name += (char)set.name [i];
+
+    sets.push_back (set);
+  }
+
+  delete cull_ini;
+
+  stage_s* stages [2] = { &vs, &ps };
+
+  for (int i = 0; i < 2; i++) {
+    stage_s& stage = *stages [i];
+
+    uint32_t bits = 4;
+
+    // Keep the load factor <= 1/2
+    while ((1UL << bits) < members [i].size () * 2)
+      ++bits;
+
+    stage.table.assign (1UL << bits, member_s ());
+    stage.shift  = 32 - bits;
+    stage.ranges = ranges [i];
+
+    for ( std::map <uint32_t, uint32_t>::const_iterator it = members [i].begin ();
+            it != members [i].end ();
+              ++it )
+      stage.insert (it->first, it->second);
+  }
+
+  end_frame ();
+
+  dll_log.Log ( L" [CullSets] Loaded %lu sets (%lu vertex and %lu pixel shaders listed) from %s",
+                  sets.size (), members [0].size (), members [1].size (), filename );
+
+  return ! sets.empty ();
+}
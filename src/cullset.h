@@ -0,0 +1,145 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__CULLSET_H__
+#define __AD__CULLSET_H__
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "shader.h"
+
+//
+// Shader cull sets (AgDrag.cull.ini), for finding out what is expensive
+//
+//   Every section is a named set of draws to skip while it is enabled, e.g.
+//
+//     [Shadows]
+//     VS=1a2b3c4d,5e6f7a8b
+//     PS=0d000000-0dffffff
+//     Category=dof,fullscreen
+//     Enable=false
+//
+//   VS / PS list hex CRC-32s or lo-hi ranges of them and Category names
+//     whole kinds of draws (see ad_cull_category_t); a draw belongs to the
+//       set if any of them match.  Each set is a console variable
+//         (Cull.<Name>) and reports what it removed (Cull.<Name>.Draws and
+//           Cull.<Name>.Prims, or every set at once with Render.CullReport).
+//
+//  * Membership is resolved when shaders are bound: each CRC hashes to the
+//      bitset of sets that list it, so a draw tests one mask.
+//
+enum ad_cull_category_t {
+  // Properties of the draw, tested when it is issued
+  AD_CULL_UI         = 0x01,
+  AD_CULL_MENU       = 0x02,
+  AD_CULL_DOF        = 0x04,
+  AD_CULL_FULLSCREEN = 0x08,
+  AD_CULL_MINIMAP    = 0x10,
+
+  // Roles of the bound pixel shader (shaderdb.h), resolved on bind
+  AD_CULL_TEXT       = 0x20,
+  AD_CULL_BACKGROUND = 0x40,
+
+  AD_CULL_DRAW_CATEGORIES = 0x1f,
+  AD_CULL_NUM_CATEGORIES  = 7
+};
+
+struct ad_cull_sets_s {
+  enum {
+    MAX_SETS = 31,
+    CONSOLE  = 0x80000000        // Render.CullVS / Render.CullPS
+  };
+
+  struct set_s {
+    std::wstring name;
+    std::string  var_name;       // Cull.<Name>
+    bool         enable;
+    uint32_t     categories;
+
+    struct counts_s {
+      int draws = 0;
+      int prims = 0;
+    } culled,                    // This frame
+      culled_last_frame;
+  };
+
+  // Bitset of the enabled sets the (vs, ps) pair belongs to
+  uint32_t bind (uint32_t vs_crc32, uint32_t ps_crc32, ad_shader_role_t ps_role) const;
+
+  // Bitset of the enabled sets that claim a draw with the given categories
+  uint32_t test (uint32_t categories) const
+  {
+    categories &= draw_categories;
+
+    if (categories == 0)
+      return 0;
+
+    uint32_t sets = 0;
+
+    for (int i = 0; categories != 0; i++, categories >>= 1) {
+      if (categories & 0x1)
+        sets |= by_category [i];
+    }
+
+    return sets & enabled;
+  }
+
+  void     count     (uint32_t mask, uint32_t prims);
+
+  // Publishes this frame's counts and picks up console changes
+  void     end_frame (void);
+
+  bool     load      (const wchar_t* filename);
+
+  std::vector <set_s> sets;
+  bool                report = false; // Log the last frame (Render.CullReport)
+
+protected:
+  struct member_s {
+    uint32_t crc32;
+    uint32_t sets;               // 0 = Empty
+  };
+
+  struct range_s {
+    uint32_t lo, hi;
+    uint32_t sets;
+  };
+
+  struct stage_s {
+    std::vector <member_s> table;   // Power-of-two, load factor <= 1/2
+    uint32_t               shift = 32;
+    std::vector <range_s>  ranges;
+
+    uint32_t find   (uint32_t crc32) const;
+    void     insert (uint32_t crc32, uint32_t sets);
+  } vs, ps;
+
+  uint32_t enabled         = 0;
+  uint32_t draw_categories = 0;     // Categories any enabled set tests per draw
+  uint32_t by_category [AD_CULL_NUM_CATEGORIES] = { 0 };
+};
+
+extern ad_cull_sets_s cull_sets;
+
+#endif /* __AD__CULLSET_H__ */
@@ -0,0 +1,171 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "display.h"
+#include "config.h"
+
+ad_display_geometry_s display;
+
+static const float AD_ASPECT_16x9 = (16.0f / 9.0f);
+
+//
+// Horizontal scale / offset to fit a 16:9 image into w x h pixels; the game
+//   never needs fixing in the other direction.
+//
+void
+AD_ComputeDisplayCoeffs (ad_display_coeffs_s& coeffs, uint32_t w, uint32_t h, bool wider)
+{
+  coeffs = ad_display_coeffs_s ();
+
+  if (! wider)
+    return;
+
+  int width = (int)(AD_ASPECT_16x9 * (float)h);
+  int x_off = ((int)w - width) / 2;
+
+  if (width <= 0)
+    return;
+
+  coeffs.x    = (float)w / (float)width;
+  coeffs.xoff = (float)x_off;
+}
+
+static bool
+AD_SameDisplayCoeffs (const ad_display_coeffs_s& a, const ad_display_coeffs_s& b)
+{
+  return a.x    == b.x    && a.y    == b.y &&
+         a.xoff == b.xoff && a.yoff == b.yoff;
+}
+
+// Everything but the generation
+static bool
+AD_SameDisplayGeometry (const ad_display_geometry_s& a, const ad_display_geometry_s& b)
+{
+  return a.width         == b.width         && a.height       == b.height       &&
+         a.aspect_ratio  == b.aspect_ratio  && a.inv_height   == b.inv_height   &&
+         a.wider         == b.wider         &&
+         a.vp_width      == b.vp_width      && a.vp_height    == b.vp_height    &&
+         a.vp_aspect     == b.vp_aspect     && a.vp_wider     == b.vp_wider     &&
+         a.vp_matches_bb == b.vp_matches_bb &&
+         a.ar_scale      == b.ar_scale      && a.inv_ar_scale == b.inv_ar_scale &&
+         AD_SameDisplayCoeffs (a.viewport,   b.viewport)   &&
+         AD_SameDisplayCoeffs (a.backbuffer, b.backbuffer) &&
+         AD_SameDisplayCoeffs (a.forced,     b.forced);
+}
+
+static void
+AD_RebuildDisplayGeometry ( uint32_t width,    uint32_t height,
+                            uint32_t vp_width, uint32_t vp_height )
+{
+  // Built aside, so that the generation only moves if something did
+  ad_display_geometry_s g = display;
+
+  g.width     = width;
+  g.height    = height;
+  g.vp_width  = vp_width;
+  g.vp_height = vp_height;
+
+  g.aspect_ratio = g.height != 0 ? (float)g.width / (float)g.height :
+                                   AD_ASPECT_16x9;
+  g.inv_height   = g.height != 0 ? 1.0f / (float)g.height : 0.0f;
+  g.wider        = g.aspect_ratio > AD_ASPECT_16x9;
+
+  config.render.aspect_ratio = g.aspect_ratio;
+
+  g.vp_aspect    = g.vp_height != 0 ? (float)g.vp_width / (float)g.vp_height :
+                                      AD_ASPECT_16x9;
+  g.vp_wider     = g.vp_aspect > AD_ASPECT_16x9;
+  g.ar_scale     = g.vp_aspect / AD_ASPECT_16x9;
+  g.inv_ar_scale = 1.0f / g.ar_scale;
+
+  // Integer division is intentional; this is the ratio test the UI code
+  //   has always used to skip off-screen render targets.
+  g.vp_matches_bb = g.vp_height != 0 && g.height != 0 &&
+                    g.vp_width / g.vp_height == g.width / g.height;
+
+  AD_ComputeDisplayCoeffs (g.forced, g.width, g.height, g.wider);
+
+  if (g.wider)
+    g.forced.yoff = config.scaling.mouse_y_offset;
+
+  if (config.render.aspect_correction) {
+    g.backbuffer = g.forced;
+    AD_ComputeDisplayCoeffs (g.viewport, g.vp_width, g.vp_height, g.wider);
+  } else {
+    g.backbuffer = ad_display_coeffs_s ();
+    g.viewport   = ad_display_coeffs_s ();
+  }
+
+  if (display.generation != 0 && AD_SameDisplayGeometry (g, display))
+    return;
+
+  //
+  // A frame switches between the scene, minimap and UI viewports (and back)
+  //   every time; each geometry seen recently keeps the generation it was
+  //     first given, so caches keyed on it still hit in the next frame.
+  //
+  static ad_display_geometry_s recent [8];
+  static uint32_t              num_recent = 0;
+  static uint32_t              last_gen   = 0;
+
+  const uint32_t count = num_recent < 8 ? num_recent : 8;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (AD_SameDisplayGeometry (g, recent [i])) {
+      g.generation = recent [i].generation;
+      display      = g;
+      return;
+    }
+  }
+
+  g.generation = ++last_gen;
+
+  recent [num_recent++ % 8] = g;
+  display                   = g;
+}
+
+void
+AD_SetBackbufferGeometry (uint32_t width, uint32_t height)
+{
+  if (display.generation != 0 && display.width  == width &&
+                                 display.height == height)
+    return;
+
+  AD_RebuildDisplayGeometry (width, height, display.vp_width, display.vp_height);
+}
+
+void
+AD_SetViewportGeometry (uint32_t width, uint32_t height)
+{
+  if (display.generation != 0 && display.vp_width  == width &&
+                                 display.vp_height == height)
+    return;
+
+  AD_RebuildDisplayGeometry (display.width, display.height, width, height);
+}
+
+void
+AD_InvalidateDisplayGeometry (void)
+{
+  AD_RebuildDisplayGeometry ( display.width,    display.height,
+                              display.vp_width, display.vp_height );
+}
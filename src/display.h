@@ -0,0 +1,83 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__DISPLAY_H__
+#define __AD__DISPLAY_H__
+
+#include <stdint.h>
+
+// Aspect ratio correction coefficients (identity if no correction applies)
+struct ad_display_coeffs_s {
+  float x    = 1.0f;
+  float y    = 1.0f;
+  float xoff = 0.0f;
+  float yoff = 0.0f;
+};
+
+//
+// Everything derived from the backbuffer / viewport dimensions and the
+//   scaling preferences, computed once whenever one of those changes rather
+//     than every time a draw, constant upload or mouse message needs it.
+//
+//  * Read it directly; equal generations mean identical geometry, so it can
+//      key caches.  Going back to a recently used geometry (e.g. the scene
+//        viewport after the minimap's) gives back its earlier generation.
+//
+struct ad_display_geometry_s {
+  uint32_t generation    = 0;
+
+  // Backbuffer
+  uint32_t width         = 0;
+  uint32_t height        = 0;
+  float    aspect_ratio  = (16.0f / 9.0f);
+  float    inv_height    = 0.0f;
+  bool     wider         = false; // Wider than 16:9
+
+  // Viewport (only its dimensions matter)
+  uint32_t vp_width      = 0;
+  uint32_t vp_height     = 0;
+  float    vp_aspect     = (16.0f / 9.0f);
+  bool     vp_wider      = false;
+  bool     vp_matches_bb = false; // Same (integer) ratio as the backbuffer
+  float    ar_scale      = 1.0f;  // vp_aspect / (16:9)
+  float    inv_ar_scale  = 1.0f;
+
+  ad_display_coeffs_s viewport;   // Scaled to the viewport
+  ad_display_coeffs_s backbuffer; // Scaled to the backbuffer (+ Mouse.YOffset)
+  ad_display_coeffs_s forced;     // As above, even if correction is disabled
+};
+
+extern ad_display_geometry_s display;
+
+// Each of these only recomputes (and changes the generation) on an actual change
+void AD_SetBackbufferGeometry   (uint32_t width, uint32_t height);
+void AD_SetViewportGeometry     (uint32_t width, uint32_t height);
+
+// Call after changing any config.render / config.scaling value used above
+void AD_InvalidateDisplayGeometry (void);
+
+// Scale / offset that fits a 16:9 image into w x h (identity unless wider)
+void AD_ComputeDisplayCoeffs      ( ad_display_coeffs_s& coeffs,
+                                    uint32_t             w,
+                                    uint32_t             h,
+                                    bool                 wider );
+
+#endif /* __AD__DISPLAY_H__ */
@@ -0,0 +1,594 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "fingerprint.h"
+#include "texdump.h"
+
+#include <string.h>
+
+#include <chrono>
+
+#if defined (_M_X64) || defined (__SSE2__) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define AD_FINGERPRINT_HAVE_SSE2
+#endif
+
+ad_fingerprint_audit_s fingerprint_audit;
+
+static const uint64_t AD_FP_PRIME32_1 = 0x9E3779B1U;
+static const uint64_t AD_FP_PRIME32_2 = 0x85EBCA77U;
+static const uint64_t AD_FP_PRIME32_3 = 0xC2B2AE3DU;
+static const uint64_t AD_FP_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t AD_FP_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t AD_FP_PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t AD_FP_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t AD_FP_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static const int AD_FP_STRIPE         = 64;
+static const int AD_FP_STRIPES_BLOCK  = 16;   // 1 KiB between scrambles
+static const int AD_FP_SECRET         = 192;  // Stripe keys advance 8 bytes each
+
+//
+// Key material: a fixed splitmix64 sequence, so every build agrees.
+//
+static struct ad_fp_secret_s {
+  uint8_t bytes [AD_FP_SECRET];
+
+  ad_fp_secret_s (void)
+  {
+    uint64_t x = 0x41674472616730ULL; // "AgDrag0"
+
+    for (int i = 0; i < AD_FP_SECRET; i += 8) {
+      uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      z =  z ^ (z >> 31);
+
+      memcpy (&bytes [i], &z, 8);
+    }
+  }
+
+  uint64_t word (int i) const { uint64_t v; memcpy (&v, &bytes [i * 8], 8); return v; }
+} fp_secret;
+
+static inline uint64_t
+AD_FP_Read64 (const uint8_t* p)
+{
+  uint64_t v;
+  memcpy (&v, p, 8);
+  return v;
+}
+
+//
+// Kernels
+//
+static void
+AD_FP_Accumulate_Scalar (uint64_t* acc, const uint8_t* p, const uint8_t* key)
+{
+  for (int j = 0; j < 8; j++) {
+    const uint64_t v  = AD_FP_Read64 (p + j * 8);
+    const uint64_t dk = v ^ AD_FP_Read64 (key + j * 8);
+
+    acc [j ^ 1] += v;
+    acc [j]     += (dk & 0xFFFFFFFFULL) * (dk >> 32);
+  }
+}
+
+static void
+AD_FP_Scramble_Scalar (uint64_t* acc, const uint8_t* key)
+{
+  for (int j = 0; j < 8; j++) {
+    uint64_t a = acc [j];
+
+    a ^= a >> 47;
+    a ^= AD_FP_Read64 (key + j * 8);
+
+    acc [j] = a * AD_FP_PRIME32_1;
+  }
+}
+
+#ifdef AD_FINGERPRINT_HAVE_SSE2
+static void
+AD_FP_Accumulate_SSE2 (uint64_t* acc, const uint8_t* p, const uint8_t* key)
+{
+  __m128i* xacc = (__m128i *)acc;
+
+  for (int i = 0; i < 4; i++) {
+    const __m128i data    = _mm_loadu_si128 ((const __m128i *)(p   + i * 16));
+    const __m128i dk      = _mm_xor_si128   (data, _mm_loadu_si128 ((const __m128i *)(key + i * 16)));
+
+    // lo32 (dk) * hi32 (dk), per 64-bit lane
+    const __m128i product = _mm_mul_epu32    (dk,   _mm_shuffle_epi32 (dk, _MM_SHUFFLE (0, 3, 0, 1)));
+    const __m128i swapped =                          _mm_shuffle_epi32 (data, _MM_SHUFFLE (1, 0, 3, 2));
+
+    _mm_storeu_si128 ( &xacc [i],
+                         _mm_add_epi64 ( _mm_loadu_si128 (&xacc [i]),
+                                           _mm_add_epi64 (product, swapped) ) );
+  }
+}
+
+static void
+AD_FP_Scramble_SSE2 (uint64_t* acc, const uint8_t* key)
+{
+  __m128i*      xacc  = (__m128i *)acc;
+  const __m128i prime = _mm_set1_epi32 ((int)AD_FP_PRIME32_1);
+
+  for (int i = 0; i < 4; i++) {
+    __m128i a = _mm_loadu_si128 (&xacc [i]);
+
+    a = _mm_xor_si128 (a, _mm_srli_epi64 (a, 47));
+    a = _mm_xor_si128 (a, _mm_loadu_si128 ((const __m128i *)(key + i * 16)));
+
+    // 64 x 32-bit multiply out of two 32 x 32s
+    const __m128i lo = _mm_mul_epu32 (a,                                             prime);
+    const __m128i hi = _mm_mul_epu32 (_mm_shuffle_epi32 (a, _MM_SHUFFLE (0, 3, 0, 1)), prime);
+
+    _mm_storeu_si128 (&xacc [i], _mm_add_epi64 (lo, _mm_slli_epi64 (hi, 32)));
+  }
+}
+#endif
+
+struct ad_fp_kernel_s {
+  void (*accumulate) (uint64_t* acc, const uint8_t* p, const uint8_t* key);
+  void (*scramble)   (uint64_t* acc, const uint8_t* key);
+};
+
+static const ad_fp_kernel_s*
+AD_FP_GetKernel (ad_fingerprint_kernel_t kernel)
+{
+  static const ad_fp_kernel_s scalar = { AD_FP_Accumulate_Scalar, AD_FP_Scramble_Scalar };
+
+#ifdef AD_FINGERPRINT_HAVE_SSE2
+  static const ad_fp_kernel_s sse2   = { AD_FP_Accumulate_SSE2,   AD_FP_Scramble_SSE2 };
+
+  if (kernel == AD_FINGERPRINT_SSE2)
+    return &sse2;
+#else
+  if (kernel == AD_FINGERPRINT_SSE2)
+    return nullptr;
+#endif
+
+  return &scalar;
+}
+
+#ifdef AD_FINGERPRINT_HAVE_SSE2
+static const ad_fingerprint_kernel_t AD_FP_BEST = AD_FINGERPRINT_SSE2;
+#else
+static const ad_fingerprint_kernel_t AD_FP_BEST = AD_FINGERPRINT_SCALAR;
+#endif
+
+//
+// Streaming state; stripes are cut from the stream, not from the calls, so
+//   feeding the same bytes in different pieces gives the same result.
+//
+struct ad_fp_state_s {
+  const ad_fp_kernel_s* kernel;
+
+  uint64_t acc    [8];
+  uint8_t  buffer [AD_FP_STRIPE];
+  size_t   buffered;
+  uint64_t length;
+  int      stripe;                     // Within the current block
+
+  void init (const ad_fp_kernel_s* k)
+  {
+    static const uint64_t seed [8] = {
+      AD_FP_PRIME32_3, AD_FP_PRIME64_1, AD_FP_PRIME64_2, AD_FP_PRIME64_3,
+      AD_FP_PRIME64_4, AD_FP_PRIME32_2, AD_FP_PRIME64_5, AD_FP_PRIME32_1
+    };
+
+    kernel   = k;
+    buffered = 0;
+    length   = 0;
+    stripe   = 0;
+
+    memcpy (acc, seed, sizeof (acc));
+  }
+
+  void consume (const uint8_t* p)
+  {
+    kernel->accumulate (acc, p, &fp_secret.bytes [stripe * 8]);
+
+    if (++stripe == AD_FP_STRIPES_BLOCK) {
+      kernel->scramble (acc, &fp_secret.bytes [AD_FP_SECRET - AD_FP_STRIPE]);
+      stripe = 0;
+    }
+  }
+
+  void update (const uint8_t* p, size_t n)
+  {
+    length += n;
+
+    if (buffered > 0) {
+      size_t fill = AD_FP_STRIPE - buffered;
+
+      if (fill > n)
+        fill = n;
+
+      memcpy (&buffer [buffered], p, fill);
+
+      buffered += fill;
+      p        += fill;
+      n        -= fill;
+
+      if (buffered < AD_FP_STRIPE)
+        return;
+
+      consume (buffer);
+      buffered = 0;
+    }
+
+    while (n >= AD_FP_STRIPE) {
+      consume (p);
+
+      p += AD_FP_STRIPE;
+      n -= AD_FP_STRIPE;
+    }
+
+    memcpy (buffer, p, n);
+    buffered = n;
+  }
+
+  static uint64_t fold (uint64_t a, uint64_t b)
+  {
+    // 64 x 64 -> 128-bit product, high half XOR low half
+    const uint64_t lo_lo = (a & 0xFFFFFFFFULL) * (b & 0xFFFFFFFFULL);
+    const uint64_t hi_lo = (a >> 32)           * (b & 0xFFFFFFFFULL);
+    const uint64_t lo_hi = (a & 0xFFFFFFFFULL) * (b >> 32);
+    const uint64_t hi_hi = (a >> 32)           * (b >> 32);
+
+    const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFFULL) + lo_hi;
+    const uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+    const uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFFULL);
+
+    return upper ^ lower;
+  }
+
+  static uint64_t avalanche (uint64_t h)
+  {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+
+    return h;
+  }
+
+  ad_fingerprint_s finish (void)
+  {
+    if (buffered > 0) {
+      memset  (&buffer [buffered], 0, AD_FP_STRIPE - buffered);
+      consume (buffer);
+    }
+
+    ad_fingerprint_s fp;
+
+    fp.lo =  length * AD_FP_PRIME64_1;
+    fp.hi = ~length * AD_FP_PRIME64_2;
+
+    for (int j = 0; j < 4; j++) {
+      fp.lo += fold (acc [2 * j] ^ fp_secret.word (j * 2),      acc [2 * j + 1] ^ fp_secret.word (j * 2 + 1));
+      fp.hi += fold (acc [2 * j] ^ fp_secret.word (j * 2 + 11), acc [2 * j + 1] ^ fp_secret.word (j * 2 + 12));
+    }
+
+    fp.lo = avalanche (fp.lo);
+    fp.hi = avalanche (fp.hi);
+
+    return fp;
+  }
+};
+
+static ad_fingerprint_s
+AD_FP_Compute ( const ad_fp_kernel_s*         kernel,
+                uint32_t                      format,
+                const ad_fingerprint_level_s* levels,
+                uint32_t                      num_levels,
+                bool                          sampled )
+{
+  ad_fp_state_s state;
+  state.init (kernel);
+
+  // Mip-chain header; also keeps full and sampled keys apart
+  uint32_t header [4] = { 0x31504641U /* "AFP1" */, format, num_levels, sampled ? 1U : 0U };
+  state.update ((const uint8_t *)header, sizeof (header));
+
+  for (uint32_t i = 0; i < num_levels; i++) {
+    const uint32_t shape [4] = { levels [i].width,     levels [i].height,
+                                 levels [i].row_bytes, levels [i].rows };
+
+    state.update ((const uint8_t *)shape, sizeof (shape));
+  }
+
+  for (uint32_t i = 0; i < num_levels; i++) {
+    const ad_fingerprint_level_s& lvl = levels [i];
+
+    const bool whole =
+      (! sampled) || lvl.rows <= AD_FINGERPRINT_SAMPLE_ROWS ||
+        (size_t)lvl.row_bytes * lvl.rows <= AD_FINGERPRINT_FULL_BYTES;
+
+    if (whole) {
+      // Contiguous rows go in one call
+      if (lvl.pitch == lvl.row_bytes)
+        state.update (lvl.bits, (size_t)lvl.row_bytes * lvl.rows);
+
+      else {
+        for (uint32_t row = 0; row < lvl.rows; row++)
+          state.update (lvl.bits + row * lvl.pitch, lvl.row_bytes);
+      }
+    }
+
+    else {
+      // Evenly spaced, first and last included
+      for (uint32_t s = 0; s < AD_FINGERPRINT_SAMPLE_ROWS; s++) {
+        const uint32_t row =
+          (uint32_t)(((uint64_t)s * (lvl.rows - 1)) / (AD_FINGERPRINT_SAMPLE_ROWS - 1));
+
+        state.update (lvl.bits + row * lvl.pitch, lvl.row_bytes);
+      }
+    }
+  }
+
+  return state.finish ();
+}
+
+ad_fingerprint_s
+AD_Fingerprint ( uint32_t                      format,
+                 const ad_fingerprint_level_s* levels,
+                 uint32_t                      num_levels,
+                 bool                          sampled )
+{
+  return AD_FP_Compute (AD_FP_GetKernel (AD_FP_BEST), format, levels, num_levels, sampled);
+}
+
+bool
+AD_Fingerprint_Kernel ( ad_fingerprint_kernel_t       kernel,
+                        uint32_t                      format,
+                        const ad_fingerprint_level_s* levels,
+                        uint32_t                      num_levels,
+                        bool                          sampled,
+                        ad_fingerprint_s&             fp )
+{
+  const ad_fp_kernel_s* k = AD_FP_GetKernel (kernel);
+
+  if (k == nullptr)
+    return false;
+
+  fp = AD_FP_Compute (k, format, levels, num_levels, sampled);
+
+  return true;
+}
+
+// Describes a staged image's levels; levels [] must hold img.levels entries
+static void
+AD_FP_DescribeImage (const ad_dump_image_s& img, ad_fingerprint_level_s* levels)
+{
+  for (uint32_t i = 0; i < img.levels; i++) {
+    levels [i].bits      = img.data.data () + img.level [i].offset;
+    levels [i].pitch     = img.level [i].pitch;
+    levels [i].row_bytes = img.level [i].pitch;
+    levels [i].rows      = img.level [i].rows;
+    levels [i].width     = img.level [i].width;
+    levels [i].height    = img.level [i].height;
+  }
+}
+
+ad_fingerprint_s
+AD_Fingerprint (const ad_dump_image_s& img, bool sampled)
+{
+  std::vector <ad_fingerprint_level_s> levels (img.levels);
+
+  AD_FP_DescribeImage (img, levels.data ());
+
+  return AD_Fingerprint (img.format, levels.data (), img.levels, sampled);
+}
+
+//
+// Benchmark
+//
+int
+AD_Fingerprint_Benchmark (ad_fingerprint_bench_s* results, int max_results)
+{
+  static const uint32_t formats [] = { 0x31545844U /* DXT1 */, 0x35545844U /* DXT5 */, 21 /* A8R8G8B8 */ };
+  static const uint32_t sizes   [] = { 256, 1024, 2048 };
+
+  typedef std::chrono::steady_clock clock;
+
+  int count = 0;
+
+  for (size_t f = 0; f < sizeof (formats) / sizeof (formats [0]); f++) {
+    for (size_t s = 0; s < sizeof (sizes) / sizeof (sizes [0]) && count < max_results; s++) {
+      ad_dump_image_s img;
+
+      if (! img.init (sizes [s], sizes [s], 32, formats [f]))
+        continue;
+
+      img.data.resize (img.bytes ());
+
+      uint64_t x = 0x9E3779B97F4A7C15ULL * (f * 4 + s + 1);
+
+      for (size_t i = 0; i < img.data.size (); i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        img.data [i] = (uint8_t)x;
+      }
+
+      std::vector <ad_fingerprint_level_s> levels (img.levels);
+      AD_FP_DescribeImage (img, levels.data ());
+
+      // ~64 MiB hashed per measurement
+      const int iterations = (int)(67108864 / img.bytes ()) + 1;
+
+      auto time = [&] (ad_fingerprint_kernel_t kernel, bool sampled, ad_fingerprint_s& fp) -> double {
+        if (! AD_Fingerprint_Kernel (kernel, img.format, levels.data (), img.levels, sampled, fp))
+          return 0.0;
+
+        clock::time_point start = clock::now ();
+
+        for (int i = 0; i < iterations; i++)
+          AD_Fingerprint_Kernel (kernel, img.format, levels.data (), img.levels, sampled, fp);
+
+        return std::chrono::duration <double, std::micro> (clock::now () - start).count () / iterations;
+      };
+
+      ad_fingerprint_bench_s& r = results [count++];
+
+      ad_fingerprint_s scalar_full, simd_full, scalar_sampled, best_sampled;
+
+      r.format     = img.format;
+      r.size       = sizes [s];
+      r.bytes      = img.bytes ();
+      r.scalar_us  = time (AD_FINGERPRINT_SCALAR, false, scalar_full);
+      r.simd_us    = time (AD_FINGERPRINT_SSE2,   false, simd_full);
+      r.sampled_us = time (AD_FP_BEST,            true,  best_sampled);
+
+      AD_Fingerprint_Kernel (AD_FINGERPRINT_SCALAR, img.format, levels.data (), img.levels, true, scalar_sampled);
+
+      r.agree = (r.simd_us == 0.0 || simd_full == scalar_full) && best_sampled == scalar_sampled;
+    }
+  }
+
+  return count;
+}
+
+//
+// Audit
+//
+ad_dump_image_s*
+ad_fingerprint_audit_s::begin (uint32_t width, uint32_t height, uint32_t levels, uint32_t format)
+{
+  ad_dump_image_s* img = new ad_dump_image_s;
+
+  if (! img->init (width, height, levels, format)) {
+    delete img;
+    return nullptr;
+  }
+
+  {
+    std::lock_guard <std::mutex> guard (lock);
+
+    if (staged + img->bytes () > (size_t)budget_mib * 1048576) {
+      ++stats.dropped;
+
+      delete img;
+      return nullptr;
+    }
+
+    staged += img->bytes ();
+
+    if (! worker.joinable ()) {
+      stopping = false;
+      worker   = std::thread (&ad_fingerprint_audit_s::work, this);
+    }
+  }
+
+  img->data.resize (img->bytes ());
+
+  return img;
+}
+
+void
+ad_fingerprint_audit_s::commit (const ad_fingerprint_s& sampled, ad_dump_image_s* img)
+{
+  {
+    std::lock_guard <std::mutex> guard (lock);
+
+    job_s job = { sampled, img };
+    queue.push_back (job);
+  }
+
+  ready.notify_one ();
+}
+
+void
+ad_fingerprint_audit_s::cancel (ad_dump_image_s* img)
+{
+  {
+    std::lock_guard <std::mutex> guard (lock);
+    staged -= img->bytes ();
+  }
+
+  delete img;
+}
+
+void
+ad_fingerprint_audit_s::record (const ad_fingerprint_s& sampled, const ad_fingerprint_s& full)
+{
+  std::lock_guard <std::mutex> guard (lock);
+
+  ++stats.audited;
+
+  std::unordered_map <uint64_t, ad_fingerprint_s>::iterator it =
+    seen.find (sampled.lo);
+
+  if (it == seen.end ())
+    seen [sampled.lo] = full;
+
+  else if (it->second != full) {
+    ++stats.collisions;
+    last_collision = sampled.lo;
+  }
+}
+
+void
+ad_fingerprint_audit_s::stop (void)
+{
+  {
+    std::lock_guard <std::mutex> guard (lock);
+    stopping = true;
+  }
+
+  ready.notify_all ();
+
+  if (worker.joinable ())
+    worker.join ();
+
+  stopping = false;
+}
+
+ad_fingerprint_audit_s::~ad_fingerprint_audit_s (void)
+{
+  // Same as the dump workers: never join under the loader lock
+  if (worker.joinable ())
+    worker.detach ();
+}
+
+void
+ad_fingerprint_audit_s::work (void)
+{
+  while (true) {
+    job_s job;
+
+    {
+      std::unique_lock <std::mutex> guard (lock);
+
+      ready.wait (guard, [this] { return stopping || (! queue.empty ()); });
+
+      if (queue.empty ())
+        return;
+
+      job = queue.front ();
+      queue.pop_front ();
+    }
+
+    record (job.sampled, AD_Fingerprint (*job.img, false));
+    cancel (job.img); // Frees its share of the budget
+  }
+}
@@ -0,0 +1,171 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__FINGERPRINT_H__
+#define __AD__FINGERPRINT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct ad_dump_image_s;
+
+//
+// Texture fingerprints (the content keys of dumps and replacements)
+//
+//   A 128-bit non-cryptographic hash over the texel rows of every level, in
+//     the style of XXH3: 64-byte stripes accumulated into eight 64-bit lanes
+//       (32x32 -> 64-bit multiplies, two lanes per SSE2 instruction), with
+//         a scramble every 1 KiB so that stripes can't trade places.
+//
+//   Rows are fed straight from wherever they live (a locked surface or a
+//     staged copy); padding past each row is never hashed, so both produce
+//       the same fingerprint.
+//
+//  * Sampled fingerprints hash the mip-chain header (format and every
+//      level's shape), every level small enough to be cheap in full, and a
+//        fixed set of evenly spaced rows from the rest.  Two textures that
+//          differ only outside those rows collide; the audit exists to tell
+//            how often that happens with the game's real data.
+//
+struct ad_fingerprint_s {
+  uint64_t lo, hi;
+
+  bool operator == (const ad_fingerprint_s& fp) const { return lo == fp.lo && hi == fp.hi; }
+  bool operator != (const ad_fingerprint_s& fp) const { return lo != fp.lo || hi != fp.hi; }
+};
+
+// For unordered containers keyed on the whole fingerprint (both halves are
+//   already well mixed)
+struct ad_fingerprint_hash_s {
+  size_t operator () (const ad_fingerprint_s& fp) const { return (size_t)(fp.lo ^ fp.hi); }
+};
+
+// One level's rows, however they are stored
+struct ad_fingerprint_level_s {
+  const uint8_t* bits;
+  size_t         pitch;          // Source stride
+  uint32_t       row_bytes;      // Hashed per row
+  uint32_t       rows;           // Of 4x4 blocks for DXTn
+  uint32_t       width, height;
+};
+
+enum ad_fingerprint_kernel_t {
+  AD_FINGERPRINT_SCALAR = 0,     // Portable
+  AD_FINGERPRINT_SSE2   = 1
+};
+
+enum {
+  AD_FINGERPRINT_SAMPLE_ROWS = 32,     // Per level, when sampled
+  AD_FINGERPRINT_FULL_BYTES  = 16384   // Levels this small are hashed whole
+};
+
+ad_fingerprint_s AD_Fingerprint ( uint32_t                      format,
+                                  const ad_fingerprint_level_s* levels,
+                                  uint32_t                      num_levels,
+                                  bool                          sampled );
+
+ad_fingerprint_s AD_Fingerprint ( const ad_dump_image_s& img, bool sampled );
+
+// A specific kernel (for verification and timing); false if unsupported
+bool             AD_Fingerprint_Kernel ( ad_fingerprint_kernel_t       kernel,
+                                         uint32_t                      format,
+                                         const ad_fingerprint_level_s* levels,
+                                         uint32_t                      num_levels,
+                                         bool                          sampled,
+                                         ad_fingerprint_s&             fp );
+
+//
+// Synthetic mip chains (DXT1, DXT5, A8R8G8B8 at 256 - 4096) timed through
+//   every kernel, full and sampled; results[] is filled in and the count
+//     returned.  A kernel that disagrees with the scalar one is reported.
+//
+struct ad_fingerprint_bench_s {
+  uint32_t format;
+  uint32_t size;                 // Level 0 is size x size
+  size_t   bytes;                // Whole chain
+  double   scalar_us;            // Full, per texture
+  double   simd_us;              // Full, per texture (0 if unsupported)
+  double   sampled_us;           // Sampled, best kernel
+  bool     agree;                // SIMD == scalar, full and sampled
+};
+
+int AD_Fingerprint_Benchmark (ad_fingerprint_bench_s* results, int max_results);
+
+//
+// Collision audit (Render.Fingerprint.Audit)
+//
+//   Every sampled fingerprint handed in is paired with the full fingerprint
+//     of the same texels, computed on a background thread from a copy; a
+//       sampled key that turns up with two different full keys is a collision.
+//
+struct ad_fingerprint_audit_s {
+  bool enable     = false;
+  int  budget_mib = 64;          // Copies waiting to be hashed
+
+  struct {
+    int audited    = 0;
+    int collisions = 0;
+    int dropped    = 0;          // Over budget
+  } stats;
+
+  uint64_t last_collision = 0;   // Sampled key (lo)
+
+  // Render thread, like ad_texture_dump_s: nullptr if over budget; otherwise
+  //   copy the texels sampled was computed from and commit, or cancel.
+  ad_dump_image_s* begin  ( uint32_t width, uint32_t height,
+                            uint32_t levels, uint32_t format );
+  void             commit (const ad_fingerprint_s& sampled, ad_dump_image_s* img);
+  void             cancel (ad_dump_image_s* img);
+
+  // When the full fingerprint is already at hand (e.g. on a dump worker)
+  void             record (const ad_fingerprint_s& sampled, const ad_fingerprint_s& full);
+
+  void             stop   (void);             // Finishes everything queued
+
+  ~ad_fingerprint_audit_s (void);
+
+protected:
+  void work (void);
+
+  struct job_s {
+    ad_fingerprint_s sampled;
+    ad_dump_image_s* img;
+  };
+
+  std::mutex                                      lock;
+  std::condition_variable                         ready;
+  std::deque <job_s>                              queue;
+  std::unordered_map <uint64_t, ad_fingerprint_s> seen;     // Sampled (lo) -> full
+  std::thread                                     worker;
+  size_t                                          staged   = 0;
+  bool                                            stopping = false;
+};
+
+extern ad_fingerprint_audit_s fingerprint_audit;
+
+#endif /* __AD__FINGERPRINT_H__ */
@@ -4,6 +4,7 @@
 #include <d3d9types.h>
 
 #include "nametags.h"
+#include "../shadow.h"
 
 ad_nametags_s* nametags = nullptr;
 
@@ -33,16 +34,16 @@ ad_nametags_s::shouldDrawOnTop (void)
 }
 
 ad_nametags_s::test_result
-ad_nametags_s::trigger (float last_z, float y, float z, float w, float zz)
+ad_nametags_s::trigger (float last_z, float y, bool ui_depth, float w, float zz)
 {
   if (! finished) {
     if (! drawing) {
-      if (last_z == 0.0f && (y != 0.0f) && (! (z == 0.0f || z == 16.0f || z == 32.0f || z == 100.0f)) && zz == 1.0f && w == 1.0f) {
+      if (last_z == 0.0f && (y != 0.0f) && (! ui_depth) && zz == 1.0f && w == 1.0f) {
         drawing = true;
         return NAMETAGS_BEGIN;
       }
     } else {
-      if (z == 0.0f || z == 16.0f || z == 32.0f || z == 100.0f) {
+      if (ui_depth) {
         drawing = false;
         return NAMETAGS_END;
       }
@@ -53,17 +54,6 @@ ad_nametags_s::trigger (float last_z, float y, float z, float w, float zz)
 }
 
 
-DWORD dwLastZEnable  = 0;
-DWORD dwLastZFunc    = 0;
-
-DWORD dwLastAlphaTest = 0;
-DWORD dwLastAlphaFunc = 0;
-DWORD dwLastAlphaRef  = 0;
-
-DWORD dwLastSrcOp    = 0;
-DWORD dwLastDstOp    = 0;
-DWORD dwLastBlend    = 0;
-
 #include "../log.h"
 #include "../hook.h"
 
@@ -91,53 +81,36 @@ ad_nametags_s::init (void)
   }
 }
 
+//
+// The game's values come from rs_shadow instead of GetRenderState, and
+//   consecutive nametags share one set of overrides: they are applied by
+//     the first primitive and restored when something else draws.
+//
 void
 ad_nametags_s::beginPrimitive (IDirect3DDevice9* pDev)
 {
-  pDev->GetRenderState (D3DRS_ZENABLE, &dwLastZEnable);
-  pDev->GetRenderState (D3DRS_ZFUNC,   &dwLastZFunc);
-
-  pDev->SetRenderState (D3DRS_ZENABLE, D3DZB_TRUE);
+  rs_shadow.override (pDev, D3DRS_ZENABLE, D3DZB_TRUE);
 
   if (top_technique > 1) {
-    pDev->GetRenderState (D3DRS_ALPHATESTENABLE,  &dwLastAlphaTest);
-    pDev->GetRenderState (D3DRS_ALPHAFUNC,        &dwLastAlphaFunc);
-    pDev->GetRenderState (D3DRS_ALPHAREF,         &dwLastAlphaRef);
-
-    pDev->GetRenderState (D3DRS_SRCBLEND,         &dwLastSrcOp);
-    pDev->GetRenderState (D3DRS_DESTBLEND,        &dwLastDstOp);
-    pDev->GetRenderState (D3DRS_ALPHABLENDENABLE, &dwLastBlend);
-
-    pDev->SetRenderState (D3DRS_SRCBLEND,         D3DBLEND_INVSRCALPHA);
-    pDev->SetRenderState (D3DRS_DESTBLEND,        D3DBLEND_SRCALPHA);
-    pDev->SetRenderState (D3DRS_ALPHABLENDENABLE, TRUE);
+    rs_shadow.override (pDev, D3DRS_SRCBLEND,         D3DBLEND_INVSRCALPHA);
+    rs_shadow.override (pDev, D3DRS_DESTBLEND,        D3DBLEND_SRCALPHA);
+    rs_shadow.override (pDev, D3DRS_ALPHABLENDENABLE, TRUE);
 
-    pDev->SetRenderState (D3DRS_ZFUNC,            D3DCMP_GREATER);
+    rs_shadow.override (pDev, D3DRS_ZFUNC,            D3DCMP_GREATER);
 
     // Avoid (most) fringing on translucent edges -- we should really be using
     //   pre-multiplied alpha, but accomplishing that is too much trouble.
-    pDev->SetRenderState (D3DRS_ALPHATESTENABLE, TRUE);
-    pDev->SetRenderState (D3DRS_ALPHAFUNC,       D3DCMP_GREATEREQUAL);
+    rs_shadow.override (pDev, D3DRS_ALPHATESTENABLE, TRUE);
+    rs_shadow.override (pDev, D3DRS_ALPHAFUNC,       D3DCMP_GREATEREQUAL);
 
-    pDev->SetRenderState (D3DRS_ALPHAREF,        0x0f);
+    rs_shadow.override (pDev, D3DRS_ALPHAREF,        0x0f);
   } else {
-    pDev->SetRenderState (D3DRS_ZFUNC,            D3DCMP_ALWAYS);
+    rs_shadow.override (pDev, D3DRS_ZFUNC,            D3DCMP_ALWAYS);
   }
 }
 
 void
 ad_nametags_s::endPrimitive (IDirect3DDevice9* pDev)
 {
-  pDev->SetRenderState (D3DRS_ZENABLE, dwLastZEnable);
-  pDev->SetRenderState (D3DRS_ZFUNC,   dwLastZFunc);
-
-  if (top_technique > 1) {
-    pDev->SetRenderState (D3DRS_ALPHATESTENABLE,  dwLastAlphaTest);
-    pDev->SetRenderState (D3DRS_ALPHAFUNC,        dwLastAlphaFunc);
-    pDev->SetRenderState (D3DRS_ALPHAREF,         dwLastAlphaRef);
-
-    pDev->SetRenderState (D3DRS_SRCBLEND,         dwLastSrcOp);
-    pDev->SetRenderState (D3DRS_DESTBLEND,        dwLastDstOp);
-    pDev->SetRenderState (D3DRS_ALPHABLENDENABLE, dwLastBlend);
-  }
-}
\ No newline at end of file
+  rs_shadow.release (pDev);
+}
@@ -62,7 +62,8 @@ struct ad_nametags_s : ad_hud_render_task_s {
     NAMETAGS_UNKNOWN
   };
 
-  test_result trigger (float last_z, float y, float z, float w, float zz);
+  // ui_depth: the draw is at one of the common UI depths (AD_RULE_UI_DEPTH)
+  test_result trigger (float last_z, float y, bool ui_depth, float w, float zz);
 
   void init  (void);
   void reset (void);
@@ -35,6 +35,7 @@
 #include "window.h"
 #include "render.h"
 #include "hook.h"
+#include "display.h"
 
 #include <mmsystem.h>
 #pragma comment (lib, "winmm.lib")
@@ -43,63 +44,17 @@
 
 ClipCursor_pfn ClipCursor_Original = nullptr;
 
-void
-AD_ComputeAspectCoeffsEx (float& x, float& y, float& xoff, float& yoff, bool force=false)
-{
-  yoff = 0.0f;
-  xoff = 0.0f;
-
-  x = 1.0f;
-  y = 1.0f;
-
-  if (! (config.render.aspect_correction || force))
-    return;
-
-  config.render.aspect_ratio = ad::RenderFix::width / ad::RenderFix::height;
-  float rescale = ((16.0f / 9.0f) / config.render.aspect_ratio);
-
-  // Wider
-  if (config.render.aspect_ratio > (16.0f / 9.0f)) {
-    int width = (16.0f / 9.0f) * ad::RenderFix::height;
-    int x_off = (ad::RenderFix::width - width) / 2;
-
-    x    = (float)ad::RenderFix::width / (float)width;
-    xoff = x_off;
-
-#if 0
-    // Calculated height will be greater than we started with, so work
-    //  in the wrong direction here...
-    int height = (9.0f / 16.0f) * ad::RenderFix::width;
-    y          = (float)ad::RenderFix::height / (float)height;
-#endif
-
-    yoff = config.scaling.mouse_y_offset;
-  } else {
-// No fix is needed in this direction
-#if 0
-    int height = (9.0f / 16.0f) * ad::RenderFix::width;
-    int y_off  = (ad::RenderFix::height - height) / 2;
-
-    y    = (float)ad::RenderFix::height / (float)height;
-    yoff = y_off;
-#endif
-  }
-}
-
 // Returns the original cursor position and stores the new one in pPoint
 POINT
 ad::InputManager::CalcCursorPos (LPPOINT pPoint, bool reverse)
 {
   // Bail-out early if aspect ratio correction is disabled, or if the
   //   aspect ratio is less than or equal to 16:9.
-  if  (! ( config.render.aspect_correction &&
-           config.render.aspect_ratio > (16.0f / 9.0f) ) )
+  if  (! ( config.render.aspect_correction && display.wider ) )
     return *pPoint;
 
-  float xscale, yscale;
-  float xoff,   yoff;
-
-  AD_ComputeAspectCoeffsEx (xscale, yscale, xoff, yoff);
+  float xscale = display.backbuffer.x,    yscale = display.backbuffer.y;
+  float xoff   = display.backbuffer.xoff, yoff   = display.backbuffer.yoff;
 
   if (! config.render.center_ui) {
     xscale = 1.0f;
@@ -356,7 +311,7 @@ GetCursorInfo_Detour (PCURSORINFO pci)
   BOOL ret = GetCursorInfo_Original (pci);
 
   // Correct the cursor position for Aspect Ratio
-  if (config.render.aspect_correction && config.render.aspect_ratio > (16.0f / 9.0f)) {
+  if (config.render.aspect_correction && display.wider) {
     POINT pt;
 
     pt.x = pci->ptScreenPos.x;
@@ -399,7 +354,7 @@ GetCursorPos_Detour (LPPOINT lpPoint)
   BOOL ret = GetCursorPos_Original (lpPoint);
 
   // Correct the cursor position for Aspect Ratio
-  if (config.render.aspect_correction && config.render.aspect_ratio > (16.0f / 9.0f))
+  if (config.render.aspect_correction && display.wider)
     ad::InputManager::CalcCursorPos (lpPoint);
 
   return ret;
@@ -759,16 +714,18 @@ ad::InputManager::Hooker::KeyboardProc (int nCode, WPARAM wParam, LPARAM lParam)
           pCommandProc->ProcessCommandLine ("CenterUI toggle");
         } else if (vkCode == VK_OEM_COMMA) {
           if (! config.scaling.locked) {
-            if (keys_ [VK_MENU])
+            if (keys_ [VK_MENU]) {
               config.scaling.mouse_y_offset -= 0.1f;
-            else
+              AD_InvalidateDisplayGeometry ();
+            } else
               config.scaling.hud_x_offset -= 0.01f;
           }
         } else if (vkCode == VK_OEM_PERIOD) {
           if (! config.scaling.locked) {
-            if (keys_ [VK_MENU])
+            if (keys_ [VK_MENU]) {
               config.scaling.mouse_y_offset += 0.1f;
-            else
+              AD_InvalidateDisplayGeometry ();
+            } else
               config.scaling.hud_x_offset += 0.01f;
           }
         } else if (keys_ [VK_MENU] && vkCode == VK_SPACE && new_press) {
@@ -0,0 +1,234 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#include "limiter.h"
+
+#ifdef _WIN32
+# include <Windows.h>
+# include <mmsystem.h>
+# pragma comment (lib, "winmm.lib")
+#else
+# include <chrono>
+# include <thread>
+#endif
+
+#include <math.h>
+
+ad_frame_limiter_s frame_limiter;
+
+#ifdef _WIN32
+struct ad_qpc_clock_s : ad_clock_s {
+  ad_qpc_clock_s (void)
+  {
+    LARGE_INTEGER qpf;
+    QueryPerformanceFrequency (&qpf);
+
+    freq = qpf.QuadPart;
+
+    // Sleep (...) is otherwise only as fine as the 15.6 ms system tick
+    timeBeginPeriod (1);
+  }
+
+  int64_t now (void)
+  {
+    LARGE_INTEGER qpc;
+    QueryPerformanceCounter (&qpc);
+
+    // Whole seconds first; ticks * 10^9 alone overflows after ~15 minutes
+    //   at a 10 MHz counter
+    return   (qpc.QuadPart / freq) * 1000000000LL +
+           ( (qpc.QuadPart % freq) * 1000000000LL ) / freq;
+  }
+
+  void sleep (int64_t ns)
+  {
+    // Anything under a tick is a yield
+    Sleep ((DWORD)(ns / 1000000LL));
+  }
+
+  void relax (void)
+  {
+    YieldProcessor ();
+  }
+
+  int64_t freq;
+};
+#else
+struct ad_steady_clock_s : ad_clock_s {
+  int64_t now (void)
+  {
+    return std::chrono::duration_cast <std::chrono::nanoseconds> (
+             std::chrono::steady_clock::now ().time_since_epoch ()
+           ).count ();
+  }
+
+  void sleep (int64_t ns)
+  {
+    std::this_thread::sleep_for (std::chrono::nanoseconds (ns));
+  }
+
+  void relax (void)
+  {
+    std::this_thread::yield ();
+  }
+};
+#endif
+
+ad_clock_s*
+AD_SystemClock (void)
+{
+#ifdef _WIN32
+  static ad_qpc_clock_s    clock;
+#else
+  static ad_steady_clock_s clock;
+#endif
+
+  return &clock;
+}
+
+//
+// The system clock isn't touched until the first wait, which keeps
+//   timeBeginPeriod (...) out of DllMain for the global instance.
+//
+ad_frame_limiter_s::ad_frame_limiter_s (ad_clock_s* clock) : clock_ (clock)
+{
+}
+
+void
+ad_frame_limiter_s::set_target (float fps)
+{
+  pending_.store (fps > 0.0f ? fps : 0.0f, std::memory_order_relaxed);
+}
+
+void
+ad_frame_limiter_s::restart (void)
+{
+  deadline_ = 0;
+  last_     = 0;
+
+  n_        = 0;
+  mean_     = 0.0;
+  m2_       = 0.0;
+  worst_    = 0;
+}
+
+int64_t
+ad_frame_limiter_s::wait (void)
+{
+  const float pending = pending_.load (std::memory_order_relaxed);
+
+  if (pending != fps_) {
+    fps_    = pending;
+    period_ = fps_ > 0.0f ? (int64_t)(1000000000.0 / fps_ + 0.5) : 0;
+
+    restart ();
+  }
+
+  if (period_ <= 0)
+    return 0;
+
+  if (clock_ == nullptr)
+    clock_ = AD_SystemClock ();
+
+  const int64_t start = clock_->now ();
+        int64_t next  = deadline_ + period_;
+        bool    late  = deadline_ != 0 && start > next + tolerance_ns;
+
+  // First frame, or more than a whole period behind: a new grid from here
+  if (deadline_ == 0 || start - next > period_)
+    next = start;
+
+  // Let the worst overshoot fade (~1.5% a frame) once the OS settles down
+  slop_ -= slop_ >> 6;
+
+  const int64_t spin = slop_ + (slop_ >> 2) > spin_ns ?
+                         slop_ + (slop_ >> 2) : spin_ns;
+
+  int64_t now = start;
+
+  while (now < next) {
+    const int64_t remaining = next - now;
+
+    if (remaining > spin) {
+      const int64_t asked = remaining - spin;
+
+      clock_->sleep (asked);
+
+      const int64_t woke = clock_->now ();
+
+      if (woke - now - asked > slop_)
+        slop_ = woke - now - asked;
+
+      now = woke;
+    }
+
+    else {
+      clock_->relax ();
+      now = clock_->now ();
+    }
+  }
+
+  ++stats.frames;
+
+  if (late)
+    ++stats.missed;
+
+  else if (now > next + tolerance_ns) {
+    ++stats.missed;
+    ++stats.overslept;
+  }
+
+  if (last_ != 0)
+    record (now - last_);
+
+  deadline_ = next;
+  last_     = now;
+
+  return now - start;
+}
+
+void
+ad_frame_limiter_s::record (int64_t interval)
+{
+  const double x     = (double)interval;
+  const double delta = x - mean_;
+
+  mean_ += delta / ++n_;
+  m2_   += delta * (x - mean_);
+
+  if (interval > worst_)
+    worst_ = interval;
+
+  if (n_ < window)
+    return;
+
+  const double variance = m2_ / n_;
+
+  stats.mean_ms     = (float)(mean_    / 1000000.0);
+  stats.variance_ms = (float)(variance / 1000000000000.0);
+  stats.stddev_ms   = (float)(sqrt (variance) / 1000000.0);
+  stats.worst_ms    = (float)(worst_   / 1000000.0);
+
+  n_     = 0;
+  mean_  = 0.0;
+  m2_    = 0.0;
+  worst_ = 0;
+}
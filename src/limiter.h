@@ -0,0 +1,117 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__LIMITER_H__
+#define __AD__LIMITER_H__
+
+#include <stdint.h>
+
+#include <atomic>
+
+//
+// Monotonic time source for the frame limiter, in nanoseconds.
+//
+//   The limiter only ever talks to the clock through this, so a fake clock
+//     (one that advances by exactly what sleep asked for, plus whatever
+//       scheduler slop a test wants to model) makes its timing reproducible.
+//
+struct ad_clock_s {
+  virtual ~ad_clock_s (void) { }
+
+  virtual int64_t now   (void)       = 0;
+  virtual void    sleep (int64_t ns) = 0; // Coarse; may overshoot by a whole tick
+  virtual void    relax (void)       = 0; // One iteration of a spin-wait
+};
+
+// QueryPerformanceCounter + Sleep (1 ms timer resolution) on Windows,
+//   std::chrono::steady_clock + std::this_thread elsewhere
+ad_clock_s* AD_SystemClock (void);
+
+//
+// Frame limiter (Window.ForegroundFPS / Window.BackgroundFPS)
+//
+//   Deadlines are a fixed grid (period = 1 / fps) rather than "now + period",
+//     so a frame that wakes up a little late doesn't push every frame after
+//       it back.  The grid is restarted if the game falls more than a whole
+//         period behind, instead of rushing frames out to catch up.
+//
+//  * Waiting is hybrid: the scheduler sleeps until the deadline is within
+//      the spin window, and the rest is busy-waited.  The window grows to
+//        cover the worst sleep overshoot seen recently, since that depends
+//          on the OS timer and not on anything we control.
+//
+//  * Render thread only, except for set_target (...).
+//
+struct ad_frame_limiter_s {
+  explicit ad_frame_limiter_s (ad_clock_s* clock = nullptr);
+
+  // 0 (or less) is unlimited; a new rate starts a new grid at the next
+  //   wait (...).  Safe from any thread (e.g. the window procedure).
+  void    set_target (float fps);
+  float   target     (void) const { return pending_.load (std::memory_order_relaxed); }
+
+  // Blocks until the next deadline; returns the time spent waiting (ns)
+  int64_t wait       (void);
+
+  // Forgets the grid (e.g. after a Reset or a long stall)
+  void    restart    (void);
+
+  int64_t spin_ns       = 2000000; // Busy-wait at least the last 2 ms
+  int64_t tolerance_ns  = 500000;  // Later than this past the deadline is a miss
+  int     window        = 120;     // Frames per published statistic
+
+  //
+  // Render.FrameLimiter.<Stat>, published every window frames; intervals
+  //   are between successive returns from wait (...), i.e. what the
+  //     Present pacing actually looked like.
+  //
+  struct {
+    float mean_ms     = 0.0f;
+    float variance_ms = 0.0f;      // ms^2
+    float stddev_ms   = 0.0f;
+    float worst_ms    = 0.0f;      // Longest interval
+    int   missed      = 0;         // Total past deadline + tolerance
+    int   overslept   = 0;         //   ... of which the limiter caused
+    int   frames      = 0;         // Total limited
+  } stats;
+
+protected:
+  void    record     (int64_t interval);
+
+  ad_clock_s* clock_;
+  std::atomic <float>
+              pending_    { 0.0f }; // set_target (...)
+  float       fps_        = 0.0f;
+  int64_t     period_     = 0;
+  int64_t     deadline_   = 0;     // 0 = no grid yet
+  int64_t     last_       = 0;     // Previous return from wait (...)
+  int64_t     slop_       = 0;     // Recent worst sleep overshoot
+
+  // Welford accumulators for the current window
+  int         n_          = 0;
+  double      mean_       = 0.0;
+  double      m2_         = 0.0;
+  int64_t     worst_      = 0;
+};
+
+extern ad_frame_limiter_s frame_limiter;
+
+#endif /* __AD__LIMITER_H__ */
@@ -0,0 +1,874 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "mipgen.h"
+#include "texdump.h"
+
+#include <string.h>
+
+#include <chrono>
+
+#if defined (_M_X64) || defined (__SSE2__) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define AD_MIP_HAVE_SSE2
+#endif
+
+ad_mip_completion_s mip_completion;
+
+static const uint32_t AD_MIP_DXT1 = 0x31545844U;
+static const uint32_t AD_MIP_DXT2 = 0x32545844U;
+static const uint32_t AD_MIP_DXT3 = 0x33545844U;
+static const uint32_t AD_MIP_DXT4 = 0x34545844U;
+static const uint32_t AD_MIP_DXT5 = 0x35545844U;
+
+#ifdef AD_MIP_HAVE_SSE2
+static const ad_mip_kernel_t AD_MIP_BEST = AD_MIP_SSE2;
+#else
+static const ad_mip_kernel_t AD_MIP_BEST = AD_MIP_SCALAR;
+#endif
+
+// Formats filtered byte-for-byte; 0 if not one of them
+static int
+AD_Mip_BytesPerTexel (uint32_t format)
+{
+  switch (format) {
+    case 21: case 22: case 32: case 33:  // A8R8G8B8, X8R8G8B8, A8B8G8R8, X8B8G8R8
+      return 4;
+    case 51:                             // A8L8
+      return 2;
+    case 28: case 50:                    // A8, L8
+      return 1;
+  }
+
+  return 0;
+}
+
+static bool
+AD_Mip_IsDXT (uint32_t format)
+{
+  return format == AD_MIP_DXT1 || format == AD_MIP_DXT2 || format == AD_MIP_DXT3 ||
+         format == AD_MIP_DXT4 || format == AD_MIP_DXT5;
+}
+
+bool
+AD_MipFormatSupported (uint32_t format)
+{
+  return AD_Mip_BytesPerTexel (format) != 0 || AD_Mip_IsDXT (format);
+}
+
+bool
+AD_MipFormatCompressed (uint32_t format)
+{
+  return AD_Mip_IsDXT (format);
+}
+
+static inline uint32_t
+AD_Mip_Clamp (uint32_t v, uint32_t limit)
+{
+  return v < limit ? v : limit - 1;
+}
+
+//
+// 2x2 box filter; odd (or 1-texel) edges repeat their last texel
+//
+static void
+AD_Mip_Row_Scalar ( const uint8_t* r0, const uint8_t* r1, uint32_t sw,
+                          uint8_t* dst, uint32_t x,       uint32_t dw, int bpp )
+{
+  for (; x < dw; x++) {
+    const uint32_t x0 = AD_Mip_Clamp (2 * x,     sw) * bpp;
+    const uint32_t x1 = AD_Mip_Clamp (2 * x + 1, sw) * bpp;
+
+    for (int c = 0; c < bpp; c++) {
+      dst [x * bpp + c] =
+        (uint8_t)((r0 [x0 + c] + r0 [x1 + c] + r1 [x0 + c] + r1 [x1 + c] + 2) >> 2);
+    }
+  }
+}
+
+#ifdef AD_MIP_HAVE_SSE2
+// 32-bit texels, four out per step; returns where the scalar tail begins
+static uint32_t
+AD_Mip_Row32_SSE2 (const uint8_t* r0, const uint8_t* r1, uint32_t sw, uint8_t* dst, uint32_t dw)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i two  = _mm_set1_epi16    (2);
+
+  uint32_t x = 0;
+
+  for (; x + 4 <= dw && 2 * x + 8 <= sw; x += 4) {
+    const __m128i a0 = _mm_loadu_si128 ((const __m128i *)(r0 + x * 8));
+    const __m128i a1 = _mm_loadu_si128 ((const __m128i *)(r0 + x * 8 + 16));
+    const __m128i b0 = _mm_loadu_si128 ((const __m128i *)(r1 + x * 8));
+    const __m128i b1 = _mm_loadu_si128 ((const __m128i *)(r1 + x * 8 + 16));
+
+    // Vertical sums (16-bit), two texels per register
+    const __m128i s01 = _mm_add_epi16 (_mm_unpacklo_epi8 (a0, zero), _mm_unpacklo_epi8 (b0, zero));
+    const __m128i s23 = _mm_add_epi16 (_mm_unpackhi_epi8 (a0, zero), _mm_unpackhi_epi8 (b0, zero));
+    const __m128i s45 = _mm_add_epi16 (_mm_unpacklo_epi8 (a1, zero), _mm_unpacklo_epi8 (b1, zero));
+    const __m128i s67 = _mm_add_epi16 (_mm_unpackhi_epi8 (a1, zero), _mm_unpackhi_epi8 (b1, zero));
+
+    // Horizontal pairs: [0+1 | 2+3], [4+5 | 6+7]
+    __m128i h0 = _mm_add_epi16 (_mm_unpacklo_epi64 (s01, s23), _mm_unpackhi_epi64 (s01, s23));
+    __m128i h1 = _mm_add_epi16 (_mm_unpacklo_epi64 (s45, s67), _mm_unpackhi_epi64 (s45, s67));
+
+    h0 = _mm_srli_epi16 (_mm_add_epi16 (h0, two), 2);
+    h1 = _mm_srli_epi16 (_mm_add_epi16 (h1, two), 2);
+
+    _mm_storeu_si128 ((__m128i *)(dst + x * 4), _mm_packus_epi16 (h0, h1));
+  }
+
+  return x;
+}
+#endif
+
+static void
+AD_Mip_Downsample ( ad_mip_kernel_t kernel,
+                    const uint8_t* src, size_t src_pitch, uint32_t sw, uint32_t sh,
+                          uint8_t* dst, size_t dst_pitch, uint32_t dw, uint32_t dh,
+                    int            bpp )
+{
+  for (uint32_t y = 0; y < dh; y++) {
+    const uint8_t* r0  = src + AD_Mip_Clamp (2 * y,     sh) * src_pitch;
+    const uint8_t* r1  = src + AD_Mip_Clamp (2 * y + 1, sh) * src_pitch;
+          uint8_t* out = dst + y * dst_pitch;
+
+    uint32_t x = 0;
+
+#ifdef AD_MIP_HAVE_SSE2
+    if (kernel == AD_MIP_SSE2 && bpp == 4)
+      x = AD_Mip_Row32_SSE2 (r0, r1, sw, out, dw);
+#else
+    (void)kernel;
+#endif
+
+    AD_Mip_Row_Scalar (r0, r1, sw, out, x, dw, bpp);
+  }
+}
+
+//
+// DXTn (texels are unpacked as R, G, B, A bytes)
+//
+static inline uint16_t
+AD_Mip_Read16 (const uint8_t* p)
+{
+  return (uint16_t)(p [0] | (p [1] << 8));
+}
+
+static inline void
+AD_Mip_Write16 (uint8_t* p, uint16_t v)
+{
+  p [0] = (uint8_t) v;
+  p [1] = (uint8_t)(v >> 8);
+}
+
+static void
+AD_Mip_Expand565 (uint16_t c, uint8_t* rgba)
+{
+  const uint32_t r = (c >> 11) & 0x1F;
+  const uint32_t g = (c >>  5) & 0x3F;
+  const uint32_t b =  c        & 0x1F;
+
+  rgba [0] = (uint8_t)((r << 3) | (r >> 2));
+  rgba [1] = (uint8_t)((g << 2) | (g >> 4));
+  rgba [2] = (uint8_t)((b << 3) | (b >> 2));
+  rgba [3] = 255;
+}
+
+static uint16_t
+AD_Mip_Pack565 (const uint8_t* rgba)
+{
+  return (uint16_t)( ((rgba [0] >> 3) << 11) | ((rgba [1] >> 2) << 5) | (rgba [2] >> 3) );
+}
+
+// Palette entries 2 and 3; punch = DXT1's three-color + transparent mode
+static void
+AD_Mip_ColorPalette (uint8_t pal [4][4], bool punch)
+{
+  for (int c = 0; c < 3; c++) {
+    if (! punch) {
+      pal [2][c] = (uint8_t)((2 * pal [0][c] +     pal [1][c]) / 3);
+      pal [3][c] = (uint8_t)((    pal [0][c] + 2 * pal [1][c]) / 3);
+    }
+
+    else {
+      pal [2][c] = (uint8_t)((pal [0][c] + pal [1][c]) / 2);
+      pal [3][c] = 0;
+    }
+  }
+
+  pal [2][3] = 255;
+  pal [3][3] = punch ? 0 : 255;
+}
+
+static void
+AD_Mip_DecodeColor (const uint8_t* block, bool dxt1, uint8_t* texels)
+{
+  const uint16_t c0 = AD_Mip_Read16 (block);
+  const uint16_t c1 = AD_Mip_Read16 (block + 2);
+
+  uint8_t pal [4][4];
+
+  AD_Mip_Expand565    (c0, pal [0]);
+  AD_Mip_Expand565    (c1, pal [1]);
+  AD_Mip_ColorPalette (pal, dxt1 && c0 <= c1);
+
+  uint32_t idx;
+  memcpy (&idx, block + 4, 4);
+
+  for (int i = 0; i < 16; i++, idx >>= 2)
+    memcpy (&texels [i * 4], pal [idx & 3], 4);
+}
+
+static void
+AD_Mip_AlphaPalette (uint8_t a0, uint8_t a1, uint8_t pal [8])
+{
+  pal [0] = a0;
+  pal [1] = a1;
+
+  if (a0 > a1) {
+    for (int i = 2; i < 8; i++)
+      pal [i] = (uint8_t)(((8 - i) * a0 + (i - 1) * a1) / 7);
+  }
+
+  else {
+    for (int i = 2; i < 6; i++)
+      pal [i] = (uint8_t)(((6 - i) * a0 + (i - 1) * a1) / 5);
+
+    pal [6] = 0;
+    pal [7] = 255;
+  }
+}
+
+static void
+AD_Mip_DecodeAlpha (const uint8_t* block, uint32_t format, uint8_t* texels)
+{
+  if (format == AD_MIP_DXT2 || format == AD_MIP_DXT3) {
+    for (int i = 0; i < 16; i++)
+      texels [i * 4 + 3] = (uint8_t)(((block [i / 2] >> ((i & 1) * 4)) & 0xF) * 17);
+
+    return;
+  }
+
+  uint8_t pal [8];
+  AD_Mip_AlphaPalette (block [0], block [1], pal);
+
+  uint64_t idx = 0;
+
+  for (int i = 0; i < 6; i++)
+    idx |= (uint64_t)block [2 + i] << (i * 8);
+
+  for (int i = 0; i < 16; i++, idx >>= 3)
+    texels [i * 4 + 3] = pal [idx & 7];
+}
+
+// One level into w * h RGBA texels
+static void
+AD_Mip_DecodeLevel ( uint32_t format, const uint8_t* src, const ad_dump_image_s::level_s& lvl,
+                     std::vector <uint8_t>& rgba )
+{
+  const bool   dxt1       = format == AD_MIP_DXT1;
+  const size_t block_size = dxt1 ? 8 : 16;
+
+  rgba.resize ((size_t)lvl.width * lvl.height * 4);
+
+  uint8_t texels [64];
+
+  for (uint32_t by = 0; by < lvl.rows; by++) {
+    for (uint32_t bx = 0; bx < lvl.pitch / block_size; bx++) {
+      const uint8_t* block = src + by * lvl.pitch + bx * block_size;
+
+      AD_Mip_DecodeColor (dxt1 ? block : block + 8, dxt1, texels);
+
+      if (! dxt1)
+        AD_Mip_DecodeAlpha (block, format, texels);
+
+      for (uint32_t y = 0; y < 4 && by * 4 + y < lvl.height; y++) {
+        for (uint32_t x = 0; x < 4 && bx * 4 + x < lvl.width; x++) {
+          memcpy ( &rgba [(((size_t)by * 4 + y) * lvl.width + bx * 4 + x) * 4],
+                     &texels [(y * 4 + x) * 4], 4 );
+        }
+      }
+    }
+  }
+}
+
+// Per-channel minimum and maximum of 16 texels
+static void
+AD_Mip_Bounds_Scalar (const uint8_t* texels, uint8_t* mn, uint8_t* mx)
+{
+  for (int c = 0; c < 4; c++) {
+    mn [c] = 255;
+    mx [c] = 0;
+  }
+
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < 4; c++) {
+      const uint8_t v = texels [i * 4 + c];
+
+      if (v < mn [c]) mn [c] = v;
+      if (v > mx [c]) mx [c] = v;
+    }
+  }
+}
+
+#ifdef AD_MIP_HAVE_SSE2
+static void
+AD_Mip_Bounds_SSE2 (const uint8_t* texels, uint8_t* mn, uint8_t* mx)
+{
+  const __m128i t0 = _mm_loadu_si128 ((const __m128i *)(texels));
+  const __m128i t1 = _mm_loadu_si128 ((const __m128i *)(texels + 16));
+  const __m128i t2 = _mm_loadu_si128 ((const __m128i *)(texels + 32));
+  const __m128i t3 = _mm_loadu_si128 ((const __m128i *)(texels + 48));
+
+  __m128i lo = _mm_min_epu8 (_mm_min_epu8 (t0, t1), _mm_min_epu8 (t2, t3));
+  __m128i hi = _mm_max_epu8 (_mm_max_epu8 (t0, t1), _mm_max_epu8 (t2, t3));
+
+  lo = _mm_min_epu8 (lo, _mm_srli_si128 (lo, 8));
+  lo = _mm_min_epu8 (lo, _mm_srli_si128 (lo, 4));
+  hi = _mm_max_epu8 (hi, _mm_srli_si128 (hi, 8));
+  hi = _mm_max_epu8 (hi, _mm_srli_si128 (hi, 4));
+
+  const uint32_t l = (uint32_t)_mm_cvtsi128_si32 (lo);
+  const uint32_t h = (uint32_t)_mm_cvtsi128_si32 (hi);
+
+  memcpy (mn, &l, 4);
+  memcpy (mx, &h, 4);
+}
+#endif
+
+// Nearest of the palette's first count entries (RGB distance), 2 bits each
+static uint32_t
+AD_Mip_ColorIndices_Scalar (const uint8_t* texels, const uint8_t pal [4][4], bool punch)
+{
+  uint32_t idx = 0;
+
+  for (int i = 0; i < 16; i++) {
+    const uint8_t* t = &texels [i * 4];
+
+    uint32_t best = 0;
+
+    if (punch && t [3] < 128)
+      best = 3;
+
+    else {
+      int best_dist = 0x7FFFFFFF;
+
+      for (uint32_t p = 0; p < (punch ? 3U : 4U); p++) {
+        const int dr = t [0] - pal [p][0];
+        const int dg = t [1] - pal [p][1];
+        const int db = t [2] - pal [p][2];
+
+        const int dist = dr * dr + dg * dg + db * db;
+
+        if (dist < best_dist) {
+          best_dist = dist;
+          best      = p;
+        }
+      }
+    }
+
+    idx |= best << (i * 2);
+  }
+
+  return idx;
+}
+
+#ifdef AD_MIP_HAVE_SSE2
+// Four-color mode only; four texels per register, same tie-breaking as above
+static uint32_t
+AD_Mip_ColorIndices_SSE2 (const uint8_t* texels, const uint8_t pal [4][4])
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i rgb  = _mm_set_epi16 (0, -1, -1, -1, 0, -1, -1, -1);
+
+  __m128i entry [4];
+
+  for (int p = 0; p < 4; p++) {
+    entry [p] = _mm_set_epi16 ( 0, pal [p][2], pal [p][1], pal [p][0],
+                                0, pal [p][2], pal [p][1], pal [p][0] );
+  }
+
+  uint32_t idx = 0;
+
+  for (int i = 0; i < 4; i++) {
+    const __m128i t  = _mm_loadu_si128 ((const __m128i *)(texels + i * 16));
+    const __m128i lo = _mm_and_si128   (_mm_unpacklo_epi8 (t, zero), rgb);
+    const __m128i hi = _mm_and_si128   (_mm_unpackhi_epi8 (t, zero), rgb);
+
+    __m128i best      = zero;
+    __m128i best_dist = _mm_set1_epi32 (0x7FFFFFFF);
+
+    for (int p = 0; p < 4; p++) {
+      const __m128i dlo = _mm_sub_epi16 (lo, entry [p]);
+      const __m128i dhi = _mm_sub_epi16 (hi, entry [p]);
+
+      // (r^2 + g^2, b^2) per texel, then summed per texel
+      const __m128 sq_lo = _mm_castsi128_ps (_mm_madd_epi16 (dlo, dlo));
+      const __m128 sq_hi = _mm_castsi128_ps (_mm_madd_epi16 (dhi, dhi));
+
+      const __m128i dist =
+        _mm_add_epi32 ( _mm_castps_si128 (_mm_shuffle_ps (sq_lo, sq_hi, _MM_SHUFFLE (2, 0, 2, 0))),
+                        _mm_castps_si128 (_mm_shuffle_ps (sq_lo, sq_hi, _MM_SHUFFLE (3, 1, 3, 1))) );
+
+      const __m128i closer = _mm_cmplt_epi32 (dist, best_dist);
+
+      best_dist = _mm_or_si128 (_mm_and_si128 (closer, dist),                _mm_andnot_si128 (closer, best_dist));
+      best      = _mm_or_si128 (_mm_and_si128 (closer, _mm_set1_epi32 (p)), _mm_andnot_si128 (closer, best));
+    }
+
+    uint32_t lanes [4];
+    _mm_storeu_si128 ((__m128i *)lanes, best);
+
+    for (int j = 0; j < 4; j++)
+      idx |= lanes [j] << ((i * 4 + j) * 2);
+  }
+
+  return idx;
+}
+#endif
+
+static void
+AD_Mip_EncodeColor (ad_mip_kernel_t kernel, const uint8_t* texels,
+                    const uint8_t* mn, const uint8_t* mx, bool dxt1, uint8_t* block)
+{
+  bool punch  = false;
+  int  opaque = 16;
+
+  // DXT1 texels with alpha < 128 become transparent; the opaque ones alone
+  //   decide the endpoints
+  uint8_t omn [4], omx [4];
+
+  if (dxt1 && mn [3] < 128) {
+    punch  = true;
+    opaque = 0;
+
+    for (int c = 0; c < 3; c++) {
+      omn [c] = 255;
+      omx [c] = 0;
+    }
+
+    for (int i = 0; i < 16; i++) {
+      if (texels [i * 4 + 3] < 128)
+        continue;
+
+      ++opaque;
+
+      for (int c = 0; c < 3; c++) {
+        const uint8_t v = texels [i * 4 + c];
+
+        if (v < omn [c]) omn [c] = v;
+        if (v > omx [c]) omx [c] = v;
+      }
+    }
+
+    mn = omn;
+    mx = omx;
+  }
+
+  if (opaque == 0) {
+    memset (block,     0x00, 4);
+    memset (block + 4, 0xFF, 4);
+    return;
+  }
+
+  // Inset the box by 1/16 on either end; the extremes are rarely worth an
+  //   endpoint of their own
+  uint8_t lo [4], hi [4];
+
+  for (int c = 0; c < 3; c++) {
+    const int inset = (mx [c] - mn [c]) >> 4;
+
+    lo [c] = (uint8_t)(mn [c] + inset);
+    hi [c] = (uint8_t)(mx [c] - inset);
+  }
+
+  uint16_t c0 = AD_Mip_Pack565 (hi);
+  uint16_t c1 = AD_Mip_Pack565 (lo);
+
+  // Four-color mode needs c0 > c1, the punch-through mode c0 <= c1
+  if (punch ? c0 > c1 : c0 < c1) {
+    const uint16_t t = c0; c0 = c1; c1 = t;
+  }
+
+  AD_Mip_Write16 (block,     c0);
+  AD_Mip_Write16 (block + 2, c1);
+
+  uint8_t pal [4][4];
+
+  AD_Mip_Expand565    (c0, pal [0]);
+  AD_Mip_Expand565    (c1, pal [1]);
+  // Equal endpoints decode in DXT1's three-color mode; only index 0 is used
+  //   either way
+  AD_Mip_ColorPalette (pal, punch || (dxt1 && c0 == c1));
+
+  uint32_t idx;
+
+#ifdef AD_MIP_HAVE_SSE2
+  if (kernel == AD_MIP_SSE2 && (! punch))
+    idx = AD_Mip_ColorIndices_SSE2   (texels, pal);
+  else
+#else
+  (void)kernel;
+#endif
+    idx = AD_Mip_ColorIndices_Scalar (texels, pal, punch);
+
+  memcpy (block + 4, &idx, 4);
+}
+
+// Nearest of the eight interpolated alphas, 3 bits each
+static uint64_t
+AD_Mip_AlphaIndices_Scalar (const uint8_t* texels, const uint8_t pal [8])
+{
+  uint64_t idx = 0;
+
+  for (int i = 0; i < 16; i++) {
+    const int a = texels [i * 4 + 3];
+
+    uint32_t best      = 0;
+    int      best_dist = 256;
+
+    for (uint32_t p = 0; p < 8; p++) {
+      const int dist = a > pal [p] ? a - pal [p] : pal [p] - a;
+
+      if (dist < best_dist) {
+        best_dist = dist;
+        best      = p;
+      }
+    }
+
+    idx |= (uint64_t)best << (i * 3);
+  }
+
+  return idx;
+}
+
+#ifdef AD_MIP_HAVE_SSE2
+static uint64_t
+AD_Mip_AlphaIndices_SSE2 (const uint8_t* texels, const uint8_t pal [8])
+{
+  // Alpha of texels 0-7 and 8-15, as 16-bit lanes
+  __m128i a [2];
+
+  for (int h = 0; h < 2; h++) {
+    const __m128i t0 = _mm_srli_epi32 (_mm_loadu_si128 ((const __m128i *)(texels + h * 32)),      24);
+    const __m128i t1 = _mm_srli_epi32 (_mm_loadu_si128 ((const __m128i *)(texels + h * 32 + 16)), 24);
+
+    a [h] = _mm_packs_epi32 (t0, t1);
+  }
+
+  uint64_t idx = 0;
+
+  for (int h = 0; h < 2; h++) {
+    __m128i best      = _mm_setzero_si128 ();
+    __m128i best_dist = _mm_set1_epi16    (256);
+
+    for (int p = 0; p < 8; p++) {
+      const __m128i entry  = _mm_set1_epi16  (pal [p]);
+      const __m128i dist   = _mm_sub_epi16   (_mm_max_epi16 (a [h], entry), _mm_min_epi16 (a [h], entry));
+      const __m128i closer = _mm_cmplt_epi16 (dist, best_dist);
+
+      best_dist = _mm_or_si128 (_mm_and_si128 (closer, dist),                _mm_andnot_si128 (closer, best_dist));
+      best      = _mm_or_si128 (_mm_and_si128 (closer, _mm_set1_epi16 (p)), _mm_andnot_si128 (closer, best));
+    }
+
+    uint16_t lanes [8];
+    _mm_storeu_si128 ((__m128i *)lanes, best);
+
+    for (int j = 0; j < 8; j++)
+      idx |= (uint64_t)lanes [j] << ((h * 8 + j) * 3);
+  }
+
+  return idx;
+}
+#endif
+
+static void
+AD_Mip_EncodeAlpha (ad_mip_kernel_t kernel, const uint8_t* texels,
+                    const uint8_t* mn, const uint8_t* mx, uint32_t format, uint8_t* block)
+{
+  if (format == AD_MIP_DXT2 || format == AD_MIP_DXT3) {
+    memset (block, 0, 8);
+
+    for (int i = 0; i < 16; i++) {
+      const uint32_t a = (texels [i * 4 + 3] * 15 + 127) / 255;
+      block [i / 2] |= (uint8_t)(a << ((i & 1) * 4));
+    }
+
+    return;
+  }
+
+  block [0] = mx [3];
+  block [1] = mn [3];
+
+  memset (block + 2, 0, 6);
+
+  if (mx [3] == mn [3])
+    return;
+
+  uint8_t pal [8];
+  AD_Mip_AlphaPalette (mx [3], mn [3], pal);
+
+  uint64_t idx;
+
+#ifdef AD_MIP_HAVE_SSE2
+  if (kernel == AD_MIP_SSE2)
+    idx = AD_Mip_AlphaIndices_SSE2   (texels, pal);
+  else
+#else
+  (void)kernel;
+#endif
+    idx = AD_Mip_AlphaIndices_Scalar (texels, pal);
+
+  for (int i = 0; i < 6; i++)
+    block [2 + i] = (uint8_t)(idx >> (i * 8));
+}
+
+// w * h RGBA texels into one level
+static void
+AD_Mip_EncodeLevel ( ad_mip_kernel_t kernel, uint32_t format, const uint8_t* rgba,
+                     const ad_dump_image_s::level_s& lvl, uint8_t* dst )
+{
+  const bool   dxt1       = format == AD_MIP_DXT1;
+  const size_t block_size = dxt1 ? 8 : 16;
+
+  uint8_t texels [64];
+  uint8_t mn [4], mx [4];
+
+  for (uint32_t by = 0; by < lvl.rows; by++) {
+    for (uint32_t bx = 0; bx < lvl.pitch / block_size; bx++) {
+      for (uint32_t y = 0; y < 4; y++) {
+        const size_t row = AD_Mip_Clamp (by * 4 + y, lvl.height);
+
+        for (uint32_t x = 0; x < 4; x++) {
+          memcpy ( &texels [(y * 4 + x) * 4],
+                     &rgba [(row * lvl.width + AD_Mip_Clamp (bx * 4 + x, lvl.width)) * 4], 4 );
+        }
+      }
+
+#ifdef AD_MIP_HAVE_SSE2
+      if (kernel == AD_MIP_SSE2)
+        AD_Mip_Bounds_SSE2   (texels, mn, mx);
+      else
+#endif
+        AD_Mip_Bounds_Scalar (texels, mn, mx);
+
+      uint8_t* block = dst + by * lvl.pitch + bx * block_size;
+
+      if (dxt1)
+        AD_Mip_EncodeColor (kernel, texels, mn, mx, true,   block);
+
+      else {
+        AD_Mip_EncodeAlpha (kernel, texels, mn, mx, format, block);
+        AD_Mip_EncodeColor (kernel, texels, mn, mx, false,  block + 8);
+      }
+    }
+  }
+}
+
+bool
+AD_GenerateMips_Kernel (ad_mip_kernel_t kernel, ad_dump_image_s& img, uint32_t first)
+{
+#ifndef AD_MIP_HAVE_SSE2
+  if (kernel == AD_MIP_SSE2)
+    return false;
+#endif
+
+  if (first == 0 || first > img.levels || img.data.size () < img.bytes ())
+    return false;
+
+  const int bpp = AD_Mip_BytesPerTexel (img.format);
+
+  if (bpp != 0) {
+    for (uint32_t l = first; l < img.levels; l++) {
+      const ad_dump_image_s::level_s& src = img.level [l - 1];
+      const ad_dump_image_s::level_s& dst = img.level [l];
+
+      AD_Mip_Downsample ( kernel,
+                            &img.data [src.offset], src.pitch, src.width, src.height,
+                            &img.data [dst.offset], dst.pitch, dst.width, dst.height, bpp );
+    }
+
+    return true;
+  }
+
+  if (! AD_Mip_IsDXT (img.format))
+    return false;
+
+  if (first == img.levels)
+    return true;
+
+  // Every level is filtered from the decoded one above it, never from its
+  //   re-encoded form
+  std::vector <uint8_t> cur, next;
+
+  const ad_dump_image_s::level_s& top = img.level [first - 1];
+
+  AD_Mip_DecodeLevel (img.format, &img.data [top.offset], top, cur);
+
+  uint32_t w = top.width;
+  uint32_t h = top.height;
+
+  for (uint32_t l = first; l < img.levels; l++) {
+    const ad_dump_image_s::level_s& dst = img.level [l];
+
+    next.resize ((size_t)dst.width * dst.height * 4);
+
+    AD_Mip_Downsample ( kernel, cur.data  (), (size_t)w * 4, w, h,
+                                next.data (), (size_t)dst.width * 4, dst.width, dst.height, 4 );
+
+    AD_Mip_EncodeLevel (kernel, img.format, next.data (), dst, &img.data [dst.offset]);
+
+    cur.swap (next);
+
+    w = dst.width;
+    h = dst.height;
+  }
+
+  return true;
+}
+
+bool
+AD_GenerateMips (ad_dump_image_s& img, uint32_t first)
+{
+  return AD_GenerateMips_Kernel (AD_MIP_BEST, img, first);
+}
+
+//
+// Benchmark
+//
+int
+AD_Mip_Benchmark (ad_mip_bench_s* results, int max_results)
+{
+  static const uint32_t formats [] = { 21 /* A8R8G8B8 */, AD_MIP_DXT1, AD_MIP_DXT5 };
+  static const uint32_t sizes   [] = { 256, 1024, 2048 };
+
+  typedef std::chrono::steady_clock clock;
+
+  int count = 0;
+
+  for (size_t f = 0; f < sizeof (formats) / sizeof (formats [0]); f++) {
+    for (size_t s = 0; s < sizeof (sizes) / sizeof (sizes [0]) && count < max_results; s++) {
+      ad_dump_image_s img;
+
+      if (! img.init (sizes [s], sizes [s], 32, formats [f]))
+        continue;
+
+      img.data.resize (img.bytes ());
+
+      // Smooth gradients with some noise, so DXT blocks aren't all flat
+      uint64_t x = 0x9E3779B97F4A7C15ULL * (f * 4 + s + 1);
+
+      for (size_t i = 0; i < img.level [1].offset; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        img.data [i] = (uint8_t)((i >> 6) + (x & 0x1F));
+      }
+
+      const size_t generated = img.bytes () - img.level [1].offset;
+
+      // ~32 MiB of level 0 filtered per measurement
+      const int iterations = (int)(33554432 / img.level [1].offset) + 1;
+
+      auto time = [&] (ad_mip_kernel_t kernel, std::vector <uint8_t>& out) -> double {
+        if (! AD_GenerateMips_Kernel (kernel, img, 1))
+          return 0.0;
+
+        out.assign (img.data.begin () + img.level [1].offset, img.data.end ());
+
+        clock::time_point start = clock::now ();
+
+        for (int i = 0; i < iterations; i++)
+          AD_GenerateMips_Kernel (kernel, img, 1);
+
+        return std::chrono::duration <double, std::micro> (clock::now () - start).count () / iterations;
+      };
+
+      ad_mip_bench_s& r = results [count++];
+
+      std::vector <uint8_t> scalar, simd;
+
+      r.format    = img.format;
+      r.size      = sizes [s];
+      r.bytes     = generated;
+      r.scalar_us = time (AD_MIP_SCALAR, scalar);
+      r.simd_us   = time (AD_MIP_SSE2,   simd);
+      r.agree     = r.simd_us == 0.0 || simd == scalar;
+    }
+  }
+
+  return count;
+}
+
+//
+// Cache
+//
+const std::vector <uint8_t>*
+ad_mip_cache_s::find (const ad_fingerprint_s& key)
+{
+  auto it = index.find (key);
+
+  if (it == index.end ())
+    return nullptr;
+
+  lru.splice (lru.begin (), lru, it->second);
+
+  return &it->second->data;
+}
+
+void
+ad_mip_cache_s::insert (const ad_fingerprint_s& key, const uint8_t* data, size_t size)
+{
+  const size_t budget = (size_t)budget_mib * 1048576;
+
+  auto it = index.find (key);
+
+  if (it != index.end ()) {
+    used -= it->second->data.size ();
+    lru.erase   (it->second);
+    index.erase (it);
+  }
+
+  if (size > budget)
+    return;
+
+  while (used + size > budget && (! lru.empty ())) {
+    used -= lru.back ().data.size ();
+    index.erase (lru.back ().key);
+    lru.pop_back ();
+  }
+
+  lru.push_front (entry_s ());
+
+  lru.front ().key = key;
+  lru.front ().data.assign (data, data + size);
+
+  index [key] = lru.begin ();
+  used       += size;
+}
+
+void
+ad_mip_cache_s::clear (void)
+{
+  lru.clear   ();
+  index.clear ();
+  used = 0;
+}
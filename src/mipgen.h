@@ -0,0 +1,140 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__MIPGEN_H__
+#define __AD__MIPGEN_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fingerprint.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+struct ad_dump_image_s;
+
+//
+// Mip-chain completion (Render.CompleteMips)
+//
+//   Textures the game creates with fewer levels than their dimensions allow
+//     are minified from level 0 alone, which costs bandwidth and shimmers.
+//       The missing levels are generated on the CPU with a 2x2 box filter
+//         whenever the driver can't autogenerate them.
+//
+//  * Byte-per-channel formats (A8R8G8B8, X8R8G8B8, A8B8G8R8, X8B8G8R8,
+//      A8L8, L8, A8) are filtered directly; DXT1-5 are decoded once, filtered
+//        at full precision level after level, and re-encoded (bounding-box
+//          endpoints, nearest palette entry).  That is an order of magnitude
+//            slower, so render.cpp leaves DXTn to the driver.
+//
+//  * Filtering happens in stored (gamma) space, like D3DX's box filter.
+//
+//  * Nothing in here depends on Windows or Direct3D (formats are D3DFORMAT
+//      values), so the kernels can be timed on any platform.
+//
+enum ad_mip_kernel_t {
+  AD_MIP_SCALAR = 0,             // Portable
+  AD_MIP_SSE2   = 1              // Box filter (32-bit texels), DXT bounds and palette matching
+};
+
+bool AD_MipFormatSupported  (uint32_t format);
+
+// DXT1-5; far more expensive to complete than the byte-per-channel formats
+bool AD_MipFormatCompressed (uint32_t format);
+
+// Fills img's levels [first, img.levels) from level first - 1 (img.data
+//   must already be sized to img.bytes ()); false if the format isn't
+//     supported or first is 0
+bool AD_GenerateMips        (ad_dump_image_s& img, uint32_t first);
+
+// A specific kernel (for verification and timing); false if unsupported
+bool AD_GenerateMips_Kernel (ad_mip_kernel_t kernel, ad_dump_image_s& img, uint32_t first);
+
+//
+// Synthetic level 0 (A8R8G8B8, DXT1, DXT5 at 256 - 2048) completed through
+//   every kernel; results[] is filled in and the count returned.  A kernel
+//     that disagrees with the scalar one is reported.
+//
+struct ad_mip_bench_s {
+  uint32_t format;
+  uint32_t size;                 // Level 0 is size x size
+  size_t   bytes;                // Generated (levels 1 - n)
+  double   scalar_us;            // Per texture
+  double   simd_us;              // Per texture (0 if unsupported)
+  bool     agree;
+};
+
+int AD_Mip_Benchmark (ad_mip_bench_s* results, int max_results);
+
+//
+// Generated levels by the fingerprint of what the game uploaded, so that
+//   content uploaded again (streaming, device resets) isn't filtered twice.
+//
+//  * Keyed on all 128 bits; two uploads sharing only the low half must not
+//      share a chain.
+//
+//  * Least recently used entries go first once budget_mib is exceeded.
+//
+//  * Render thread only.
+//
+struct ad_mip_cache_s {
+  int budget_mib = 64;
+
+  // nullptr on a miss
+  const std::vector <uint8_t>* find   (const ad_fingerprint_s& key);
+  void                         insert (const ad_fingerprint_s& key, const uint8_t* data, size_t size);
+  void                         clear  (void);
+
+  size_t                       bytes  (void) const { return used; }
+
+protected:
+  struct entry_s {
+    ad_fingerprint_s       key;
+    std::vector <uint8_t>  data;
+  };
+
+  std::list <entry_s>                                 lru;    // Most recent first
+  std::unordered_map < ad_fingerprint_s, std::list <entry_s>::iterator,
+                       ad_fingerprint_hash_s >        index;
+  size_t                                              used = 0;
+};
+
+struct ad_mip_completion_s {
+  bool enable = false;           // Textures created from now on
+  bool cpu    = false;           // Never use the driver's AUTOGENMIPMAP
+
+  // Render.CompleteMips.<Stat>
+  struct {
+    int promoted  = 0;           // Created with a full chain instead
+    int autogen   = 0;           //   ... of which the driver generates
+    int generated = 0;           // Uploads completed on the CPU
+    int cached    = 0;           //   ... from ad_mip_cache_s
+    int failed    = 0;           // Uploaded without the rest of the chain
+  } stats;
+
+  ad_mip_cache_s cache;
+};
+
+extern ad_mip_completion_s mip_completion;
+
+#endif /* __AD__MIPGEN_H__ */
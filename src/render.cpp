@@ -25,6 +25,7 @@
 #include "log.h"
 
 #include <stdint.h>
+#include <math.h>
 
 #include <comdef.h>
 
@@ -81,47 +82,37 @@ bool AD_IsDrawingUI (void) {
   return ui.drawing;
 }
 
-#include <map>
-std::unordered_map <LPVOID, uint32_t> vs_checksums;
-std::unordered_map <LPVOID, uint32_t> ps_checksums;
-
-// Encapsulates a tracked Direct3D9 shader
-struct dd_shader_s {
-  const uint32_t crc32;         // Bytecode Signature
-  const wchar_t* description;   // _Brief_ Description
-
-  enum {
-    MAX_CONSTS = 256,           // Allow storage for up to 64x vec4
-    MAX_VEC4S  = MAX_CONSTS / 4
-  };
-
-  union {
-    // Flat array of constants
-    float   data [MAX_CONSTS];
-
-    // Individual vec4s for convenience
-    struct {
-      float data  [4];          // One component in an indexed vec4
-    }       vec4s [MAX_VEC4S];
-  } constants;
-};
-
-#define PS_CRC32_TEXT 0x0d6c2e96 // All text uses this pixel shader
-#define PS_CRC32_BG0  0x79b9d805 // One of a few pixel shaders used for translucent backgrounds
-
-dd_shader_s ps_text = { PS_CRC32_TEXT, L"text" };
-dd_shader_s ps_bg0  = { PS_CRC32_BG0,  L"bg0"  };
-
-#define VS_CRC32_MINIMAP0 0x9a78e585
-
-dd_shader_s vs_minimap0 = { VS_CRC32_MINIMAP0, L"minimap0" };
-
-// Map checksums to shaders
-std::unordered_map <uint32_t, dd_shader_s*> tracked_shader_map;
+#include "shader.h"
+#include "crc32.h"
+#include "display.h"
+#include "xform.h"
+#include "uimemo.h"
+#include "shadow.h"
+#include "rules.h"
+#include "shaderdb.h"
+#include "cullset.h"
+#include "blit.h"
+#include "scale.h"
+#include "texpolicy.h"
+#include "texdump.h"
+#include "texpack.h"
+#include "fingerprint.h"
+#include "resources.h"
+#include "mipgen.h"
+#include "limiter.h"
+#include "window.h"
+
+// Every shader the game has bound, keyed by its D3D9 object
+ad_shader_table_s vs_shaders;
+ad_shader_table_s ps_shaders;
 
 struct {
   dd_shader_s* ps = nullptr; // Non-NULL if the bound ps is being tracked
   dd_shader_s* vs = nullptr; // Non-NULL if the bound vs is being tracked
+
+  bool is (dd_shader_s* shader, ad_shader_role_t role) const {
+    return shader != nullptr && shader->role == role;
+  }
 } current_shader;
 
 
@@ -146,9 +137,11 @@ struct {
   bool fix_dof    = true;
   bool kill_dof   = false;
   bool dof_active = false;
+  bool fullscreen = false;
 
   void reset (void) {
     dof_active = false;
+    fullscreen = false;
   }
 } postproc;
 
@@ -158,109 +151,532 @@ struct {
   int  frame_count = 0;
 } tracer;
 
-void
-AD_ComputeAspectCoeffs (float& x, float& y, float& xoff, float& yoff, bool force = false)
+static void
+AD_LogXformBenchmark (const float* blocks, int count, float ar_scale, float x_scale)
 {
-  yoff = 0.0f;
-  xoff = 0.0f;
+  ad_xform_bench_s results [4];
 
-  x = 1.0f;
-  y = 1.0f;
+  const int kernels =
+    AD_Xform_Benchmark (blocks, count, ar_scale, x_scale, results, 4);
 
-  if (! (config.render.aspect_correction || force))
-    return;
+  dll_log.Log ( L" [XformBench] %lu recorded UI blocks"
+                L" (ar_scale=%f, x_scale=%f)",
+                  (unsigned long)count, ar_scale, x_scale );
 
-  config.render.aspect_ratio = (float)ad::RenderFix::width / (float)ad::RenderFix::height;
-  float rescale              = (16.0f / 9.0f) / config.render.aspect_ratio;
+  static const wchar_t* names [] = { L"Scalar", L"SSE", L"AVX" };
 
-  // Wider
-  if (config.render.aspect_ratio > (16.0 / 9.0f)) {
-    int width = (16.0f / 9.0f) * viewport.Height;
-    int x_off = (viewport.Width - width) / 2;
+  for (int i = 0; i < kernels; i++) {
+    const ad_xform_bench_s& r = results [i];
 
-    x    = (float)viewport.Width / (float)width;
-    xoff = x_off;
-  } else {
-    // Game doesn't need fixing in the other direction
-#if 0
-    int height = (9.0f / 16.0f) * viewport.Width;
-    int y_off  = (viewport.Height - height) / 2;
+    dll_log.Log ( L" [XformBench]  %-10s : %8.2f ns/block  "
+                  L"{ mismatches: %lu bitwise, %lu by value }%s",
+                    r.kernel < 0 ? L"4x4 Loop" : names [r.kernel],
+                      r.ns,
+                        (unsigned long)r.mismatch_bits,
+                          (unsigned long)r.mismatch_value,
+                            r.active ? L" <Active>" : L"" );
+  }
+}
 
-    y    = (float)viewport.Height / (float)height;
-    yoff = y_off;
-#endif
+// Records UI constant blocks for AD_Xform_Benchmark (Render.XformBench <N>)
+struct {
+  enum { MAX_BLOCKS = 1024 };
+
+  int    record = 0;
+  int    count  = 0;
+  float  blocks [MAX_BLOCKS * 16];
+
+  void add (const float* block, float x_scale) {
+    if (record > MAX_BLOCKS)
+      record = MAX_BLOCKS;
+
+    memcpy (&blocks [count++ * 16], block, sizeof (float) * 16);
+
+    if (count >= record) {
+      AD_LogXformBenchmark (blocks, count, display.ar_scale, x_scale);
+
+      record = 0;
+      count  = 0;
+    }
+  }
+} xform_bench;
+
+static void
+AD_LogBlitBenchmark (const ad_blit_call_s* calls, int count)
+{
+  const ad_blit_bench_s r = AD_Blit_Benchmark (calls, count);
+
+  if (r.mismatches != 0) {
+    const ad_blit_call_s& call = r.first_mismatch;
+
+    dll_log.Log ( L" [BlitBench] Mismatch: %lux%lu -> [%li,%li / %li,%li]",
+                    call.src_w, call.src_h,
+                      call.dest.left,  call.dest.top,
+                      call.dest.right, call.dest.bottom );
   }
+
+  dll_log.Log ( L" [BlitBench] %lu recorded blits (%lu corrected), %lu mismatches;"
+                L" %7.2f ns/blit (math), %7.2f ns/blit (cached, %d hits / %d misses)",
+                  (unsigned long)count, (unsigned long)r.corrected, (unsigned long)r.mismatches,
+                    r.math_ns, r.cached_ns, r.hits, r.misses );
 }
 
+// Records StretchRect calls for AD_Blit_Benchmark (Render.BlitBench <N>)
+struct {
+  enum { MAX_CALLS = 256 };
+
+  int            record = 0;
+  int            count  = 0;
+  ad_blit_call_s calls [MAX_CALLS];
+
+  void add (const ad_blit_call_s& call) {
+    if (record > MAX_CALLS)
+      record = MAX_CALLS;
+
+    calls [count++] = call;
+
+    if (count >= record) {
+      AD_LogBlitBenchmark (calls, count);
+
+      record = 0;
+      count  = 0;
+    }
+  }
+} blit_bench;
+
+// Times the draw path on a synthetic world frame (Render.DrawBench <N>)
+struct {
+  int record = 0;
+} draw_bench;
+
+// Times the fingerprint kernels (Render.FingerprintBench)
+struct {
+  bool run = false;
+} fingerprint_bench;
+
+// Times the mip generation kernels (Render.MipBench)
+struct {
+  bool run = false;
+} mip_bench;
+
+void AD_DrawBenchmark (int draws);
+void AD_LogFingerprintBenchmark (void);
+void AD_LogMipBenchmark (void);
+bool AD_HookSetTexture (IDirect3DDevice9* pDevice);
+void AD_HookResourceCreation (IDirect3DDevice9* pDevice);
+void AD_HookTextureUploads (IDirect3DDevice9* pDevice);
+void AD_BackgroundPresent (IDirect3DDevice9* pDevice);
+
 #include "hook.h"
 
 IDirect3DVertexShader9* g_pVS;
 IDirect3DPixelShader9*  g_pPS;
 
-static uint32_t crc32_tab[] = {
-  0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
-  0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-  0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
-  0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-  0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
-  0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-  0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
-  0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-  0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
-  0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-  0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
-  0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-  0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
-  0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-  0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
-  0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-  0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
-  0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-  0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
-  0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-  0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
-  0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-  0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
-  0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-  0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
-  0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-  0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
-  0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-  0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
-  0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-  0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
-  0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-  0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
-  0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-  0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
-  0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-  0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
-  0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-  0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
-  0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-  0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
-  0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-  0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+// Store the CURRENT shader's checksum instead of repeatedly
+//   looking it up in the above tables.
+uint32_t vs_checksum = 0;
+uint32_t ps_checksum = 0;
+
+//
+// Can any of the fixups in the draw / vertex constant detours apply while
+//   the bound (vs, ps) pair is in use?  Recomputed on every shader bind and
+//     once per frame (which picks up console changes).
+//
+struct {
+  bool     enable  = true;
+  uint32_t verdict = 0;          // 0 = World geometry, nothing to do
+  uint32_t cull    = 0;          // Cull sets the pair belongs to
+
+  enum {
+    PAIR_CULL    = 0x1,          // Render.CullVS / Render.CullPS, cull sets
+    PAIR_MINIMAP = 0x2,          // Minimap vertex shader (constant fix)
+    DISABLED     = 0x80000000    // Render.FastPath 0
+  };
+
+  void update (void) {
+    cull =
+      cull_sets.bind ( vs_checksum, ps_checksum,
+                         current_shader.ps != nullptr ? current_shader.ps->role :
+                                                        AD_SHADER_ROLE_NONE ) |
+      ( (vs_checksum == debug.cull_vs || ps_checksum == debug.cull_ps) ?
+          ad_cull_sets_s::CONSOLE : 0 );
+
+    verdict =
+      ( cull != 0 ? PAIR_CULL : 0 ) |
+      ( (config.render.fix_minimap && config.render.aspect_correction &&
+         current_shader.is (current_shader.vs, AD_SHADER_ROLE_MINIMAP)) ?
+          PAIR_MINIMAP : 0 ) |
+      ( enable ? 0 : DISABLED );
+  }
+} fastpath;
+
+//
+// Background mode (Render.Background), decided once per frame from
+//   window.active: while the window is inactive nothing is fixed up, and the
+//     draws of every Nth frame (Render.Background.DropEvery) are dropped.
+//       A dropped frame presents the last one drawn (Render.Background.Cache)
+//         or black; the game's simulation keeps ticking either way.
+//
+struct {
+  bool               skip_fixups = false;   // Window inactive
+  bool               dropping    = false;   // This frame's draws go nowhere
+
+  // Render.Background.Drawn / .Dropped, since the window last went inactive
+  int                drawn       = 0;
+  int                dropped     = 0;
+
+  uint32_t           frame       = 0;       // Inactive frames so far
+  IDirect3DSurface9* pCache      = nullptr; // Last drawn frame (D3DPOOL_DEFAULT)
+  bool               cached      = false;
+
+  // Must happen before every Reset
+  void release (void) {
+    if (pCache != nullptr)
+      pCache->Release ();
+
+    pCache = nullptr;
+    cached = false;
+  }
+
+  // For the frame that is about to begin
+  void begin_frame (bool active) {
+    if (active || (! config.render.background_mode)) {
+      if (skip_fixups)
+        release ();
+
+      skip_fixups = false;
+      dropping    = false;
+      frame       = 0;
+      return;
+    }
+
+    if (! skip_fixups) {
+      drawn   = 0;
+      dropped = 0;
+    }
+
+    skip_fixups = true;
+
+    const int every = config.render.background_drop;
+
+    // Nothing is dropped until there is an image to show in its place
+    dropping = every > 0 && (++frame % (uint32_t)every) == 0 &&
+                 (cached || (! config.render.background_cache));
+  }
+} background;
+
+// For the draw detours in shadow.cpp
+bool
+AD_DroppingFrame (void)
+{
+  return background.dropping;
+}
+
+//
+// Everything else a fixup could depend on is per-frame state that is only
+//   ever set once the UI (or the map) starts drawing, so until then this
+//     single branch sends draws straight to the driver.
+//
+static inline bool
+AD_FastPath (void)
+{
+  if (background.skip_fixups)
+    return true;
+
+  return ( fastpath.verdict  | ui.drawing         | minimap->drawing |
+           vp_shadow.pending | rs_shadow.released ) == 0;
+}
+
+//
+// Shaders may be created (and released) on a loading thread while the render
+//   thread is binding them; every change to the two tables goes through here.
+//     Lookups are lock-free (ad_shader_table_s::lookup).
+//
+CRITICAL_SECTION cs_shader_tables;
+
+//
+// Fingerprints pShader and stores (or overwrites) its record.
+//
+//  * If pbFunc is given, it must be the bytecode pShader was created from;
+//      otherwise the bytecode is fetched back from D3D9.
+//
+template <typename _T>
+bool
+AD_FingerprintShader ( ad_shader_table_s& table,
+                       _T*                pShader,
+                       bool               pixel,
+                       const void*        pbFunc,
+                       ad_shader_rec_s*   pRec = nullptr )
+{
+  UINT len = 0;
+  pShader->GetFunction (nullptr, &len);
+
+  uint32_t crc;
+
+  if (pbFunc != nullptr) {
+    crc = crc32 (0, pbFunc, len);
+  } else {
+    void* pbCopy = malloc (len);
+
+    if (pbCopy == nullptr)
+      return false;
+
+    pShader->GetFunction (pbCopy, &len);
+
+    crc = crc32 (0, pbCopy, len);
+
+    free (pbCopy);
+  }
+
+  EnterCriticalSection (&cs_shader_tables);
+  table.begin_write    ();
+
+  ad_shader_rec_s* rec = table.insert (pShader);
+
+  if (rec != nullptr) {
+    rec->crc32   = crc;
+    rec->tracked = shader_db.find (crc, pixel);
+    rec->flags   = pixel ? ad_shader_rec_s::FLAG_PIXEL :
+                           ad_shader_rec_s::FLAG_VERTEX;
+
+    if (pRec != nullptr)
+      *pRec = *rec;
+  }
+
+  table.end_write      ();
+  LeaveCriticalSection (&cs_shader_tables);
+
+  return rec != nullptr;
+}
+
+void AD_HookRelease (IUnknown* pObj);
+
+//
+// Copies the record for pShader into rec; false if pShader is NULL (or its
+//   bytecode is unavailable).
+//
+//  * Shaders are normally fingerprinted when they are created, this only has
+//      to hash anything for shaders that existed before our hooks did.
+//
+template <typename _T>
+bool
+AD_GetShaderRecord ( ad_shader_table_s& table,
+                     _T*                pShader,
+                     bool               pixel,
+                     ad_shader_rec_s&   rec )
+{
+  if (pShader == nullptr)
+    return false;
+
+  if (table.lookup (pShader, rec))
+    return true;
+
+  // A miss, or a loading thread kept writing; find out under the lock
+  EnterCriticalSection (&cs_shader_tables);
+
+  ad_shader_rec_s* pRec = table.find (pShader);
+
+  if (pRec != nullptr)
+    rec = *pRec;
+
+  LeaveCriticalSection (&cs_shader_tables);
+
+  if (pRec != nullptr)
+    return true;
+
+  if (! AD_FingerprintShader (table, pShader, pixel, nullptr, &rec))
+    return false;
+
+  AD_HookRelease (pShader);
+
+  return true;
+}
+
+
+//
+// Once the application's last reference is gone the pointer is free to be
+//   handed out again for a completely different shader, so drop the record.
+//
+//  * Both tables are purged because the runtime may share one Release
+//      implementation between vertex and pixel shaders (see below); so may
+//        textures and surfaces, which is why a table that doesn't hold the
+//          pointer isn't written to (lock-free readers would retry).
+//
+void
+AD_EvictShader (IUnknown* pShader)
+{
+  EnterCriticalSection (&cs_shader_tables);
+
+  if (vs_shaders.find (pShader) != nullptr) {
+    vs_shaders.begin_write ();
+    vs_shaders.erase       (pShader);
+    vs_shaders.end_write   ();
+  }
+
+  if (ps_shaders.find (pShader) != nullptr) {
+    ps_shaders.begin_write ();
+    ps_shaders.erase       (pShader);
+    ps_shaders.end_write   ();
+  }
+
+  LeaveCriticalSection (&cs_shader_tables);
+
+  // A new shader at the same address must not pass for the bound one
+  if ((void *)g_pVS == (void *)pShader) g_pVS = nullptr;
+  if ((void *)g_pPS == (void *)pShader) g_pPS = nullptr;
+}
+
+//
+// IUnknown::Release of the shaders, textures and surfaces we have seen, by
+//   address.  The runtime may share one implementation between interfaces,
+//     so each one is hooked once, by a detour that does what every interface
+//       needs: the object's last reference is gone and its pointer is free to
+//         be handed out again, whatever it was.
+//
+typedef ULONG (STDMETHODCALLTYPE *Release_t)(IUnknown* This);
+
+static const size_t AD_MAX_RELEASE_HOOKS = 8;
+
+static struct {
+  void* volatile target;
+  Release_t      original;
+} release_hooks [AD_MAX_RELEASE_HOOKS] = { };
+
+//
+// One detour per slot, so each calls its own trampoline whatever the object
+//   (an object need not be released through its own vtable [2]).
+//
+template <size_t _Slot>
+COM_DECLSPEC_NOTHROW
+ULONG
+STDMETHODCALLTYPE
+D3D9Release_Detour (IUnknown* This)
+{
+  ULONG refs = release_hooks [_Slot].original (This);
+
+  if (refs == 0) {
+    AD_EvictShader    (This);
+    resources.release (This);
+  }
+
+  return refs;
+}
+
+static const Release_t release_detours [AD_MAX_RELEASE_HOOKS] = {
+  D3D9Release_Detour <0>, D3D9Release_Detour <1>,
+  D3D9Release_Detour <2>, D3D9Release_Detour <3>,
+  D3D9Release_Detour <4>, D3D9Release_Detour <5>,
+  D3D9Release_Detour <6>, D3D9Release_Detour <7>
 };
 
-uint32_t
-crc32(uint32_t crc, const void *buf, size_t size)
+//
+// The first object of each kind we see supplies the vtable; only the first
+//   caller to claim a target's slot hooks it.
+//
+void
+AD_HookRelease (IUnknown* pObj)
 {
-  const uint8_t *p;
+  void** vftable = *(void***)pObj;
+
+  for (size_t i = 0; i < AD_MAX_RELEASE_HOOKS; i++) {
+    void* prev =
+      InterlockedCompareExchangePointer (&release_hooks [i].target, vftable [2], nullptr);
+
+    if (prev == vftable [2])
+      return;
 
-  p = (uint8_t *)buf;
-  crc = crc ^ ~0U;
+    if (prev != nullptr)
+      continue;
+
+    // The trampoline is in place before the detour can run
+    MH_STATUS status =
+      AD_CreateFuncHook ( L"IUnknown::Release",
+                          vftable [2],
+                          release_detours [i],
+                (LPVOID*)&release_hooks [i].original );
+
+    // Give the slot back, so the next object with this Release tries again
+    if (status != MH_OK)
+      InterlockedExchangePointer (&release_hooks [i].target, nullptr);
+    else
+      status = AD_EnableHook (vftable [2]);
+
+    static volatile LONG failed = 0;
+
+    if (status != MH_OK && InterlockedExchange (&failed, 1) == 0) {
+      dll_log.Log ( L" [Resources] Could not hook IUnknown::Release at %p (%d); "
+                    L"objects released through it are not evicted or accounted",
+                      vftable [2], (int)status );
+    }
+
+    return;
+  }
 
-  while (size--)
-    crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  // Objects released through this target are never evicted or accounted
+  static volatile LONG warned = 0;
 
-  return crc ^ ~0U;
+  if (InterlockedExchange (&warned, 1) == 0) {
+    dll_log.Log ( L" [Resources] Every IUnknown::Release hook slot (%lu) is taken; "
+                  L"not hooking %p", (unsigned long)AD_MAX_RELEASE_HOOKS, vftable [2] );
+  }
 }
 
-// Store the CURRENT shader's checksum instead of repeatedly
-//   looking it up in the above hashmaps.
-uint32_t vs_checksum = 0;
-uint32_t ps_checksum = 0;
+
+typedef HRESULT (STDMETHODCALLTYPE *CreateVertexShader_t)
+  (IDirect3DDevice9*        This,
+   CONST DWORD*             pFunction,
+   IDirect3DVertexShader9** ppShader);
+
+CreateVertexShader_t D3D9CreateVertexShader_Original = nullptr;
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9CreateVertexShader_Detour (IDirect3DDevice9*        This,
+                               CONST DWORD*             pFunction,
+                               IDirect3DVertexShader9** ppShader)
+{
+  HRESULT hr = D3D9CreateVertexShader_Original (This, pFunction, ppShader);
+
+  // Ignore anything that's not the primary render device.
+  if (This != ad::RenderFix::pDevice)
+    return hr;
+
+  if (SUCCEEDED (hr) && ppShader != nullptr && *ppShader != nullptr) {
+    AD_FingerprintShader (vs_shaders, *ppShader, false, pFunction);
+    AD_HookRelease       (*ppShader);
+  }
+
+  return hr;
+}
+
+typedef HRESULT (STDMETHODCALLTYPE *CreatePixelShader_t)
+  (IDirect3DDevice9*       This,
+   CONST DWORD*            pFunction,
+   IDirect3DPixelShader9** ppShader);
+
+CreatePixelShader_t D3D9CreatePixelShader_Original = nullptr;
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9CreatePixelShader_Detour (IDirect3DDevice9*       This,
+                              CONST DWORD*            pFunction,
+                              IDirect3DPixelShader9** ppShader)
+{
+  HRESULT hr = D3D9CreatePixelShader_Original (This, pFunction, ppShader);
+
+  // Ignore anything that's not the primary render device.
+  if (This != ad::RenderFix::pDevice)
+    return hr;
+
+  if (SUCCEEDED (hr) && ppShader != nullptr && *ppShader != nullptr) {
+    AD_FingerprintShader (ps_shaders, *ppShader, true, pFunction);
+    AD_HookRelease       (*ppShader);
+  }
+
+  return hr;
+}
 
 typedef HRESULT (STDMETHODCALLTYPE *SetVertexShader_t)
   (IDirect3DDevice9*       This,
@@ -277,50 +693,30 @@ D3D9SetVertexShader_Detour (IDirect3DDevice9*       This,
   if (This != ad::RenderFix::pDevice)
     return D3D9SetVertexShader_Original (This, pShader);
 
-  if (g_pVS != pShader) {
-    if (pShader != nullptr) {
-      if (vs_checksums.find (pShader) == vs_checksums.end ()) {
-        UINT len;
-        pShader->GetFunction (nullptr, &len);
-
-        void* pbFunc = malloc (len);
-
-        if (pbFunc != nullptr) {
-          pShader->GetFunction (pbFunc, &len);
-
-          vs_checksums [pShader] = crc32 (0, pbFunc, len);
+  // Rebinding what is already bound changes nothing we track
+  if (pShader == g_pVS && pShader != nullptr)
+    return D3D9SetVertexShader_Original (This, pShader);
 
-          free (pbFunc);
+  ad_shader_rec_s rec;
 
-          if (vs_checksums [pShader] == vs_minimap0.crc32)
-            tracked_shader_map [vs_checksums [pShader]] = &vs_minimap0;
+  bool     known =
+    AD_GetShaderRecord (vs_shaders, pShader, false, rec);
 
-          else
-            tracked_shader_map [vs_checksums [pShader]] = nullptr;
-        }
-      }
-    }
-    else {
-      vs_checksum = 0;
-    }
-  }
+  uint32_t crc   = known ? rec.crc32 : 0;
 
-  if (vs_checksum != vs_checksums [pShader])
+  // Vertex Shader Changed
+  if (vs_checksum != crc) {
     ui.center = false;
 
-  // Vertex Shader Changed
-  if (vs_checksum != vs_checksums [pShader]) {
-    minimap->notifyShaderChange (vs_checksums [pShader], ps_checksum, false);
+    minimap->notifyShaderChange (crc, ps_checksum, false);
   }
 
-  vs_checksum = vs_checksums [pShader];
-
+  vs_checksum = crc;
 
   // Cache the tracked shader
-  if (tracked_shader_map.find (vs_checksum) != tracked_shader_map.end ())
-    current_shader.vs = tracked_shader_map [vs_checksum];
-  else
-    current_shader.vs = nullptr;
+  current_shader.vs = known ? rec.tracked : nullptr;
+
+  fastpath.update ();
 
 
   g_pVS = pShader;
@@ -343,53 +739,38 @@ D3D9SetPixelShader_Detour (IDirect3DDevice9*      This,
   if (This != ad::RenderFix::pDevice)
     return D3D9SetPixelShader_Original (This, pShader);
 
-  if (g_pPS != pShader) {
-    if (pShader != nullptr) {
-      if (ps_checksums.find (pShader) == ps_checksums.end ()) {
-        UINT len;
-        pShader->GetFunction (nullptr, &len);
-
-        void* pbFunc = malloc (len);
-
-        if (pbFunc != nullptr) {
-          pShader->GetFunction (pbFunc, &len);
+  // Rebinding what is already bound changes nothing we track (except that
+  //   post-processing is detected per bind)
+  if (pShader == g_pPS && pShader != nullptr) {
+    postproc.dof_active = false;
+    postproc.fullscreen = false;
 
-          ps_checksums [pShader] = crc32 (0, pbFunc, len);
-
-          free (pbFunc);
+    return D3D9SetPixelShader_Original (This, pShader);
+  }
 
-          if (ps_checksums [pShader] == ps_bg0.crc32)
-            tracked_shader_map [ps_checksums [pShader]] = &ps_bg0;
+  ad_shader_rec_s rec;
 
-          else if (ps_checksums [pShader] == ps_text.crc32)
-            tracked_shader_map [ps_checksums [pShader]] = &ps_text;
+  bool     known =
+    AD_GetShaderRecord (ps_shaders, pShader, true, rec);
 
-          else
-            tracked_shader_map [ps_checksums [pShader]] = nullptr;
-        }
-      }
-    } else {
-      ps_checksum = 0;
-    }
-  }
+  uint32_t crc   = known ? rec.crc32 : 0;
 
   //game->menu == menu_map;
 
   // Pixel Shader Changed
-  if (ps_checksum != ps_checksums [pShader]) {
-    minimap->notifyShaderChange (vs_checksum, ps_checksums [pShader], true);
+  if (ps_checksum != crc) {
+    minimap->notifyShaderChange (vs_checksum, crc, true);
   }
 
   postproc.dof_active = false;
+  postproc.fullscreen = false;
 
-  ps_checksum = ps_checksums [pShader];
-
+  ps_checksum = crc;
 
   // Cache the tracked shader
-  if (tracked_shader_map.find (ps_checksum) != tracked_shader_map.end ())
-    current_shader.ps = tracked_shader_map [ps_checksum];
-  else
-    current_shader.ps = nullptr;
+  current_shader.ps = known ? rec.tracked : nullptr;
+
+  fastpath.update ();
 
 
   g_pPS = pShader;
@@ -435,11 +816,36 @@ D3D9EndScene_Detour (IDirect3DDevice9* This)
   return hr;
 }
 
+//
+// Window.ForegroundFPS / Window.BackgroundFPS; before Present (the default)
+//   paces Present itself, after it (Render.FrameLimiter.PostPresent) the game
+//     starts its next frame on the deadline, with fresher input.
+//
+static void
+AD_LimitFramerate (bool post_present)
+{
+  if (config.render.limiter_post != post_present)
+    return;
+
+  frame_limiter.spin_ns = (int64_t)(config.render.limiter_spin_ms * 1000000.0f);
+  frame_limiter.wait ();
+}
+
 COM_DECLSPEC_NOTHROW
 void
 STDMETHODCALLTYPE
 D3D9EndFrame_Pre (void)
 {
+  // Overlays draw after this; they must see the game's own state
+  if (ad::RenderFix::pDevice != nullptr) {
+    vp_shadow.flush (ad::RenderFix::pDevice);
+    rs_shadow.flush (ad::RenderFix::pDevice);
+
+    AD_BackgroundPresent (ad::RenderFix::pDevice);
+
+    AD_LimitFramerate (false);
+  }
+
   return BMF_BeginBufferSwap ();
 }
 
@@ -452,6 +858,8 @@ D3D9EndFrame_Post (HRESULT hr, IUnknown* device)
   if (device != ad::RenderFix::pDevice)
     return BMF_EndBufferSwap (hr, device);
 
+  AD_LimitFramerate (true);
+
   debug.reset     ();
   ui.reset        ();
 
@@ -460,12 +868,69 @@ D3D9EndFrame_Post (HRESULT hr, IUnknown* device)
 
   postproc.reset  ();
 
-  g_pPS           = nullptr;
-  g_pVS           = nullptr;
-  vs_checksum     = 0;
-  ps_checksum     = 0;
+  ui_memo.publish ();
 
-  ad::RenderFix::dwRenderThreadID = GetCurrentThreadId ();
+  AD_InstallStateShadow   (ad::RenderFix::pDevice,
+  AD_HookSetTexture       (ad::RenderFix::pDevice));
+  AD_HookResourceCreation (ad::RenderFix::pDevice);
+  AD_HookTextureUploads   (ad::RenderFix::pDevice);
+
+  background.begin_frame (window.active);
+
+  vp_shadow.end_frame   ();
+  rs_shadow.end_frame   ();
+  call_filter.end_frame ();
+  cull_sets.end_frame   ();
+
+  // Render.TexturePolicyReport
+  if (texture_policy.log_report) {
+    texture_policy.report ();
+    texture_policy.log_report = false;
+  }
+
+  resources.publish ();
+
+  // Render.Resources.Top <N>
+  if (resources.top > 0) {
+    resources.dump (resources.top);
+    resources.top = 0;
+  }
+
+  g_pPS           = nullptr;
+  g_pVS           = nullptr;
+  vs_checksum     = 0;
+  ps_checksum     = 0;
+
+  fastpath.update ();
+
+  if (draw_bench.record > 0) {
+    AD_DrawBenchmark (draw_bench.record);
+    draw_bench.record = 0;
+  }
+
+  if (fingerprint_bench.run) {
+    AD_LogFingerprintBenchmark ();
+    fingerprint_bench.run = false;
+  }
+
+  if (mip_bench.run) {
+    AD_LogMipBenchmark ();
+    mip_bench.run = false;
+  }
+
+  // Render.Fingerprint.Audit
+  static int collisions_logged = 0;
+
+  if (fingerprint_audit.stats.collisions > collisions_logged) {
+    collisions_logged = fingerprint_audit.stats.collisions;
+
+    dll_log.Log ( L" [Fingerprint] Sampled fingerprint %016llX matched different "
+                  L"textures (%d collisions in %d audited)",
+                    fingerprint_audit.last_collision, collisions_logged,
+                      fingerprint_audit.stats.audited );
+  }
+
+  ad::RenderFix::dwRenderThreadID = GetCurrentThreadId ();
 
   if (tracer.log_frame && tracer.frame_count > 0) {
     dll_log.Log (L" --- SwapChain Present ---");
@@ -493,16 +958,6 @@ typedef enum D3DXIMAGE_FILEFORMAT {
   D3DXIFF_FORCE_DWORD  = 0x7fffffff
 } D3DXIMAGE_FILEFORMAT, *LPD3DXIMAGE_FILEFORMAT;
 
-typedef HRESULT (STDMETHODCALLTYPE *D3DXSaveTextureToFile_t)(
-  _In_       LPCWSTR                pDestFile,
-  _In_       D3DXIMAGE_FILEFORMAT   DestFormat,
-  _In_       LPDIRECT3DBASETEXTURE9 pSrcTexture,
-  _In_ const PALETTEENTRY           *pSrcPalette
-  );
-
-D3DXSaveTextureToFile_t
-  D3DXSaveTextureToFile = nullptr;
-
 typedef HRESULT (STDMETHODCALLTYPE *SetTexture_t)
   (     IDirect3DDevice9      *This,
    _In_ DWORD                  Sampler,
@@ -518,9 +973,165 @@ D3D9SetTexture_Detour ( IDirect3DDevice9      *This,
                   _In_  DWORD                  Sampler,
                   _In_  IDirect3DBaseTexture9 *pTexture )
 {
-  return D3D9SetTexture_Original (This, Sampler, pTexture);
+  // Ignore anything that's not the primary render device.
+  if (This != ad::RenderFix::pDevice)
+    return D3D9SetTexture_Original (This, Sampler, pTexture);
+
+  if (call_filter.active () && tex_shadow.is_bound (Sampler, pTexture)) {
+    ++call_filter.dropped.textures;
+    return D3D_OK;
+  }
+
+  HRESULT hr = D3D9SetTexture_Original (This, Sampler, pTexture);
+
+  if (SUCCEEDED (hr))
+    tex_shadow.track  (Sampler, pTexture);
+  else
+    tex_shadow.forget (Sampler);
+
+  return hr;
+}
+
+// True once SetTexture is hooked
+bool
+AD_HookSetTexture (IDirect3DDevice9* pDevice)
+{
+  static bool attempted = false;
+  static bool hooked    = false;
+
+  if (attempted || pDevice == nullptr)
+    return hooked;
+
+  attempted = true;
+
+  void** vftable = *(void***)pDevice;
+
+  hooked =
+    AD_CreateFuncHook ( L"IDirect3DDevice9::SetTexture",
+                        vftable [65],
+                        D3D9SetTexture_Detour,
+              (LPVOID*)&D3D9SetTexture_Original ) == MH_OK &&
+    AD_EnableHook     (vftable [65])            == MH_OK;
+
+  return hooked;
+}
+
+//
+// Render.DumpTextures: the render thread only copies the (system memory)
+//   upload source into a staged image; texdump.cpp does everything else.
+//
+static ad_dump_image_s*
+AD_BeginDump (UINT width, UINT height, UINT levels, D3DFORMAT format)
+{
+  static bool created = false;
+
+  if (! created) {
+    CreateDirectoryW (L"textures", nullptr);
+    created = true;
+  }
+
+  return texture_dump.begin (width, height, levels, (uint32_t)format);
+}
+
+static bool
+AD_StageDumpLevel (ad_dump_image_s* img, UINT level, IDirect3DSurface9* pSurface)
+{
+  D3DLOCKED_RECT locked;
+
+  if (FAILED (pSurface->LockRect (&locked, nullptr, D3DLOCK_READONLY)))
+    return false;
+
+  const ad_dump_image_s::level_s& lvl = img->level [level];
+
+  const uint8_t* src = (const uint8_t *)locked.pBits;
+        uint8_t* dst = &img->data [lvl.offset];
+
+  for (uint32_t row = 0; row < lvl.rows; row++)
+    memcpy (dst + row * lvl.pitch, src + row * locked.Pitch, lvl.pitch);
+
+  pSurface->UnlockRect ();
+
+  return true;
+}
+
+// Copies every level of img (already laid out) from a lockable texture
+static bool
+AD_StageDumpTexture (ad_dump_image_s* img, IDirect3DTexture9* pTex)
+{
+  for (UINT i = 0; i < img->levels; i++) {
+    IDirect3DSurface9* pSurf = nullptr;
+
+    bool copied = SUCCEEDED (pTex->GetSurfaceLevel (i, &pSurf)) &&
+                    AD_StageDumpLevel (img, i, pSurf);
+
+    if (pSurf != nullptr)
+      pSurf->Release ();
+
+    if (! copied)
+      return false;
+  }
+
+  return true;
+}
+
+void
+AD_DumpSurface (IDirect3DSurface9* pSurface)
+{
+  D3DSURFACE_DESC desc;
+
+  if (pSurface == nullptr || FAILED (pSurface->GetDesc (&desc)))
+    return;
+
+  ad_dump_image_s* img = AD_BeginDump (desc.Width, desc.Height, 1, desc.Format);
+
+  if (img == nullptr)
+    return;
+
+  if (AD_StageDumpLevel (img, 0, pSurface))
+    texture_dump.commit (img);
+  else
+    texture_dump.cancel (img);
 }
 
+void
+AD_DumpTexture (IDirect3DBaseTexture9* pTexture)
+{
+  // Cube and volume textures are not dumped
+  if (pTexture == nullptr || pTexture->GetType () != D3DRTYPE_TEXTURE)
+    return;
+
+  IDirect3DTexture9* pTex = (IDirect3DTexture9 *)pTexture;
+
+  D3DSURFACE_DESC desc;
+
+  if (FAILED (pTex->GetLevelDesc (0, &desc)))
+    return;
+
+  ad_dump_image_s* img =
+    AD_BeginDump (desc.Width, desc.Height, pTex->GetLevelCount (), desc.Format);
+
+  if (img == nullptr)
+    return;
+
+  if (AD_StageDumpTexture (img, pTex))
+    texture_dump.commit (img);
+  else
+    texture_dump.cancel (img);
+}
+
+typedef HRESULT (STDMETHODCALLTYPE *CreateTexture_t)
+  (IDirect3DDevice9   *This,
+   UINT                Width,
+   UINT                Height,
+   UINT                Levels,
+   DWORD               Usage,
+   D3DFORMAT           Format,
+   D3DPOOL             Pool,
+   IDirect3DTexture9 **ppTexture,
+   HANDLE             *pSharedHandle);
+
+extern CreateTexture_t D3D9CreateTexture_Original;
+
 typedef HRESULT (STDMETHODCALLTYPE *UpdateSurface_t)
   ( _In_       IDirect3DDevice9  *This,
     _In_       IDirect3DSurface9 *pSourceSurface,
@@ -530,6 +1141,669 @@ typedef HRESULT (STDMETHODCALLTYPE *UpdateSurface_t)
 
 UpdateSurface_t D3D9UpdateSurface_Original = nullptr;
 
+typedef HRESULT (STDMETHODCALLTYPE *UpdateTexture_t)
+  (IDirect3DDevice9      *This,
+   IDirect3DBaseTexture9 *pSourceTexture,
+   IDirect3DBaseTexture9 *pDestinationTexture);
+
+UpdateTexture_t D3D9UpdateTexture_Original = nullptr;
+
+//
+// System-memory textures for the uploads we make ourselves (replacements,
+//   completed mip chains), one per (width, height, levels, format) and
+//     reused: creating and releasing one per upload is itself a
+//       render-thread hitch on load-heavy scenes.
+//
+//  * Least recently used shapes are released past max_textures; acquire (...)
+//      hands out a reference of its own, so an evicted texture lives until
+//        the caller is done with it.
+//
+//  * Render thread only.
+//
+struct ad_staging_cache_s {
+  size_t max_textures = 8;
+
+  // AddRef'd, whole levels must be locked to mark them dirty; nullptr if
+  //   the device can't create one
+  IDirect3DTexture9* acquire ( IDirect3DDevice9* pDevice,
+                               UINT              width,
+                               UINT              height,
+                               UINT              levels,
+                               D3DFORMAT         format );
+
+  void               clear   (void);
+
+protected:
+  struct entry_s {
+    UINT               width, height, levels;
+    D3DFORMAT          format;
+    IDirect3DTexture9* pTex;
+  };
+
+  std::list <entry_s> lru;                 // Most recent first
+  IDirect3DDevice9*   device = nullptr;    // What lru's textures belong to
+};
+
+static ad_staging_cache_s staging;
+
+IDirect3DTexture9*
+ad_staging_cache_s::acquire ( IDirect3DDevice9* pDevice,
+                              UINT              width,
+                              UINT              height,
+                              UINT              levels,
+                              D3DFORMAT         format )
+{
+  if (pDevice != device) {
+    clear ();
+    device = pDevice;
+  }
+
+  for (auto it = lru.begin (); it != lru.end (); ++it) {
+    if ( it->width  == width  && it->height == height &&
+         it->levels == levels && it->format == format ) {
+      lru.splice (lru.begin (), lru, it);
+
+      it->pTex->AddRef ();
+      return it->pTex;
+    }
+  }
+
+  IDirect3DTexture9* pTex = nullptr;
+
+  if (FAILED (D3D9CreateTexture_Original ( pDevice, width, height, levels, 0x00,
+                                             format, D3DPOOL_SYSTEMMEM, &pTex, nullptr )))
+    return nullptr;
+
+  lru.push_front ({ width, height, levels, format, pTex });
+
+  while (lru.size () > max_textures) {
+    lru.back ().pTex->Release ();
+    lru.pop_back ();
+  }
+
+  pTex->AddRef ();
+  return pTex;
+}
+
+void
+ad_staging_cache_s::clear (void)
+{
+  for (entry_s& entry : lru)
+    entry.pTex->Release ();
+
+  lru.clear ();
+}
+
+//
+// Render.ReplaceTextures: the upload source is fingerprinted the way a dump
+//   names it (in place, through a read-only lock), and a replacement from
+//     AgDrag.texpack of the same size and format is staged in a texture of
+//       our own (ad_staging_cache_s).  The game's upload goes ahead as it
+//         asked, then the replacement is uploaded over it.
+//
+//  * The game's memory is never written: it may upload the same source again
+//      (which must fingerprint the same) or read it back, and dumps must see
+//        the original.
+//
+//  * Render thread only; the layout keeps its allocation between uploads.
+//
+static ad_dump_image_s upload_layout;
+
+static const UINT AD_MAX_UPLOAD_LEVELS = 16;
+
+// levels [] is filled in from upload_layout while every surface is locked
+static bool
+AD_FingerprintSurfaces (IDirect3DSurface9** surfs, bool sampled, ad_fingerprint_s& fp)
+{
+  ad_fingerprint_level_s levels [AD_MAX_UPLOAD_LEVELS];
+
+  UINT locked = 0;
+
+  for (; locked < upload_layout.levels; locked++) {
+    D3DLOCKED_RECT lr;
+
+    if (FAILED (surfs [locked]->LockRect (&lr, nullptr, D3DLOCK_READONLY)))
+      break;
+
+    const ad_dump_image_s::level_s& lvl = upload_layout.level [locked];
+
+    levels [locked].bits      = (const uint8_t *)lr.pBits;
+    levels [locked].pitch     = lr.Pitch;
+    levels [locked].row_bytes = lvl.pitch;
+    levels [locked].rows      = lvl.rows;
+    levels [locked].width     = lvl.width;
+    levels [locked].height    = lvl.height;
+  }
+
+  const bool complete = locked == upload_layout.levels;
+
+  if (complete)
+    fp = AD_Fingerprint (upload_layout.format, levels, upload_layout.levels, sampled);
+
+  while (locked-- > 0)
+    surfs [locked]->UnlockRect ();
+
+  return complete;
+}
+
+static bool
+AD_ReplaceLevel ( const ad_dump_image_s& repl, const uint8_t* texels,
+                  UINT level, IDirect3DSurface9* pSurface )
+{
+  D3DLOCKED_RECT locked;
+
+  // Locking the whole level also marks all of it dirty for UpdateTexture
+  if (FAILED (pSurface->LockRect (&locked, nullptr, 0x00)))
+    return false;
+
+  const ad_dump_image_s::level_s& lvl = repl.level [level];
+
+  const uint8_t* src = texels + lvl.offset;
+        uint8_t* dst = (uint8_t *)locked.pBits;
+
+  for (uint32_t row = 0; row < lvl.rows; row++)
+    memcpy (dst + row * locked.Pitch, src + row * lvl.pitch, lvl.pitch);
+
+  pSurface->UnlockRect ();
+
+  return true;
+}
+
+// False if there is no usable replacement for fp
+static bool
+AD_FindReplacement (const ad_fingerprint_s& fp, ad_dump_image_s& repl, const uint8_t** ppTexels)
+{
+  const uint8_t* pData;
+  size_t         size;
+
+  if (! texture_pack.find (fp.lo, &pData, &size)) {
+    ++texture_pack.stats.misses;
+    return false;
+  }
+
+  if ( (! AD_DecodeDDS (pData, size, repl, ppTexels)) ||
+       repl.width  != upload_layout.width             ||
+       repl.height != upload_layout.height            ||
+       repl.format != upload_layout.format            ||
+       repl.levels <  upload_layout.levels ) {
+    ++texture_pack.stats.mismatched;
+    return false;
+  }
+
+  ++texture_pack.stats.hits;
+
+  return true;
+}
+
+// surfs [] holds levels surfaces of a lockable upload source; returns the
+//   replacement staged in a texture of the same shape (AddRef'd), or nullptr
+static IDirect3DTexture9*
+AD_StageReplacement ( IDirect3DDevice9*      This,
+                      IDirect3DSurface9**    surfs,
+                      const D3DSURFACE_DESC& desc,
+                      UINT                   levels )
+{
+  if ( levels > AD_MAX_UPLOAD_LEVELS ||
+       (! upload_layout.init (desc.Width, desc.Height, levels, desc.Format)) )
+    return nullptr;
+
+  const bool sampled = texture_pack.sampled ();
+
+  ad_fingerprint_s fp;
+
+  if (! AD_FingerprintSurfaces (surfs, sampled, fp))
+    return nullptr;
+
+  // Render.Fingerprint.Audit: hand a copy to the background full hash
+  if (sampled && fingerprint_audit.enable) {
+    ad_dump_image_s* img =
+      fingerprint_audit.begin (desc.Width, desc.Height, upload_layout.levels, desc.Format);
+
+    if (img != nullptr) {
+      bool copied = true;
+
+      for (UINT i = 0; i < img->levels && copied; i++)
+        copied = AD_StageDumpLevel (img, i, surfs [i]);
+
+      if (copied)
+        fingerprint_audit.commit (fp, img);
+      else
+        fingerprint_audit.cancel (img);
+    }
+  }
+
+  ad_dump_image_s repl;
+  const uint8_t*  texels;
+
+  if (! AD_FindReplacement (fp, repl, &texels))
+    return nullptr;
+
+  IDirect3DTexture9* pStage =
+    staging.acquire (This, desc.Width, desc.Height, upload_layout.levels, desc.Format);
+
+  if (pStage == nullptr)
+    return nullptr;
+
+  bool staged = true;
+
+  for (UINT i = 0; i < upload_layout.levels && staged; i++) {
+    IDirect3DSurface9* pSurf = nullptr;
+
+    staged = SUCCEEDED (pStage->GetSurfaceLevel (i, &pSurf)) &&
+               AD_ReplaceLevel (repl, texels, i, pSurf);
+
+    if (pSurf != nullptr)
+      pSurf->Release ();
+  }
+
+  if (! staged) {
+    pStage->Release ();
+    return nullptr;
+  }
+
+  return pStage;
+}
+
+// The replacement for an UpdateSurface source, as level 0 of a staging
+//   texture (AddRef'd), or nullptr
+IDirect3DSurface9*
+AD_ReplaceSurface (IDirect3DDevice9* This, IDirect3DSurface9* pSurface)
+{
+  D3DSURFACE_DESC desc;
+
+  if (pSurface == nullptr || FAILED (pSurface->GetDesc (&desc)))
+    return nullptr;
+
+  IDirect3DTexture9* pStage = AD_StageReplacement (This, &pSurface, desc, 1);
+  IDirect3DSurface9* pRepl  = nullptr;
+
+  if (pStage == nullptr)
+    return nullptr;
+
+  if (FAILED (pStage->GetSurfaceLevel (0, &pRepl)))
+    pRepl = nullptr;
+
+  pStage->Release ();
+
+  return pRepl;
+}
+
+// The replacement for an UpdateTexture source (AddRef'd), or nullptr
+IDirect3DTexture9*
+AD_ReplaceTexture (IDirect3DDevice9* This, IDirect3DBaseTexture9* pTexture)
+{
+  if (pTexture == nullptr || pTexture->GetType () != D3DRTYPE_TEXTURE)
+    return nullptr;
+
+  IDirect3DTexture9* pTex = (IDirect3DTexture9 *)pTexture;
+
+  D3DSURFACE_DESC desc;
+
+  if (FAILED (pTex->GetLevelDesc (0, &desc)))
+    return nullptr;
+
+  IDirect3DSurface9* surfs [AD_MAX_UPLOAD_LEVELS] = { nullptr };
+
+  UINT levels = pTex->GetLevelCount ();
+
+  if (levels > AD_MAX_UPLOAD_LEVELS)
+    return nullptr;
+
+  UINT got = 0;
+
+  while (got < levels && SUCCEEDED (pTex->GetSurfaceLevel (got, &surfs [got])))
+    ++got;
+
+  IDirect3DTexture9* pRepl =
+    got == levels ? AD_StageReplacement (This, surfs, desc, levels) : nullptr;
+
+  while (got-- > 0)
+    surfs [got]->Release ();
+
+  return pRepl;
+}
+
+void
+AD_LogFingerprintBenchmark (void)
+{
+  ad_fingerprint_bench_s results [16];
+
+  int count = AD_Fingerprint_Benchmark (results, 16);
+
+  dll_log.Log (L" [Fingerprint] Benchmark (per texture, full mip chain):");
+
+  for (int i = 0; i < count; i++) {
+    const ad_fingerprint_bench_s& r = results [i];
+
+    dll_log.Log ( L"   %-8s %4lux%-4lu %8.2f MiB  Scalar: %9.1f us  SSE2: %9.1f us  "
+                  L"Sampled: %7.1f us%s",
+                    r.format == D3DFMT_A8R8G8B8 ? L"A8R8G8B8" : r.format == D3DFMT_DXT1 ? L"DXT1" : L"DXT5",
+                      r.size, r.size, (double)r.bytes / 1048576.0,
+                        r.scalar_us, r.simd_us, r.sampled_us,
+                          r.agree ? L"" : L"  ** KERNELS DISAGREE **" );
+  }
+}
+
+//
+// Render.CompleteMips: a texture the game creates with fewer levels than its
+//   dimensions allow is given a full chain instead (AD_PlanMipCompletion) and
+//     tagged with what the game asked for.  After each upload the driver
+//       regenerates the rest of an AUTOGENMIPMAP texture; every other one is
+//         completed on the CPU (mipgen.h) and uploaded through a system-memory
+//           copy of the whole chain (ad_staging_cache_s).
+//
+//  * The CPU path runs inside the upload, so it is only taken for
+//      uncompressed formats: re-encoding a 2048x2048 DXT chain costs ~55 ms
+//        on a cache miss, against ~3.3 ms for A8R8G8B8.  DXTn is completed
+//          only where the driver can autogenerate it.
+//
+//  * Only whole uploads of level 0 are completed; UpdateSurface into part of
+//      it leaves the generated levels stale.
+//
+//  * Render thread only (the chain and the cache keep their allocations).
+//
+struct ad_mip_tag_s {
+  UINT levels;                   // What the game asked for
+  bool autogen;
+};
+
+// {4B37286D-7384-4312-86E6-D90F7E77B386}
+static const GUID AD_GUID_MIP_COMPLETION =
+  { 0x4b37286d, 0x7384, 0x4312, { 0x86, 0xe6, 0xd9, 0x0f, 0x7e, 0x77, 0xb3, 0x86 } };
+
+static ad_dump_image_s mip_chain;
+
+static bool
+AD_LookupMipTag (IDirect3DBaseTexture9* pTexture, ad_mip_tag_s& tag)
+{
+  if (pTexture == nullptr)
+    return false;
+
+  DWORD size = sizeof (ad_mip_tag_s);
+
+  return SUCCEEDED (pTexture->GetPrivateData (AD_GUID_MIP_COMPLETION, &tag, &size)) &&
+           size == sizeof (ad_mip_tag_s);
+}
+
+void
+AD_TagMipCompletion (IDirect3DTexture9* pTexture, const ad_mip_tag_s& tag)
+{
+  pTexture->SetPrivateData (AD_GUID_MIP_COMPLETION, &tag, sizeof (ad_mip_tag_s), 0);
+
+  ++mip_completion.stats.promoted;
+
+  if (tag.autogen)
+    ++mip_completion.stats.autogen;
+}
+
+static bool
+AD_CanAutogenMips (IDirect3DDevice9* pDevice, D3DFORMAT format)
+{
+  IDirect3D9* pD3D = nullptr;
+
+  if (FAILED (pDevice->GetDirect3D (&pD3D)))
+    return false;
+
+  D3DDEVICE_CREATION_PARAMETERS params;
+  D3DDISPLAYMODE                mode;
+
+  // D3DOK_NOAUTOGEN is a success code, but means the format can't
+  bool can =
+    SUCCEEDED (pDevice->GetCreationParameters (&params))                  &&
+    SUCCEEDED (pD3D->GetAdapterDisplayMode (params.AdapterOrdinal, &mode)) &&
+      pD3D->CheckDeviceFormat ( params.AdapterOrdinal, params.DeviceType, mode.Format,
+                                  D3DUSAGE_AUTOGENMIPMAP, D3DRTYPE_TEXTURE, format ) == D3D_OK;
+
+  pD3D->Release ();
+
+  return can;
+}
+
+// Rewrites req for a full chain; false if the texture is left as it is
+bool
+AD_PlanMipCompletion (IDirect3DDevice9* pDevice, ad_texture_request_s& req, ad_mip_tag_s& tag)
+{
+  const DWORD excluded = D3DUSAGE_RENDERTARGET | D3DUSAGE_DEPTHSTENCIL |
+                         D3DUSAGE_DYNAMIC      | D3DUSAGE_AUTOGENMIPMAP;
+
+  // Only textures the game fills through UpdateTexture / UpdateSurface
+  if (req.pool != D3DPOOL_DEFAULT || req.levels == 0 || (req.usage & excluded))
+    return false;
+
+  UINT full = 1;
+
+  for (UINT w = req.width, h = req.height; w > 1 || h > 1; w >>= 1, h >>= 1)
+    ++full;
+
+  if (req.levels >= full || full > AD_MAX_UPLOAD_LEVELS)
+    return false;
+
+  // An AUTOGENMIPMAP texture only ever exposes one level to the game
+  tag.levels  = req.levels;
+  tag.autogen = req.levels == 1 && (! mip_completion.cpu) &&
+                  AD_CanAutogenMips (pDevice, req.format);
+
+  if ((! tag.autogen) && (AD_MipFormatCompressed (req.format) ||
+                          (! AD_MipFormatSupported (req.format))))
+    return false;
+
+  req.levels = 0;
+
+  if (tag.autogen)
+    req.usage |= D3DUSAGE_AUTOGENMIPMAP;
+
+  return true;
+}
+
+//
+// Uploads surfs [0, src_levels) (lockable) and the rest of pDest's chain,
+//   generated or cached.
+//
+static HRESULT
+AD_CompleteMipChain ( IDirect3DDevice9*      This,
+                      IDirect3DSurface9**    surfs,
+                      UINT                   src_levels,
+                      const D3DSURFACE_DESC& desc,
+                      IDirect3DTexture9*     pDest )
+{
+  const UINT levels = pDest->GetLevelCount ();
+
+  if ( levels > AD_MAX_UPLOAD_LEVELS || src_levels >= levels ||
+       (! mip_chain.init (desc.Width, desc.Height, levels, desc.Format)) )
+    return D3DERR_INVALIDCALL;
+
+  mip_chain.data.resize (mip_chain.bytes ());
+
+  ad_fingerprint_level_s fp_levels [AD_MAX_UPLOAD_LEVELS];
+
+  for (UINT i = 0; i < src_levels; i++) {
+    if (! AD_StageDumpLevel (&mip_chain, i, surfs [i]))
+      return D3DERR_INVALIDCALL;
+
+    const ad_dump_image_s::level_s& lvl = mip_chain.level [i];
+
+    fp_levels [i].bits      = &mip_chain.data [lvl.offset];
+    fp_levels [i].pitch     = lvl.pitch;
+    fp_levels [i].row_bytes = lvl.pitch;
+    fp_levels [i].rows      = lvl.rows;
+    fp_levels [i].width     = lvl.width;
+    fp_levels [i].height    = lvl.height;
+  }
+
+  // Full, not sampled: a collision here would put the wrong image in the
+  //   distance
+  const ad_fingerprint_s key =
+    AD_Fingerprint (mip_chain.format, fp_levels, src_levels, false);
+
+  const size_t  tail   = mip_chain.level [src_levels].offset;
+  const size_t  size   = mip_chain.bytes () - tail;
+
+  const std::vector <uint8_t>* cached = mip_completion.cache.find (key);
+
+  if (cached != nullptr && cached->size () == size) {
+    memcpy (&mip_chain.data [tail], cached->data (), size);
+    ++mip_completion.stats.cached;
+  }
+
+  else {
+    if (! AD_GenerateMips (mip_chain, src_levels))
+      return D3DERR_INVALIDCALL;
+
+    mip_completion.cache.insert (key, &mip_chain.data [tail], size);
+    ++mip_completion.stats.generated;
+  }
+
+  IDirect3DTexture9* pStage =
+    staging.acquire (This, desc.Width, desc.Height, levels, desc.Format);
+
+  if (pStage == nullptr)
+    return E_OUTOFMEMORY;
+
+  HRESULT hr = D3D_OK;
+
+  for (UINT i = 0; i < levels && SUCCEEDED (hr); i++) {
+    IDirect3DSurface9* pSurf = nullptr;
+
+    hr = pStage->GetSurfaceLevel (i, &pSurf);
+
+    if (SUCCEEDED (hr)) {
+      if (! AD_ReplaceLevel (mip_chain, mip_chain.data.data (), i, pSurf))
+        hr = D3DERR_INVALIDCALL;
+
+      pSurf->Release ();
+    }
+  }
+
+  if (SUCCEEDED (hr))
+    hr = D3D9UpdateTexture_Original (This, pStage, pDest);
+
+  pStage->Release ();
+
+  return hr;
+}
+
+// UpdateTexture into a tagged (CPU-completed) texture; without generate,
+//   only the levels the game gave us are uploaded
+HRESULT
+AD_CompleteTexture ( IDirect3DDevice9*      This,
+                     IDirect3DBaseTexture9* pSource,
+                     IDirect3DTexture9*     pDest,
+                     bool                   generate )
+{
+  if (pSource == nullptr || pSource->GetType () != D3DRTYPE_TEXTURE)
+    return D3D9UpdateTexture_Original (This, pSource, pDest);
+
+  IDirect3DTexture9* pSrc = (IDirect3DTexture9 *)pSource;
+
+  D3DSURFACE_DESC src_desc, dst_desc;
+
+  const UINT src_levels = pSrc->GetLevelCount ();
+
+  // Nothing is missing, or it's not an upload we can complete
+  if ( FAILED (pSrc->GetLevelDesc  (0, &src_desc))   ||
+       FAILED (pDest->GetLevelDesc (0, &dst_desc))   ||
+       src_levels      >= pDest->GetLevelCount ()    ||
+       src_desc.Width  != dst_desc.Width             ||
+       src_desc.Height != dst_desc.Height            ||
+       src_desc.Format != dst_desc.Format )
+    return D3D9UpdateTexture_Original (This, pSource, pDest);
+
+  IDirect3DSurface9* surfs [AD_MAX_UPLOAD_LEVELS] = { nullptr };
+
+  UINT got = 0;
+
+  while (got < src_levels && SUCCEEDED (pSrc->GetSurfaceLevel (got, &surfs [got])))
+    ++got;
+
+  HRESULT hr = D3DERR_INVALIDCALL;
+
+  if (got == src_levels && generate)
+    hr = AD_CompleteMipChain (This, surfs, src_levels, dst_desc, pDest);
+
+  if (FAILED (hr)) {
+    if (generate) {
+      ++mip_completion.stats.failed;
+
+      dll_log.Log ( L" [MipGen] Could not complete a %lux%lu upload (Format: %lu, %lu of %lu levels): %08X",
+                      dst_desc.Width, dst_desc.Height, dst_desc.Format,
+                        src_levels, pDest->GetLevelCount (), hr );
+    }
+
+    // UpdateTexture won't copy fewer levels than the destination has; at
+    //   least upload the ones the game gave us
+    hr = got == src_levels ? D3D_OK : D3DERR_INVALIDCALL;
+
+    for (UINT i = 0; i < got && SUCCEEDED (hr); i++) {
+      IDirect3DSurface9* pSurf = nullptr;
+
+      hr = pDest->GetSurfaceLevel (i, &pSurf);
+
+      if (SUCCEEDED (hr)) {
+        hr = D3D9UpdateSurface_Original (This, surfs [i], nullptr, pSurf, nullptr);
+        pSurf->Release ();
+      }
+    }
+  }
+
+  while (got-- > 0)
+    surfs [got]->Release ();
+
+  return hr;
+}
+
+// A whole level 0 was just uploaded with UpdateSurface
+void
+AD_CompleteSurface ( IDirect3DDevice9*  This,
+                     IDirect3DSurface9* pSource,
+                     IDirect3DSurface9* pDest )
+{
+  IDirect3DTexture9* pTex = nullptr;
+
+  if (FAILED (pDest->GetContainer (__uuidof (IDirect3DTexture9), (void **)&pTex)))
+    return;
+
+  ad_mip_tag_s    tag;
+  D3DSURFACE_DESC src_desc, dst_desc, top;
+
+  if ( AD_LookupMipTag (pTex, tag)                  &&
+       SUCCEEDED (pSource->GetDesc     (&src_desc)) &&
+       SUCCEEDED (pDest->GetDesc       (&dst_desc)) &&
+       SUCCEEDED (pTex->GetLevelDesc (0, &top))     &&
+       dst_desc.Width  == top.Width                 &&
+       dst_desc.Height == top.Height                &&
+       src_desc.Width  == top.Width                 &&
+       src_desc.Height == top.Height                &&
+       src_desc.Format == top.Format ) {
+    if (tag.autogen)
+      pTex->GenerateMipSubLevels ();
+
+    else if (FAILED (AD_CompleteMipChain (This, &pSource, 1, top, pTex)))
+      ++mip_completion.stats.failed;
+  }
+
+  pTex->Release ();
+}
+
+void
+AD_LogMipBenchmark (void)
+{
+  ad_mip_bench_s results [16];
+
+  int count = AD_Mip_Benchmark (results, 16);
+
+  dll_log.Log (L" [MipGen] Benchmark (per texture, levels 1 - n from level 0):");
+
+  for (int i = 0; i < count; i++) {
+    const ad_mip_bench_s& r = results [i];
+
+    dll_log.Log ( L"   %-8s %4lux%-4lu %8.2f MiB  Scalar: %9.1f us  SSE2: %9.1f us%s",
+                    r.format == D3DFMT_A8R8G8B8 ? L"A8R8G8B8" : r.format == D3DFMT_DXT1 ? L"DXT1" : L"DXT5",
+                      r.size, r.size, (double)r.bytes / 1048576.0,
+                        r.scalar_us, r.simd_us,
+                          r.agree ? L"" : L"  ** KERNELS DISAGREE **" );
+  }
+}
+
 COM_DECLSPEC_NOTHROW
 HRESULT
 STDMETHODCALLTYPE
@@ -539,6 +1813,21 @@ D3D9UpdateSurface_Detour ( IDirect3DDevice9  *This,
                 _In_       IDirect3DSurface9 *pDestinationSurface,
                 _In_ const POINT             *pDestinationPoint )
 {
+  if (This != ad::RenderFix::pDevice)
+    return D3D9UpdateSurface_Original ( This,
+                                          pSourceSurface,
+                                            pSourceRect,
+                                              pDestinationSurface,
+                                                pDestinationPoint );
+
+  // Dumps see what the game uploaded, not its replacement
+  if (texture_dump.enable)
+    AD_DumpSurface (pSourceSurface);
+
+  IDirect3DSurface9* pRepl =
+    (texture_pack.enable && texture_pack.is_open ()) ?
+      AD_ReplaceSurface (This, pSourceSurface) : nullptr;
+
   HRESULT hr =
     D3D9UpdateSurface_Original ( This,
                                    pSourceSurface,
@@ -546,46 +1835,56 @@ D3D9UpdateSurface_Detour ( IDirect3DDevice9  *This,
                                        pDestinationSurface,
                                          pDestinationPoint );
 
-//#define DUMP_TEXTURES
-  if (SUCCEEDED (hr)) {
-#ifdef DUMP_TEXTURES
-    IDirect3DTexture9 *pBase = nullptr;
-
-    HRESULT hr2 =
-      pDestinationSurface->GetContainer (
-            __uuidof (IDirect3DTexture9),
-              (void **)&pBase
-          );
-
-    if (SUCCEEDED (hr2) && pBase != nullptr) {
-      if (D3DXSaveTextureToFile == nullptr) {
-        D3DXSaveTextureToFile =
-          (D3DXSaveTextureToFile_t)
-          GetProcAddress ( ad::RenderFix::d3dx9_43_dll,
-            "D3DXSaveTextureToFileW" );
-      }
+  // The replacement has the source's shape, so the same rect and point
+  //   put it over exactly what the game just uploaded
+  IDirect3DSurface9* pUploaded = pSourceSurface;
 
-      if (D3DXSaveTextureToFile != nullptr) {
-        wchar_t wszFileName [MAX_PATH] = { L'\0' };
-        _swprintf ( wszFileName, L"textures\\UpdateSurface_%x.png",
-          pBase );
-        D3DXSaveTextureToFile (wszFileName, D3DXIFF_PNG, pBase, NULL);
-      }
+  if ( SUCCEEDED (hr) && pRepl != nullptr &&
+       SUCCEEDED (D3D9UpdateSurface_Original ( This,
+                                                 pRepl,
+                                                   pSourceRect,
+                                                     pDestinationSurface,
+                                                       pDestinationPoint )) )
+    pUploaded = pRepl;
 
-      pBase->Release ();
-    }
-#endif
-  }
+  // Render.CompleteMips
+  if ( SUCCEEDED (hr) && mip_completion.stats.promoted > 0 &&
+       pSourceRect == nullptr &&
+       (pDestinationPoint == nullptr || (pDestinationPoint->x == 0 && pDestinationPoint->y == 0)) )
+    AD_CompleteSurface (This, pUploaded, pDestinationSurface);
+
+  if (pRepl != nullptr)
+    pRepl->Release ();
 
   return hr;
 }
 
-typedef HRESULT (STDMETHODCALLTYPE *UpdateTexture_t)
-  (IDirect3DDevice9      *This,
-   IDirect3DBaseTexture9 *pSourceTexture,
-   IDirect3DBaseTexture9 *pDestinationTexture);
+// UpdateTexture with Render.CompleteMips applied to the destination, unless
+//   what is uploaded is about to be uploaded over (generate = false)
+static HRESULT
+AD_UploadTexture ( IDirect3DDevice9*      This,
+                   IDirect3DBaseTexture9* pSource,
+                   IDirect3DBaseTexture9* pDest,
+                   bool                   generate )
+{
+  ad_mip_tag_s tag;
 
-UpdateTexture_t D3D9UpdateTexture_Original = nullptr;
+  const bool tagged =
+    mip_completion.stats.promoted > 0 && AD_LookupMipTag (pDest, tag);
+
+  // The destination has more levels than the game uploads
+  if (tagged && (! tag.autogen))
+    return AD_CompleteTexture (This, pSource, (IDirect3DTexture9 *)pDest, generate);
+
+  HRESULT hr = D3D9UpdateTexture_Original (This, pSource, pDest);
+
+  // The driver only regenerates the sublevels of an AUTOGENMIPMAP texture
+  //   when asked to (or the first time it is sampled)
+  if (SUCCEEDED (hr) && tagged && generate)
+    pDest->GenerateMipSubLevels ();
+
+  return hr;
+}
 
 COM_DECLSPEC_NOTHROW
 HRESULT
@@ -594,43 +1893,122 @@ D3D9UpdateTexture_Detour (IDirect3DDevice9      *This,
                           IDirect3DBaseTexture9 *pSourceTexture,
                           IDirect3DBaseTexture9 *pDestinationTexture)
 {
-  HRESULT hr = D3D9UpdateTexture_Original (This, pSourceTexture,
-                                                 pDestinationTexture);
+  if (This != ad::RenderFix::pDevice)
+    return D3D9UpdateTexture_Original (This, pSourceTexture, pDestinationTexture);
 
-//#define DUMP_TEXTURES
-  if (SUCCEEDED (hr)) {
-#if 0
-    if ( incomplete_textures.find (pDestinationTexture) != 
-         incomplete_textures.end () ) {
-      dll_log.Log (L" Generating Mipmap LODs for incomplete texture!");
-      (pDestinationTexture->GenerateMipSubLevels ());
-    }
-#endif
-#ifdef DUMP_TEXTURES
-    if (SUCCEEDED (hr)) {
-      if (D3DXSaveTextureToFile != nullptr) {
-        wchar_t wszFileName [MAX_PATH] = { L'\0' };
-        _swprintf ( wszFileName, L"textures\\UpdateTexture_%x.dds",
-          pSourceTexture );
-        D3DXSaveTextureToFile (wszFileName, D3DXIFF_DDS, pDestinationTexture, NULL);
-      }
-    }
-#endif
-  }
+  // Dumps see what the game uploaded, not its replacement
+  if (texture_dump.enable)
+    AD_DumpTexture (pSourceTexture);
+
+  IDirect3DTexture9* pRepl =
+    (texture_pack.enable && texture_pack.is_open ()) ?
+      AD_ReplaceTexture (This, pSourceTexture) : nullptr;
+
+  if (pRepl == nullptr)
+    return AD_UploadTexture (This, pSourceTexture, pDestinationTexture, true);
+
+  // The game's upload as it asked for it (consuming the source's dirty
+  //   regions as usual), then the replacement over it
+  HRESULT hr = AD_UploadTexture (This, pSourceTexture, pDestinationTexture, false);
+
+  // If that fails, what the game uploaded still gets the rest of its chain
+  if (SUCCEEDED (hr) && FAILED (AD_UploadTexture (This, pRepl, pDestinationTexture, true)))
+    AD_UploadTexture (This, pSourceTexture, pDestinationTexture, true);
+
+  pRepl->Release ();
 
   return hr;
 }
 
-typedef HRESULT (STDMETHODCALLTYPE *CreateTexture_t)
-  (IDirect3DDevice9   *This,
-   UINT                Width,
-   UINT                Height,
-   UINT                Levels,
-   DWORD               Usage,
-   D3DFORMAT           Format,
-   D3DPOOL             Pool,
-   IDirect3DTexture9 **ppTexture,
-   HANDLE             *pSharedHandle);
+void
+AD_HookTextureUploads (IDirect3DDevice9* pDevice)
+{
+  static bool hooked = false;
+
+  if (hooked || pDevice == nullptr)
+    return;
+
+  hooked = true;
+
+  void** vftable = *(void***)pDevice;
+
+  AD_CreateFuncHook ( L"IDirect3DDevice9::UpdateSurface",
+                      vftable [30],
+                      D3D9UpdateSurface_Detour,
+            (LPVOID*)&D3D9UpdateSurface_Original );
+
+  AD_CreateFuncHook ( L"IDirect3DDevice9::UpdateTexture",
+                      vftable [31],
+                      D3D9UpdateTexture_Detour,
+            (LPVOID*)&D3D9UpdateTexture_Original );
+
+  AD_EnableHook (vftable [30]);
+  AD_EnableHook (vftable [31]);
+}
+
+static ad_resource_category_t
+AD_ResourceCategory (DWORD usage)
+{
+  if (usage & D3DUSAGE_RENDERTARGET)
+    return AD_RESOURCE_RENDER_TARGET;
+
+  if (usage & D3DUSAGE_DEPTHSTENCIL)
+    return AD_RESOURCE_DEPTH_STENCIL;
+
+  return AD_RESOURCE_TEXTURE;
+}
+
+// Accounts for what was actually created (policy / scaling included)
+void
+AD_TrackTexture (IDirect3DTexture9* pTex)
+{
+  D3DSURFACE_DESC desc;
+
+  if (FAILED (pTex->GetLevelDesc (0, &desc)))
+    return;
+
+  ad_resource_s res;
+
+  res.width    = desc.Width;
+  res.height   = desc.Height;
+  res.levels   = pTex->GetLevelCount ();
+  res.samples  = 1;
+  res.format   = desc.Format;
+  res.pool     = desc.Pool;
+  res.usage    = desc.Usage;
+  res.category = AD_ResourceCategory (desc.Usage);
+  res.bytes    = AD_TextureBytes (res.width, res.height, res.levels, res.format);
+
+  resources.track (pTex, res);
+
+  AD_HookRelease (pTex);
+}
+
+void
+AD_TrackSurface (IDirect3DSurface9* pSurf)
+{
+  D3DSURFACE_DESC desc;
+
+  if (FAILED (pSurf->GetDesc (&desc)))
+    return;
+
+  ad_resource_s res;
+
+  res.width    = desc.Width;
+  res.height   = desc.Height;
+  res.levels   = 1;
+  res.samples  = desc.MultiSampleType >= D3DMULTISAMPLE_2_SAMPLES ?
+                   (UINT)desc.MultiSampleType : 1;
+  res.format   = desc.Format;
+  res.pool     = desc.Pool;
+  res.usage    = desc.Usage;
+  res.category = AD_ResourceCategory (desc.Usage);
+  res.bytes    = AD_TextureBytes (res.width, res.height, 1, res.format) * res.samples;
+
+  resources.track (pSurf, res);
+
+  AD_HookRelease (pSurf);
+}
 
 CreateTexture_t D3D9CreateTexture_Original = nullptr;
 
@@ -654,9 +2032,92 @@ D3D9CreateTexture_Detour (IDirect3DDevice9   *This,
 
   int levels = Levels;
 
+  ad_scaled_target_s scaled = { Width, Height, Width, Height };
+
+  // Scene targets (Render.Scale); a single level, so there is no mip chain
+  //   that would also have to be remapped.
+  bool scale =
+    levels == 1 && render_scale.match ( Width, Height, Usage,
+                                          display.width, display.height,
+                                            scaled.real_width, scaled.real_height );
+
+  ad_texture_request_s orig = { Width, Height, Levels, Usage, Format, Pool };
+  ad_texture_request_s req  = orig;
+
+  // Everything else goes through the creation policy (AgDrag.textures.ini)
+  int rule = scale ? -1 : texture_policy.apply (req);
+
+  if (rule >= 0) {
+    scaled.real_width  = req.width;
+    scaled.real_height = req.height;
+
+    // A capped target is addressed in the game's pixels, just like a scaled one
+    scale = (req.width != Width || req.height != Height) &&
+            (req.usage & (D3DUSAGE_RENDERTARGET | D3DUSAGE_DEPTHSTENCIL));
+  }
+
+  // Render.CompleteMips, for whatever no rule touched
+  ad_mip_tag_s mip_tag;
+
+  bool complete =
+    rule < 0 && (! scale) && mip_completion.enable &&
+      AD_PlanMipCompletion (This, req, mip_tag);
+
   HRESULT hr = 
-    D3D9CreateTexture_Original (This, Width, Height, levels, Usage,
-                                Format, Pool, ppTexture, pSharedHandle);
+    D3D9CreateTexture_Original (This, scaled.real_width, scaled.real_height, req.levels, req.usage,
+                                req.format, req.pool, ppTexture, pSharedHandle);
+
+  bool refused = FAILED (hr);
+
+  // D3DOK_NOAUTOGEN is a success code, but the levels a rule added would
+  //   never be filled (e.g. DXTn)
+  if (hr == D3DOK_NOAUTOGEN && rule >= 0 && (req.usage & ~Usage & D3DUSAGE_AUTOGENMIPMAP)) {
+    (*ppTexture)->Release ();
+    refused = true;
+  }
+
+  // Unsupported override (e.g. AUTOGENMIPMAP on this format); do what the
+  //   game asked for instead.
+  if ((rule >= 0 || complete) && refused) {
+    if (rule >= 0) {
+      texture_policy.refused (rule);
+
+      dll_log.Log ( L" [TexPolicy] Texture %lux%lu (Usage: %lx, Format: %lu, Pool: %lu) "
+                    L"refused its override (%08X)",
+                      Width, Height, Usage, Format, Pool, hr );
+    }
+
+    hr = D3D9CreateTexture_Original ( This, Width, Height, Levels, Usage,
+                                        Format, Pool, ppTexture, pSharedHandle );
+
+    if (SUCCEEDED (hr))
+      AD_TrackTexture (*ppTexture);
+
+    return hr;
+  }
+
+  if (SUCCEEDED (hr))
+    AD_TrackTexture (*ppTexture);
+
+  if (complete && SUCCEEDED (hr))
+    AD_TagMipCompletion (*ppTexture, mip_tag);
+
+  if (rule >= 0)
+    texture_policy.account (rule, orig, req, (*ppTexture)->GetLevelCount ());
+
+  if (scale && SUCCEEDED (hr)) {
+    IDirect3DSurface9* pSurf = nullptr;
+
+    if (SUCCEEDED ((*ppTexture)->GetSurfaceLevel (0, &pSurf))) {
+      ad_render_scale_s::tag (pSurf, scaled);
+      pSurf->Release ();
+    }
+
+    ++render_scale.targets;
+
+    dll_log.Log ( L" [Scale] Scene texture %lux%lu (Usage: %lx) created at %lux%lu",
+                    Width, Height, Usage, scaled.real_width, scaled.real_height );
+  }
 
   return hr;
 }
@@ -687,14 +2148,29 @@ D3D9CreateDepthStencilSurface_Detour (IDirect3DDevice9     *This,
                                       IDirect3DSurface9   **ppSurface,
                                       HANDLE               *pSharedHandle)
 {
-  dll_log.Log (L" [!] IDirect3DDevice9::CreateDepthStencilSurface (%lu, %lu, "
-                      L"%lu, %lu, %lu, %lu, %08Xh, %08Xh)",
-                 Width, Height, Format, MultiSample, MultisampleQuality,
-                 Discard, ppSurface, pSharedHandle);
+  ad_scaled_target_s scaled = { Width, Height, Width, Height };
+
+  bool scale =
+    This == ad::RenderFix::pDevice &&
+      render_scale.match ( Width, Height, D3DUSAGE_DEPTHSTENCIL,
+                             display.width, display.height,
+                               scaled.real_width, scaled.real_height );
 
-  return D3D9CreateDepthStencilSurface_Original (This, Width, Height, Format,
-                                                 MultiSample, MultisampleQuality,
-                                                 Discard, ppSurface, pSharedHandle);
+  HRESULT hr =
+    D3D9CreateDepthStencilSurface_Original (This, scaled.real_width, scaled.real_height, Format,
+                                            MultiSample, MultisampleQuality,
+                                            Discard, ppSurface, pSharedHandle);
+
+  // Render.Resources.* (replaces the old per-creation log line)
+  if (This == ad::RenderFix::pDevice && SUCCEEDED (hr))
+    AD_TrackSurface (*ppSurface);
+
+  if (scale && SUCCEEDED (hr)) {
+    ad_render_scale_s::tag (*ppSurface, scaled);
+    ++render_scale.targets;
+  }
+
+  return hr;
 }
 
 typedef HRESULT (STDMETHODCALLTYPE *CreateRenderTarget_t)
@@ -723,14 +2199,70 @@ D3D9CreateRenderTarget_Detour (IDirect3DDevice9     *This,
                                IDirect3DSurface9   **ppSurface,
                                HANDLE               *pSharedHandle)
 {
-  dll_log.Log (L" [!] IDirect3DDevice9::CreateRenderTarget (%lu, %lu, "
-                      L"%lu, %lu, %lu, %lu, %08Xh, %08Xh)",
-                 Width, Height, Format, MultiSample, MultisampleQuality,
-                 Lockable, ppSurface, pSharedHandle);
+  ad_scaled_target_s scaled = { Width, Height, Width, Height };
+
+  // Lockable targets are read back by the game at the size it asked for
+  bool scale =
+    This == ad::RenderFix::pDevice && (! Lockable) &&
+      render_scale.match ( Width, Height, D3DUSAGE_RENDERTARGET,
+                             display.width, display.height,
+                               scaled.real_width, scaled.real_height );
+
+  HRESULT hr =
+    D3D9CreateRenderTarget_Original (This, scaled.real_width, scaled.real_height, Format,
+                                     MultiSample, MultisampleQuality,
+                                     Lockable, ppSurface, pSharedHandle);
+
+  // Render.Resources.* (replaces the old per-creation log line)
+  if (This == ad::RenderFix::pDevice && SUCCEEDED (hr))
+    AD_TrackSurface (*ppSurface);
+
+  if (scale && SUCCEEDED (hr)) {
+    ad_render_scale_s::tag (*ppSurface, scaled);
+    ++render_scale.targets;
+
+    dll_log.Log ( L" [Scale] Scene render target %lux%lu created at %lux%lu",
+                    Width, Height, scaled.real_width, scaled.real_height );
+  }
+
+  return hr;
+}
+
+//
+// Hooked as soon as the device is known (BMF_SetPresentParamsD3D9), so that
+//   the scene targets created with it are already subject to Render.Scale
+//     and counted in Render.Resources.*.
+//
+void
+AD_HookResourceCreation (IDirect3DDevice9* pDevice)
+{
+  static bool hooked = false;
+
+  if (hooked || pDevice == nullptr)
+    return;
+
+  hooked = true;
 
-  return D3D9CreateRenderTarget_Original (This, Width, Height, Format,
-                                          MultiSample, MultisampleQuality,
-                                          Lockable, ppSurface, pSharedHandle);
+  void** vftable = *(void***)pDevice;
+
+  AD_CreateFuncHook ( L"IDirect3DDevice9::CreateTexture",
+                      vftable [23],
+                      D3D9CreateTexture_Detour,
+            (LPVOID*)&D3D9CreateTexture_Original );
+
+  AD_CreateFuncHook ( L"IDirect3DDevice9::CreateRenderTarget",
+                      vftable [28],
+                      D3D9CreateRenderTarget_Detour,
+            (LPVOID*)&D3D9CreateRenderTarget_Original );
+
+  AD_CreateFuncHook ( L"IDirect3DDevice9::CreateDepthStencilSurface",
+                      vftable [29],
+                      D3D9CreateDepthStencilSurface_Detour,
+            (LPVOID*)&D3D9CreateDepthStencilSurface_Original );
+
+  AD_EnableHook (vftable [23]);
+  AD_EnableHook (vftable [28]);
+  AD_EnableHook (vftable [29]);
 }
 
 COM_DECLSPEC_NOTHROW
@@ -754,83 +2286,42 @@ D3D9SetScissorRect_Detour (IDirect3DDevice9* This,
     return S_OK;
   }
 
-  return D3D9SetScissorRect_Original (This, pRect);
+  // If the rectangle has a non-zero area, we are interested in reverse engineering
+  // vertex shaders currently active...
+  ui.scissoring = pRect != nullptr && pRect->left < pRect->right &&
+                                      pRect->top  < pRect->bottom;
 
-  // If we don't care about aspect ratio, then just early-out
-  if (! config.render.aspect_correction)
+  if (pRect == nullptr)
     return D3D9SetScissorRect_Original (This, pRect);
 
-  //if (! needs_aspect)
-    //dll_log.Log (L" ** Scissor rectangle forced aspect ratio correction!");
-
-  //needs_aspect = true;
-
-  // Otherwise, fix this because the UI's scissor rectangles are
-  //   completely wrong after we start messing with viewport scaling.
+  RECT fixed_scissor = *pRect;
 
-  RECT fixed_scissor;
-  fixed_scissor.bottom = pRect->bottom;
-  fixed_scissor.top    = pRect->top;
-  fixed_scissor.left   = pRect->left;
-  fixed_scissor.right  = pRect->right;
+  // The world is never corrected, so neither are its scissor rects
+  if (ui.drawing && config.render.fix_scissor && config.render.center_ui) {
+    // The UI's scissor rectangles are completely wrong after we start
+    //   messing with viewport scaling; squeeze them into the same 16:9
+    //     column the UI is centered in.
+    const ad_display_coeffs_s& fit = rt_shadow.fit ();
 
-  float x_scale, y_scale;
-  float x_off,   y_off;
-  AD_ComputeAspectCoeffs (x_scale, y_scale, x_off, y_off);
+    if (fit.x != 1.0f) {
+      fixed_scissor.left  = (LONG)floorf ((float)pRect->left  / fit.x + fit.xoff);
+      fixed_scissor.right = (LONG)ceilf  ((float)pRect->right / fit.x + fit.xoff);
 
-  float height = (9.0f / 16.0f) * (float)viewport.Width;
-
-  dll_log.Log (L"Scissor Rectangle: [%lu,%lu / %lu,%lu] { %lu,%lu / %lu,%lu }",
-               pRect->left, pRect->top, pRect->right, pRect->bottom,
-                 viewport.X, viewport.Y, viewport.X + viewport.Width, viewport.Y + viewport.Height );
-
-  // If the rectangle has a non-zero area, we are interested in reverse engineering
-  // vertex shaders currently active...
-  if (pRect->left < pRect->right && pRect->top < pRect->bottom)
-    ui.scissoring = true;
-  else
-    ui.scissoring = false;
-
-  float Width  = 0.0f;
-  float Height = 0.0f;
-
-  IDirect3DSurface9* pSurf = nullptr;
-  if (SUCCEEDED (ad::RenderFix::pDevice->GetRenderTarget (0, &pSurf))) {
-    pSurf->Release ();
-
-    D3DSURFACE_DESC desc;
-    if (SUCCEEDED (pSurf->GetDesc (&desc))) {
-      float Width  = (float)desc.Width;
-      float Height = (float)desc.Height;
+      if (tracer.log_frame && config.trace.ui) {
+        dll_log.Log ( L" Scissor Rectangle: [%li,%li / %li,%li] -> [%li,%li / %li,%li] (RT: %lux%lu)",
+                        pRect->left,         pRect->top,         pRect->right,         pRect->bottom,
+                        fixed_scissor.left,  fixed_scissor.top,  fixed_scissor.right,  fixed_scissor.bottom,
+                          rt_shadow.width, rt_shadow.height );
+      }
     }
   }
 
-  // Wider
-  if (config.render.aspect_ratio > (16.0f / 9.0f)) {
-    float left_ndc  = 2.0f * ((float)pRect->left  / ((float)viewport.X  + (float)viewport.Width)) - 1.0f;
-    float right_ndc = 2.0f * ((float)pRect->right / ((float)viewport.X  + (float)viewport.Width)) - 1.0f;
-
-    int width = (16.0f / 9.0f) * height;
-
-    fixed_scissor.left  = (left_ndc  * width + width) / 2.0f + x_off;
-    fixed_scissor.right = (right_ndc * width + width) / 2.0f + x_off;
-  } else {
-    float top_ndc    = 2.0f * ((float)pRect->top    / ((float)viewport.Y + (float)viewport.Height)) - 1.0f;
-    float bottom_ndc = 2.0f * ((float)pRect->bottom / ((float)viewport.Y + (float)viewport.Height)) - 1.0f;
-
-    int height = (9.0f / 16.0f) * viewport.Width;
-
-    fixed_scissor.top    = (top_ndc    * height + height) / 2.0f + y_off;
-    fixed_scissor.bottom = (bottom_ndc * height + height) / 2.0f + y_off;
-  }
+  // Full-resolution pixels -> the (smaller) target's, if it is scaled
+  render_scale.map (fixed_scissor);
 
   return D3D9SetScissorRect_Original (This, &fixed_scissor);
 }
 
-typedef HRESULT (STDMETHODCALLTYPE *SetViewport_t)(
-        IDirect3DDevice9* This,
-  CONST D3DVIEWPORT9*     pViewport);
-
 SetViewport_t D3D9SetViewport_Original = nullptr;
 
 COM_DECLSPEC_NOTHROW
@@ -839,25 +2330,38 @@ STDMETHODCALLTYPE
 D3D9SetViewport_Detour (IDirect3DDevice9* This,
                   CONST D3DVIEWPORT9*     pViewport)
 {
-  // Ignore anything that's not the primary render device.
-  if (This != ad::RenderFix::pDevice)
+  // Ignore anything that's not the primary render device (and let the
+  //   runtime refuse a NULL viewport).
+  if (This != ad::RenderFix::pDevice || pViewport == nullptr)
     return D3D9SetViewport_Original (This, pViewport);
 
-  HRESULT hr = D3D9SetViewport_Original (This, pViewport);
+  // What the device gets; differs only while a scaled target is bound
+  D3DVIEWPORT9 bound = *pViewport;
+  render_scale.map (bound);
+
+  // Already bound (and not merely as a pending minimap adjustment)
+  if ( call_filter.active () && vp_shadow.known && (! vp_shadow.pending) &&
+       memcmp (&vp_shadow.bound, &bound, sizeof (D3DVIEWPORT9)) == 0 ) {
+    viewport = *pViewport;
+    ++call_filter.dropped.viewports;
+
+    AD_SetViewportGeometry (viewport.Width, viewport.Height);
+
+    return D3D_OK;
+  }
 
-  // Detected tiled drawing, we need to handle this specially...
-  //if (pViewport->Width == 64) {
-    //fix_rect = true;
-  //}
+  HRESULT hr = D3D9SetViewport_Original (This, &bound);
 
   if (SUCCEEDED (hr)) {
     viewport = *pViewport;
+    vp_shadow.track (bound);
+
+    AD_SetViewportGeometry (viewport.Width, viewport.Height);
   }
 
   return hr;
 }
 
-#if 0
 typedef HRESULT (STDMETHODCALLTYPE *StretchRect_t)
   (      IDirect3DDevice9    *This,
          IDirect3DSurface9   *pSourceSurface,
@@ -879,46 +2383,74 @@ D3D9StretchRect_Detour (      IDirect3DDevice9    *This,
                         const RECT                *pDestRect,
                               D3DTEXTUREFILTERTYPE Filter )
 {
-  if (fix_rect && config.render.aspect_correction) {
-    //fix_rect = false;
-    RECT fake_dest;
-
-    if (pDestRect == nullptr) {
-      pDestRect = &fake_dest;
+  // Ignore anything that's not the primary render device.
+  if (This != ad::RenderFix::pDevice)
+    return D3D9StretchRect_Original ( This, pSourceSurface, pSourceRect,
+                                        pDestSurface, pDestRect, Filter );
+
+  // Rects on scaled targets are in full-resolution pixels
+  RECT               scaled_src, scaled_dest;
+  ad_scaled_target_s scaled;
+
+  if (render_scale.targets > 0) {
+    if (pSourceRect != nullptr && ad_render_scale_s::lookup (pSourceSurface, scaled)) {
+      scaled_src = *pSourceRect;
+      ad_render_scale_s::map_rect (scaled_src, scaled);
+      pSourceRect = &scaled_src;
+    }
 
-      fake_dest.left   = 0;
-      fake_dest.right  = viewport.Width;
-      fake_dest.top    = 0;
-      fake_dest.bottom = viewport.Height;
+    if (pDestRect != nullptr && ad_render_scale_s::lookup (pDestSurface, scaled)) {
+      scaled_dest = *pDestRect;
+      ad_render_scale_s::map_rect (scaled_dest, scaled);
+      pDestRect = &scaled_dest;
     }
+  }
 
-    int left = 0;
-    int top  = 0;
+  if (! config.render.fix_blits)
+    return D3D9StretchRect_Original ( This, pSourceSurface, pSourceRect,
+                                        pDestSurface, pDestRect, Filter );
 
-    DWORD width = (pDestRect->right - pDestRect->left);
-    DWORD height = (9.0f / 16.0f) * (pDestRect->right - pDestRect->left);
+  D3DSURFACE_DESC desc;
 
-    if (height > pDestRect->bottom) {
-      width  = (16.0f / 9.0f) * (pDestRect->bottom - pDestRect->top);
-      height = (pDestRect->bottom - pDestRect->top);
-      left   = ((pDestRect->right - pDestRect->left) - width) / 2;
-    } else {
-      top    = ((pDestRect->bottom - pDestRect->top) - height) / 2;
-    }
+  ad_blit_call_s blit;
+
+  if (pSourceRect != nullptr) {
+    blit.src_w = pSourceRect->right  - pSourceRect->left;
+    blit.src_h = pSourceRect->bottom - pSourceRect->top;
+  } else if (pSourceSurface != nullptr && SUCCEEDED (pSourceSurface->GetDesc (&desc))) {
+    blit.src_w = desc.Width;
+    blit.src_h = desc.Height;
+  } else {
+    blit.src_w = 0;
+    blit.src_h = 0;
+  }
+
+  if (pDestRect != nullptr) {
+    blit.dest = *pDestRect;
+  } else if (pDestSurface != nullptr && SUCCEEDED (pDestSurface->GetDesc (&desc))) {
+    blit.dest.left   = 0;
+    blit.dest.top    = 0;
+    blit.dest.right  = desc.Width;
+    blit.dest.bottom = desc.Height;
+  } else {
+    memset (&blit.dest, 0, sizeof (RECT));
+  }
+
+  if (blit_bench.record > 0)
+    blit_bench.add (blit);
 
-    RECT fixed;
+  RECT fixed;
 
-    fixed.left   = left;
-    fixed.top    = top;
-    fixed.right  = left + width;
-    fixed.bottom = top  + height;
+  if (blit_cache.fit (blit.src_w, blit.src_h, blit.dest, fixed)) {
+    if (tracer.log_frame && config.trace.ui) {
+      dll_log.Log ( L" StretchRect: %lux%lu -> [%li,%li / %li,%li] -> [%li,%li / %li,%li]",
+                      blit.src_w, blit.src_h,
+                        blit.dest.left, blit.dest.top, blit.dest.right, blit.dest.bottom,
+                          fixed.left,     fixed.top,     fixed.right,     fixed.bottom );
+    }
 
-    return D3D9StretchRect_Original ( This,
-                                        pSourceSurface,
-                                        nullptr,
-                                          pDestSurface,
-                                          &fixed,
-                                            Filter );
+    return D3D9StretchRect_Original ( This, pSourceSurface, pSourceRect,
+                                        pDestSurface, &fixed, Filter );
   }
 
   return D3D9StretchRect_Original ( This,
@@ -928,7 +2460,65 @@ D3D9StretchRect_Detour (      IDirect3DDevice9    *This,
                                         pDestRect,
                                           Filter );
 }
-#endif
+
+//
+// Before Present (and the overlays): a dropped frame gets the last drawn
+//   image, or black, and a drawn one is kept for the frames to come.
+//
+void
+AD_BackgroundPresent (IDirect3DDevice9* pDevice)
+{
+  if ( (! background.skip_fixups)                 ||
+       D3D9StretchRect_Original        == nullptr ||
+       D3D9CreateRenderTarget_Original == nullptr )
+    return;
+
+  const bool keep = config.render.background_cache &&
+                    config.render.background_drop > 0;
+
+  if ((! background.dropping) && (! keep)) {
+    ++background.drawn;
+    return;
+  }
+
+  IDirect3DSurface9* pBackBuffer = nullptr;
+
+  if (FAILED (pDevice->GetBackBuffer (0, 0, D3DBACKBUFFER_TYPE_MONO, &pBackBuffer)))
+    return;
+
+  if (background.dropping) {
+    if (background.cached) {
+      D3D9StretchRect_Original ( pDevice, background.pCache, nullptr,
+                                   pBackBuffer, nullptr, D3DTEXF_NONE );
+    }
+
+    else
+      pDevice->ColorFill (pBackBuffer, nullptr, D3DCOLOR_XRGB (0, 0, 0));
+
+    ++background.dropped;
+  }
+
+  else {
+    D3DSURFACE_DESC desc;
+
+    // Same size and multisampling as the backbuffer, so both copies are
+    //   straight blits (and never subject to Render.Scale)
+    if (background.pCache == nullptr && SUCCEEDED (pBackBuffer->GetDesc (&desc))) {
+      D3D9CreateRenderTarget_Original ( pDevice, desc.Width, desc.Height, desc.Format,
+                                          desc.MultiSampleType, desc.MultiSampleQuality,
+                                            FALSE, &background.pCache, nullptr );
+    }
+
+    background.cached =
+      background.pCache != nullptr &&
+        SUCCEEDED ( D3D9StretchRect_Original ( pDevice, pBackBuffer, nullptr,
+                                                 background.pCache, nullptr, D3DTEXF_NONE ) );
+
+    ++background.drawn;
+  }
+
+  pBackBuffer->Release ();
+}
 
 typedef HRESULT (STDMETHODCALLTYPE *DrawPrimitive_t)
                 ( IDirect3DDevice9* This,
@@ -938,6 +2528,34 @@ typedef HRESULT (STDMETHODCALLTYPE *DrawPrimitive_t)
 
 DrawPrimitive_t D3D9DrawPrimitive_Original = nullptr;
 
+//
+// Bitset of the cull sets that remove the draw about to be issued
+//   (ad_cull_sets_s::CONSOLE for Render.CullVS / Render.CullPS).
+//
+static inline uint32_t
+AD_CullDraw (UINT prims)
+{
+  const uint32_t categories =
+    ( ui.drawing          ? AD_CULL_UI         : 0 ) |
+    ( ui.drawing_menu     ? AD_CULL_MENU       : 0 ) |
+    ( postproc.dof_active ? AD_CULL_DOF        : 0 ) |
+    ( postproc.fullscreen ? AD_CULL_FULLSCREEN : 0 ) |
+    ( minimap->drawing    ? AD_CULL_MINIMAP    : 0 );
+
+  const uint32_t culled = fastpath.cull | cull_sets.test (categories);
+
+  if (culled != 0) {
+    cull_sets.count (culled, prims);
+
+    if (tracer.log_frame && config.trace.shaders) {
+      dll_log.Log ( L"Killed Shader: (vs: %x, ps: %x) [Sets: %x]",
+                      vs_checksum, ps_checksum, culled );
+    }
+  }
+
+  return culled;
+}
+
 COM_DECLSPEC_NOTHROW
 __declspec (noinline)
 HRESULT
@@ -947,8 +2565,14 @@ D3D9DrawPrimitive_Detour ( IDirect3DDevice9* This,
                            UINT              StartVertex,
                            UINT              PrimitiveCount )
 {
+  ++draw_epoch;
+
+  // Background mode: the whole frame is being dropped
+  if (background.dropping && This == ad::RenderFix::pDevice)
+    return S_OK;
+
   // Ignore anything that's not the primary render device.
-  if (This != ad::RenderFix::pDevice) {
+  if (This != ad::RenderFix::pDevice || AD_FastPath ()) {
     return
       D3D9DrawPrimitive_Original ( This,
                                      PrimitiveType,
@@ -957,14 +2581,10 @@ D3D9DrawPrimitive_Detour ( IDirect3DDevice9* This,
   }
 
   //
-  // Kill Debug VS or PS
+  // Kill Debug VS or PS, and anything in an enabled cull set
   //
-  if (vs_checksum == debug.cull_vs || ps_checksum == debug.cull_ps) {
-    if (tracer.log_frame && config.trace.shaders) {
-      dll_log.Log (L"Killed Shader: (vs: %x, ps: %x)", vs_checksum, ps_checksum);
-    }
+  if (AD_CullDraw (PrimitiveCount))
     return S_OK;
-  }
 
   //
   // Kill Depth of Field Pass
@@ -975,9 +2595,8 @@ D3D9DrawPrimitive_Detour ( IDirect3DDevice9* This,
 
   if (minimap->drawing) {
     D3DVIEWPORT9 vp = viewport;
-    float x, y;
-    float x_off, y_off;
-    AD_ComputeAspectCoeffs (x, y, x_off, y_off);
+    const float x     = display.viewport.x,    y     = display.viewport.y;
+    const float x_off = display.viewport.xoff, y_off = display.viewport.yoff;
 
     if (config.render.center_ui && ((! minimap->main_map) || minimap->finished || (! minimap->drawing))) {
       vp.Width /= x;
@@ -1002,15 +2621,19 @@ D3D9DrawPrimitive_Detour ( IDirect3DDevice9* This,
       vp.Y += ((float)viewport.Height - vp.Height / x) / 2.0f;
     }
 
-    D3D9SetViewport_Original (This, &vp);
+    vp_shadow.apply (This, vp);
 
     minimap->prims_drawn++;
     minimap->center_prim = false;
+  } else {
+    vp_shadow.flush (This);
   }
 
   if (nametags->drawing && nametags->shouldDrawOnTop ()) {
     // Draw once normally
     if (nametags->top_technique > 1) {
+      rs_shadow.flush (This);
+
       D3D9DrawPrimitive_Original ( This,
                                      PrimitiveType,
                                        StartVertex,
@@ -1018,14 +2641,15 @@ D3D9DrawPrimitive_Detour ( IDirect3DDevice9* This,
     }
 
     nametags->beginPrimitive (This);
+  } else {
+    rs_shadow.flush (This);
   }
 
 #if 0
   if (needs_center && needs_aspect) {
     D3DVIEWPORT9 vp = viewport;
-    float x, y;
-    float x_off, y_off;
-    AD_ComputeAspectCoeffs (x, y, x_off, y_off);
+    const float x     = display.viewport.x,    y     = display.viewport.y;
+    const float x_off = display.viewport.xoff, y_off = display.viewport.yoff;
 
     if (config.render.center_ui) {
       vp.Width /= x;
@@ -1047,7 +2671,7 @@ D3D9DrawPrimitive_Detour ( IDirect3DDevice9* This,
     nametags->endPrimitive (This);
 
   if (minimap->drawing /*|| (needs_center && needs_aspect)*/) {
-    D3D9SetViewport_Original (This, &viewport);
+    vp_shadow.release (This);
   }
 
   return hr;
@@ -1075,25 +2699,25 @@ D3D9DrawIndexedPrimitive_Detour (IDirect3DDevice9* This,
                                  UINT              startIndex,
                                  UINT              primCount)
 {
+  ++draw_epoch;
+
+  // Background mode: the whole frame is being dropped
+  if (background.dropping && This == ad::RenderFix::pDevice)
+    return S_OK;
+
   // Ignore anything that's not the primary render device.
-  if (This != ad::RenderFix::pDevice) {
+  if (This != ad::RenderFix::pDevice || AD_FastPath ()) {
     return D3D9DrawIndexedPrimitive_Original ( This, Type,
                                                  BaseVertexIndex, MinVertexIndex,
                                                    NumVertices, startIndex,
                                                      primCount );
-
-
   }
 
   //
-  // Kill Debug VS or PS
+  // Kill Debug VS or PS, and anything in an enabled cull set
   //
-  if (vs_checksum == debug.cull_vs || ps_checksum == debug.cull_ps) {
-    if (tracer.log_frame && config.trace.shaders) {
-      dll_log.Log (L"Killed Shader: (vs: %x, ps: %x)", vs_checksum, ps_checksum);
-    }
+  if (AD_CullDraw (primCount))
     return S_OK;
-  }
 
   //
   // Kill Depth of Field Pass
@@ -1118,9 +2742,8 @@ D3D9DrawIndexedPrimitive_Detour (IDirect3DDevice9* This,
     }
 
     D3DVIEWPORT9 vp = viewport;
-    float x, y;
-    float x_off, y_off;
-    AD_ComputeAspectCoeffs (x, y, x_off, y_off);
+    const float x     = display.viewport.x,    y     = display.viewport.y;
+    const float x_off = display.viewport.xoff, y_off = display.viewport.yoff;
 
     if (minimap->main_map && minimap->drawing && (! minimap->finished)) { // Main map
       vp.Height *= x;
@@ -1133,17 +2756,18 @@ D3D9DrawIndexedPrimitive_Detour (IDirect3DDevice9* This,
       vp.Y += ((float)viewport.Height - vp.Height / x) / 2.0f;
     }
 
-    D3D9SetViewport_Original (This, &vp);
+    vp_shadow.apply (This, vp);
 
     minimap->prims_drawn++;
+  } else {
+    vp_shadow.flush (This);
   }
 
 #if 0
   if (needs_center && needs_aspect) {
     D3DVIEWPORT9 vp = viewport;
-    float x, y;
-    float x_off, y_off;
-    AD_ComputeAspectCoeffs (x, y, x_off, y_off);
+    const float x     = display.viewport.x,    y     = display.viewport.y;
+    const float x_off = display.viewport.xoff, y_off = display.viewport.yoff;
 
     if (config.render.center_ui) {
       vp.Width /= x;
@@ -1157,6 +2781,8 @@ D3D9DrawIndexedPrimitive_Detour (IDirect3DDevice9* This,
   if (nametags->drawing && nametags->shouldDrawOnTop ()) {
     // Draw once normally
     if (nametags->top_technique > 1) {
+      rs_shadow.flush (This);
+
       D3D9DrawIndexedPrimitive_Original ( This, Type,
                                             BaseVertexIndex, MinVertexIndex,
                                                NumVertices, startIndex,
@@ -1164,6 +2790,8 @@ D3D9DrawIndexedPrimitive_Detour (IDirect3DDevice9* This,
     }
 
     nametags->beginPrimitive (This);
+  } else {
+    rs_shadow.flush (This);
   }
 
   HRESULT
@@ -1176,7 +2804,7 @@ D3D9DrawIndexedPrimitive_Detour (IDirect3DDevice9* This,
     nametags->endPrimitive (This);
 
   if (minimap->drawing /*|| (needs_center && needs_aspect)*/) {
-    D3D9SetViewport_Original (This, &viewport);
+    vp_shadow.release (This);
   }
 
   return hr;
@@ -1193,6 +2821,39 @@ SetVertexShaderConstantF_t D3D9SetVertexShaderConstantF_Original = nullptr;
 
 float name_shift_coeff = 1.01f;
 
+//
+// Every upload the vertex constant detour makes goes through here, so that
+//   vs_consts mirrors what the device actually has (fixups included).
+//
+static inline
+HRESULT
+AD_SetVertexShaderConstantF ( IDirect3DDevice9* This,
+                              UINT              StartRegister,
+                              CONST float*      pConstantData,
+                              UINT              Vector4fCount )
+{
+  uint32_t changed =
+    vs_consts.write (StartRegister, pConstantData, Vector4fCount);
+
+  if ( changed == 0 && call_filter.active () && Vector4fCount > 0 &&
+       StartRegister + Vector4fCount <= vs_consts.num_vec4s ) {
+    ++call_filter.dropped.vs_consts;
+    return D3D_OK;
+  }
+
+  HRESULT hr =
+    D3D9SetVertexShaderConstantF_Original ( This,
+                                              StartRegister,
+                                                pConstantData,
+                                                  Vector4fCount );
+
+  // The device kept whatever it had; don't let the filter drop the retry
+  if (FAILED (hr))
+    vs_consts.forget (StartRegister, Vector4fCount);
+
+  return hr;
+}
+
 COM_DECLSPEC_NOTHROW
 HRESULT
 STDMETHODCALLTYPE
@@ -1209,6 +2870,17 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
                                                          Vector4fCount );
   }
 
+  if (AD_FastPath ()) {
+    return AD_SetVertexShaderConstantF ( This,
+                                           StartRegister,
+                                             pConstantData,
+                                               Vector4fCount );
+  }
+
+  const uint32_t verdict =
+    draw_rules.evaluate ( AD_RULE_STAGE_VS, vs_checksum, ps_checksum,
+                            StartRegister, pConstantData, Vector4fCount );
+
 #if 0
   if (scissoring) {
     dll_log.Log ( L" SetVertexShaderConstantF (%x) - Start: %lu, Count: %lu",
@@ -1224,7 +2896,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
   //
   // Post-Processing Fix (e.g. DoF)
   //
-  if (ui.drawing && (float)viewport.Width / (float)viewport.Height > (16.0f / 9.0f) && postproc.fix_dof && StartRegister == 1 && Vector4fCount == 1 && pConstantData [2] == 0.0f && pConstantData [3] == 0.0f) {
+  if (ui.drawing && display.vp_wider && postproc.fix_dof && (verdict & AD_RULE_DOF)) {
     float inv_x         = 1.0f / pConstantData [0];
     float inv_y         = 1.0f / pConstantData [1];
     const float aspect  = 16.0f / 9.0f;
@@ -1235,7 +2907,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       //dll_log.Log (L"DoF Vertex Shader: %x - ps: %x", vs_checksum, ps_checksum);
       //dll_log.Log (L"Fixed Depth Of Field...");
 
-      float ar       = (float)viewport.Width / (float)viewport.Height;
+      float ar       = display.vp_aspect;
 
       float pFixedConstants [4];
 
@@ -1247,7 +2919,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       //dll_log.Log (L" Y Before: %f, Y After: %f", inv_y, 1.0f / pFixedConstants [1]);
 
       if (ui.widescreen)
-        return D3D9SetVertexShaderConstantF_Original (This, StartRegister, pFixedConstants, Vector4fCount);
+        return AD_SetVertexShaderConstantF (This, StartRegister, pFixedConstants, Vector4fCount);
     }
   }
 
@@ -1255,8 +2927,8 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
   //
   // Map and Mini-Map Fix
   //
-  if (config.render.fix_minimap && config.render.aspect_correction && current_shader.vs == &vs_minimap0) {
-    if (StartRegister == 2 && pConstantData [1] >= -(1.0f / (float)ad::RenderFix::height/*(float)viewport.Height*/) - 0.000001 && pConstantData [1] <= -(1.0f / (float)ad::RenderFix::height/*(float)viewport.Height*/) + 0.000001) {
+  if (config.render.fix_minimap && config.render.aspect_correction && current_shader.is (current_shader.vs, AD_SHADER_ROLE_MINIMAP)) {
+    if (StartRegister == (UINT)current_shader.vs->params [0] && pConstantData [1] >= -display.inv_height - 0.000001 && pConstantData [1] <= -display.inv_height + 0.000001) {
 #if 0
         dll_log.Log ( L" SetVertexShaderConstantF (%li) - Start: %lu, Count: %lu",
                         vs_checksum, StartRegister, Vector4fCount );
@@ -1269,12 +2941,8 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
 
       float pNotConstantData [16];
 
-      float ar       = (float)viewport.Width / (float)viewport.Height;
-      float ar_scale = ar / (16.0f / 9.0f);
-
-      float x_scale, y_scale;
-      float x_off,   y_off;
-      AD_ComputeAspectCoeffs (x_scale, y_scale, x_off, y_off);
+      const float x_scale = display.viewport.x,    y_scale = display.viewport.y;
+      const float x_off   = display.viewport.xoff, y_off   = display.viewport.yoff;
 
       // Vertical Fix
       for (UINT i = 1; i < Vector4fCount * 4; i += 2) {
@@ -1288,7 +2956,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       minimap->drawing = true;
 
       if (ui.widescreen)
-        return D3D9SetVertexShaderConstantF_Original (This, StartRegister, pNotConstantData, Vector4fCount);
+        return AD_SetVertexShaderConstantF (This, StartRegister, pNotConstantData, Vector4fCount);
     }
   }
 
@@ -1301,15 +2969,13 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       pNotConstantData [1] = pConstantData [1] / ar_scale;
       //pNotConstantData [2] = pConstantData [2] / ar_scale;
       //pNotConstantData [3] = pConstantData [3] / ar_scale;
-      return D3D9SetVertexShaderConstantF_Original (This, StartRegister, pNotConstantData, Vector4fCount);
+      return AD_SetVertexShaderConstantF (This, StartRegister, pNotConstantData, Vector4fCount);
   }
 #endif
 
   // Quest indicators are 128x128 textures billboarded before nametags (phase 1 of 2)
-  if (ui.drawing && StartRegister == 11 && Vector4fCount == 1) {
-    if (pConstantData [0] == 0.0078125f) // 1.0 / 128.0
-      ui.drawing_quest = true;
-  }
+  if (ui.drawing && (verdict & AD_RULE_QUEST_MARKER))
+    ui.drawing_quest = true;
 
 #if 1
   if (ui.drawing) {
@@ -1332,7 +2998,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       minimap->prim_zpos = pConstantData [14];
     }
 
-  if (ui.drawing && (! minimap->main_map) && config.render.aspect_correction && viewport.Width / viewport.Height == ad::RenderFix::width / ad::RenderFix::height && (StartRegister == 1/* || StartRegister == 9*/)) {
+  if (ui.drawing && (! minimap->main_map) && config.render.aspect_correction && display.vp_matches_bb && (StartRegister == 1/* || StartRegister == 9*/)) {
     //last_vs = 0x5c8f22bc && last_ps == 0xbf9778a
 
     //
@@ -1343,7 +3009,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
 
     trigger = nametags->trigger ( ui.last_z,
                                     pConstantData [13],
-                                      pConstantData [14],
+                                      (verdict & AD_RULE_UI_DEPTH) != 0,
                                         pConstantData [15],
                                           pConstantData [10] );
 
@@ -1376,8 +3042,8 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
                                 ps_checksum );
     }
 
-    float ar       = (float)viewport.Width / (float)viewport.Height;
-    float ar_scale = ar / (16.0f / 9.0f);
+    const float ar_scale     = display.ar_scale;
+    const float inv_ar_scale = display.inv_ar_scale;
 
     //dll_log.Log (L"Vertex Shader: %x ", vs_checksum);
 
@@ -1404,12 +3070,16 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
         }
 #endif
 
-      float x_scale, y_scale;
-      float x_off,   y_off;
-      AD_ComputeAspectCoeffs (x_scale, y_scale, x_off, y_off);
+      const float x_scale = display.viewport.x,    y_scale = display.viewport.y;
+      const float x_off   = display.viewport.xoff, y_off   = display.viewport.yoff;
+
+      if (xform_bench.record > 0)
+        xform_bench.add (pConstantData, x_scale);
 
       height = (9.0f / 16.0f) * width;
 
+      // Divided, not multiplied by cached reciprocals: the rewritten
+      //   translation must stay bit-identical to what it always was
       float x_ndc = 2.0f * ((x_pos / x_scale) /  width) - 1.0f;
       float y_ndc = 2.0f * ((y_pos / y_scale) / height) - 1.0f;
 
@@ -1422,7 +3092,7 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
 
         if (ui.center) {
           // The background on menu screens uses this scale, and we always want to stretch it
-          if (pConstantData [0] == 1.0f && pConstantData [5] == 1.5f) {
+          if (verdict & AD_RULE_MENU_BG) {
             ui.drawing_menu = true;
             ui.center       = false;
           }
@@ -1448,14 +3118,14 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       }
 
       // Background UI stuff
-      if (current_shader.ps == &ps_bg0 && (! ui.bg_filled)) {
+      if (current_shader.is (current_shader.ps, AD_SHADER_ROLE_BACKGROUND) && (! ui.bg_filled)) {
         ui.center    = false;
         ui.bg_filled = true;
       }
 
       // All fullscreen effects have translation of 640 horizontally and 360 vertically...
       //   this is precisely 1/2 of the Xbox 360's native resolution.
-      if (pConstantData [12] == 640.0f && pConstantData [13] == 360.0f && (pConstantData [14] <= 32.0f) && (ps_checksum != 0xf22375e3)) {
+      if (verdict & AD_RULE_FULLSCREEN) {
         if (tracer.log_frame && config.trace.ui)
           dll_log.Log ( L" Fullscreen effect detected: <%f,%f,%f> (vs=%x, ps=%x)",
                           pConstantData [12],
@@ -1463,7 +3133,8 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
                               pConstantData [14],
                                 vs_checksum, ps_checksum );
 
-        ui.center = false;
+        ui.center           = false;
+        postproc.fullscreen = true;
       }
 
       if (tracer.log_frame && config.trace.ui && (! ui.center) && (! minimap->drawing)) {
@@ -1491,76 +3162,91 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
         dll_log.Log (L" Rotated: (%2.1f, %2.1f)", xx, yy);
       }
 
-      if (ui.center)
-        pNotConstantData [0] /= ar_scale;
-      //else if (nametags->drawing) {
-        //pNotConstantData [0] /= ar_scale;
-      //}
+      //
+      // Everything below depends only on the incoming block and on the state
+      //   hashed alongside it, so HUD elements re-uploading the same block
+      //     every frame are served from ui_memo.  Every input the rewrite
+      //       reads belongs in memo_state.
+      //
+      uint32_t memo_state [ad_ui_memo_s::STATE_WORDS];
+
+      const bool name_fix = (! ui.drawing_menu) && nametags->drawing &&
+                              nametags->shouldAspectCorrect ();
+
+      memo_state [0] = (ui.center         ? ad_ui_memo_s::STATE_CENTER      : 0) |
+                       (minimap->drawing  ? ad_ui_memo_s::STATE_MINIMAP     : 0) |
+                       (nametags->drawing ? ad_ui_memo_s::STATE_NAMETAGS    : 0) |
+                       (name_fix          ? ad_ui_memo_s::STATE_NAMETAG_FIX : 0) |
+                       (ui.drawing        ? ad_ui_memo_s::STATE_UI          : 0) |
+                       (ui.drawing_menu   ? ad_ui_memo_s::STATE_MENU        : 0) |
+                       (minimap->main_map ? ad_ui_memo_s::STATE_MAIN_MAP    : 0);
+      memo_state [1] = display.generation;
+
+      memcpy (&memo_state [2], &config.scaling.hud_x_offset, sizeof (float));
+      memcpy (&memo_state [3], &name_shift_coeff,            sizeof (float));
+      memcpy (&memo_state [4], &minimap_scale,               sizeof (float));
+
+      memo_state [5] = viewport.Width;
+      memo_state [6] = viewport.Height;
+
+      if (! (ui_memo.enable && ui_memo.lookup (pConstantData, memo_state, pNotConstantData))) {
+        if (ui.center)
+          pNotConstantData [0] /= ar_scale;
+        //else if (nametags->drawing) {
+          //pNotConstantData [0] /= ar_scale;
+        //}
 
-      pNotConstantData [1] /= ar_scale;
-      pNotConstantData [4] /= ar_scale;
-      pNotConstantData [5] /= ar_scale;
+        pNotConstantData [1] /= ar_scale;
+        pNotConstantData [4] /= ar_scale;
+        pNotConstantData [5] /= ar_scale;
 
-      ////dll_log.Log (L"x_off, ar_scale, x_scale, maybe?, maybe? : %f, %f, %f, %f, %f", x_off, ar_scale, x_scale, x_off / ar_scale, x_off / x_scale);
+        ////dll_log.Log (L"x_off, ar_scale, x_scale, maybe?, maybe? : %f, %f, %f, %f, %f", x_off, ar_scale, x_scale, x_off / ar_scale, x_off / x_scale);
 
 
-      float scale_trans [16];
-      float scale [16] = { 1.0f/x_scale, 0.0f,    0.0f, 0.0f,
-                           0.0f,         y_scale, 0.0f, 0.0f,
-                           0.0f,         0.0f,    1.0f, 0.0f,
-                           0.0f,         0.0f,    0.0f, 1.0f };
-      float trans [16] = { 1.0f, 0.0f, 0.0f, 0.0f,
-                           0.0f, 1.0f, 0.0f, 0.0f,
-                           0.0f, 0.0f, 1.0f, 0.0f,
-                           (((x_ndc * (float)viewport.Width + (float)viewport.Width) / 2.0f)), ((y_ndc * viewport.Height + viewport.Height) / 2.0f), 0.0f, 1.0f };
+        float scale_trans [16];
+        float scale [4] = { 1.0f/x_scale, y_scale, 1.0f, 1.0f };
+        float trans [3] = { (((x_ndc * (float)viewport.Width + (float)viewport.Width) / 2.0f)), ((y_ndc * viewport.Height + viewport.Height) / 2.0f), 0.0f };
 
-      for (int i = 0; i < 16; i += 4)
-        for (int j = 0; j < 4; j++)
-          scale_trans [i+j] = scale [i] * trans [j] + scale [i+1] * trans [j+4] + scale [i+2] * trans [j+8] + scale [i+3] * trans [j+12];
+        AD_Xform_ScaleTranslate (scale_trans, scale, trans);
 
-      if (ui.center)
-        pNotConstantData [12] = ((x_ndc * (float)viewport.Width + (float)viewport.Width) / 2.0f) + config.scaling.hud_x_offset;
+        if (ui.center)
+          pNotConstantData [12] = ((x_ndc * (float)viewport.Width + (float)viewport.Width) / 2.0f) + config.scaling.hud_x_offset;
 
-      pNotConstantData [13] = scale_trans [13];
+        pNotConstantData [13] = scale_trans [13];
 
-      if (true) {
-        float scale2 [16] = { 1.0f/ar_scale, 0.0f,         0.0f, 0.0f,
-                              0.0f,         1.0f/ar_scale, 0.0f, 0.0f,
-                              0.0f,         0.0f,          1.0f/ar_scale, 0.0f,
-                              0.0f,         0.0f,          0.0f, 1.0f };
-        float orig [16] = { pConstantData [ 0], pConstantData [ 1], pConstantData [ 2], pConstantData [ 3],
-                            pConstantData [ 4], pConstantData [ 5], pConstantData [ 6], pConstantData [ 7],
-                            pConstantData [ 8], pConstantData [ 9], pConstantData [10], pConstantData [11],
-                            pConstantData [12], pConstantData [13], pConstantData [14], pConstantData [15] };
+        if (true) {
+          float scale2 [4] = { inv_ar_scale, inv_ar_scale, inv_ar_scale, 1.0f };
 
-        float scaled [16];
+          float scaled [16];
 
-        for (int i = 0; i < 16; i += 4)
-          for (int j = 0; j < 4; j++)
-            scaled [i+j] = scale2 [i] * orig [j] + scale2 [i+1] * orig [j+4] + scale2 [i+2] * orig [j+8] + scale2 [i+3] * orig [j+12];
+          AD_Xform_DiagScale (scaled, scale2, pConstantData);
 
-        if (minimap->drawing || ui.center)
-          pNotConstantData [0] = scaled [0];
+          if (minimap->drawing || ui.center)
+            pNotConstantData [0] = scaled [0];
 
-        if (! ui.center)
-          pNotConstantData [12] = scaled [12];
+          if (! ui.center)
+            pNotConstantData [12] = scaled [12];
 
-        if ((! ui.drawing_menu) && nametags->drawing && (nametags->shouldAspectCorrect ())) {
-          //dll_log.Log (L"Pos X: %9.7f <Scale: %9.7f> - %9.7f", scale_trans [12], pNotConstantData [0], scale_trans [12] / pNotConstantData [0]);
-          pNotConstantData [12] = scale_trans [12] * (ar_scale * name_shift_coeff);
-          pNotConstantData [0] /= ar_scale;
-        }
+          if ((! ui.drawing_menu) && nametags->drawing && (nametags->shouldAspectCorrect ())) {
+            //dll_log.Log (L"Pos X: %9.7f <Scale: %9.7f> - %9.7f", scale_trans [12], pNotConstantData [0], scale_trans [12] / pNotConstantData [0]);
+            pNotConstantData [12] = scale_trans [12] * (ar_scale * name_shift_coeff);
+            pNotConstantData [0] /= ar_scale;
+          }
 
-        pNotConstantData [1] = scaled [1];
-        pNotConstantData [4] = scaled [4];
-        pNotConstantData [5] = scaled [5];
+          pNotConstantData [1] = scaled [1];
+          pNotConstantData [4] = scaled [4];
+          pNotConstantData [5] = scaled [5];
 
-        if (ui.drawing && (! minimap->main_map) && minimap->drawing) {
-          pNotConstantData [0] *= ar_scale * minimap_scale;
-          pNotConstantData [1] *= ar_scale * minimap_scale;
-          pNotConstantData [4] *= ar_scale * minimap_scale;
-          pNotConstantData [5] *= ar_scale * minimap_scale;
+          if (ui.drawing && (! minimap->main_map) && minimap->drawing) {
+            pNotConstantData [0] *= ar_scale * minimap_scale;
+            pNotConstantData [1] *= ar_scale * minimap_scale;
+            pNotConstantData [4] *= ar_scale * minimap_scale;
+            pNotConstantData [5] *= ar_scale * minimap_scale;
+          }
         }
+
+        if (ui_memo.enable)
+          ui_memo.store (pConstantData, memo_state, pNotConstantData);
       }
 
       if (minimap->drawing) {
@@ -1572,16 +3258,125 @@ D3D9SetVertexShaderConstantF_Detour (IDirect3DDevice9* This,
       ///////pNotConstantData [13] += ((float)viewport.Height - viewport.Height / x_scale) / 2.0f;
 
       if (ui.widescreen)
-        return D3D9SetVertexShaderConstantF_Original (This, StartRegister, pNotConstantData, Vector4fCount);
+        return AD_SetVertexShaderConstantF (This, StartRegister, pNotConstantData, Vector4fCount);
     }
 
     //if (pConstantData [12] == 640.0 && pConstantData [13] == 420.0)
       //dll_log.Log (L"UI Shader Detected: (vs=%x,ps=%x)", vs_checksum, ps_checksum);
   }} while (false);
 
-  return D3D9SetVertexShaderConstantF_Original (This, StartRegister, pConstantData, Vector4fCount);
+  return AD_SetVertexShaderConstantF (This, StartRegister, pConstantData, Vector4fCount);
+}
+
+
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+AD_NullSetVertexShaderConstantF ( IDirect3DDevice9*, UINT, CONST float*, UINT )
+{
+  return D3D_OK;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+AD_NullDrawIndexedPrimitive ( IDirect3DDevice9*, D3DPRIMITIVETYPE,
+                              INT, UINT, UINT, UINT, UINT )
+{
+  return D3D_OK;
 }
 
+//
+// Runs draws x (SetVertexShaderConstantF + DrawIndexedPrimitive) through the
+//   detours as world geometry, once with the fast path and once without,
+//     with the driver swapped out so only our own overhead is measured.
+//
+//  * Must be called on the render thread, between frames.
+//
+void
+AD_DrawBenchmark (int draws)
+{
+  if ( D3D9SetVertexShaderConstantF_Original == nullptr ||
+       D3D9DrawIndexedPrimitive_Original     == nullptr ||
+       ad::RenderFix::pDevice                == nullptr )
+    return;
+
+  SetVertexShaderConstantF_t vs_const = D3D9SetVertexShaderConstantF_Original;
+  DrawIndexedPrimitive_t     draw     = D3D9DrawIndexedPrimitive_Original;
+
+  D3D9SetVertexShaderConstantF_Original = AD_NullSetVertexShaderConstantF;
+  D3D9DrawIndexedPrimitive_Original     = AD_NullDrawIndexedPrimitive;
+
+  const uint32_t     vs_crc = vs_checksum,       ps_crc = ps_checksum;
+  dd_shader_s* const vs_trk = current_shader.vs, *ps_trk = current_shader.ps;
+  const bool         enable = fastpath.enable;
+
+  current_shader.vs = nullptr;
+  current_shader.ps = nullptr;
+
+  // Any pair that is not being culled, by the console or an enabled cull set
+  //   (the odd step never lands back on the console pair)
+  bool unculled = false;
+
+  for (uint32_t i = 1; i <= 64 && (! unculled); i++) {
+    vs_checksum = debug.cull_vs + i * 0x9e3779b9;
+    ps_checksum = debug.cull_ps + i * 0x9e3779b9;
+
+    unculled = cull_sets.bind (vs_checksum, ps_checksum, AD_SHADER_ROLE_NONE) == 0;
+  }
+
+  const float block [16] = { 1.0f, 0.0f, 0.0f, 0.0f,
+                             0.0f, 1.0f, 0.0f, 0.0f,
+                             0.0f, 0.0f, 1.0f, 0.0f,
+                             0.0f, 0.0f, 0.0f, 1.0f };
+
+  LARGE_INTEGER freq, start, end;
+  QueryPerformanceFrequency (&freq);
+
+  double ns_per_draw [2];
+
+  for (int pass = 0; pass < 2 && unculled; pass++) {
+    fastpath.enable = (pass == 1);
+    fastpath.update ();
+
+    QueryPerformanceCounter (&start);
+
+    for (int i = 0; i < draws; i++) {
+      D3D9SetVertexShaderConstantF_Detour ( ad::RenderFix::pDevice, 0, block, 4 );
+      D3D9DrawIndexedPrimitive_Detour     ( ad::RenderFix::pDevice,
+                                              D3DPT_TRIANGLELIST, 0, 0, 3, 0, 1 );
+    }
+
+    QueryPerformanceCounter (&end);
+
+    ns_per_draw [pass] =
+      (double)(end.QuadPart - start.QuadPart) * 1.0e9 /
+        (double)freq.QuadPart / (double)draws;
+  }
+
+  D3D9SetVertexShaderConstantF_Original = vs_const;
+  D3D9DrawIndexedPrimitive_Original     = draw;
+
+  vs_checksum       = vs_crc;
+  ps_checksum       = ps_crc;
+  current_shader.vs = vs_trk;
+  current_shader.ps = ps_trk;
+  fastpath.enable   = enable;
+  fastpath.update ();
+
+  if (! unculled) {
+    dll_log.Log (L" [DrawBench] Every shader pair tried is culled; disable the cull sets and retry.");
+    return;
+  }
+
+  // The synthetic uploads never reached the device
+  vs_consts.invalidate ();
+
+  dll_log.Log ( L" [DrawBench] %d world draws: %7.2f ns/draw (checks), "
+                L"%7.2f ns/draw (fast path)",
+                  draws, ns_per_draw [0], ns_per_draw [1] );
+}
 
 
 typedef HRESULT (STDMETHODCALLTYPE *SetPixelShaderConstantF_t)(
@@ -1592,6 +3387,34 @@ typedef HRESULT (STDMETHODCALLTYPE *SetPixelShaderConstantF_t)(
 
 SetVertexShaderConstantF_t D3D9SetPixelShaderConstantF_Original = nullptr;
 
+//
+// Every return from the detour below (background mode included) goes
+//   through here, so that ps_consts and the call filter see the same
+//     stream of writes whatever else was skipped.
+//
+static inline HRESULT
+AD_ForwardPSConstants ( IDirect3DDevice9* This,
+                        UINT              StartRegister,
+                        CONST float*      pConstantData,
+                        UINT              Vector4fCount,
+                        uint32_t          changed )
+{
+  if ( changed == 0 && call_filter.active () && Vector4fCount > 0 &&
+       StartRegister + Vector4fCount <= ps_consts.num_vec4s ) {
+    ++call_filter.dropped.ps_consts;
+    return D3D_OK;
+  }
+
+  HRESULT hr =
+    D3D9SetPixelShaderConstantF_Original (This, StartRegister, pConstantData, Vector4fCount);
+
+  // Nothing reached the device
+  if (FAILED (hr))
+    ps_consts.forget (StartRegister, Vector4fCount);
+
+  return hr;
+}
+
 COM_DECLSPEC_NOTHROW
 HRESULT
 STDMETHODCALLTYPE
@@ -1608,6 +3431,17 @@ D3D9SetPixelShaderConstantF_Detour (IDirect3DDevice9* This,
                                                         Vector4fCount );
   }
 
+  const uint32_t changed =
+    ps_consts.write (StartRegister, pConstantData, Vector4fCount);
+
+  // Background mode: nothing is fixed up, so the UI needn't be detected
+  if (background.skip_fixups)
+    return AD_ForwardPSConstants (This, StartRegister, pConstantData, Vector4fCount, changed);
+
+  const uint32_t verdict =
+    draw_rules.evaluate ( AD_RULE_STAGE_PS, vs_checksum, ps_checksum,
+                            StartRegister, pConstantData, Vector4fCount );
+
   if (ui.scissoring) {
 #if 0
     dll_log.Log ( L" SetPixelShaderConstantF (%x) - Start: %lu, Count: %lu",
@@ -1622,15 +3456,12 @@ D3D9SetPixelShaderConstantF_Detour (IDirect3DDevice9* This,
 
   // When the game switches from rendering the world to the UI, it's as simple as looking for the first
   //   occurence of this pattern.
-  if (StartRegister == 1 && Vector4fCount == 1) {
-    if (pConstantData [0] == 0.5f && pConstantData [1] == 2.0f &&
-        pConstantData [2] == 1.0f && pConstantData [3] == 1.0f) {
-      if (! ui.drawing) {
-        if (tracer.log_frame && config.trace.ui)
-          dll_log.Log (L"Forcing ARC On Because of Pixel Shader");
-      }
-      ui.drawing = true;
+  if (verdict & AD_RULE_UI_BEGIN) {
+    if (! ui.drawing) {
+      if (tracer.log_frame && config.trace.ui)
+        dll_log.Log (L"Forcing ARC On Because of Pixel Shader");
     }
+    ui.drawing = true;
   }
 
   // If this is a tracked pixel shader ...
@@ -1644,23 +3475,18 @@ D3D9SetPixelShaderConstantF_Detour (IDirect3DDevice9* This,
                                              pConstantData [i*4+2], pConstantData [i*4+3] );
       }
 
-      if (memcmp ( &current_shader.ps->constants.vec4s [StartRegister].data [0],
-                     pConstantData,
-                       sizeof (float) * 4 * min (Vector4fCount, dd_shader_s::MAX_VEC4S)) )
-        dll_log.Log ( L"     * CHANGED values detected");
+      if (changed > 0)
+        dll_log.Log ( L"     * CHANGED values detected (%lu vec4s)", changed);
     }
-
-    memcpy ( &current_shader.ps->constants.vec4s [StartRegister].data [0],
-               pConstantData,
-                 sizeof (float) * 4 * min (Vector4fCount, dd_shader_s::MAX_VEC4S) );
   }
 
   if (minimap->drawing) {
     // Accurately detect only the center triangle on the mini-map
-    if (StartRegister == 4 && Vector4fCount == 1 && pConstantData [0] == 1.0f && pConstantData [1] == 1.0f &&
-                                                    pConstantData [2] == 1.0f && pConstantData [3] == 1.0f &&
-        minimap->drawing) {
-      if (minimap->prim_ypos > 575.0f && minimap->prim_ypos < 585.0f && minimap->prim_xpos > 165.0f && minimap->prim_xpos < 175.0f) {
+    if (verdict & AD_RULE_MINIMAP_CENTER) {
+      // Params: x_min, x_max, y_min, y_max of the primitive's position
+      const float* window = draw_rules.params (AD_RULE_MINIMAP_CENTER);
+
+      if (minimap->prim_ypos > window [2] && minimap->prim_ypos < window [3] && minimap->prim_xpos > window [0] && minimap->prim_xpos < window [1]) {
         if (tracer.log_frame && config.trace.minimap)
           dll_log.Log (L" Center Primitive: VS: %x, PS: %x", vs_checksum, ps_checksum);
         minimap->center_prim = true;
@@ -1675,7 +3501,7 @@ D3D9SetPixelShaderConstantF_Detour (IDirect3DDevice9* This,
       minimap->ps23 = pConstantData [3];
   }
 
-  return D3D9SetPixelShaderConstantF_Original (This, StartRegister, pConstantData, Vector4fCount);
+  return AD_ForwardPSConstants (This, StartRegister, pConstantData, Vector4fCount, changed);
 }
 
 
@@ -1741,6 +3567,11 @@ BMF_SetPresentParamsD3D9_Detour (IDirect3DDevice9*      device,
 
   ad::RenderFix::pDevice             = device;
 
+  // The game creates its scene targets (and loads most textures) straight
+  //   after this, long before the first frame is presented
+  AD_HookResourceCreation (device);
+  AD_HookTextureUploads   (device);
+
   if (pparams != nullptr) {
     memcpy (&present_params, pparams, sizeof D3DPRESENT_PARAMETERS);
 
@@ -1807,11 +3638,23 @@ BMF_SetPresentParamsD3D9_Detour (IDirect3DDevice9*      device,
     // Optimized centers to avoid post-processing noise
     //
 
-    float x,    y;
-    float xoff, yoff;
+    AD_SetBackbufferGeometry (ad::RenderFix::width, ad::RenderFix::height);
+    rt_shadow.reset          (ad::RenderFix::width, ad::RenderFix::height);
+    render_scale.reset       ();
 
-    extern void AD_ComputeAspectCoeffsEx (float& x, float& y, float& xoff, float& yoff, bool force);
-    AD_ComputeAspectCoeffsEx (x, y, xoff, yoff, true);
+    // The backbuffer copy can't survive Reset, and neither can the frame pacing
+    background.release    ();
+    frame_limiter.restart ();
+
+    // Reset puts a full-surface viewport and default states back on the device
+    vp_shadow.invalidate ();
+    rs_shadow.invalidate ();
+    vs_consts.invalidate ();
+    ps_consts.invalidate ();
+    tex_shadow.invalidate ();
+
+    const float x    = display.forced.x,    y    = display.forced.y;
+    const float xoff = display.forced.xoff, yoff = display.forced.yoff;
 
     dll_log.Log ( L" [Scaling] (  X  : %11.6f,   Y  : %11.6f )",
                     x, y );
@@ -1862,6 +3705,8 @@ BMF_SetPresentParamsD3D9_Detour (IDirect3DDevice9*      device,
 
       dll_log.Log ( L" <AutoCal> ( Mouse.YOffset=%11.6f", config.scaling.mouse_y_offset );
       dll_log.Log ( L"               HUD.XOffset=%11.6f ) { %s }", xoff_auto, aspect.c_str () );
+
+      AD_InvalidateDisplayGeometry ();
     } else {
       dll_log.Log ( L" <UserSet> ( Mouse.YOffset=%11.6f",
                       config.scaling.mouse_y_offset );
@@ -1924,6 +3769,17 @@ BMF_SetPresentParamsD3D9_Detour (IDirect3DDevice9*      device,
 void
 ad::RenderFix::Init (void)
 {
+  InitializeCriticalSectionAndSpinCount (&cs_shader_tables, 1024);
+
+  draw_rules.load     (L"AgDrag.rules.ini");
+  shader_db.load      (L"AgDrag.shaders.ini");
+  cull_sets.load      (L"AgDrag.cull.ini");
+  texture_policy.load (L"AgDrag.textures.ini");
+
+  if (texture_pack.open ("AgDrag.texpack"))
+    dll_log.Log ( L" [TexPack] Mapped AgDrag.texpack (%d replacements, %s fingerprints)",
+                    texture_pack.size (), texture_pack.sampled () ? L"sampled" : L"full" );
+
   AD_CreateDLLHook ( config.system.injector.c_str (),
                      "D3D9SetViewport_Override",
                       D3D9SetViewport_Detour,
@@ -1934,12 +3790,10 @@ ad::RenderFix::Init (void)
                       D3D9SetScissorRect_Detour,
             (LPVOID*)&D3D9SetScissorRect_Original );
 
-#if 0
   AD_CreateDLLHook ( config.system.injector.c_str (),
                      "D3D9StretchRect_Override",
                       D3D9StretchRect_Detour,
             (LPVOID*)&D3D9StretchRect_Original );
-#endif
 
   AD_CreateDLLHook ( config.system.injector.c_str (),
                      "D3D9DrawPrimitive_Override",
@@ -1956,6 +3810,16 @@ ad::RenderFix::Init (void)
                       D3D9SetVertexShaderConstantF_Detour,
             (LPVOID*)&D3D9SetVertexShaderConstantF_Original );
 
+  AD_CreateDLLHook ( config.system.injector.c_str (),
+                     "D3D9CreateVertexShader_Override",
+                      D3D9CreateVertexShader_Detour,
+            (LPVOID*)&D3D9CreateVertexShader_Original );
+
+  AD_CreateDLLHook ( config.system.injector.c_str (),
+                     "D3D9CreatePixelShader_Override",
+                      D3D9CreatePixelShader_Detour,
+            (LPVOID*)&D3D9CreatePixelShader_Original );
+
   AD_CreateDLLHook ( config.system.injector.c_str (),
                      "D3D9SetVertexShader_Override",
                       D3D9SetVertexShader_Detour,
@@ -2006,15 +3870,18 @@ ad::RenderFix::CommandProcessor::CommandProcessor (void)
 {
   center_ui_    = new eTB_VarStub <bool>  (&config.render.center_ui);
 
-  eTB_Variable* aspect_correction   = new eTB_VarStub <bool>  (&config.render.aspect_correction);
+  aspect_correction_ = new eTB_VarStub <bool>  (&config.render.aspect_correction, this);
+  mouse_y_offset_    = new eTB_VarStub <float> (&config.scaling.mouse_y_offset,    this);
 
   eTB_CommandProcessor* pCommandProc = SK_GetCommandProcessor ();
 
-  pCommandProc->AddVariable ("AspectCorrection", aspect_correction);
+  pCommandProc->AddVariable ("AspectCorrection", aspect_correction_);
   pCommandProc->AddVariable ("CenterUI",         center_ui_);
   pCommandProc->AddVariable ("NameShiftCoeff",   new eTB_VarStub <float> (&name_shift_coeff));
   pCommandProc->AddVariable ("AllowScissor",     new eTB_VarStub <bool>  (&debug.allow_scissor));
   pCommandProc->AddVariable ("FixMinimap",       new eTB_VarStub <bool>  (&config.render.fix_minimap));
+  pCommandProc->AddVariable ("FixScissor",       new eTB_VarStub <bool>  (&config.render.fix_scissor));
+  pCommandProc->AddVariable ("FixBlits",         new eTB_VarStub <bool>  (&config.render.fix_blits));
   pCommandProc->AddVariable ("VertFixMap",       new eTB_VarStub <bool>  (&vert_fix_map));
 
   pCommandProc->AddVariable ("FixDOF",           new eTB_VarStub <bool>  (&postproc.fix_dof));
@@ -2032,12 +3899,103 @@ ad::RenderFix::CommandProcessor::CommandProcessor (void)
 
   pCommandProc->AddVariable ("Render.AllowBG",   new eTB_VarStub <bool>  (&config.render.allow_background));
 
+  pCommandProc->AddVariable ("Render.FrameLimiter.PostPresent", new eTB_VarStub <bool>  (&config.render.limiter_post));
+  pCommandProc->AddVariable ("Render.FrameLimiter.SpinMs",      new eTB_VarStub <float> (&config.render.limiter_spin_ms));
+  pCommandProc->AddVariable ("Render.FrameLimiter.MeanMs",      new eTB_VarStub <float> (&frame_limiter.stats.mean_ms));
+  pCommandProc->AddVariable ("Render.FrameLimiter.VarianceMs",  new eTB_VarStub <float> (&frame_limiter.stats.variance_ms));
+  pCommandProc->AddVariable ("Render.FrameLimiter.StdDevMs",    new eTB_VarStub <float> (&frame_limiter.stats.stddev_ms));
+  pCommandProc->AddVariable ("Render.FrameLimiter.WorstMs",     new eTB_VarStub <float> (&frame_limiter.stats.worst_ms));
+  pCommandProc->AddVariable ("Render.FrameLimiter.Missed",      new eTB_VarStub <int>   (&frame_limiter.stats.missed));
+  pCommandProc->AddVariable ("Render.FrameLimiter.Overslept",   new eTB_VarStub <int>   (&frame_limiter.stats.overslept));
+  pCommandProc->AddVariable ("Render.FrameLimiter.Frames",      new eTB_VarStub <int>   (&frame_limiter.stats.frames));
+
+  pCommandProc->AddVariable ("Render.Background",           new eTB_VarStub <bool> (&config.render.background_mode));
+  pCommandProc->AddVariable ("Render.Background.DropEvery", new eTB_VarStub <int>  (&config.render.background_drop));
+  pCommandProc->AddVariable ("Render.Background.Cache",     new eTB_VarStub <bool> (&config.render.background_cache));
+  pCommandProc->AddVariable ("Render.Background.Drawn",     new eTB_VarStub <int>  (&background.drawn));
+  pCommandProc->AddVariable ("Render.Background.Dropped",   new eTB_VarStub <int>  (&background.dropped));
+
   pCommandProc->AddVariable ("Render.CullVS",    new eTB_VarStub <int>   (&debug.cull_vs));
   pCommandProc->AddVariable ("Render.CullPS",    new eTB_VarStub <int>   (&debug.cull_ps));
+  pCommandProc->AddVariable ("Render.CullReport", new eTB_VarStub <bool>  (&cull_sets.report));
+
+  pCommandProc->AddVariable ("Render.TexturePolicyReport", new eTB_VarStub <bool> (&texture_policy.log_report));
+
+  pCommandProc->AddVariable ("Render.DumpTextures",            new eTB_VarStub <bool> (&texture_dump.enable));
+  pCommandProc->AddVariable ("Render.DumpTextures.PNG",        new eTB_VarStub <bool> (&texture_dump.png));
+  pCommandProc->AddVariable ("Render.DumpTextures.BudgetMiB",  new eTB_VarStub <int>  (&texture_dump.budget_mib));
+  pCommandProc->AddVariable ("Render.DumpTextures.Queued",     new eTB_VarStub <int>  (&texture_dump.stats.queued));
+  pCommandProc->AddVariable ("Render.DumpTextures.Dropped",    new eTB_VarStub <int>  (&texture_dump.stats.dropped));
+  pCommandProc->AddVariable ("Render.DumpTextures.Duplicates", new eTB_VarStub <int>  (&texture_dump.stats.duplicates));
+  pCommandProc->AddVariable ("Render.DumpTextures.Written",    new eTB_VarStub <int>  (&texture_dump.stats.written));
+  pCommandProc->AddVariable ("Render.DumpTextures.Failed",     new eTB_VarStub <int>  (&texture_dump.stats.failed));
+
+  pCommandProc->AddVariable ("Render.ReplaceTextures",            new eTB_VarStub <bool> (&texture_pack.enable));
+  pCommandProc->AddVariable ("Render.ReplaceTextures.Hits",       new eTB_VarStub <int>  (&texture_pack.stats.hits));
+  pCommandProc->AddVariable ("Render.ReplaceTextures.Misses",     new eTB_VarStub <int>  (&texture_pack.stats.misses));
+  pCommandProc->AddVariable ("Render.ReplaceTextures.Mismatched", new eTB_VarStub <int>  (&texture_pack.stats.mismatched));
+  pCommandProc->AddVariable ("Render.DumpTextures.Sampled",       new eTB_VarStub <bool> (&texture_dump.sampled));
+
+  pCommandProc->AddVariable ("Render.Fingerprint.Audit",      new eTB_VarStub <bool> (&fingerprint_audit.enable));
+  pCommandProc->AddVariable ("Render.Fingerprint.Audited",    new eTB_VarStub <int>  (&fingerprint_audit.stats.audited));
+  pCommandProc->AddVariable ("Render.Fingerprint.Collisions", new eTB_VarStub <int>  (&fingerprint_audit.stats.collisions));
+  pCommandProc->AddVariable ("Render.Fingerprint.Dropped",    new eTB_VarStub <int>  (&fingerprint_audit.stats.dropped));
+  pCommandProc->AddVariable ("Render.FingerprintBench",       new eTB_VarStub <bool> (&fingerprint_bench.run));
+
+  pCommandProc->AddVariable ("Render.CompleteMips",           new eTB_VarStub <bool> (&mip_completion.enable));
+  pCommandProc->AddVariable ("Render.CompleteMips.CPU",       new eTB_VarStub <bool> (&mip_completion.cpu));
+  pCommandProc->AddVariable ("Render.CompleteMips.CacheMiB",  new eTB_VarStub <int>  (&mip_completion.cache.budget_mib));
+  pCommandProc->AddVariable ("Render.CompleteMips.Promoted",  new eTB_VarStub <int>  (&mip_completion.stats.promoted));
+  pCommandProc->AddVariable ("Render.CompleteMips.Autogen",   new eTB_VarStub <int>  (&mip_completion.stats.autogen));
+  pCommandProc->AddVariable ("Render.CompleteMips.Generated", new eTB_VarStub <int>  (&mip_completion.stats.generated));
+  pCommandProc->AddVariable ("Render.CompleteMips.Cached",    new eTB_VarStub <int>  (&mip_completion.stats.cached));
+  pCommandProc->AddVariable ("Render.CompleteMips.Failed",    new eTB_VarStub <int>  (&mip_completion.stats.failed));
+  pCommandProc->AddVariable ("Render.MipBench",               new eTB_VarStub <bool> (&mip_bench.run));
+
+  pCommandProc->AddVariable ("Render.Resources.Textures",        new eTB_VarStub <int>   (&resources.totals_ [AD_RESOURCE_TEXTURE].count));
+  pCommandProc->AddVariable ("Render.Resources.TextureMiB",      new eTB_VarStub <float> (&resources.totals_ [AD_RESOURCE_TEXTURE].mib));
+  pCommandProc->AddVariable ("Render.Resources.RenderTargets",   new eTB_VarStub <int>   (&resources.totals_ [AD_RESOURCE_RENDER_TARGET].count));
+  pCommandProc->AddVariable ("Render.Resources.RenderTargetMiB", new eTB_VarStub <float> (&resources.totals_ [AD_RESOURCE_RENDER_TARGET].mib));
+  pCommandProc->AddVariable ("Render.Resources.DepthStencil",    new eTB_VarStub <int>   (&resources.totals_ [AD_RESOURCE_DEPTH_STENCIL].count));
+  pCommandProc->AddVariable ("Render.Resources.DepthStencilMiB", new eTB_VarStub <float> (&resources.totals_ [AD_RESOURCE_DEPTH_STENCIL].mib));
+  pCommandProc->AddVariable ("Render.Resources.Untracked",       new eTB_VarStub <int>   (&resources.overflow_));
+  pCommandProc->AddVariable ("Render.Resources.Top",             new eTB_VarStub <int>   (&resources.top));
+
+  // Cull.<Name>, Cull.<Name>.Draws and Cull.<Name>.Prims for every set in AgDrag.cull.ini
+  for (size_t i = 0; i < cull_sets.sets.size (); i++) {
+    ad_cull_sets_s::set_s& set = cull_sets.sets [i];
+
+    pCommandProc->AddVariable ( set.var_name.c_str (),
+                                  new eTB_VarStub <bool> (&set.enable) );
+    pCommandProc->AddVariable ( (set.var_name + ".Draws").c_str (),
+                                  new eTB_VarStub <int>  (&set.culled_last_frame.draws) );
+    pCommandProc->AddVariable ( (set.var_name + ".Prims").c_str (),
+                                  new eTB_VarStub <int>  (&set.culled_last_frame.prims) );
+  }
 
   pCommandProc->AddVariable ("Render.MapScale",  new eTB_VarStub <float> (&minimap_scale));
-
-  pCommandProc->AddVariable ("Mouse.YOffset",    new eTB_VarStub <float> (&config.scaling.mouse_y_offset));
+  pCommandProc->AddVariable ("Render.XformBench", new eTB_VarStub <int>   (&xform_bench.record));
+  pCommandProc->AddVariable ("Render.DrawBench",  new eTB_VarStub <int>   (&draw_bench.record));
+  pCommandProc->AddVariable ("Render.BlitBench",  new eTB_VarStub <int>   (&blit_bench.record));
+  pCommandProc->AddVariable ("Render.Scale",         new eTB_VarStub <float> (&render_scale.scale));
+  pCommandProc->AddVariable ("Render.ScaleDepth",    new eTB_VarStub <bool>  (&render_scale.scale_depth));
+  pCommandProc->AddVariable ("Render.ScaledTargets", new eTB_VarStub <int>   (&render_scale.targets));
+  pCommandProc->AddVariable ("Render.FastPath",   new eTB_VarStub <bool>  (&fastpath.enable));
+  pCommandProc->AddVariable ("Render.ViewportSaved", new eTB_VarStub <int> (&vp_shadow.saved_last_frame));
+  pCommandProc->AddVariable ("Render.StatesSaved",   new eTB_VarStub <int> (&rs_shadow.saved_last_frame));
+
+  pCommandProc->AddVariable ("Render.FilterCalls",             new eTB_VarStub <bool> (&call_filter.enable));
+  pCommandProc->AddVariable ("Render.FilterCalls.VSConstants", new eTB_VarStub <int>  (&call_filter.dropped_last_frame.vs_consts));
+  pCommandProc->AddVariable ("Render.FilterCalls.PSConstants", new eTB_VarStub <int>  (&call_filter.dropped_last_frame.ps_consts));
+  pCommandProc->AddVariable ("Render.FilterCalls.Textures",    new eTB_VarStub <int>  (&call_filter.dropped_last_frame.textures));
+  pCommandProc->AddVariable ("Render.FilterCalls.Viewports",   new eTB_VarStub <int>  (&call_filter.dropped_last_frame.viewports));
+
+  pCommandProc->AddVariable ("UI.Memo",            new eTB_VarStub <bool>  (&ui_memo.enable));
+  pCommandProc->AddVariable ("UI.Memo.Hits",       new eTB_VarStub <int>   (&ui_memo.hits_));
+  pCommandProc->AddVariable ("UI.Memo.HitRate",    new eTB_VarStub <float> (&ui_memo.hit_rate_));
+  pCommandProc->AddVariable ("UI.Memo.BytesSaved", new eTB_VarStub <float> (&ui_memo.bytes_saved_));
+
+  pCommandProc->AddVariable ("Mouse.YOffset",    mouse_y_offset_);
   pCommandProc->AddVariable ("HUD.XOffset",      new eTB_VarStub <float> (&config.scaling.hud_x_offset));
 
   pCommandProc->AddVariable ("Scale.AutoCalc",   new eTB_VarStub <bool> (&config.scaling.auto_calc));
@@ -2047,6 +4005,25 @@ ad::RenderFix::CommandProcessor::CommandProcessor (void)
 bool
 ad::RenderFix::CommandProcessor::OnVarChange (eTB_Variable* var, void* val)
 {
+  if (val == nullptr)
+    return false;
+
+  if (var == aspect_correction_) {
+    config.render.aspect_correction = *(bool *)val;
+
+    AD_InvalidateDisplayGeometry ();
+
+    return true;
+  }
+
+  if (var == mouse_y_offset_) {
+    config.scaling.mouse_y_offset = *(float *)val;
+
+    AD_InvalidateDisplayGeometry ();
+
+    return true;
+  }
+
   return true;
 }
 
@@ -53,7 +53,9 @@ namespace ad
 
     protected:
       eTB_Variable* aspect_ratio_;
+      eTB_Variable* aspect_correction_;
       eTB_Variable* center_ui_;
+      eTB_Variable* mouse_y_offset_;
 
     private:
       static CommandProcessor* pCommProc;
@@ -0,0 +1,203 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "resources.h"
+#include "log.h"
+
+#include <algorithm>
+#include <vector>
+
+ad_resource_registry_s resources;
+
+// Slot keys besides nullptr (Empty) that can never be a real object
+static const void* const AD_RESOURCE_TOMBSTONE = (const void *)0x1;
+static const void* const AD_RESOURCE_CLAIMED   = (const void *)0x2; // Being filled in
+
+static const wchar_t* ad_resource_names [AD_RESOURCE_CATEGORIES] = {
+  L"Texture", L"RenderTarget", L"DepthStencil"
+};
+
+ad_resource_registry_s::ad_resource_registry_s (void)
+{
+  slots = new slot_s [NUM_SLOTS];
+
+  for (int i = 0; i < NUM_SLOTS; i++)
+    slots [i].key = nullptr;
+
+  for (int i = 0; i < AD_RESOURCE_CATEGORIES; i++) {
+    count [i] = 0;
+    bytes [i] = 0;
+  }
+
+  overflow = 0;
+}
+
+ad_resource_registry_s::~ad_resource_registry_s (void)
+{
+  delete [] slots;
+}
+
+static const void*
+AD_CAS_Key (const void* volatile* key, const void* value, const void* comparand)
+{
+  return InterlockedCompareExchangePointer ( (PVOID volatile *)key,
+                                               (PVOID)value, (PVOID)comparand );
+}
+
+bool
+ad_resource_registry_s::track (const void* pResource, const ad_resource_s& res)
+{
+  const uint32_t mask = NUM_SLOTS - 1;
+
+  while (true) {
+    uint32_t idx  = home (pResource);
+    slot_s*  free = nullptr;
+
+    for (int probe = 0; probe < MAX_PROBE; probe++, idx = (idx + 1) & mask) {
+      const void* key = slots [idx].key;
+
+      // A release we never saw (the object was freed outside our hooks) left
+      //   this address behind; the old entry is gone either way.
+      if (key == pResource) {
+        release (pResource);
+        key = slots [idx].key;
+      }
+
+      if (key == AD_RESOURCE_TOMBSTONE && free == nullptr)
+        free = &slots [idx];
+
+      if (key == nullptr) {
+        if (free == nullptr)
+          free = &slots [idx];
+        break;
+      }
+    }
+
+    if (free == nullptr) {
+      InterlockedIncrement (&overflow);
+      return false;
+    }
+
+    const void* expected = free->key;
+
+    if (expected != nullptr && expected != AD_RESOURCE_TOMBSTONE)
+      continue;
+
+    // Lost the slot to another thread; look again
+    if (AD_CAS_Key (&free->key, AD_RESOURCE_CLAIMED, expected) != expected)
+      continue;
+
+    free->res = res;
+
+    InterlockedIncrement   (&count [res.category]);
+    InterlockedExchangeAdd64 (&bytes [res.category], (LONG64)res.bytes);
+
+    // Publishes res along with the key
+    InterlockedExchangePointer ((PVOID volatile *)&free->key, (PVOID)pResource);
+
+    return true;
+  }
+}
+
+bool
+ad_resource_registry_s::release (const void* pResource)
+{
+  const uint32_t mask = NUM_SLOTS - 1;
+
+  uint32_t idx = home (pResource);
+
+  // Nothing is ever inserted further than MAX_PROBE from home
+  for (int probe = 0; probe < MAX_PROBE; probe++, idx = (idx + 1) & mask) {
+    const void* key = slots [idx].key;
+
+    if (key == nullptr)
+      return false;
+
+    if (key != pResource)
+      continue;
+
+    const ad_resource_s res = slots [idx].res;
+
+    if (AD_CAS_Key (&slots [idx].key, AD_RESOURCE_TOMBSTONE, pResource) != pResource)
+      return false;
+
+    InterlockedDecrement     (&count [res.category]);
+    InterlockedExchangeAdd64 (&bytes [res.category], -(LONG64)res.bytes);
+
+    return true;
+  }
+
+  return false;
+}
+
+void
+ad_resource_registry_s::publish (void)
+{
+  for (int i = 0; i < AD_RESOURCE_CATEGORIES; i++) {
+    totals_ [i].count = count [i];
+    totals_ [i].mib   = (float)((double)bytes [i] / 1048576.0);
+  }
+
+  overflow_ = overflow;
+}
+
+void
+ad_resource_registry_s::dump (int num)
+{
+  std::vector <ad_resource_s> live;
+
+  for (int i = 0; i < NUM_SLOTS; i++) {
+    const void* key = slots [i].key;
+
+    if ( key != nullptr && key != AD_RESOURCE_TOMBSTONE &&
+                           key != AD_RESOURCE_CLAIMED )
+      live.push_back (slots [i].res);
+  }
+
+  if (num > (int)live.size ())
+    num = (int)live.size ();
+
+  std::partial_sort ( live.begin (), live.begin () + num, live.end (),
+                        [] (const ad_resource_s& a, const ad_resource_s& b) {
+                          return a.bytes > b.bytes;
+                        } );
+
+  publish ();
+
+  dll_log.Log ( L" [Resources] %d live: Textures %d (%.2f MiB), Render Targets %d "
+                L"(%.2f MiB), Depth-Stencil %d (%.2f MiB); %d untracked",
+                  (int)live.size (),
+                    totals_ [AD_RESOURCE_TEXTURE].count,       totals_ [AD_RESOURCE_TEXTURE].mib,
+                    totals_ [AD_RESOURCE_RENDER_TARGET].count, totals_ [AD_RESOURCE_RENDER_TARGET].mib,
+                    totals_ [AD_RESOURCE_DEPTH_STENCIL].count, totals_ [AD_RESOURCE_DEPTH_STENCIL].mib,
+                      overflow_ );
+
+  for (int i = 0; i < num; i++) {
+    const ad_resource_s& res = live [i];
+
+    dll_log.Log ( L"   %9.2f MiB  %-12s %5lux%-5lu Levels: %2lu  Samples: %lu  "
+                  L"Format: %4lu  Pool: %lu  Usage: %05lx",
+                    (double)res.bytes / 1048576.0, ad_resource_names [res.category],
+                      res.width, res.height, res.levels, res.samples,
+                        res.format, res.pool, res.usage );
+  }
+}
@@ -0,0 +1,124 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__RESOURCES_H__
+#define __AD__RESOURCES_H__
+
+#include <Windows.h>
+#include <d3d9.h>
+#include <stdint.h>
+
+//
+// Accounts for every texture, render target and depth-stencil surface the
+//   game creates, so the cost of a resolution (ultrawide targets, shadow
+//     maps, ...) can be read off the console instead of guessed at.
+//
+//  * Creation may happen on a loading thread while the render thread is
+//      releasing something else; the table is open-addressed with CAS-claimed
+//        slots and interlocked totals, so neither path ever takes a lock.
+//
+//  * Entries are dropped by the Release hooks once the last reference goes;
+//      a slot is then tombstoned and reused by a later insert on its chain.
+//        (A release racing the creation of a new resource at the same
+//          address can drop the new one's entry; the totals always match
+//            the table.)
+//
+//  * Tombstones are never turned back into empty slots (lock-free, that
+//      could cut off an entry being inserted right behind one), so over a
+//        long session every slot ends up non-empty.  Probes are bounded by
+//          MAX_PROBE instead: an insert takes the first tombstone or empty
+//            slot within that distance of home (or counts as Untracked), so
+//              no lookup ever has to look further.
+//
+//  * Sizes are computed from format, dimensions, mip count and multisample
+//      count (what the driver actually allocates may be padded further).
+//
+enum ad_resource_category_t {
+  AD_RESOURCE_TEXTURE       = 0, // Sampled only
+  AD_RESOURCE_RENDER_TARGET = 1, // Surfaces, and textures with RENDERTARGET usage
+  AD_RESOURCE_DEPTH_STENCIL = 2, // Surfaces, and textures with DEPTHSTENCIL usage
+
+  AD_RESOURCE_CATEGORIES    = 3
+};
+
+struct ad_resource_s {
+  UINT                   width, height;
+  UINT                   levels;
+  UINT                   samples;       // 1 unless multisampled
+  D3DFORMAT              format;
+  D3DPOOL                pool;
+  DWORD                  usage;
+  ad_resource_category_t category;
+  uint64_t               bytes;
+};
+
+struct ad_resource_registry_s {
+  enum {
+    SLOT_BITS = 14,
+    NUM_SLOTS = 1 << SLOT_BITS,         // ~768 KiB
+    MAX_PROBE = 64                      // Slots from home, at most
+  };
+
+  // Both return false if the table is full / pResource was not tracked
+  bool track   (const void* pResource, const ad_resource_s& res);
+  bool release (const void* pResource);
+
+  // Copies the running totals into the console variables below (once per-frame)
+  void publish (void);
+
+  // Logs the count largest live resources (Render.Resources.Top)
+  void dump    (int count);
+
+  // Console-visible totals, per category (Render.Resources.*)
+  struct {
+    int   count = 0;
+    float mib   = 0.0f;
+  } totals_ [AD_RESOURCE_CATEGORIES];
+
+  int   overflow_ = 0;                  // Render.Resources.Untracked
+  int   top       = 0;                  // Render.Resources.Top <N>
+
+   ad_resource_registry_s (void);
+  ~ad_resource_registry_s (void);
+
+protected:
+  struct slot_s {
+    const void* volatile key;           // nullptr = Empty
+    ad_resource_s        res;
+  };
+
+  static uint32_t home (const void* pResource)
+  {
+    // Fibonacci hashing; D3D9 objects are at least 8-byte aligned.
+    return (uint32_t)( (uint32_t)((uintptr_t)pResource >> 3) * 2654435769U ) >> (32 - SLOT_BITS);
+  }
+
+  slot_s*       slots;
+
+  volatile LONG count [AD_RESOURCE_CATEGORIES];
+  volatile LONG64
+                bytes [AD_RESOURCE_CATEGORIES];
+  volatile LONG overflow;
+};
+
+extern ad_resource_registry_s resources;
+
+#endif /* __AD__RESOURCES_H__ */
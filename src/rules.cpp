@@ -0,0 +1,497 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include <Windows.h>
+
+#include "rules.h"
+#include "ini.h"
+#include "log.h"
+
+#include <xmmintrin.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <cmath>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+ad_draw_rules_s draw_rules;
+
+//
+// Written to AgDrag.rules.ini the first time the game is started; these are
+//   the signatures the detours used to have hardcoded.
+//
+static const wchar_t* AD_DEFAULT_RULES =
+  L"[UI.Begin]\n"
+  L"Stage=PS\n"
+  L"Register=1\n"
+  L"Count=1\n"
+  L"Match=c0==0.5,c1==2,c2==1,c3==1\n"
+  L"Action=UIBegin\n"
+  L"\n"
+  L"[UI.Depth.0]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=4\n"
+  L"Match=c14==0\n"
+  L"Action=UIDepth\n"
+  L"\n"
+  L"[UI.Depth.16]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=4\n"
+  L"Match=c14==16\n"
+  L"Action=UIDepth\n"
+  L"\n"
+  L"[UI.Depth.32]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=4\n"
+  L"Match=c14==32\n"
+  L"Action=UIDepth\n"
+  L"\n"
+  L"[UI.Depth.100]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=4\n"
+  L"Match=c14==100\n"
+  L"Action=UIDepth\n"
+  L"\n"
+  L"[Menu.Background]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=4\n"
+  L"Match=c0==1,c5==1.5\n"
+  L"Action=MenuBackground\n"
+  L"\n"
+  L"[Fullscreen.Effect]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=4\n"
+  L"PS=!f22375e3\n"
+  L"Match=c12==640,c13==360,c14<=32\n"
+  L"Action=Fullscreen\n"
+  L"\n"
+  L"[DepthOfField]\n"
+  L"Stage=VS\n"
+  L"Register=1\n"
+  L"Count=1\n"
+  L"Match=c2==0,c3==0\n"
+  L"Action=DepthOfField\n"
+  L"\n"
+  L"[Quest.Marker]\n"
+  L"Stage=VS\n"
+  L"Register=11\n"
+  L"Count=1\n"
+  L"Match=c0==0.0078125\n"
+  L"Action=QuestMarker\n"
+  L"\n"
+  L"[Minimap.Center]\n"
+  L"Stage=PS\n"
+  L"Register=4\n"
+  L"Count=1\n"
+  L"Match=c0==1,c1==1,c2==1,c3==1\n"
+  L"Params=165,175,575,585\n"
+  L"Action=MinimapCenter\n";
+
+struct ad_draw_rules_s::rule_s {
+  // A float passes if lo <= value <= hi (so NaN never does)
+  float    lo [16];
+  float    hi [16];
+  uint32_t lanes;                // Bit per float that Match compares
+
+  uint32_t key;
+  uint32_t vs_crc32;
+  uint32_t ps_crc32;
+  uint32_t flags;
+  uint32_t action;
+
+  enum {
+    VS_SET = 0x1,
+    VS_NOT = 0x2,
+    PS_SET = 0x4,
+    PS_NOT = 0x8
+  };
+};
+
+static const struct {
+  const wchar_t*   name;
+  ad_rule_action_t action;
+} ad_rule_actions [] = {
+  { L"UIBegin",        AD_RULE_UI_BEGIN       },
+  { L"UIDepth",        AD_RULE_UI_DEPTH       },
+  { L"MenuBackground", AD_RULE_MENU_BG        },
+  { L"Fullscreen",     AD_RULE_FULLSCREEN     },
+  { L"DepthOfField",   AD_RULE_DOF            },
+  { L"QuestMarker",    AD_RULE_QUEST_MARKER   },
+  { L"MinimapCenter",  AD_RULE_MINIMAP_CENTER }
+};
+
+static inline uint32_t
+AD_RuleBucket (uint32_t key)
+{
+  // Fibonacci hashing down to log2 (MAX_BUCKETS) = 6 bits
+  return (key * 2654435769U) >> 26;
+}
+
+static inline int
+AD_RuleActionIndex (uint32_t action)
+{
+  int idx = 0;
+
+  while (action > 1) {
+    action >>= 1;
+    ++idx;
+  }
+
+  return idx;
+}
+
+static bool
+AD_ParseShaderFilter (const std::wstring& str, uint32_t& crc32, bool& negate)
+{
+  const wchar_t* wszHex = str.c_str ();
+
+  negate = (*wszHex == L'!');
+
+  if (negate)
+    ++wszHex;
+
+  wchar_t* end = nullptr;
+  crc32 = wcstoul (wszHex, &end, 16);
+
+  return end != wszHex && *end == L'\0';
+}
+
+static bool
+AD_ParseMatch (const std::wstring& str, ad_draw_rules_s::rule_s& rule, uint32_t lane_count)
+{
+  const wchar_t* wszTerm = str.c_str ();
+
+  while (*wszTerm != L'\0') {
+    while (*wszTerm == L' ' || *wszTerm == L',')
+      ++wszTerm;
+
+    if (*wszTerm == L'\0')
+      break;
+
+    if (*wszTerm++ != L'c')
+      return false;
+
+    wchar_t* end  = nullptr;
+    uint32_t lane = wcstoul (wszTerm, &end, 10);
+
+    if (end == wszTerm || lane >= lane_count)
+      return false;
+
+    wszTerm = end;
+
+    wchar_t op [3] = { 0 };
+
+    for (int i = 0; i < 2 && wcschr (L"=<>", *wszTerm) != nullptr && *wszTerm != L'\0'; i++)
+      op [i] = *wszTerm++;
+
+    float val = (float)wcstod (wszTerm, &end);
+
+    if (end == wszTerm)
+      return false;
+
+    wszTerm = end;
+
+    float lo = -INFINITY,
+          hi =  INFINITY;
+
+    if      (! wcscmp (op, L"=="))   lo = hi = val;
+    else if (! wcscmp (op, L"<="))   hi = val;
+    else if (! wcscmp (op, L">="))   lo = val;
+    else if (! wcscmp (op, L"<"))    hi = nextafterf (val, -INFINITY);
+    else if (! wcscmp (op, L">"))    lo = nextafterf (val,  INFINITY);
+    else
+      return false;
+
+    // Several terms on the same float narrow its range
+    if (lo > rule.lo [lane]) rule.lo [lane] = lo;
+    if (hi < rule.hi [lane]) rule.hi [lane] = hi;
+
+    rule.lanes |= (1UL << lane);
+  }
+
+  return rule.lanes != 0;
+}
+
+static bool
+AD_ParseRule ( ad::INI::File::Section&  section,
+               ad_draw_rules_s::rule_s& rule,
+               float                    params [4] )
+{
+  for (int i = 0; i < 16; i++) {
+    rule.lo [i] = -INFINITY;
+    rule.hi [i] =  INFINITY;
+  }
+
+  rule.lanes  = 0;
+  rule.flags  = 0;
+  rule.action = 0;
+
+  if (! ( section.contains_key (L"Stage")    && section.contains_key (L"Register") &&
+          section.contains_key (L"Count")    && section.contains_key (L"Match")    &&
+          section.contains_key (L"Action") ))
+    return false;
+
+  ad_rule_stage_t stage;
+
+  if      (section.get_value (L"Stage") == L"VS") stage = AD_RULE_STAGE_VS;
+  else if (section.get_value (L"Stage") == L"PS") stage = AD_RULE_STAGE_PS;
+  else
+    return false;
+
+  int reg   = _wtoi (section.get_value (L"Register").c_str ());
+  int count = _wtoi (section.get_value (L"Count").c_str    ());
+
+  // Match can only look at up to 4 vec4s
+  if (reg < 0 || reg > 255 || count < 1 || count > 4)
+    return false;
+
+  rule.key = ad_draw_rules_s::make_key (stage, reg, count);
+
+  for (size_t i = 0; i < sizeof (ad_rule_actions) / sizeof (ad_rule_actions [0]); i++) {
+    if (section.get_value (L"Action") == ad_rule_actions [i].name)
+      rule.action = ad_rule_actions [i].action;
+  }
+
+  if (rule.action == 0)
+    return false;
+
+  bool negate;
+
+  if (section.contains_key (L"VS")) {
+    if (! AD_ParseShaderFilter (section.get_value (L"VS"), rule.vs_crc32, negate))
+      return false;
+
+    rule.flags |= ad_draw_rules_s::rule_s::VS_SET |
+                    (negate ? ad_draw_rules_s::rule_s::VS_NOT : 0);
+  }
+
+  if (section.contains_key (L"PS")) {
+    if (! AD_ParseShaderFilter (section.get_value (L"PS"), rule.ps_crc32, negate))
+      return false;
+
+    rule.flags |= ad_draw_rules_s::rule_s::PS_SET |
+                    (negate ? ad_draw_rules_s::rule_s::PS_NOT : 0);
+  }
+
+  if (! AD_ParseMatch (section.get_value (L"Match"), rule, count * 4))
+    return false;
+
+  memset (params, 0, sizeof (float) * 4);
+
+  if (section.contains_key (L"Params")) {
+    const wchar_t* wszParam = section.get_value (L"Params").c_str ();
+
+    for (int i = 0; i < 4 && *wszParam != L'\0'; i++) {
+      wchar_t* end = nullptr;
+      params [i] = (float)wcstod (wszParam, &end);
+
+      if (end == wszParam)
+        return false;
+
+      wszParam = (*end == L',') ? end + 1 : end;
+    }
+  }
+
+  return true;
+}
+
+static inline bool
+AD_MatchRule (const ad_draw_rules_s::rule_s& rule, const float* data, uint32_t vec4_count)
+{
+  uint32_t passed = 0;
+
+  for (uint32_t i = 0; i < vec4_count; i++) {
+    if (((rule.lanes >> (i * 4)) & 0xf) == 0)
+      continue;
+
+    __m128 val = _mm_loadu_ps (&data    [i * 4]);
+    __m128 lo  = _mm_loadu_ps (&rule.lo [i * 4]);
+    __m128 hi  = _mm_loadu_ps (&rule.hi [i * 4]);
+
+    __m128 in  = _mm_and_ps (_mm_cmpge_ps (val, lo), _mm_cmple_ps (val, hi));
+
+    passed |= (uint32_t)_mm_movemask_ps (in) << (i * 4);
+  }
+
+  return (passed & rule.lanes) == rule.lanes;
+}
+
+
+ad_draw_rules_s::ad_draw_rules_s (void)
+{
+  rules     = nullptr;
+  num_rules = 0;
+
+  memset (buckets,       0, sizeof (buckets));
+  memset (action_params, 0, sizeof (action_params));
+}
+
+ad_draw_rules_s::~ad_draw_rules_s (void)
+{
+  delete [] rules;
+}
+
+uint32_t
+ad_draw_rules_s::evaluate ( ad_rule_stage_t stage,
+                            uint32_t        vs_crc32,
+                            uint32_t        ps_crc32,
+                            uint32_t        start_register,
+                            const float*    data,
+                            uint32_t        vec4_count ) const
+{
+  if (vec4_count > 4 || start_register > 255)
+    return 0;
+
+  const uint32_t key = make_key (stage, start_register, vec4_count);
+        uint32_t idx = AD_RuleBucket (key);
+
+  while (buckets [idx].key != key) {
+    if (buckets [idx].key == 0)
+      return 0;
+
+    idx = (idx + 1) & (MAX_BUCKETS - 1);
+  }
+
+  uint32_t verdict = 0;
+
+  const rule_s* rule = &rules [buckets [idx].first];
+  const rule_s* last = rule + buckets [idx].count;
+
+  for (; rule < last; ++rule) {
+    if ( (rule->flags & rule_s::VS_SET) &&
+         ((vs_crc32 == rule->vs_crc32) == ((rule->flags & rule_s::VS_NOT) != 0)) )
+      continue;
+
+    if ( (rule->flags & rule_s::PS_SET) &&
+         ((ps_crc32 == rule->ps_crc32) == ((rule->flags & rule_s::PS_NOT) != 0)) )
+      continue;
+
+    if (AD_MatchRule (*rule, data, vec4_count))
+      verdict |= rule->action;
+  }
+
+  return verdict;
+}
+
+const float*
+ad_draw_rules_s::params (ad_rule_action_t action) const
+{
+  return action_params [AD_RuleActionIndex (action)];
+}
+
+bool
+ad_draw_rules_s::load (const wchar_t* filename)
+{
+  ad::INI::File* rules_ini = new ad::INI::File ((wchar_t *)filename);
+
+  if (rules_ini->get_sections ().empty ()) {
+    rules_ini->import (AD_DEFAULT_RULES);
+    rules_ini->write  (filename);
+
+    dll_log.Log (L" [Rules] Created %s from the built-in rules.", filename);
+  }
+
+  std::vector <rule_s> parsed;
+  float                params [MAX_ACTIONS][4] = { 0 };
+
+  const std::map <std::wstring, ad::INI::File::Section>& sections =
+    rules_ini->get_sections ();
+
+  for ( std::map <std::wstring, ad::INI::File::Section>::const_iterator it = sections.begin ();
+          it != sections.end ();
+            ++it ) {
+    rule_s rule;
+    float  rule_params [4];
+
+    if (! AD_ParseRule (rules_ini->get_section (it->first), rule, rule_params)) {
+      dll_log.Log (L" [Rules] Ignoring malformed rule [%s]", it->first.c_str ());
+      continue;
+    }
+
+    memcpy (params [AD_RuleActionIndex (rule.action)], rule_params, sizeof (rule_params));
+
+    parsed.push_back (rule);
+  }
+
+  delete rules_ini;
+
+  // Rules that share a key must be contiguous
+  std::stable_sort ( parsed.begin (), parsed.end (),
+                       [](const rule_s& a, const rule_s& b) { return a.key < b.key; } );
+
+  bucket_s compiled [MAX_BUCKETS] = { 0 };
+  int      num_keys               = 0;
+
+  for (size_t i = 0; i < parsed.size (); ) {
+    size_t j = i;
+
+    while (j < parsed.size () && parsed [j].key == parsed [i].key)
+      ++j;
+
+    // Keep the load factor <= 1/2
+    if ((num_keys + 1) * 2 > MAX_BUCKETS) {
+      dll_log.Log (L" [Rules] Too many distinct (stage, register, count) keys; ignoring the rest.");
+      parsed.resize (i);
+      break;
+    }
+
+    uint32_t idx = AD_RuleBucket (parsed [i].key);
+
+    while (compiled [idx].key != 0)
+      idx = (idx + 1) & (MAX_BUCKETS - 1);
+
+    compiled [idx].key   = parsed [i].key;
+    compiled [idx].first = (uint16_t)i;
+    compiled [idx].count = (uint16_t)(j - i);
+
+    ++num_keys;
+
+    i = j;
+  }
+
+  rule_s* table = parsed.empty () ? nullptr : new rule_s [parsed.size ()];
+
+  if (table != nullptr)
+    memcpy (table, parsed.data (), sizeof (rule_s) * parsed.size ());
+
+  delete [] rules;
+
+  rules     = table;
+  num_rules = (int)parsed.size ();
+
+  memcpy (buckets,       compiled, sizeof (buckets));
+  memcpy (action_params, params,   sizeof (action_params));
+
+  dll_log.Log ( L" [Rules] Compiled %d draw classification rules (%d keys) from %s",
+                  num_rules, num_keys, filename );
+
+  return num_rules > 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__RULES_H__
+#define __AD__RULES_H__
+
+#include <stdint.h>
+
+//
+// Draw classification rules (AgDrag.rules.ini)
+//
+//   Every heuristic that recognizes a part of the frame by the exact values
+//     the game uploads to a shader constant register lives in a rule file
+//       instead of the detours, e.g.
+//
+//     [UI.Begin]
+//     Stage=PS
+//     Register=1
+//     Count=1
+//     Match=c0==0.5,c1==2,c2==1,c3==1
+//     Action=UIBegin
+//
+//   Stage, Register and Count select the calls a rule applies to; VS / PS
+//     (hex CRC-32, '!' to negate) optionally restrict it to shaders, Match
+//       compares individual floats (c0 .. c15) with ==, <=, >=, < or >, and
+//         Params are up to four numbers the action itself interprets.
+//
+//  * Rules are compiled at load into a table keyed on (stage, register,
+//      count); one probe finds the only rules that could apply and each
+//        of those is tested with a handful of SSE range compares.
+//
+enum ad_rule_stage_t {
+  AD_RULE_STAGE_VS = 0,
+  AD_RULE_STAGE_PS = 1
+};
+
+enum ad_rule_action_t {
+  AD_RULE_UI_BEGIN       = 0x01, // The frame switches from world to UI
+  AD_RULE_UI_DEPTH       = 0x02, // Common UI depth (nametag phase boundary)
+  AD_RULE_MENU_BG        = 0x04, // Menu background, always stretched
+  AD_RULE_FULLSCREEN     = 0x08, // Fullscreen effect, never centered
+  AD_RULE_DOF            = 0x10, // Depth of field pass
+  AD_RULE_QUEST_MARKER   = 0x20, // 128x128 quest indicator billboard
+  AD_RULE_MINIMAP_CENTER = 0x40  // Center triangle on the mini-map
+};
+
+struct ad_draw_rules_s {
+  // Bitmask of the ad_rule_action_t every matching rule asks for
+  uint32_t     evaluate ( ad_rule_stage_t stage,
+                          uint32_t        vs_crc32,
+                          uint32_t        ps_crc32,
+                          uint32_t        start_register,
+                          const float*    data,
+                          uint32_t        vec4_count ) const;
+
+  // Params of the (last loaded) rule for action; all zero if none
+  const float* params   (ad_rule_action_t action) const;
+
+  // Replaces the compiled table with the rules in filename, which is
+  //   created from the built-in rules if it does not exist.
+  bool         load     (const wchar_t* filename);
+
+  int          size     (void) const { return num_rules; }
+
+  ad_draw_rules_s  (void);
+  ~ad_draw_rules_s (void);
+
+  struct rule_s;
+
+  static uint32_t make_key (ad_rule_stage_t stage, uint32_t start_register, uint32_t vec4_count)
+  {
+    return 0x80000000UL | ((uint32_t)stage << 16) | (start_register << 3) | vec4_count;
+  }
+
+protected:
+  struct bucket_s {
+    uint32_t key;                // 0 = Empty
+    uint16_t first;
+    uint16_t count;
+  };
+
+  enum {
+    MAX_BUCKETS = 64,            // Power-of-two; (stage, register, count) keys
+    MAX_ACTIONS = 32
+  };
+
+  rule_s*  rules;
+  int      num_rules;
+  bucket_s buckets    [MAX_BUCKETS];
+  float    action_params [MAX_ACTIONS][4];
+};
+
+extern ad_draw_rules_s draw_rules;
+
+#endif /* __AD__RULES_H__ */
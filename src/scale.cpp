@@ -0,0 +1,145 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "scale.h"
+
+#include <math.h>
+#include <string.h>
+
+ad_render_scale_s render_scale;
+
+// {6A1D2C5E-3F0B-4C8E-9B41-7D2A5E0C9F13}
+static const GUID AD_GUID_SCALED_TARGET =
+  { 0x6a1d2c5e, 0x3f0b, 0x4c8e, { 0x9b, 0x41, 0x7d, 0x2a, 0x5e, 0x0c, 0x9f, 0x13 } };
+
+bool
+ad_render_scale_s::match ( uint32_t  width,      uint32_t  height, DWORD usage,
+                           uint32_t  bb_width,   uint32_t  bb_height,
+                           uint32_t& real_width, uint32_t& real_height ) const
+{
+  if (scale >= 1.0f || width != bb_width || height != bb_height || bb_width == 0)
+    return false;
+
+  if (! ( (usage & D3DUSAGE_RENDERTARGET) ||
+          ((usage & D3DUSAGE_DEPTHSTENCIL) && scale_depth) ))
+    return false;
+
+  float s = scale;
+
+  if (s < 0.25f)
+    s = 0.25f;
+
+  real_width  = (uint32_t)floorf ((float)width  * s + 0.5f);
+  real_height = (uint32_t)floorf ((float)height * s + 0.5f);
+
+  if (real_width  < 1) real_width  = 1;
+  if (real_height < 1) real_height = 1;
+
+  return true;
+}
+
+void
+ad_render_scale_s::map_viewport (D3DVIEWPORT9& vp, const ad_scaled_target_s& target)
+{
+  RECT rc = { (LONG)vp.X,              (LONG)vp.Y,
+              (LONG)(vp.X + vp.Width), (LONG)(vp.Y + vp.Height) };
+
+  map_rect (rc, target);
+
+  vp.X      = (DWORD)rc.left;
+  vp.Y      = (DWORD)rc.top;
+  vp.Width  = (DWORD)(rc.right  - rc.left);
+  vp.Height = (DWORD)(rc.bottom - rc.top);
+}
+
+void
+ad_render_scale_s::map_rect (RECT& rc, const ad_scaled_target_s& target)
+{
+  if (target.width == 0 || target.height == 0)
+    return;
+
+  const float sx = (float)target.real_width  / (float)target.width;
+  const float sy = (float)target.real_height / (float)target.height;
+
+  // Grow outward so that a full-size rect still covers the whole target
+  rc.left   = (LONG)floorf ((float)rc.left   * sx);
+  rc.top    = (LONG)floorf ((float)rc.top    * sy);
+  rc.right  = (LONG)ceilf  ((float)rc.right  * sx);
+  rc.bottom = (LONG)ceilf  ((float)rc.bottom * sy);
+
+  if (rc.right  > (LONG)target.real_width)  rc.right  = (LONG)target.real_width;
+  if (rc.bottom > (LONG)target.real_height) rc.bottom = (LONG)target.real_height;
+}
+
+void
+ad_render_scale_s::tag (IDirect3DSurface9* pSurface, const ad_scaled_target_s& target)
+{
+  pSurface->SetPrivateData ( AD_GUID_SCALED_TARGET,
+                               &target, sizeof (ad_scaled_target_s), 0 );
+}
+
+bool
+ad_render_scale_s::lookup (IDirect3DSurface9* pSurface, ad_scaled_target_s& target)
+{
+  if (pSurface == nullptr)
+    return false;
+
+  DWORD size = sizeof (ad_scaled_target_s);
+
+  return SUCCEEDED (pSurface->GetPrivateData (AD_GUID_SCALED_TARGET, &target, &size)) &&
+           size == sizeof (ad_scaled_target_s);
+}
+
+void
+ad_render_scale_s::map (D3DVIEWPORT9& vp)
+{
+  if (! active)
+    return;
+
+  last_game = vp;
+
+  map_viewport (vp, bound);
+
+  last_mapped = vp;
+  last_valid  = true;
+}
+
+void
+ad_render_scale_s::unmap (D3DVIEWPORT9& vp) const
+{
+  if (! active)
+    return;
+
+  // Hand back exactly what the game set, rather than a rounded inverse
+  if (last_valid && memcmp (&vp, &last_mapped, sizeof (D3DVIEWPORT9)) == 0) {
+    vp = last_game;
+    return;
+  }
+
+  const float sx = (float)bound.width  / (float)bound.real_width;
+  const float sy = (float)bound.height / (float)bound.real_height;
+
+  vp.X      = (DWORD)floorf ((float)vp.X      * sx + 0.5f);
+  vp.Y      = (DWORD)floorf ((float)vp.Y      * sy + 0.5f);
+  vp.Width  = (DWORD)floorf ((float)vp.Width  * sx + 0.5f);
+  vp.Height = (DWORD)floorf ((float)vp.Height * sy + 0.5f);
+}
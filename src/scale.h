@@ -0,0 +1,102 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__SCALE_H__
+#define __AD__SCALE_H__
+
+#include <Windows.h>
+#include <d3d9.h>
+#include <stdint.h>
+
+//
+// Internal render-resolution scaling (Render.Scale)
+//
+//   Off-screen scene targets (render targets, and optionally depth buffers,
+//     exactly the size of the backbuffer) are created at a fraction of that
+//       size; the game keeps addressing them in full-resolution pixels, so
+//         viewports, scissor, clear and blit rects aimed at one are remapped
+//           while it is bound.  The final composite samples the target with
+//             normalized coordinates (or StretchRects it), which upscales it.
+//
+//  * Scaled surfaces carry their original size as private data, so binding
+//      one is recognized without keeping a table of (recyclable) pointers.
+//
+//  * Targets are sized when they are created (the creation methods are
+//      hooked along with the device), so changing the scale at runtime only
+//        affects targets created afterwards, in practice after the next
+//          device reset (e.g. a mode change).
+//
+struct ad_scaled_target_s {
+  uint32_t width,      height;   // What the game asked for
+  uint32_t real_width, real_height;
+};
+
+struct ad_render_scale_s {
+  float    scale       = 1.0f;   // Render.Scale, 0.25 - 1.0
+  bool     scale_depth = false;  // Render.ScaleDepth
+
+  int      targets     = 0;      // Scaled resources created so far
+
+  //
+  // Device-independent, so they can be exercised with made-up sizes
+  //
+
+  // Is a (width x height, usage) resource a scene target, and if so, how big
+  //   should it really be?
+  bool match ( uint32_t  width,  uint32_t  height, DWORD usage,
+               uint32_t  bb_width,  uint32_t  bb_height,
+               uint32_t& real_width, uint32_t& real_height ) const;
+
+  static void map_viewport (D3DVIEWPORT9& vp, const ad_scaled_target_s& target);
+  static void map_rect     (RECT&         rc, const ad_scaled_target_s& target);
+
+  //
+  // Through the surface interface only (a fake surface will do)
+  //
+  static void tag    (IDirect3DSurface9* pSurface, const ad_scaled_target_s& target);
+  static bool lookup (IDirect3DSurface9* pSurface,       ad_scaled_target_s& target);
+
+  //
+  // Render target 0
+  //
+  bool               active = false;   // A scaled target is bound
+  ad_scaled_target_s bound;
+
+  void bind  (IDirect3DSurface9* pSurface) { active = lookup (pSurface, bound); }
+  void reset (void)                        { active = false; }
+
+  // Game viewport -> device viewport while a scaled target is bound
+  void map   (D3DVIEWPORT9& vp);
+
+  // Device viewport -> what the game set (GetViewport)
+  void unmap (D3DVIEWPORT9& vp) const;
+
+  void map   (RECT& rc) const { if (active) map_rect (rc, bound); }
+
+protected:
+  D3DVIEWPORT9 last_game;
+  D3DVIEWPORT9 last_mapped;
+  bool         last_valid = false;
+};
+
+extern ad_render_scale_s render_scale;
+
+#endif /* __AD__SCALE_H__ */
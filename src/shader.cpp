@@ -0,0 +1,187 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "shader.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+# include <malloc.h>
+#else
+# define _aligned_malloc(size,align) aligned_alloc ((align), (size))
+# define _aligned_free(ptr)          free          (ptr)
+#endif
+
+// 1024 slots (16 KiB) comfortably holds a typical play session's worth of
+//   shaders without ever growing.
+static const uint32_t AD_SHADER_TABLE_BITS = 10;
+
+static ad_shader_rec_s*
+AD_AllocShaderSlots (uint32_t num_slots)
+{
+  size_t size = sizeof (ad_shader_rec_s) * num_slots;
+
+  ad_shader_rec_s* slots =
+    (ad_shader_rec_s *)_aligned_malloc (size, 64);
+
+  if (slots != nullptr)
+    memset (slots, 0, size);
+
+  return slots;
+}
+
+ad_shader_table_s::ad_shader_table_s (void)
+{
+  shift = 32 - AD_SHADER_TABLE_BITS;
+  mask  = (1UL << AD_SHADER_TABLE_BITS) - 1;
+  count = 0;
+  slots = AD_AllocShaderSlots (mask + 1);
+
+  version     = 0;
+  num_retired = 0;
+}
+
+ad_shader_table_s::~ad_shader_table_s (void)
+{
+  for (uint32_t i = 0; i < num_retired; i++)
+    _aligned_free (retired [i]);
+
+  _aligned_free (slots);
+}
+
+ad_shader_rec_s*
+ad_shader_table_s::insert (const void* pShader)
+{
+  // Keep the load factor <= 1/2
+  if ((count + 1) * 2 > mask + 1)
+    grow ();
+
+  // Growing failed and there is no room left; at least one slot must stay
+  //   empty or find (...) would never terminate.
+  if (count + 1 > mask)
+    return nullptr;
+
+  uint32_t idx = slot (pShader);
+
+  while (true) {
+    ad_shader_rec_s* rec = &slots [idx];
+
+    if (rec->key == pShader)
+      return rec;
+
+    if (rec->key == nullptr) {
+      rec->key = pShader;
+      ++count;
+      return rec;
+    }
+
+    idx = (idx + 1) & mask;
+  }
+}
+
+bool
+ad_shader_table_s::erase (const void* pShader)
+{
+  uint32_t idx = slot (pShader);
+
+  while (slots [idx].key != pShader) {
+    if (slots [idx].key == nullptr)
+      return false;
+
+    idx = (idx + 1) & mask;
+  }
+
+  //
+  // Backward-shift deletion: pull every displaced record that follows the
+  //   hole back toward its home slot so that no tombstones are needed and
+  //     probe sequences stay as short as they were before the insert.
+  //
+  uint32_t hole = idx;
+
+  while (true) {
+    idx = (idx + 1) & mask;
+
+    if (slots [idx].key == nullptr)
+      break;
+
+    uint32_t home = slot (slots [idx].key);
+
+    // Can the record at idx legally live in the hole? (Cyclic distance)
+    if ( ((idx - home) & mask) >= ((idx - hole) & mask) ) {
+      slots [hole] = slots [idx];
+      hole         = idx;
+    }
+  }
+
+  memset (&slots [hole], 0, sizeof (ad_shader_rec_s));
+  --count;
+
+  return true;
+}
+
+void
+ad_shader_table_s::clear (void)
+{
+  memset (slots, 0, sizeof (ad_shader_rec_s) * (mask + 1));
+  count = 0;
+}
+
+void
+ad_shader_table_s::grow (void)
+{
+  ad_shader_rec_s* old_slots = slots;
+  uint32_t         old_size  = mask + 1;
+
+  ad_shader_rec_s* new_slots = AD_AllocShaderSlots (old_size * 2);
+
+  // Out of memory (or nowhere to retire the old slots); keep probing the
+  //   (crowded) table we already have.
+  if (new_slots == nullptr || num_retired == sizeof (retired) / sizeof (retired [0])) {
+    _aligned_free (new_slots);
+    return;
+  }
+
+  const uint32_t new_mask  = (old_size * 2) - 1;
+  const uint32_t new_shift = shift - 1;
+
+  for (uint32_t i = 0; i < old_size; i++) {
+    if (old_slots [i].key == nullptr)
+      continue;
+
+    uint32_t idx = slot (old_slots [i].key, new_shift);
+
+    while (new_slots [idx].key != nullptr)
+      idx = (idx + 1) & new_mask;
+
+    new_slots [idx] = old_slots [i];
+  }
+
+  // See lookup (...) for the order
+  slots = new_slots;
+  std::atomic_thread_fence (std::memory_order_release);
+  mask  = new_mask;
+  shift = new_shift;
+
+  // A lock-free reader may still be probing these
+  retired [num_retired++] = old_slots;
+}
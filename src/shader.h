@@ -0,0 +1,202 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__SHADER_H__
+#define __AD__SHADER_H__
+
+#include <stdint.h>
+
+#include <atomic>
+
+// What the detours use a tracked shader for
+enum ad_shader_role_t {
+  AD_SHADER_ROLE_NONE       = 0, // Only named in traces
+  AD_SHADER_ROLE_TEXT       = 1, // All UI text
+  AD_SHADER_ROLE_BACKGROUND = 2, // Translucent UI background
+  AD_SHADER_ROLE_MINIMAP    = 3  // Params: [0] = Register of the map transform
+};
+
+// Encapsulates a tracked Direct3D9 shader
+//
+//  * Constant values are mirrored device-wide (vs_consts / ps_consts in
+//      shadow.h), not per shader.
+//
+//  * Entries are loaded from the shader database (shaderdb.h).
+//
+struct dd_shader_s {
+  uint32_t         crc32;       // Bytecode Signature
+  const wchar_t*   description; // _Brief_ Description
+  ad_shader_role_t role;
+  float            params [4];  // Interpreted by the role
+};
+
+// Everything we know about a shader object, so that binding it only ever
+//   costs a single probe into ad_shader_table_s.
+//
+//  * 16 bytes on x86, a 64-byte cache line holds four of these.
+//
+struct alignas (16) ad_shader_rec_s {
+  const void*  key;             // IDirect3D{Vertex|Pixel}Shader9 *
+  uint32_t     crc32;           // Bytecode Signature
+  dd_shader_s* tracked;         // Non-NULL if the shader is being tracked
+  uint32_t     flags;
+
+  enum {
+    FLAG_VERTEX = 0x1,
+    FLAG_PIXEL  = 0x2
+  };
+};
+
+//
+// Flat open-addressing (linear probe) map from shader object to its record.
+//
+//   Load factor is kept at or below 1/2 so that the overwhelming majority of
+//     lookups resolve on the first slot, and nothing is ever allocated per
+//       entry (unlike std::unordered_map's nodes).
+//
+//  * Writers (insert, erase, clear) must be serialized by the caller and
+//      bracket their changes, records filled in included, with begin_write
+//        and end_write.  lookup (...) then needs no lock at all: it retries
+//          if a write overlapped it, and slots outgrown by grow (...) are kept
+//            until the table is destroyed so a reader never touches freed memory.
+//
+//  * A writer that is preempted mid-write would leave readers spinning for
+//      a whole time slice, so lookup (...) gives up after a few attempts;
+//        the caller confirms a miss with find (...) under its writers' lock.
+//
+struct ad_shader_table_s {
+   ad_shader_table_s (void);
+  ~ad_shader_table_s (void);
+
+  // Copies pShader's record into rec; false if it has none, or if writes
+  //   kept overlapping the lookup.  Lock-free.
+  bool             lookup (const void* pShader, ad_shader_rec_s& rec) const
+  {
+    for (int attempt = 0; attempt < 16; attempt++) {
+      const uint32_t ver = version.load (std::memory_order_acquire);
+
+      // A write is in progress
+      if (ver & 1)
+        continue;
+
+      // grow (...) publishes the larger slots before the larger mask, so
+      //   reading them in the opposite order never indexes past the end
+      const uint32_t         msk    = mask;
+      std::atomic_thread_fence (std::memory_order_acquire);
+      const ad_shader_rec_s* pSlots = slots;
+
+      // Every snapshot a writer can leave behind still has empty slots (the
+      //   load factor is at most 1/2), so this always terminates
+      uint32_t idx   = slot (pShader, shift) & msk;
+      bool     found = false;
+
+      while (true) {
+        const void* key = pSlots [idx].key;
+
+        if (key == pShader) {
+          rec   = pSlots [idx];
+          found = true;
+          break;
+        }
+
+        if (key == nullptr)
+          break;
+
+        idx = (idx + 1) & msk;
+      }
+
+      std::atomic_thread_fence (std::memory_order_acquire);
+
+      if (version.load (std::memory_order_relaxed) == ver)
+        return found;
+    }
+
+    return false;
+  }
+
+  void             begin_write (void)
+  {
+    version.fetch_add (1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+  }
+
+  void             end_write   (void)
+  {
+    version.fetch_add (1, std::memory_order_release);
+  }
+
+  // Returns nullptr if pShader has no record (writers only)
+  ad_shader_rec_s* find   (const void* pShader) const
+  {
+    uint32_t idx = slot (pShader);
+
+    while (true) {
+      ad_shader_rec_s* rec = &slots [idx];
+
+      if (rec->key == pShader)
+        return rec;
+
+      if (rec->key == nullptr)
+        return nullptr;
+
+      idx = (idx + 1) & mask;
+    }
+  }
+
+  // Returns the existing record for pShader, or a zero-initialized one
+  //   (nullptr only if the table is full and cannot grow)
+  ad_shader_rec_s* insert (const void* pShader);
+
+  // Returns false if pShader had no record
+  bool             erase  (const void* pShader);
+
+  void             clear  (void);
+
+  uint32_t         size   (void) const { return count; }
+
+protected:
+  uint32_t slot (const void* pShader) const
+  {
+    return slot (pShader, shift);
+  }
+
+  static uint32_t slot (const void* pShader, uint32_t bits_shift)
+  {
+    // Fibonacci hashing; D3D9 objects are at least 8-byte aligned.
+    return (uint32_t)( (uint32_t)((uintptr_t)pShader >> 3) * 2654435769U ) >> bits_shift;
+  }
+
+  void grow (void);
+
+private:
+  ad_shader_rec_s* slots;
+  uint32_t         mask;
+  uint32_t         shift;
+  uint32_t         count;
+
+  std::atomic <uint32_t> version;       // Odd while a write is in progress
+
+  // Outgrown slots; at most one per doubling of a 32-bit index space
+  ad_shader_rec_s* retired      [32];
+  uint32_t         num_retired;
+};
+
+#endif /* __AD__SHADER_H__ */
@@ -0,0 +1,319 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include <Windows.h>
+
+#include "shaderdb.h"
+#include "ini.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+ad_shader_db_s shader_db;
+
+//
+// Written to AgDrag.shaders.ini the first time the game is started; these are
+//   the shaders the detours used to have hardcoded.
+//
+static const wchar_t* AD_DEFAULT_SHADERS =
+  L"[Text]\n"
+  L"Stage=PS\n"
+  L"CRC=0d6c2e96\n"
+  L"Role=Text\n"
+  L"Description=text\n"
+  L"\n"
+  L"[Background.0]\n"
+  L"Stage=PS\n"
+  L"CRC=79b9d805\n"
+  L"Role=Background\n"
+  L"Description=bg0\n"
+  L"\n"
+  L"[Minimap.0]\n"
+  L"Stage=VS\n"
+  L"CRC=9a78e585\n"
+  L"Role=Minimap\n"
+  L"Params=2\n"
+  L"Description=minimap0\n";
+
+static const struct {
+  const wchar_t*   name;
+  ad_shader_role_t role;
+} ad_shader_roles [] = {
+  { L"None",       AD_SHADER_ROLE_NONE       },
+  { L"Text",       AD_SHADER_ROLE_TEXT       },
+  { L"Background", AD_SHADER_ROLE_BACKGROUND },
+  { L"Minimap",    AD_SHADER_ROLE_MINIMAP    }
+};
+
+// Buckets hold two keys on average; the search below stays short even
+//   for a few thousand shaders.
+static const uint32_t AD_MPH_KEYS_PER_BUCKET = 2;
+static const uint32_t AD_MPH_MAX_DISP        = 1UL << 20;
+
+static bool
+AD_ParseShader ( const std::wstring&      name,
+                 ad::INI::File::Section&  section,
+                 dd_shader_s&             shader,
+                 bool&                    pixel )
+{
+  if (! ( section.contains_key (L"Stage") && section.contains_key (L"CRC") &&
+          section.contains_key (L"Role") ))
+    return false;
+
+  if      (section.get_value (L"Stage") == L"VS") pixel = false;
+  else if (section.get_value (L"Stage") == L"PS") pixel = true;
+  else
+    return false;
+
+  const wchar_t* wszHex = section.get_value (L"CRC").c_str ();
+  wchar_t*       end    = nullptr;
+
+  shader.crc32 = wcstoul (wszHex, &end, 16);
+
+  if (end == wszHex || *end != L'\0')
+    return false;
+
+  bool known_role = false;
+
+  for (size_t i = 0; i < sizeof (ad_shader_roles) / sizeof (ad_shader_roles [0]); i++) {
+    if (section.get_value (L"Role") == ad_shader_roles [i].name) {
+      shader.role = ad_shader_roles [i].role;
+      known_role  = true;
+    }
+  }
+
+  if (! known_role)
+    return false;
+
+  memset (shader.params, 0, sizeof (shader.params));
+
+  if (section.contains_key (L"Params")) {
+    const wchar_t* wszParam = section.get_value (L"Params").c_str ();
+
+    for (int i = 0; i < 4 && *wszParam != L'\0'; i++) {
+      shader.params [i] = (float)wcstod (wszParam, &end);
+
+      if (end == wszParam)
+        return false;
+
+      wszParam = (*end == L',') ? end + 1 : end;
+    }
+  }
+
+  shader.description =
+    _wcsdup ( section.contains_key (L"Description") ?
+                section.get_value (L"Description").c_str () :
+                name.c_str () );
+
+  return shader.description != nullptr;
+}
+
+//
+// Hash and displace: keys are first split into buckets by hash (crc, 0),
+//   then the largest buckets pick the first displacement d that sends all
+//     of their keys to free slots through hash (crc, d).
+//
+static bool
+AD_CompileShaders ( const std::vector <dd_shader_s>& shaders,
+                    dd_shader_s*&                    entries,
+                    uint32_t*&                       disp,
+                    uint32_t&                        num_buckets )
+{
+  const uint32_t size = (uint32_t)shaders.size ();
+
+  num_buckets = (size + AD_MPH_KEYS_PER_BUCKET - 1) / AD_MPH_KEYS_PER_BUCKET;
+
+  std::vector <std::vector <uint32_t>> buckets (num_buckets);
+
+  for (uint32_t i = 0; i < size; i++) {
+    buckets [ad_shader_db_s::reduce (ad_shader_db_s::hash (shaders [i].crc32, 0), num_buckets)].
+      push_back (i);
+  }
+
+  std::vector <uint32_t> order (num_buckets);
+
+  for (uint32_t i = 0; i < num_buckets; i++)
+    order [i] = i;
+
+  std::stable_sort ( order.begin (), order.end (),
+                       [&](uint32_t a, uint32_t b) { return buckets [a].size () > buckets [b].size (); } );
+
+  std::vector <uint32_t> slot_of (size, UINT32_MAX);
+  std::vector <bool>     taken   (size, false);
+  std::vector <uint32_t> displacement (num_buckets, 0);
+  std::vector <uint32_t> slots;
+
+  for (uint32_t b = 0; b < num_buckets; b++) {
+    const std::vector <uint32_t>& bucket = buckets [order [b]];
+
+    if (bucket.empty ())
+      break;
+
+    uint32_t d = 1;
+
+    for (; d < AD_MPH_MAX_DISP; d++) {
+      slots.clear ();
+
+      for (size_t k = 0; k < bucket.size (); k++) {
+        uint32_t slot =
+          ad_shader_db_s::reduce (ad_shader_db_s::hash (shaders [bucket [k]].crc32, d), size);
+
+        if (taken [slot] || std::find (slots.begin (), slots.end (), slot) != slots.end ())
+          break;
+
+        slots.push_back (slot);
+      }
+
+      if (slots.size () == bucket.size ())
+        break;
+    }
+
+    if (d == AD_MPH_MAX_DISP)
+      return false;
+
+    for (size_t k = 0; k < bucket.size (); k++) {
+      taken   [slots  [k]] = true;
+      slot_of [bucket [k]] = slots [k];
+    }
+
+    displacement [order [b]] = d;
+  }
+
+  entries = new dd_shader_s [size];
+  disp    = new uint32_t    [num_buckets];
+
+  for (uint32_t i = 0; i < size; i++)
+    entries [slot_of [i]] = shaders [i];
+
+  memcpy (disp, displacement.data (), sizeof (uint32_t) * num_buckets);
+
+  return true;
+}
+
+
+ad_shader_db_s::ad_shader_db_s (void)
+{
+  memset (&vs, 0, sizeof (vs));
+  memset (&ps, 0, sizeof (ps));
+}
+
+ad_shader_db_s::~ad_shader_db_s (void)
+{
+  release (vs);
+  release (ps);
+}
+
+void
+ad_shader_db_s::release (mph_s& mph)
+{
+  for (uint32_t i = 0; i < mph.size; i++)
+    free ((void *)mph.entries [i].description);
+
+  delete [] mph.entries;
+  delete [] mph.disp;
+
+  memset (&mph, 0, sizeof (mph));
+}
+
+bool
+ad_shader_db_s::load (const wchar_t* filename)
+{
+  ad::INI::File* shaders_ini = new ad::INI::File ((wchar_t *)filename);
+
+  if (shaders_ini->get_sections ().empty ()) {
+    shaders_ini->import (AD_DEFAULT_SHADERS);
+    shaders_ini->write  (filename);
+
+    dll_log.Log (L" [Shaders] Created %s from the built-in database.", filename);
+  }
+
+  std::vector <dd_shader_s> parsed [2];
+
+  const std::map <std::wstring, ad::INI::File::Section>& sections =
+    shaders_ini->get_sections ();
+
+  for ( std::map <std::wstring, ad::INI::File::Section>::const_iterator it = sections.begin ();
+          it != sections.end ();
+            ++it ) {
+    dd_shader_s shader;
+    bool        pixel;
+
+    if (! AD_ParseShader (it->first, shaders_ini->get_section (it->first), shader, pixel)) {
+      dll_log.Log (L" [Shaders] Ignoring malformed shader [%s]", it->first.c_str ());
+      continue;
+    }
+
+    std::vector <dd_shader_s>& stage = parsed [pixel ? 1 : 0];
+
+    bool duplicate = false;
+
+    for (size_t i = 0; i < stage.size (); i++)
+      duplicate |= (stage [i].crc32 == shader.crc32);
+
+    if (duplicate) {
+      dll_log.Log ( L" [Shaders] Ignoring [%s]; %s CRC %08x is already tracked",
+                      it->first.c_str (), pixel ? L"PS" : L"VS", shader.crc32 );
+      free ((void *)shader.description);
+      continue;
+    }
+
+    stage.push_back (shader);
+  }
+
+  delete shaders_ini;
+
+  mph_s* stages [2] = { &vs, &ps };
+  bool   ok         = true;
+
+  for (int i = 0; i < 2; i++) {
+    release (*stages [i]);
+
+    if (parsed [i].empty ())
+      continue;
+
+    mph_s compiled = { 0 };
+
+    if (! AD_CompileShaders (parsed [i], compiled.entries, compiled.disp, compiled.num_buckets)) {
+      dll_log.Log ( L" [Shaders] Could not compile a perfect hash for %lu %s shaders!",
+                      parsed [i].size (), i ? L"pixel" : L"vertex" );
+
+      for (size_t j = 0; j < parsed [i].size (); j++)
+        free ((void *)parsed [i][j].description);
+
+      ok = false;
+      continue;
+    }
+
+    compiled.size = (uint32_t)parsed [i].size ();
+    *stages [i]   = compiled;
+  }
+
+  dll_log.Log ( L" [Shaders] Compiled %lu vertex and %lu pixel shaders from %s",
+                  vs.size, ps.size, filename );
+
+  return ok;
+}
@@ -0,0 +1,109 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__SHADERDB_H__
+#define __AD__SHADERDB_H__
+
+#include <stdint.h>
+
+#include "shader.h"
+
+//
+// Tracked shader database (AgDrag.shaders.ini)
+//
+//   Every shader the detours single out is described by one section, e.g.
+//
+//     [Minimap.0]
+//     Stage=VS
+//     CRC=9a78e585
+//     Role=Minimap
+//     Params=2
+//
+//   CRC is the hex CRC-32 of the bytecode, Role is what the detours use the
+//     shader for (None only names it in traces) and Params are up to four
+//       numbers the role interprets.  Description defaults to the section.
+//
+//  * Each stage is compiled at load into a minimal perfect hash (hash and
+//      displace): one displacement lookup and one multiply-shift locate the
+//        only entry a CRC could be, so binding never probes or allocates.
+//
+struct ad_shader_db_s {
+  // Returns nullptr if crc32 is not tracked for the given stage
+  dd_shader_s* find (uint32_t crc32, bool pixel) const
+  {
+    const mph_s& mph = pixel ? ps : vs;
+
+    if (mph.size == 0)
+      return nullptr;
+
+    uint32_t     disp  = mph.disp    [reduce (hash (crc32, 0),    mph.num_buckets)];
+    dd_shader_s* entry = &mph.entries [reduce (hash (crc32, disp), mph.size)];
+
+    return entry->crc32 == crc32 ? entry : nullptr;
+  }
+
+  // Compiles the shaders in filename, which is created from the built-in
+  //   database if it does not exist.
+  //
+  //  * Shader records point into the database; load it only before the
+  //      game creates its first shader.
+  bool         load (const wchar_t* filename);
+
+  int          size (bool pixel) const { return (int)(pixel ? ps.size : vs.size); }
+
+  ad_shader_db_s  (void);
+  ~ad_shader_db_s (void);
+
+  static uint32_t hash (uint32_t crc32, uint32_t seed)
+  {
+    // MurmurHash3 finalizer; CRCs are already well mixed, but the seed is not
+    uint32_t h = crc32 ^ (seed * 0x9e3779b9U);
+
+    h ^= h >> 16; h *= 0x85ebca6bU;
+    h ^= h >> 13; h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+
+    return h;
+  }
+
+  // Maps a 32-bit hash onto [0, n) without a division
+  static uint32_t reduce (uint32_t h, uint32_t n)
+  {
+    return (uint32_t)(((uint64_t)h * n) >> 32);
+  }
+
+protected:
+  struct mph_s {
+    dd_shader_s* entries;        // size entries, one per tracked shader
+    uint32_t*    disp;           // num_buckets displacements
+    uint32_t     size;
+    uint32_t     num_buckets;
+  };
+
+  void release (mph_s& mph);
+
+  mph_s vs;
+  mph_s ps;
+};
+
+extern ad_shader_db_s shader_db;
+
+#endif /* __AD__SHADERDB_H__ */
@@ -0,0 +1,983 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "shadow.h"
+
+#include "render.h"
+#include "config.h"
+#include "scale.h"
+#include "hook.h"
+#include "log.h"
+
+#include <string.h>
+#include <emmintrin.h>
+
+#include <vector>
+
+// The game's viewport (render.cpp)
+extern D3DVIEWPORT9 viewport;
+
+// Background mode is dropping this frame's draws (render.cpp)
+extern bool AD_DroppingFrame (void);
+
+bool                    recording_state_block = false;
+
+ad_viewport_shadow_s    vp_shadow;
+ad_renderstate_shadow_s rs_shadow;
+
+uint32_t                draw_epoch = 0;
+
+ad_constant_file_s      vs_consts (256);
+ad_constant_file_s      ps_consts (224);
+
+ad_texture_shadow_s       tex_shadow;
+ad_render_target_shadow_s rt_shadow;
+ad_call_filter_s          call_filter;
+
+typedef HRESULT (STDMETHODCALLTYPE *SetRenderState_t)
+  (IDirect3DDevice9* This, D3DRENDERSTATETYPE State, DWORD Value);
+
+SetRenderState_t D3D9SetRenderState_Original = nullptr;
+
+typedef HRESULT (STDMETHODCALLTYPE *GetRenderState_t)
+  (IDirect3DDevice9* This, D3DRENDERSTATETYPE State, DWORD* pValue);
+
+GetRenderState_t D3D9GetRenderState_Original = nullptr;
+
+static inline bool
+AD_SameViewport (const D3DVIEWPORT9& a, const D3DVIEWPORT9& b)
+{
+  return memcmp (&a, &b, sizeof (D3DVIEWPORT9)) == 0;
+}
+
+//
+// vp (and the game's viewport) are in game pixels, bound is what the device
+//   has; they only differ while a scaled target (Render.Scale) is bound.
+//
+HRESULT
+ad_viewport_shadow_s::apply (IDirect3DDevice9* dev, const D3DVIEWPORT9& vp)
+{
+  pending = true;
+
+  D3DVIEWPORT9 mapped = vp;
+  render_scale.map (mapped);
+
+  if (known && AD_SameViewport (bound, mapped)) {
+    ++saved;
+    return D3D_OK;
+  }
+
+  ++issued;
+
+  HRESULT hr = D3D9SetViewport_Original (dev, &mapped);
+
+  if (SUCCEEDED (hr)) {
+    bound = mapped;
+    known = defer;
+  } else {
+    known = false;
+  }
+
+  return hr;
+}
+
+void
+ad_viewport_shadow_s::release (IDirect3DDevice9* dev)
+{
+  if (! defer)
+    restore (dev);
+}
+
+void
+ad_viewport_shadow_s::restore (IDirect3DDevice9* dev)
+{
+  pending = false;
+
+  D3DVIEWPORT9 mapped = viewport;
+  render_scale.map (mapped);
+
+  if (known && AD_SameViewport (bound, mapped)) {
+    ++saved;
+    return;
+  }
+
+  ++issued;
+
+  if (SUCCEEDED (D3D9SetViewport_Original (dev, &mapped))) {
+    bound = mapped;
+    known = defer;
+  } else {
+    known = false;
+  }
+}
+
+void
+ad_viewport_shadow_s::track (const D3DVIEWPORT9& vp)
+{
+  // Without the hooks, the device could change it where we cannot see
+  bound   = vp;
+  known   = defer && (! recording_state_block);
+  pending = false;
+}
+
+void
+ad_viewport_shadow_s::invalidate (void)
+{
+  known   = false;
+  pending = false;
+}
+
+void
+ad_viewport_shadow_s::end_frame (void)
+{
+  saved_last_frame = saved;
+
+  issued = 0;
+  saved  = 0;
+}
+
+
+HRESULT
+ad_renderstate_shadow_s::set (IDirect3DDevice9* dev, D3DRENDERSTATETYPE state, DWORD val)
+{
+  if (is_known (state) && value [state] == val) {
+    ++saved;
+    return D3D_OK;
+  }
+
+  ++issued;
+
+  HRESULT hr =
+    D3D9SetRenderState_Original != nullptr ?
+      D3D9SetRenderState_Original (dev, state, val) :
+        dev->SetRenderState       (state, val);
+
+  if (SUCCEEDED (hr))
+    track  (state, val);
+  else
+    forget (state);
+
+  return hr;
+}
+
+DWORD
+ad_renderstate_shadow_s::get (IDirect3DDevice9* dev, D3DRENDERSTATETYPE state)
+{
+  if (is_known (state)) {
+    ++saved;
+    return value [state];
+  }
+
+  ++issued;
+
+  DWORD val = 0;
+
+  // Not through the detour; that would flush the overrides being made
+  HRESULT hr =
+    D3D9GetRenderState_Original != nullptr ?
+      D3D9GetRenderState_Original (dev, state, &val) :
+        dev->GetRenderState       (state, &val);
+
+  if (SUCCEEDED (hr))
+    track (state, val);
+
+  return val;
+}
+
+void
+ad_renderstate_shadow_s::override (IDirect3DDevice9* dev, D3DRENDERSTATETYPE state, DWORD val)
+{
+  released = false;
+
+  for (int i = 0; i < num_overrides; i++) {
+    if (overrides [i].state == state) {
+      set (dev, state, val);
+      return;
+    }
+  }
+
+  if (num_overrides == MAX_OVERRIDES)
+    return;
+
+  overrides [num_overrides].state = state;
+  overrides [num_overrides].game  = get (dev, state);
+
+  ++num_overrides;
+
+  set (dev, state, val);
+}
+
+void
+ad_renderstate_shadow_s::release (IDirect3DDevice9* dev)
+{
+  released = true;
+
+  if (! defer)
+    restore (dev);
+}
+
+void
+ad_renderstate_shadow_s::restore (IDirect3DDevice9* dev)
+{
+  // Reverse order, in case the same state was somehow saved twice
+  while (num_overrides > 0) {
+    --num_overrides;
+
+    set (dev, overrides [num_overrides].state,
+              overrides [num_overrides].game);
+  }
+
+  released = false;
+}
+
+bool
+ad_renderstate_shadow_s::intercept (D3DRENDERSTATETYPE state, DWORD val)
+{
+  if (recording_state_block)
+    return false;
+
+  for (int i = 0; i < num_overrides; i++) {
+    if (overrides [i].state == state) {
+      overrides [i].game = val;
+      ++saved;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+ad_renderstate_shadow_s::track (D3DRENDERSTATETYPE state, DWORD val)
+{
+  if ((uint32_t)state >= MAX_STATES)
+    return;
+
+  // Without the hooks, the device could change it where we cannot see
+  if ((! defer) || recording_state_block) {
+    forget (state);
+    return;
+  }
+
+  value [state]       =  val;
+  known [state >> 5] |=  (1UL << (state & 31));
+}
+
+void
+ad_renderstate_shadow_s::forget (D3DRENDERSTATETYPE state)
+{
+  if ((uint32_t)state < MAX_STATES)
+    known [state >> 5] &= ~(1UL << (state & 31));
+}
+
+void
+ad_renderstate_shadow_s::invalidate (void)
+{
+  memset (known, 0, sizeof (known));
+
+  num_overrides = 0;
+  released      = false;
+}
+
+void
+ad_renderstate_shadow_s::end_frame (void)
+{
+  saved_last_frame = saved;
+
+  issued = 0;
+  saved  = 0;
+}
+
+
+
+ad_constant_file_s::ad_constant_file_s (uint32_t vec4s)
+{
+  num_vec4s   = vec4s < MAX_VEC4S ? vec4s : MAX_VEC4S;
+  generation  = 0;
+  dirty_epoch = draw_epoch - 1;
+
+  memset (regs,  0, sizeof (regs));
+  memset (gen,   0, sizeof (gen));
+  memset (known, 0, sizeof (known));
+  memset (dirty, 0, sizeof (dirty));
+
+  dirty_first = MAX_VEC4S;
+  dirty_last  = 0;
+}
+
+void
+ad_constant_file_s::begin_epoch (void)
+{
+  memset (dirty, 0, sizeof (dirty));
+
+  dirty_epoch = draw_epoch;
+  dirty_first = MAX_VEC4S;
+  dirty_last  = 0;
+}
+
+uint32_t
+ad_constant_file_s::write (uint32_t start, const float* data, uint32_t count)
+{
+  // Recorded into the state block, not the device
+  if (recording_state_block)
+    return count;
+
+  if (dirty_epoch != draw_epoch)
+    begin_epoch ();
+
+  uint32_t end     = (start + count) < num_vec4s ? (start + count) : num_vec4s;
+  uint32_t changed = 0;
+
+  const uint32_t next = generation + 1;
+
+  for (uint32_t reg = start; reg < end; reg++, data += 4) {
+    const uint32_t bit  = 1UL << (reg & 31);
+    const uint32_t word = reg >> 5;
+
+    // Bitwise, so that -0.0 vs 0.0 and NaNs count as changes
+    __m128i in  = _mm_loadu_si128 ((const __m128i *)data);
+    __m128i cur = _mm_loadu_si128 ((const __m128i *)regs [reg]);
+
+    if ( (known [word] & bit) &&
+         _mm_movemask_epi8 (_mm_cmpeq_epi32 (in, cur)) == 0xffff )
+      continue;
+
+    _mm_storeu_si128 ((__m128i *)regs [reg], in);
+
+    known [word] |= bit;
+    dirty [word] |= bit;
+    gen   [reg]   = next;
+
+    if (reg < dirty_first) dirty_first = reg;
+    if (reg > dirty_last)  dirty_last  = reg;
+
+    ++changed;
+  }
+
+  if (changed > 0)
+    generation = next;
+
+  return changed;
+}
+
+void
+ad_constant_file_s::invalidate (void)
+{
+  if (dirty_epoch != draw_epoch)
+    begin_epoch ();
+
+  ++generation;
+
+  for (uint32_t reg = 0; reg < num_vec4s; reg++)
+    gen [reg] = generation;
+
+  memset (known, 0,    sizeof (known));
+  memset (dirty, 0xff, sizeof (dirty));
+
+  dirty_first = 0;
+  dirty_last  = num_vec4s - 1;
+}
+
+void
+ad_constant_file_s::forget (uint32_t start, uint32_t count)
+{
+  if (recording_state_block)
+    return;
+
+  if (dirty_epoch != draw_epoch)
+    begin_epoch ();
+
+  uint32_t end = (start + count) < num_vec4s ? (start + count) : num_vec4s;
+
+  if (start >= end)
+    return;
+
+  ++generation;
+
+  for (uint32_t reg = start; reg < end; reg++) {
+    const uint32_t bit  = 1UL << (reg & 31);
+    const uint32_t word = reg >> 5;
+
+    known [word] &= ~bit;
+    dirty [word] |=  bit;
+    gen   [reg]   = generation;
+  }
+
+  if (start   < dirty_first) dirty_first = start;
+  if (end - 1 > dirty_last)  dirty_last  = end - 1;
+}
+
+
+void
+ad_texture_shadow_s::track (DWORD sampler, IDirect3DBaseTexture9* tex)
+{
+  int idx = slot (sampler);
+
+  if (idx < 0)
+    return;
+
+  if (recording_state_block) {
+    forget (sampler);
+    return;
+  }
+
+  bound [idx]  = tex;
+  known       |= (1UL << idx);
+}
+
+void
+ad_texture_shadow_s::forget (DWORD sampler)
+{
+  int idx = slot (sampler);
+
+  if (idx >= 0)
+    known &= ~(1UL << idx);
+}
+
+
+void
+ad_render_target_shadow_s::track (IDirect3DSurface9* pSurface)
+{
+  D3DSURFACE_DESC desc;
+
+  // Binding NULL to RT 0 fails; keep what the device still has
+  if (pSurface == nullptr || FAILED (pSurface->GetDesc (&desc)))
+    return;
+
+  // Scaled targets are still addressed at the size the game asked for
+  if (render_scale.active) {
+    desc.Width  = render_scale.bound.width;
+    desc.Height = render_scale.bound.height;
+  }
+
+  if (desc.Width != width || desc.Height != height) {
+    width  = desc.Width;
+    height = desc.Height;
+    stale  = true;
+  }
+}
+
+void
+ad_render_target_shadow_s::reset (uint32_t backbuffer_width, uint32_t backbuffer_height)
+{
+  width  = backbuffer_width;
+  height = backbuffer_height;
+  stale  = true;
+}
+
+void
+ad_render_target_shadow_s::refit (void)
+{
+  // Integer division is intentional; it is the same ratio test that tells
+  //   off-screen targets apart from the backbuffer everywhere else.
+  bool matches_bb = height != 0 && display.height != 0 &&
+                    width / height == display.width / display.height;
+
+  if (matches_bb && config.render.aspect_correction)
+    AD_ComputeDisplayCoeffs (coeffs, width, height, display.wider);
+  else
+    coeffs = ad_display_coeffs_s ();
+
+  fit_generation = display.generation;
+  stale          = false;
+}
+
+//
+// Everything the game does that either depends on its own viewport / render
+//   states being bound, or changes them without going through SetViewport /
+//     SetRenderState.
+//
+typedef HRESULT (STDMETHODCALLTYPE *SetRenderTarget_t)
+  (IDirect3DDevice9* This, DWORD RenderTargetIndex, IDirect3DSurface9* pRenderTarget);
+typedef HRESULT (STDMETHODCALLTYPE *Clear_t)
+  (IDirect3DDevice9* This, DWORD Count, CONST D3DRECT* pRects, DWORD Flags,
+   D3DCOLOR Color, float Z, DWORD Stencil);
+typedef HRESULT (STDMETHODCALLTYPE *GetViewport_t)
+  (IDirect3DDevice9* This, D3DVIEWPORT9* pViewport);
+typedef HRESULT (STDMETHODCALLTYPE *CreateStateBlock_t)
+  (IDirect3DDevice9* This, D3DSTATEBLOCKTYPE Type, IDirect3DStateBlock9** ppSB);
+typedef HRESULT (STDMETHODCALLTYPE *BeginStateBlock_t)
+  (IDirect3DDevice9* This);
+typedef HRESULT (STDMETHODCALLTYPE *EndStateBlock_t)
+  (IDirect3DDevice9* This, IDirect3DStateBlock9** ppSB);
+typedef HRESULT (STDMETHODCALLTYPE *DrawPrimitiveUP_t)
+  (IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT PrimitiveCount,
+   CONST void* pVertexStreamZeroData, UINT VertexStreamZeroStride);
+typedef HRESULT (STDMETHODCALLTYPE *DrawIndexedPrimitiveUP_t)
+  (IDirect3DDevice9* This, D3DPRIMITIVETYPE PrimitiveType, UINT MinVertexIndex,
+   UINT NumVertices, UINT PrimitiveCount, CONST void* pIndexData,
+   D3DFORMAT IndexDataFormat, CONST void* pVertexStreamZeroData,
+   UINT VertexStreamZeroStride);
+typedef HRESULT (STDMETHODCALLTYPE *ProcessVertices_t)
+  (IDirect3DDevice9* This, UINT SrcStartIndex, UINT DestIndex, UINT VertexCount,
+   IDirect3DVertexBuffer9* pDestBuffer, IDirect3DVertexDeclaration9* pVertexDecl,
+   DWORD Flags);
+typedef HRESULT (STDMETHODCALLTYPE *StateBlock_t)
+  (IDirect3DStateBlock9* This);
+
+SetRenderTarget_t        D3D9SetRenderTarget_Original        = nullptr;
+Clear_t                  D3D9Clear_Original                  = nullptr;
+GetViewport_t            D3D9GetViewport_Original            = nullptr;
+CreateStateBlock_t       D3D9CreateStateBlock_Original       = nullptr;
+BeginStateBlock_t        D3D9BeginStateBlock_Original        = nullptr;
+EndStateBlock_t          D3D9EndStateBlock_Original          = nullptr;
+DrawPrimitiveUP_t        D3D9DrawPrimitiveUP_Original        = nullptr;
+DrawIndexedPrimitiveUP_t D3D9DrawIndexedPrimitiveUP_Original = nullptr;
+ProcessVertices_t        D3D9ProcessVertices_Original        = nullptr;
+StateBlock_t             D3D9StateBlock_Capture_Original     = nullptr;
+StateBlock_t             D3D9StateBlock_Apply_Original       = nullptr;
+
+// Flush pending restores, for calls that only ever come from the game
+#define AD_SHADOW_FLUSH(dev)                \
+  if ((dev) == ad::RenderFix::pDevice) {    \
+    vp_shadow.flush ((dev));                \
+    rs_shadow.flush ((dev));                \
+  }
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9SetRenderState_Detour (IDirect3DDevice9*  This,
+                           D3DRENDERSTATETYPE State,
+                           DWORD              Value)
+{
+  // Ignore anything that's not the primary render device.
+  if (This != ad::RenderFix::pDevice)
+    return D3D9SetRenderState_Original (This, State, Value);
+
+  if (rs_shadow.intercept (State, Value))
+    return D3D_OK;
+
+  HRESULT hr = D3D9SetRenderState_Original (This, State, Value);
+
+  if (SUCCEEDED (hr))
+    rs_shadow.track  (State, Value);
+  else
+    rs_shadow.forget (State);
+
+  return hr;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9SetRenderTarget_Detour (IDirect3DDevice9*  This,
+                            DWORD              RenderTargetIndex,
+                            IDirect3DSurface9* pRenderTarget)
+{
+  AD_SHADOW_FLUSH (This);
+
+  HRESULT hr =
+    D3D9SetRenderTarget_Original (This, RenderTargetIndex, pRenderTarget);
+
+  // Setting RT 0 resets the viewport to cover the whole surface
+  if (This == ad::RenderFix::pDevice && RenderTargetIndex == 0) {
+    vp_shadow.invalidate ();
+
+    if (SUCCEEDED (hr)) {
+      render_scale.bind (pRenderTarget);
+      rt_shadow.track   (pRenderTarget);
+    }
+  }
+
+  return hr;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9Clear_Detour (IDirect3DDevice9* This,
+                  DWORD             Count,
+            CONST D3DRECT*          pRects,
+                  DWORD             Flags,
+                  D3DCOLOR          Color,
+                  float             Z,
+                  DWORD             Stencil)
+{
+  AD_SHADOW_FLUSH (This);
+
+  // Partial clears are in game pixels, just like the viewport
+  if ( This == ad::RenderFix::pDevice && render_scale.active &&
+       pRects != nullptr && Count > 0 ) {
+    std::vector <D3DRECT> mapped (pRects, pRects + Count);
+
+    for (D3DRECT& rect : mapped) {
+      RECT rc = { rect.x1, rect.y1, rect.x2, rect.y2 };
+
+      render_scale.map (rc);
+
+      rect.x1 = rc.left;  rect.y1 = rc.top;
+      rect.x2 = rc.right; rect.y2 = rc.bottom;
+    }
+
+    return D3D9Clear_Original (This, Count, mapped.data (), Flags, Color, Z, Stencil);
+  }
+
+  return D3D9Clear_Original (This, Count, pRects, Flags, Color, Z, Stencil);
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9GetViewport_Detour (IDirect3DDevice9* This,
+                        D3DVIEWPORT9*     pViewport)
+{
+  AD_SHADOW_FLUSH (This);
+
+  HRESULT hr = D3D9GetViewport_Original (This, pViewport);
+
+  if (This == ad::RenderFix::pDevice && SUCCEEDED (hr))
+    render_scale.unmap (*pViewport);
+
+  return hr;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9GetRenderState_Detour (IDirect3DDevice9*  This,
+                           D3DRENDERSTATETYPE State,
+                           DWORD*             pValue)
+{
+  // The game must never read back one of our overrides
+  AD_SHADOW_FLUSH (This);
+
+  return D3D9GetRenderState_Original (This, State, pValue);
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9DrawPrimitiveUP_Detour (IDirect3DDevice9* This,
+                            D3DPRIMITIVETYPE  PrimitiveType,
+                            UINT              PrimitiveCount,
+                      CONST void*             pVertexStreamZeroData,
+                            UINT              VertexStreamZeroStride)
+{
+  ++draw_epoch;
+
+  if (This == ad::RenderFix::pDevice && AD_DroppingFrame ())
+    return S_OK;
+
+  AD_SHADOW_FLUSH (This);
+
+  return D3D9DrawPrimitiveUP_Original ( This, PrimitiveType, PrimitiveCount,
+                                          pVertexStreamZeroData,
+                                            VertexStreamZeroStride );
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9DrawIndexedPrimitiveUP_Detour (IDirect3DDevice9* This,
+                                   D3DPRIMITIVETYPE  PrimitiveType,
+                                   UINT              MinVertexIndex,
+                                   UINT              NumVertices,
+                                   UINT              PrimitiveCount,
+                             CONST void*             pIndexData,
+                                   D3DFORMAT         IndexDataFormat,
+                             CONST void*             pVertexStreamZeroData,
+                                   UINT              VertexStreamZeroStride)
+{
+  ++draw_epoch;
+
+  if (This == ad::RenderFix::pDevice && AD_DroppingFrame ())
+    return S_OK;
+
+  AD_SHADOW_FLUSH (This);
+
+  return D3D9DrawIndexedPrimitiveUP_Original ( This, PrimitiveType,
+                                                 MinVertexIndex, NumVertices,
+                                                   PrimitiveCount,
+                                                     pIndexData, IndexDataFormat,
+                                                       pVertexStreamZeroData,
+                                                         VertexStreamZeroStride );
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9ProcessVertices_Detour (IDirect3DDevice9*            This,
+                            UINT                         SrcStartIndex,
+                            UINT                         DestIndex,
+                            UINT                         VertexCount,
+                            IDirect3DVertexBuffer9*      pDestBuffer,
+                            IDirect3DVertexDeclaration9* pVertexDecl,
+                            DWORD                        Flags)
+{
+  AD_SHADOW_FLUSH (This);
+
+  return D3D9ProcessVertices_Original ( This, SrcStartIndex, DestIndex,
+                                          VertexCount, pDestBuffer,
+                                            pVertexDecl, Flags );
+}
+
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9StateBlock_Capture_Detour (IDirect3DStateBlock9* This)
+{
+  IDirect3DDevice9* pDev = nullptr;
+
+  if (SUCCEEDED (This->GetDevice (&pDev))) {
+    AD_SHADOW_FLUSH (pDev);
+    pDev->Release ();
+  }
+
+  return D3D9StateBlock_Capture_Original (This);
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9StateBlock_Apply_Detour (IDirect3DStateBlock9* This)
+{
+  IDirect3DDevice9* pDev = nullptr;
+
+  if (FAILED (This->GetDevice (&pDev)))
+    return D3D9StateBlock_Apply_Original (This);
+
+  // Restores must not land on top of whatever the block sets
+  AD_SHADOW_FLUSH (pDev);
+
+  HRESULT hr = D3D9StateBlock_Apply_Original (This);
+
+  if (pDev == ad::RenderFix::pDevice) {
+    vp_shadow.invalidate ();
+    rs_shadow.invalidate ();
+
+    vs_consts.invalidate ();
+    ps_consts.invalidate ();
+    tex_shadow.invalidate ();
+  }
+
+  pDev->Release ();
+
+  return hr;
+}
+
+static bool
+AD_HookStateBlock (IDirect3DStateBlock9* pSB)
+{
+  static bool attempted = false;
+  static bool hooked    = false;
+
+  if (attempted || pSB == nullptr)
+    return hooked;
+
+  attempted = true;
+
+  void** vftable = *(void***)pSB;
+
+  hooked =
+    AD_CreateFuncHook ( L"IDirect3DStateBlock9::Capture",
+                        vftable [4],
+                        D3D9StateBlock_Capture_Detour,
+              (LPVOID*)&D3D9StateBlock_Capture_Original ) == MH_OK &&
+    AD_EnableHook     (vftable [4]) == MH_OK;
+
+  hooked = hooked &&
+    AD_CreateFuncHook ( L"IDirect3DStateBlock9::Apply",
+                        vftable [5],
+                        D3D9StateBlock_Apply_Detour,
+              (LPVOID*)&D3D9StateBlock_Apply_Original ) == MH_OK &&
+    AD_EnableHook     (vftable [5]) == MH_OK;
+
+  return hooked;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9CreateStateBlock_Detour (IDirect3DDevice9*      This,
+                             D3DSTATEBLOCKTYPE      Type,
+                             IDirect3DStateBlock9** ppSB)
+{
+  AD_SHADOW_FLUSH (This);
+
+  HRESULT hr = D3D9CreateStateBlock_Original (This, Type, ppSB);
+
+  if (SUCCEEDED (hr))
+    AD_HookStateBlock (*ppSB);
+
+  return hr;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9BeginStateBlock_Detour (IDirect3DDevice9* This)
+{
+  AD_SHADOW_FLUSH (This);
+
+  HRESULT hr = D3D9BeginStateBlock_Original (This);
+
+  if (SUCCEEDED (hr) && This == ad::RenderFix::pDevice) {
+    recording_state_block = true;
+
+    vp_shadow.invalidate  ();
+    rs_shadow.invalidate  ();
+    tex_shadow.invalidate ();
+  }
+
+  return hr;
+}
+
+COM_DECLSPEC_NOTHROW
+HRESULT
+STDMETHODCALLTYPE
+D3D9EndStateBlock_Detour (IDirect3DDevice9*      This,
+                          IDirect3DStateBlock9** ppSB)
+{
+  HRESULT hr = D3D9EndStateBlock_Original (This, ppSB);
+
+  if (This == ad::RenderFix::pDevice) {
+    recording_state_block = false;
+
+    vp_shadow.invalidate  ();
+    rs_shadow.invalidate  ();
+    tex_shadow.invalidate ();
+  }
+
+  if (SUCCEEDED (hr))
+    AD_HookStateBlock (*ppSB);
+
+  return hr;
+}
+
+
+//
+// State blocks the game created at load time (before CreateStateBlock was
+//   hooked) are applied through the same IDirect3DStateBlock9 vtable; a block
+//     of our own hooks it, and nothing is deferred or filtered before that.
+//
+//  * CreateStateBlock fails while the game is recording one; attempted is
+//      left alone then, so the next frame tries again.
+//
+static void
+AD_EnableStateShadow (IDirect3DDevice9* pDevice, bool set_texture_hooked, bool& attempted)
+{
+  IDirect3DStateBlock9* pSB = nullptr;
+
+  if ( recording_state_block ||
+       FAILED (D3D9CreateStateBlock_Original (pDevice, D3DSBT_PIXELSTATE, &pSB)) )
+    return;
+
+  attempted = true;
+
+  const bool hooked = AD_HookStateBlock (pSB);
+
+  pSB->Release ();
+
+  if (! hooked)
+    dll_log.Log (L" [!] Could not hook IDirect3DStateBlock9; state restores will not be deferred.");
+
+  if (! set_texture_hooked)
+    dll_log.Log (L" [!] IDirect3DDevice9::SetTexture is not hooked; redundant calls will not be filtered.");
+
+  // Everything seen so far may have been changed by a block we didn't see
+  vp_shadow.invalidate  ();
+  rs_shadow.invalidate  ();
+  tex_shadow.invalidate ();
+  vs_consts.invalidate  ();
+  ps_consts.invalidate  ();
+
+  vp_shadow.defer       = hooked;
+  rs_shadow.defer       = hooked;
+  call_filter.available = hooked && set_texture_hooked;
+}
+
+static bool
+AD_HookDeviceMethod (void** vftable, int idx, const wchar_t* name, LPVOID pDetour, LPVOID* ppOriginal)
+{
+  if ( AD_CreateFuncHook (name, vftable [idx], pDetour, ppOriginal) != MH_OK ||
+       AD_EnableHook     (vftable [idx])                             != MH_OK ) {
+    dll_log.Log (L" [!] Could not hook %s; state restores will not be deferred.", name);
+    return false;
+  }
+
+  return true;
+}
+
+void
+AD_InstallStateShadow (IDirect3DDevice9* pDevice, bool set_texture_hooked)
+{
+  static bool installed   = false;
+  static bool device_ok   = false;
+  static bool state_block = false; // Hooking IDirect3DStateBlock9 was tried
+
+  if (pDevice == nullptr)
+    return;
+
+  if (installed) {
+    if (device_ok && (! state_block))
+      AD_EnableStateShadow (pDevice, set_texture_hooked, state_block);
+
+    return;
+  }
+
+  installed = true;
+
+  void** vftable = *(void***)pDevice;
+
+  bool ok = true;
+
+  ok &= AD_HookDeviceMethod ( vftable, 37, L"IDirect3DDevice9::SetRenderTarget",
+                                D3D9SetRenderTarget_Detour,
+                      (LPVOID*)&D3D9SetRenderTarget_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 43, L"IDirect3DDevice9::Clear",
+                                D3D9Clear_Detour,
+                      (LPVOID*)&D3D9Clear_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 48, L"IDirect3DDevice9::GetViewport",
+                                D3D9GetViewport_Detour,
+                      (LPVOID*)&D3D9GetViewport_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 57, L"IDirect3DDevice9::SetRenderState",
+                                D3D9SetRenderState_Detour,
+                      (LPVOID*)&D3D9SetRenderState_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 58, L"IDirect3DDevice9::GetRenderState",
+                                D3D9GetRenderState_Detour,
+                      (LPVOID*)&D3D9GetRenderState_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 59, L"IDirect3DDevice9::CreateStateBlock",
+                                D3D9CreateStateBlock_Detour,
+                      (LPVOID*)&D3D9CreateStateBlock_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 60, L"IDirect3DDevice9::BeginStateBlock",
+                                D3D9BeginStateBlock_Detour,
+                      (LPVOID*)&D3D9BeginStateBlock_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 61, L"IDirect3DDevice9::EndStateBlock",
+                                D3D9EndStateBlock_Detour,
+                      (LPVOID*)&D3D9EndStateBlock_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 83, L"IDirect3DDevice9::DrawPrimitiveUP",
+                                D3D9DrawPrimitiveUP_Detour,
+                      (LPVOID*)&D3D9DrawPrimitiveUP_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 84, L"IDirect3DDevice9::DrawIndexedPrimitiveUP",
+                                D3D9DrawIndexedPrimitiveUP_Detour,
+                      (LPVOID*)&D3D9DrawIndexedPrimitiveUP_Original );
+  ok &= AD_HookDeviceMethod ( vftable, 85, L"IDirect3DDevice9::ProcessVertices",
+                                D3D9ProcessVertices_Detour,
+                      (LPVOID*)&D3D9ProcessVertices_Original );
+
+  device_ok = ok;
+
+  if (device_ok)
+    AD_EnableStateShadow (pDevice, set_texture_hooked, state_block);
+}
@@ -0,0 +1,348 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__SHADOW_H__
+#define __AD__SHADOW_H__
+
+#include <Windows.h>
+#include <d3d9.h>
+#include <stdint.h>
+
+#include "display.h"
+
+typedef HRESULT (STDMETHODCALLTYPE *SetViewport_t)(
+        IDirect3DDevice9* This,
+  CONST D3DVIEWPORT9*     pViewport);
+
+extern SetViewport_t D3D9SetViewport_Original;
+
+// Between BeginStateBlock and EndStateBlock, Set calls never reach the device
+extern bool recording_state_block;
+
+//
+// Every shadow below lives for as long as the device does.  Overlays draw
+//   between frames through the same (hooked) device methods as the game, so
+//     what they bind is tracked like anything else; only what changes state
+//       behind the hooks (Reset, state blocks, SetRenderTarget's viewport)
+//         invalidates a shadow.
+//
+//
+// Knows which viewport the device really has bound, so that the per-draw
+//   minimap adjustments only reach the driver when the value changes.
+//
+//   Putting the game's own viewport back is deferred until something that
+//     depends on it (any other draw, Clear, GetViewport, state blocks, ...)
+//       comes along; consecutive minimap blips then cost no calls at all.
+//
+//  * Deferral is only enabled once every one of those places is hooked
+//      (AD_InstallStateShadow); until then restores are immediate.
+//
+struct ad_viewport_shadow_s {
+  D3DVIEWPORT9 bound;            // What the device has, if known
+  bool         known   = false;
+  bool         pending = false;  // bound is an adjustment, not the game's
+  bool         defer   = false;
+
+  // Driver calls issued / avoided (this frame, last frame)
+  int          issued  = 0;
+  int          saved   = 0;
+  int          saved_last_frame = 0;
+
+  // Temporarily bind vp (e.g. an adjusted minimap viewport)
+  HRESULT apply      (IDirect3DDevice9* dev, const D3DVIEWPORT9& vp);
+
+  // Done with the adjustment; restores now, or at the next flush (...)
+  void    release    (IDirect3DDevice9* dev);
+
+  // Anything that depends on the game's viewport must call this first
+  void    flush      (IDirect3DDevice9* dev)
+  {
+    if (pending)
+      restore (dev);
+  }
+
+  // The game bound vp itself
+  void    track      (const D3DVIEWPORT9& vp);
+
+  // The device's viewport changed behind our back (Reset, state blocks...)
+  void    invalidate (void);
+
+  void    end_frame  (void);
+
+protected:
+  void    restore    (IDirect3DDevice9* dev);
+};
+
+extern ad_viewport_shadow_s vp_shadow;
+
+//
+// Mirror of every render state the game sets, so that we never need to ask
+//   the driver (GetRenderState) what is bound.
+//
+//   override (...) temporarily binds a value of our own and remembers the
+//     game's; release (...) puts the game's values back -- immediately, or
+//       (once the hooks are in) at the next flush (...).  Overriding the
+//         same state with the same value again costs nothing, so a run of
+//           draws with identical overrides only pays for them once.
+//
+//  * While a state is overridden, the game's own SetRenderState calls for it
+//      only update the value that will be restored.
+//
+struct ad_renderstate_shadow_s {
+  enum {
+    MAX_STATES    = 256,         // D3DRS_BLENDOPALPHA (209) is the last one
+    MAX_OVERRIDES = 16
+  };
+
+  DWORD    value [MAX_STATES];
+  uint32_t known [MAX_STATES / 32] = { 0 };
+
+  struct {
+    D3DRENDERSTATETYPE state;
+    DWORD              game;     // Value to restore
+  }        overrides [MAX_OVERRIDES];
+  int      num_overrides = 0;
+
+  bool     released = false;     // Overrides are bound only until flush (...)
+  bool     defer    = false;
+
+  // Driver calls issued / avoided (this frame, last frame)
+  int      issued  = 0;
+  int      saved   = 0;
+  int      saved_last_frame = 0;
+
+  // The value bound for state (GetRenderState only if we have never seen it)
+  DWORD   get        (IDirect3DDevice9* dev, D3DRENDERSTATETYPE state);
+
+  void    override   (IDirect3DDevice9* dev, D3DRENDERSTATETYPE state, DWORD val);
+  void    release    (IDirect3DDevice9* dev);
+
+  // Anything that depends on the game's render states must call this first
+  void    flush      (IDirect3DDevice9* dev)
+  {
+    if (released)
+      restore (dev);
+  }
+
+  // The game is setting state; returns true if the device must not see it
+  bool    intercept  (D3DRENDERSTATETYPE state, DWORD val);
+  void    track      (D3DRENDERSTATETYPE state, DWORD val);
+  void    forget     (D3DRENDERSTATETYPE state);
+
+  void    invalidate (void);
+
+  void    end_frame  (void);
+
+  bool    is_known   (D3DRENDERSTATETYPE state) const
+  {
+    return (uint32_t)state < MAX_STATES &&
+             (known [state >> 5] & (1UL << (state & 31))) != 0;
+  }
+
+protected:
+  void    restore    (IDirect3DDevice9* dev);
+  HRESULT set        (IDirect3DDevice9* dev, D3DRENDERSTATETYPE state, DWORD val);
+};
+
+extern ad_renderstate_shadow_s rs_shadow;
+
+// Bumped by every draw; "since the last draw" is measured against this
+extern uint32_t draw_epoch;
+
+//
+// Device-wide mirror of a shader stage's float constant registers.
+//
+//   Each register is stamped with the generation (one per write that changed
+//     anything) it last changed in, so "has this changed since ..." is a
+//       single compare, and the registers changed since the last draw are
+//         kept as a bitmap + covering range instead of being re-scanned.
+//
+struct ad_constant_file_s {
+  enum {
+    MAX_VEC4S = 256
+  };
+
+  float    regs    [MAX_VEC4S][4];
+  uint32_t gen     [MAX_VEC4S];
+  uint32_t known   [MAX_VEC4S / 32];
+  uint32_t dirty   [MAX_VEC4S / 32]; // Changed since the last draw...
+  uint32_t dirty_epoch;              //   (if this is still draw_epoch)
+  uint32_t dirty_first;
+  uint32_t dirty_last;
+
+  uint32_t generation;
+  uint32_t num_vec4s;
+
+  ad_constant_file_s (uint32_t vec4s);
+
+  // Returns the number of vec4s whose value actually changed
+  uint32_t     write         (uint32_t start, const float* data, uint32_t count);
+
+  // The registers' values are no longer known (Reset, state blocks...)
+  void         invalidate    (void);
+
+  // Same, for [start, start + count) only (e.g. the upload failed)
+  void         forget        (uint32_t start, uint32_t count);
+
+  // nullptr if the register's value is not known
+  const float* get           (uint32_t reg) const
+  {
+    return (reg < num_vec4s && (known [reg >> 5] & (1UL << (reg & 31)))) ?
+             regs [reg] : nullptr;
+  }
+
+  bool         changed_since (uint32_t reg, uint32_t since_gen) const
+  {
+    return reg < num_vec4s && gen [reg] > since_gen;
+  }
+
+  bool         is_dirty      (uint32_t reg) const
+  {
+    return reg < num_vec4s && dirty_epoch == draw_epoch &&
+             (dirty [reg >> 5] & (1UL << (reg & 31))) != 0;
+  }
+
+  // Range covering every register changed since the last draw (if any)
+  bool         dirty_range   (uint32_t& first, uint32_t& last) const
+  {
+    if (dirty_epoch != draw_epoch || dirty_first > dirty_last)
+      return false;
+
+    first = dirty_first;
+    last  = dirty_last;
+
+    return true;
+  }
+
+protected:
+  void         begin_epoch   (void);
+};
+
+extern ad_constant_file_s vs_consts; // 256 registers (vs_3_0)
+extern ad_constant_file_s ps_consts; // 224 registers (ps_3_0)
+
+//
+// Texture bound to each sampler (pixel 0-15, then the 4 vertex samplers).
+//
+//  * The device holds a reference to whatever is bound, so a pointer cannot
+//      be recycled for a different texture while it is still in here.
+//
+struct ad_texture_shadow_s {
+  enum {
+    MAX_SAMPLERS = 20
+  };
+
+  IDirect3DBaseTexture9* bound [MAX_SAMPLERS];
+  uint32_t               known = 0;
+
+  // -1 for samplers we do not mirror (e.g. D3DDMAPSAMPLER)
+  static int slot (DWORD sampler)
+  {
+    if (sampler < 16)
+      return (int)sampler;
+
+    if (sampler >= D3DVERTEXTEXTURESAMPLER0 && sampler <= D3DVERTEXTEXTURESAMPLER3)
+      return 16 + (int)(sampler - D3DVERTEXTEXTURESAMPLER0);
+
+    return -1;
+  }
+
+  bool is_bound (DWORD sampler, IDirect3DBaseTexture9* tex) const
+  {
+    int idx = slot (sampler);
+
+    return idx >= 0 && (known & (1UL << idx)) && bound [idx] == tex;
+  }
+
+  void track      (DWORD sampler, IDirect3DBaseTexture9* tex);
+  void forget     (DWORD sampler);
+  void invalidate (void) { known = 0; }
+};
+
+extern ad_texture_shadow_s tex_shadow;
+
+//
+// Dimensions of render target 0, read once whenever the game binds one so
+//   that fixups in terms of the target (scissor rects) never query the device.
+//
+//  * Until SetRenderTarget is hooked, and after every Reset, the target is
+//      assumed to be the backbuffer.
+//
+struct ad_render_target_shadow_s {
+  uint32_t width  = 0;
+  uint32_t height = 0;
+
+  void track (IDirect3DSurface9* pSurface);
+  void reset (uint32_t backbuffer_width, uint32_t backbuffer_height);
+
+  // 16:9 fit of the target (identity if it is an off-screen target with a
+  //   different shape than the backbuffer, or nothing needs correcting)
+  const ad_display_coeffs_s& fit (void)
+  {
+    if (stale || fit_generation != display.generation)
+      refit ();
+
+    return coeffs;
+  }
+
+protected:
+  void refit (void);
+
+  ad_display_coeffs_s coeffs;
+  uint32_t            fit_generation = 0;
+  bool                stale          = true;
+};
+
+extern ad_render_target_shadow_s rt_shadow;
+
+//
+// Opt-in (Render.FilterCalls): drop game calls that would not change the
+//   shadowed device state at all, so the driver never sees them.
+//
+struct ad_call_filter_s {
+  bool enable    = false;
+  bool available = false;        // Every invalidation point is hooked
+
+  bool active (void) const { return enable && available; }
+
+  struct counts_s {
+    int vs_consts = 0;
+    int ps_consts = 0;
+    int textures  = 0;
+    int viewports = 0;
+  } dropped,                     // This frame
+    dropped_last_frame;
+
+  void end_frame (void)
+  {
+    dropped_last_frame = dropped;
+    dropped            = counts_s ();
+  }
+};
+
+extern ad_call_filter_s call_filter;
+
+// Hooks the device methods the shadows above need to observe; deferral and
+//   filtering are enabled once those, IDirect3DStateBlock9 and SetTexture
+//     (set_texture_hooked) all are.  Called every frame until then.
+void AD_InstallStateShadow (IDirect3DDevice9* pDevice, bool set_texture_hooked);
+
+#endif /* __AD__SHADOW_H__ */
@@ -0,0 +1,769 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "texdump.h"
+#include "fingerprint.h"
+#include "crc32.h"
+
+#include <stdio.h>
+#include <string.h>
+
+ad_texture_dump_s texture_dump;
+
+//
+// The formats a dump can be written in; everything DDS can describe with a
+//   pixel format (float formats use their D3DFORMAT value as the FourCC, the
+//     way D3DX writes them).
+//
+enum {
+  AD_DDPF_ALPHAPIXELS = 0x00001,
+  AD_DDPF_ALPHA       = 0x00002,
+  AD_DDPF_FOURCC      = 0x00004,
+  AD_DDPF_RGB         = 0x00040,
+  AD_DDPF_LUMINANCE   = 0x20000
+};
+
+#define AD_FOURCC(a,b,c,d) \
+  ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static const struct ad_dump_format_s {
+  uint32_t format;               // D3DFORMAT
+  uint32_t bits;                 // Per pixel, or per 4x4 block
+  bool     block;
+  uint32_t flags, fourcc;
+  uint32_t r, g, b, a;
+} ad_dump_formats [] = {
+  {  21, 32, false, AD_DDPF_RGB | AD_DDPF_ALPHAPIXELS, 0, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },
+  {  22, 32, false, AD_DDPF_RGB,                       0, 0x00FF0000, 0x0000FF00, 0x000000FF, 0x00000000 },
+  {  23, 16, false, AD_DDPF_RGB,                       0, 0x0000F800, 0x000007E0, 0x0000001F, 0x00000000 },
+  {  24, 16, false, AD_DDPF_RGB,                       0, 0x00007C00, 0x000003E0, 0x0000001F, 0x00000000 },
+  {  25, 16, false, AD_DDPF_RGB | AD_DDPF_ALPHAPIXELS, 0, 0x00007C00, 0x000003E0, 0x0000001F, 0x00008000 },
+  {  26, 16, false, AD_DDPF_RGB | AD_DDPF_ALPHAPIXELS, 0, 0x00000F00, 0x000000F0, 0x0000000F, 0x0000F000 },
+  {  28,  8, false, AD_DDPF_ALPHA,                     0, 0x00000000, 0x00000000, 0x00000000, 0x000000FF },
+  {  32, 32, false, AD_DDPF_RGB | AD_DDPF_ALPHAPIXELS, 0, 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 },
+  {  33, 32, false, AD_DDPF_RGB,                       0, 0x000000FF, 0x0000FF00, 0x00FF0000, 0x00000000 },
+  {  50,  8, false, AD_DDPF_LUMINANCE,                 0, 0x000000FF, 0x00000000, 0x00000000, 0x00000000 },
+  {  51, 16, false, AD_DDPF_LUMINANCE | AD_DDPF_ALPHAPIXELS,
+                                                       0, 0x000000FF, 0x00000000, 0x00000000, 0x0000FF00 },
+
+  {  36,  64, false, AD_DDPF_FOURCC,  36, 0, 0, 0, 0 }, // A16B16G16R16
+  { 111,  16, false, AD_DDPF_FOURCC, 111, 0, 0, 0, 0 }, // R16F
+  { 112,  32, false, AD_DDPF_FOURCC, 112, 0, 0, 0, 0 }, // G16R16F
+  { 113,  64, false, AD_DDPF_FOURCC, 113, 0, 0, 0, 0 }, // A16B16G16R16F
+  { 114,  32, false, AD_DDPF_FOURCC, 114, 0, 0, 0, 0 }, // R32F
+  { 115,  64, false, AD_DDPF_FOURCC, 115, 0, 0, 0, 0 }, // G32R32F
+  { 116, 128, false, AD_DDPF_FOURCC, 116, 0, 0, 0, 0 }, // A32B32G32R32F
+
+  { AD_FOURCC ('D','X','T','1'),  64, true, AD_DDPF_FOURCC, AD_FOURCC ('D','X','T','1'), 0, 0, 0, 0 },
+  { AD_FOURCC ('D','X','T','2'), 128, true, AD_DDPF_FOURCC, AD_FOURCC ('D','X','T','2'), 0, 0, 0, 0 },
+  { AD_FOURCC ('D','X','T','3'), 128, true, AD_DDPF_FOURCC, AD_FOURCC ('D','X','T','3'), 0, 0, 0, 0 },
+  { AD_FOURCC ('D','X','T','4'), 128, true, AD_DDPF_FOURCC, AD_FOURCC ('D','X','T','4'), 0, 0, 0, 0 },
+  { AD_FOURCC ('D','X','T','5'), 128, true, AD_DDPF_FOURCC, AD_FOURCC ('D','X','T','5'), 0, 0, 0, 0 }
+};
+
+static const ad_dump_format_s*
+AD_FindDumpFormat (uint32_t format)
+{
+  for (size_t i = 0; i < sizeof (ad_dump_formats) / sizeof (ad_dump_formats [0]); i++) {
+    if (ad_dump_formats [i].format == format)
+      return &ad_dump_formats [i];
+  }
+
+  return nullptr;
+}
+
+bool
+ad_dump_image_s::init (uint32_t w, uint32_t h, uint32_t num_levels, uint32_t fmt)
+{
+  const ad_dump_format_s* desc = AD_FindDumpFormat (fmt);
+
+  if (desc == nullptr || w == 0 || h == 0 || num_levels == 0)
+    return false;
+
+  width  = w;
+  height = h;
+  levels = 0;
+  format = fmt;
+
+  level.clear ();
+
+  size_t offset = 0;
+
+  while (levels < num_levels) {
+    level_s lvl;
+
+    lvl.width  = w;
+    lvl.height = h;
+    lvl.pitch  = desc->block ? ((w + 3) / 4) * (desc->bits / 8) : (w * desc->bits) / 8;
+    lvl.rows   = desc->block ?  (h + 3) / 4                      :  h;
+    lvl.offset = offset;
+
+    offset += (size_t)lvl.pitch * lvl.rows;
+
+    level.push_back (lvl);
+    ++levels;
+
+    // More levels than the dimensions allow
+    if (w == 1 && h == 1)
+      break;
+
+    if (w > 1) w >>= 1;
+    if (h > 1) h >>= 1;
+  }
+
+  return true;
+}
+
+size_t
+ad_dump_image_s::bytes (void) const
+{
+  if (level.empty ())
+    return 0;
+
+  return level.back ().offset + (size_t)level.back ().pitch * level.back ().rows;
+}
+
+//
+// DDS
+//
+static void
+AD_Put32LE (std::vector <uint8_t>& out, uint32_t v)
+{
+  out.push_back ((uint8_t) v);        out.push_back ((uint8_t)(v >> 8));
+  out.push_back ((uint8_t)(v >> 16)); out.push_back ((uint8_t)(v >> 24));
+}
+
+static void
+AD_Put32BE (std::vector <uint8_t>& out, uint32_t v)
+{
+  out.push_back ((uint8_t)(v >> 24)); out.push_back ((uint8_t)(v >> 16));
+  out.push_back ((uint8_t)(v >> 8));  out.push_back ((uint8_t) v);
+}
+
+bool
+AD_EncodeDDS (const ad_dump_image_s& img, std::vector <uint8_t>& out)
+{
+  const ad_dump_format_s* desc = AD_FindDumpFormat (img.format);
+
+  if (desc == nullptr || img.level.empty () || img.data.size () < img.bytes ())
+    return false;
+
+  const bool mips = img.levels > 1;
+
+  out.clear   ();
+  out.reserve (128 + img.bytes ());
+
+  AD_Put32LE (out, AD_FOURCC ('D','D','S',' '));
+
+  AD_Put32LE (out, 124);                                       // dwSize
+  AD_Put32LE (out, 0x1 | 0x2 | 0x4 | 0x1000 |                  // CAPS | HEIGHT | WIDTH | PIXELFORMAT
+                   (mips        ? 0x20000 : 0) |               // MIPMAPCOUNT
+                   (desc->block ? 0x80000 : 0x8));             // LINEARSIZE : PITCH
+  AD_Put32LE (out, img.height);
+  AD_Put32LE (out, img.width);
+  AD_Put32LE (out, desc->block ? img.level [0].pitch * img.level [0].rows :
+                                 img.level [0].pitch);
+  AD_Put32LE (out, 0);                                         // dwDepth
+  AD_Put32LE (out, img.levels);
+
+  for (int i = 0; i < 11; i++)
+    AD_Put32LE (out, 0);                                       // dwReserved1
+
+  AD_Put32LE (out, 32);                                        // ddspf.dwSize
+  AD_Put32LE (out, desc->flags);
+  AD_Put32LE (out, desc->fourcc);
+  AD_Put32LE (out, (desc->flags & AD_DDPF_FOURCC) ? 0 : desc->bits);
+  AD_Put32LE (out, desc->r);
+  AD_Put32LE (out, desc->g);
+  AD_Put32LE (out, desc->b);
+  AD_Put32LE (out, desc->a);
+
+  AD_Put32LE (out, 0x1000 | (mips ? (0x8 | 0x400000) : 0));    // TEXTURE [| COMPLEX | MIPMAP]
+
+  for (int i = 0; i < 4; i++)
+    AD_Put32LE (out, 0);                                       // dwCaps2-4, dwReserved2
+
+  out.insert (out.end (), img.data.begin (), img.data.begin () + img.bytes ());
+
+  return true;
+}
+
+static uint32_t
+AD_Get32LE (const uint8_t* p)
+{
+  return (uint32_t)p [0]         | ((uint32_t)p [1] << 8) |
+        ((uint32_t)p [2] << 16)  | ((uint32_t)p [3] << 24);
+}
+
+bool
+AD_DecodeDDS ( const uint8_t* data, size_t size,
+               ad_dump_image_s& img, const uint8_t** ppTexels )
+{
+  if (size < 128 || AD_Get32LE (data) != AD_FOURCC ('D','D','S',' ') ||
+                    AD_Get32LE (data + 4) != 124)
+    return false;
+
+  const uint32_t flags  = AD_Get32LE (data + 8);
+  const uint32_t height = AD_Get32LE (data + 12);
+  const uint32_t width  = AD_Get32LE (data + 16);
+  const uint32_t levels = (flags & 0x20000) ? AD_Get32LE (data + 28) : 1;
+
+  const uint8_t* pf = data + 76;
+
+  const uint32_t pf_flags  = AD_Get32LE (pf + 4);
+  const uint32_t pf_fourcc = AD_Get32LE (pf + 8);
+  const uint32_t pf_bits   = AD_Get32LE (pf + 12);
+
+  const ad_dump_format_s* desc = nullptr;
+
+  for (size_t i = 0; i < sizeof (ad_dump_formats) / sizeof (ad_dump_formats [0]) && desc == nullptr; i++) {
+    const ad_dump_format_s& fmt = ad_dump_formats [i];
+
+    if (pf_flags & AD_DDPF_FOURCC) {
+      if ((fmt.flags & AD_DDPF_FOURCC) && fmt.fourcc == pf_fourcc)
+        desc = &fmt;
+    }
+
+    else if ( (! (fmt.flags & AD_DDPF_FOURCC)) && fmt.bits == pf_bits &&
+              fmt.r == AD_Get32LE (pf + 16) && fmt.g == AD_Get32LE (pf + 20) &&
+              fmt.b == AD_Get32LE (pf + 24) &&
+              fmt.a == ((pf_flags & (AD_DDPF_ALPHAPIXELS | AD_DDPF_ALPHA)) ? AD_Get32LE (pf + 28) : 0) )
+      desc = &fmt;
+  }
+
+  if (desc == nullptr || (! img.init (width, height, levels == 0 ? 1 : levels, desc->format)))
+    return false;
+
+  if (size - 128 < img.bytes ())
+    return false;
+
+  img.data.clear ();
+  *ppTexels = data + 128;
+
+  return true;
+}
+
+//
+// PNG (zlib stream of one fixed-Huffman deflate block)
+//
+//   Fixed codes cost a little ratio against dynamic ones, but need no second
+//     pass over the data; game textures compress mostly through the matches.
+//
+struct ad_bit_writer_s {
+  std::vector <uint8_t>& out;
+  uint32_t               bits;
+  int                    count;
+
+  ad_bit_writer_s (std::vector <uint8_t>& dest) : out (dest), bits (0), count (0) { }
+
+  void put (uint32_t value, int n)
+  {
+    bits  |= value << count;
+    count += n;
+
+    while (count >= 8) {
+      out.push_back ((uint8_t)bits);
+      bits  >>= 8;
+      count  -= 8;
+    }
+  }
+
+  // Huffman codes are stored most-significant bit first
+  void code (uint32_t value, int n)
+  {
+    uint32_t reversed = 0;
+
+    for (int i = 0; i < n; i++)
+      reversed |= ((value >> i) & 0x1) << (n - 1 - i);
+
+    put (reversed, n);
+  }
+
+  void flush (void)
+  {
+    if (count > 0)
+      out.push_back ((uint8_t)bits);
+
+    bits  = 0;
+    count = 0;
+  }
+};
+
+static const uint16_t ad_len_base  [29] = {   3,   4,   5,   6,   7,   8,   9,  10,  11,  13,
+                                             15,  17,  19,  23,  27,  31,  35,  43,  51,  59,
+                                             67,  83,  99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t  ad_len_extra [29] = {   0,   0,   0,   0,   0,   0,   0,   0,   1,   1,
+                                              1,   1,   2,   2,   2,   2,   3,   3,   3,   3,
+                                              4,   4,   4,   4,   5,   5,   5,   5,   0 };
+static const uint16_t ad_dist_base  [30] = {    1,     2,     3,     4,     5,     7,     9,    13,
+                                               17,    25,    33,    49,    65,    97,   129,   193,
+                                              257,   385,   513,   769,  1025,  1537,  2049,  3073,
+                                             4097,  6145,  8193, 12289, 16385, 24577 };
+static const uint8_t  ad_dist_extra [30] = {  0,  0,  0,  0,  1,  1,  2,  2,  3,  3,
+                                              4,  4,  5,  5,  6,  6,  7,  7,  8,  8,
+                                              9,  9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static void
+AD_Deflate_Symbol (ad_bit_writer_s& w, uint32_t sym)
+{
+  if      (sym < 144) w.code (0x30  +  sym,        8);
+  else if (sym < 256) w.code (0x190 + (sym - 144), 9);
+  else if (sym < 280) w.code (         sym - 256,  7);
+  else                w.code (0xC0  + (sym - 280), 8);
+}
+
+static void
+AD_Deflate_Match (ad_bit_writer_s& w, uint32_t length, uint32_t distance)
+{
+  int lc = 28;
+  while (ad_len_base [lc] > length)
+    --lc;
+
+  AD_Deflate_Symbol (w, 257 + lc);
+  w.put             (length - ad_len_base [lc], ad_len_extra [lc]);
+
+  int dc = 29;
+  while (ad_dist_base [dc] > distance)
+    --dc;
+
+  w.code (dc, 5);
+  w.put  (distance - ad_dist_base [dc], ad_dist_extra [dc]);
+}
+
+static void
+AD_Deflate (const uint8_t* p, size_t n, std::vector <uint8_t>& out)
+{
+  static const uint32_t WINDOW    = 32768;
+  static const int      HASH_BITS = 15;
+  static const int      MAX_CHAIN = 16;
+
+  std::vector <int32_t> head (1 << HASH_BITS, -1);
+  std::vector <int32_t> prev (WINDOW,         -1);
+
+  ad_bit_writer_s w (out);
+
+  w.put (1, 1); // BFINAL
+  w.put (1, 2); // BTYPE = Fixed Huffman
+
+  auto hash3 = [p] (size_t i) -> uint32_t {
+    uint32_t v = p [i] | (p [i + 1] << 8) | (p [i + 2] << 16);
+    return (v * 2654435769U) >> (32 - HASH_BITS);
+  };
+
+  auto insert = [&] (size_t i) {
+    if (i + 3 > n)
+      return;
+
+    uint32_t h = hash3 (i);
+
+    prev [i & (WINDOW - 1)] = head [h];
+    head [h]                = (int32_t)i;
+  };
+
+  size_t i = 0;
+
+  while (i < n) {
+    uint32_t best_len  = 0;
+    uint32_t best_dist = 0;
+
+    if (i + 3 <= n) {
+      size_t  max   = n - i > 258 ? 258 : n - i;
+      int32_t cand  = head [hash3 (i)];
+      int     chain = MAX_CHAIN;
+
+      while (cand >= 0 && i - cand <= WINDOW && chain-- > 0) {
+        uint32_t len = 0;
+
+        while (len < max && p [cand + len] == p [i + len])
+          ++len;
+
+        if (len > best_len) {
+          best_len  = len;
+          best_dist = (uint32_t)(i - cand);
+
+          if (len == max)
+            break;
+        }
+
+        int32_t next = prev [cand & (WINDOW - 1)];
+
+        // The slot was reused by a newer position; the chain ends here
+        if (next >= cand)
+          break;
+
+        cand = next;
+      }
+    }
+
+    if (best_len >= 3) {
+      AD_Deflate_Match (w, best_len, best_dist);
+
+      for (uint32_t j = 0; j < best_len; j++)
+        insert (i + j);
+
+      i += best_len;
+    }
+
+    else {
+      AD_Deflate_Symbol (w, p [i]);
+      insert (i++);
+    }
+  }
+
+  AD_Deflate_Symbol (w, 256); // End of block
+  w.flush ();
+}
+
+static uint32_t
+AD_Adler32 (const uint8_t* p, size_t n)
+{
+  uint32_t a = 1, b = 0;
+
+  while (n > 0) {
+    // Largest run that can't overflow b
+    size_t run = n > 5552 ? 5552 : n;
+    n -= run;
+
+    while (run-- > 0) {
+      a += *p++;
+      b += a;
+    }
+
+    a %= 65521;
+    b %= 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+static void
+AD_PNG_Chunk (std::vector <uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+{
+  AD_Put32BE (out, (uint32_t)size);
+
+  size_t start = out.size ();
+
+  out.insert (out.end (), type, type + 4);
+  out.insert (out.end (), data, data + size);
+
+  AD_Put32BE (out, crc32 (0, &out [start], size + 4));
+}
+
+static bool
+AD_PNG_Supported (uint32_t format)
+{
+  return format == 21 || format == 22 || format == 32 || format == 33;
+}
+
+bool
+AD_EncodePNG (const ad_dump_image_s& img, std::vector <uint8_t>& out)
+{
+  // Byte offsets of R, G and B within a pixel, and whether alpha is real
+  int  r, g, b;
+  bool alpha;
+
+  switch (img.format) {
+    case 21: r = 2; g = 1; b = 0; alpha = true;  break; // A8R8G8B8
+    case 22: r = 2; g = 1; b = 0; alpha = false; break; // X8R8G8B8
+    case 32: r = 0; g = 1; b = 2; alpha = true;  break; // A8B8G8R8
+    case 33: r = 0; g = 1; b = 2; alpha = false; break; // X8B8G8R8
+    default:
+      return false;
+  }
+
+  if (img.level.empty () || img.data.size () < img.bytes ())
+    return false;
+
+  const ad_dump_image_s::level_s& lvl = img.level [0];
+
+  const uint32_t bpp    = alpha ? 4 : 3;
+  const size_t   stride = (size_t)lvl.width * bpp;
+
+  // Each scanline gets whichever of None, Sub or Up has the smallest sum of
+  //   absolute differences (the usual heuristic).
+  std::vector <uint8_t> raw      (stride);
+  std::vector <uint8_t> above    (stride, 0);
+  std::vector <uint8_t> filtered ((stride + 1) * lvl.height);
+
+  for (uint32_t y = 0; y < lvl.height; y++) {
+    const uint8_t* src = &img.data [lvl.offset + (size_t)y * lvl.pitch];
+
+    for (uint32_t x = 0; x < lvl.width; x++) {
+      raw [x * bpp + 0] = src [x * 4 + r];
+      raw [x * bpp + 1] = src [x * 4 + g];
+      raw [x * bpp + 2] = src [x * 4 + b];
+
+      if (alpha)
+        raw [x * bpp + 3] = src [x * 4 + 3];
+    }
+
+    uint32_t cost [3] = { 0, 0, 0 };
+
+    for (size_t i = 0; i < stride; i++) {
+      uint8_t sub = raw [i] - (i >= bpp ? raw [i - bpp] : 0);
+      uint8_t up  = raw [i] - above [i];
+
+      cost [0] += raw [i] < 128 ? raw [i] : 256 - raw [i];
+      cost [1] += sub     < 128 ? sub     : 256 - sub;
+      cost [2] += up      < 128 ? up      : 256 - up;
+    }
+
+    int filter = 0;
+
+    if (cost [1] < cost [filter]) filter = 1;
+    if (cost [2] < cost [filter]) filter = 2;
+
+    uint8_t* dst = &filtered [y * (stride + 1)];
+
+    *dst++ = (uint8_t)filter;
+
+    for (size_t i = 0; i < stride; i++) {
+      switch (filter) {
+        case 0: dst [i] = raw [i];                                      break;
+        case 1: dst [i] = raw [i] - (i >= bpp ? raw [i - bpp] : 0);     break;
+        case 2: dst [i] = raw [i] - above [i];                          break;
+      }
+    }
+
+    above.swap (raw);
+  }
+
+  std::vector <uint8_t> zlib;
+
+  zlib.push_back (0x78); // Deflate, 32 KiB window
+  zlib.push_back (0x01); // No dictionary, fastest
+
+  AD_Deflate (filtered.data (), filtered.size (), zlib);
+  AD_Put32BE (zlib, AD_Adler32 (filtered.data (), filtered.size ()));
+
+  static const uint8_t signature [8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+  uint8_t ihdr [13] = { 0 };
+
+  ihdr [0]  = (uint8_t)(lvl.width  >> 24); ihdr [1] = (uint8_t)(lvl.width  >> 16);
+  ihdr [2]  = (uint8_t)(lvl.width  >> 8);  ihdr [3] = (uint8_t) lvl.width;
+  ihdr [4]  = (uint8_t)(lvl.height >> 24); ihdr [5] = (uint8_t)(lvl.height >> 16);
+  ihdr [6]  = (uint8_t)(lvl.height >> 8);  ihdr [7] = (uint8_t) lvl.height;
+  ihdr [8]  = 8;                           // Bits per channel
+  ihdr [9]  = alpha ? 6 : 2;               // RGBA : RGB
+
+  out.clear ();
+  out.insert (out.end (), signature, signature + 8);
+
+  AD_PNG_Chunk (out, "IHDR", ihdr,         sizeof (ihdr));
+  AD_PNG_Chunk (out, "IDAT", zlib.data (), zlib.size ());
+  AD_PNG_Chunk (out, "IEND", nullptr,      0);
+
+  return true;
+}
+
+//
+// Queue
+//
+ad_dump_image_s*
+ad_texture_dump_s::begin (uint32_t width, uint32_t height, uint32_t levels, uint32_t format)
+{
+  ad_dump_image_s* img = new ad_dump_image_s;
+
+  if (! img->init (width, height, levels, format)) {
+    delete img;
+    return nullptr;
+  }
+
+  const size_t size = img->bytes ();
+
+  {
+    std::lock_guard <std::mutex> guard (lock);
+
+    if (staged + size > (size_t)budget_mib * 1048576) {
+      ++stats.dropped;
+
+      delete img;
+      return nullptr;
+    }
+
+    staged += size;
+  }
+
+  if (workers.empty ())
+    start ();
+
+  // The only allocation the render thread pays for
+  img->data.resize (size);
+
+  return img;
+}
+
+void
+ad_texture_dump_s::commit (ad_dump_image_s* img)
+{
+  {
+    std::lock_guard <std::mutex> guard (lock);
+
+    queue.push_back (img);
+    ++stats.queued;
+  }
+
+  ready.notify_one ();
+}
+
+void
+ad_texture_dump_s::cancel (ad_dump_image_s* img)
+{
+  {
+    std::lock_guard <std::mutex> guard (lock);
+    staged -= img->bytes ();
+  }
+
+  delete img;
+}
+
+void
+ad_texture_dump_s::start (int threads)
+{
+  if (! workers.empty ())
+    return;
+
+  if (threads <= 0) {
+    // Leave most of the CPU to the game
+    threads = (int)std::thread::hardware_concurrency () / 2;
+
+    if (threads < 1) threads = 1;
+    if (threads > 4) threads = 4;
+  }
+
+  stopping = false;
+  stats    = decltype (stats) ();
+
+  for (int i = 0; i < threads; i++)
+    workers.push_back (std::thread (&ad_texture_dump_s::work, this));
+}
+
+void
+ad_texture_dump_s::stop (void)
+{
+  {
+    std::lock_guard <std::mutex> guard (lock);
+    stopping = true;
+  }
+
+  ready.notify_all ();
+
+  for (size_t i = 0; i < workers.size (); i++)
+    workers [i].join ();
+
+  workers.clear ();
+  stopping = false;
+}
+
+ad_texture_dump_s::~ad_texture_dump_s (void)
+{
+  // By now the process is exiting (and the workers are gone, or about to be);
+  //   joining under the loader lock could deadlock.
+  for (size_t i = 0; i < workers.size (); i++)
+    workers [i].detach ();
+}
+
+void
+ad_texture_dump_s::work (void)
+{
+  while (true) {
+    ad_dump_image_s* img = nullptr;
+
+    {
+      std::unique_lock <std::mutex> guard (lock);
+
+      ready.wait (guard, [this] { return stopping || (! queue.empty ()); });
+
+      // Stopping only once everything queued is saved
+      if (queue.empty ())
+        return;
+
+      img = queue.front ();
+      queue.pop_front ();
+    }
+
+    save   (img);
+    cancel (img); // Frees its share of the budget
+  }
+}
+
+void
+ad_texture_dump_s::save (ad_dump_image_s* img)
+{
+  const ad_fingerprint_s fp   = AD_Fingerprint (*img, sampled);
+  const uint64_t         hash = fp.lo;
+
+  // Sampled names are only as good as the audit says; the full fingerprint
+  //   costs little on a worker.
+  if (sampled && fingerprint_audit.enable)
+    fingerprint_audit.record (fp, AD_Fingerprint (*img, false));
+
+  {
+    std::lock_guard <std::mutex> guard (lock);
+
+    if (! seen.insert (hash).second) {
+      ++stats.duplicates;
+      return;
+    }
+  }
+
+  const bool is_png = png && AD_PNG_Supported (img->format);
+
+  char name [32];
+  snprintf (name, sizeof (name), "/%016llX.%s", (unsigned long long)hash,
+                                                is_png ? "png" : "dds");
+
+  const std::string path = directory + name;
+
+  // Dumped by an earlier session
+  FILE* existing = fopen (path.c_str (), "rb");
+
+  if (existing != nullptr) {
+    fclose (existing);
+
+    std::lock_guard <std::mutex> guard (lock);
+    ++stats.duplicates;
+
+    return;
+  }
+
+  std::vector <uint8_t> file;
+
+  bool encoded = is_png ? AD_EncodePNG (*img, file) :
+                          AD_EncodeDDS (*img, file);
+
+  FILE* out = encoded ? fopen (path.c_str (), "wb") : nullptr;
+
+  bool written =
+    out != nullptr && fwrite (file.data (), 1, file.size (), out) == file.size ();
+
+  if (out != nullptr)
+    fclose (out);
+
+  std::lock_guard <std::mutex> guard (lock);
+
+  if (written)
+    ++stats.written;
+  else
+    ++stats.failed;
+}
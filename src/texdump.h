@@ -0,0 +1,135 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__TEXDUMP_H__
+#define __AD__TEXDUMP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+//
+// Asynchronous texture dump (Render.DumpTextures)
+//
+//   The upload detours (UpdateTexture / UpdateSurface) only copy the texels of
+//     the system-memory source into a staging image; hashing, deduplication,
+//       encoding and file I/O all happen on a small pool of worker threads.
+//
+//  * The staging queue is bounded in bytes; while the workers are behind, new
+//      uploads are dropped (and counted) instead of stalling the render thread.
+//
+//  * Files are named by content (<directory>/<fingerprint>.dds|png, see
+//      fingerprint.h), so a texture the game uploads over and over is only
+//        ever written once.
+//
+//  * Nothing in here depends on Windows or Direct3D (formats are D3DFORMAT
+//      values), so the queue and encoders can be timed on any platform.
+//
+struct ad_dump_image_s {
+  struct level_s {
+    uint32_t width, height;
+    uint32_t pitch;              // Bytes per row (of 4x4 blocks for DXTn)
+    uint32_t rows;
+    size_t   offset;             // Into data
+  };
+
+  uint32_t width,  height;       // Level 0
+  uint32_t levels;
+  uint32_t format;               // D3DFORMAT
+
+  std::vector <level_s> level;
+  std::vector <uint8_t> data;    // Tightly packed, level 0 first
+
+  // Lays out every level (data still has to be sized to bytes ()); false if
+  //   the format can't be dumped
+  bool     init  (uint32_t width, uint32_t height, uint32_t levels, uint32_t format);
+  size_t   bytes (void) const;
+};
+
+// Whole files, in memory
+bool AD_EncodeDDS (const ad_dump_image_s& img, std::vector <uint8_t>& out);
+
+// Lays img out from a DDS file (any format AD_EncodeDDS writes); *ppTexels
+//   points into data rather than filling img.data
+bool AD_DecodeDDS ( const uint8_t* data, size_t size,
+                    ad_dump_image_s& img, const uint8_t** ppTexels );
+
+// 32-bit RGB(A) formats only, level 0 only
+bool AD_EncodePNG (const ad_dump_image_s& img, std::vector <uint8_t>& out);
+
+struct ad_texture_dump_s {
+  bool        enable      = false;        // Render.DumpTextures
+  bool        png         = true;         // 32-bit RGB(A) as PNG, the rest as DDS
+  bool        sampled     = false;        // Named by sampled fingerprints
+  int         budget_mib  = 256;          // Staged but not yet encoded
+  std::string directory   = "textures";
+
+  // Render.DumpTextures.<Stat>, since the workers started
+  struct {
+    int queued     = 0;
+    int dropped    = 0;                   // Over budget
+    int duplicates = 0;
+    int written    = 0;
+    int failed     = 0;                   // Encoder or file system
+  } stats;
+
+  //
+  // Producer (render thread)
+  //
+
+  // nullptr if the upload has to be dropped; otherwise fill in data and
+  //   commit, or cancel if it could not be read after all.
+  ad_dump_image_s* begin  ( uint32_t width, uint32_t height,
+                            uint32_t levels, uint32_t format );
+  void             commit (ad_dump_image_s* img);
+  void             cancel (ad_dump_image_s* img);
+
+  //
+  // Workers (started by the first begin)
+  //
+  void start (int threads = 0);           // 0 = Based on the CPU count
+  void stop  (void);                      // Finishes everything queued
+
+  ~ad_texture_dump_s (void);
+
+protected:
+  void work (void);
+  void save (ad_dump_image_s* img);
+
+  std::mutex                    lock;
+  std::condition_variable       ready;
+  std::deque <ad_dump_image_s*> queue;
+  std::unordered_set <uint64_t> seen;
+  std::vector <std::thread>     workers;
+  size_t                        staged   = 0;  // Bytes begun but not yet saved
+  bool                          stopping = false;
+};
+
+extern ad_texture_dump_s texture_dump;
+
+#endif /* __AD__TEXDUMP_H__ */
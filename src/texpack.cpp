@@ -0,0 +1,357 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "texpack.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+# include <Windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+ad_texture_pack_s texture_pack;
+
+//
+// AD_LZ
+//
+//   A sequence is a token (literal count << 4 | match length - 4), extra
+//     length bytes for either nibble that is 15 (each adds up to 255), the
+//       literals, then a 16-bit little-endian match offset and the extra match
+//         length bytes.  The last sequence is literals only.
+//
+static const size_t AD_LZ_MIN_MATCH = 4;
+static const size_t AD_LZ_WINDOW    = 65535;
+static const int    AD_LZ_HASH_BITS = 16;
+
+static void
+AD_LZ_PutLength (std::vector <uint8_t>& out, size_t len)
+{
+  while (len >= 255) {
+    out.push_back (255);
+    len -= 255;
+  }
+
+  out.push_back ((uint8_t)len);
+}
+
+static void
+AD_LZ_Sequence ( std::vector <uint8_t>& out, const uint8_t* literals, size_t num_literals,
+                 size_t offset, size_t match_len )
+{
+  size_t extra = match_len >= AD_LZ_MIN_MATCH ? match_len - AD_LZ_MIN_MATCH : 0;
+
+  out.push_back ( (uint8_t)( ((num_literals < 15 ? num_literals : 15) << 4) |
+                              (extra        < 15 ? extra        : 15) ) );
+
+  if (num_literals >= 15)
+    AD_LZ_PutLength (out, num_literals - 15);
+
+  out.insert (out.end (), literals, literals + num_literals);
+
+  // Trailing literals
+  if (match_len == 0)
+    return;
+
+  out.push_back ((uint8_t) offset);
+  out.push_back ((uint8_t)(offset >> 8));
+
+  if (extra >= 15)
+    AD_LZ_PutLength (out, extra - 15);
+}
+
+void
+AD_LZ_Compress (const uint8_t* src, size_t size, std::vector <uint8_t>& out)
+{
+  out.clear   ();
+  out.reserve (size + size / 255 + 16);
+
+  std::vector <int64_t> table (1 << AD_LZ_HASH_BITS, -1);
+
+  size_t anchor = 0; // First pending literal
+  size_t i      = 0;
+
+  while (i + AD_LZ_MIN_MATCH <= size) {
+    uint32_t v;
+    memcpy (&v, src + i, 4);
+
+    uint32_t h    = (v * 2654435769U) >> (32 - AD_LZ_HASH_BITS);
+    int64_t  cand = table [h];
+
+    table [h] = (int64_t)i;
+
+    if ( cand < 0 || i - (size_t)cand > AD_LZ_WINDOW ||
+         memcmp (src + cand, src + i, AD_LZ_MIN_MATCH) != 0 ) {
+      ++i;
+      continue;
+    }
+
+    size_t len = AD_LZ_MIN_MATCH;
+
+    while (i + len < size && src [cand + len] == src [i + len])
+      ++len;
+
+    AD_LZ_Sequence (out, src + anchor, i - anchor, i - (size_t)cand, len);
+
+    i     += len;
+    anchor = i;
+  }
+
+  AD_LZ_Sequence (out, src + anchor, size - anchor, 0, 0);
+}
+
+static bool
+AD_LZ_GetLength (const uint8_t*& ip, const uint8_t* end, size_t& len)
+{
+  uint8_t b;
+
+  do {
+    if (ip >= end)
+      return false;
+
+    b    = *ip++;
+    len += b;
+  } while (b == 255);
+
+  return true;
+}
+
+size_t
+AD_LZ_Decompress (const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size)
+{
+  const uint8_t* ip   = src;
+  const uint8_t* iend = src + size;
+  size_t         op   = 0;
+
+  for (;;) {
+    // Every stream ends with a literals-only sequence; running out of input
+    //   before it means the stream was cut short
+    if (ip >= iend)
+      return 0;
+
+    const uint8_t token = *ip++;
+
+    size_t num_literals = token >> 4;
+
+    if (num_literals == 15 && (! AD_LZ_GetLength (ip, iend, num_literals)))
+      return 0;
+
+    if ( num_literals > (size_t)(iend - ip) ||
+         num_literals > dst_size - op )
+      return 0;
+
+    memcpy (dst + op, ip, num_literals);
+
+    ip += num_literals;
+    op += num_literals;
+
+    // The last sequence has no match
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return 0;
+
+    size_t offset    = ip [0] | (ip [1] << 8);
+    size_t match_len = token & 0xF;
+
+    ip += 2;
+
+    if (match_len == 15 && (! AD_LZ_GetLength (ip, iend, match_len)))
+      return 0;
+
+    match_len += AD_LZ_MIN_MATCH;
+
+    if (offset == 0 || offset > op || match_len > dst_size - op)
+      return 0;
+
+    // Byte by byte; a match may overlap what it is producing
+    for (size_t j = 0; j < match_len; j++, op++)
+      dst [op] = dst [op - offset];
+  }
+
+  return op;
+}
+
+//
+// Pack
+//
+bool
+ad_texture_pack_s::open (const char* path)
+{
+  close ();
+
+#ifdef _WIN32
+  HANDLE hFile =
+    CreateFileA ( path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr );
+
+  if (hFile == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER file_size;
+
+  HANDLE hMapping =
+    GetFileSizeEx (hFile, &file_size) ?
+      CreateFileMappingA (hFile, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+
+  const void* view =
+    hMapping != nullptr ? MapViewOfFile (hMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+  if (view == nullptr) {
+    if (hMapping != nullptr)
+      CloseHandle (hMapping);
+
+    CloseHandle (hFile);
+    return false;
+  }
+
+  file    = hFile;
+  mapping = hMapping;
+  base    = (const uint8_t *)view;
+  length  = (size_t)file_size.QuadPart;
+#else
+  int fd = ::open (path, O_RDONLY);
+
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+
+  void* view =
+    (fstat (fd, &st) == 0 && st.st_size > 0) ?
+      mmap (nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+  // The mapping keeps the file alive
+  ::close (fd);
+
+  if (view == MAP_FAILED)
+    return false;
+
+  base   = (const uint8_t *)view;
+  length = (size_t)st.st_size;
+#endif
+
+  const ad_pack_header_s* hdr = (const ad_pack_header_s *)base;
+
+  bool valid =
+    length >= sizeof (ad_pack_header_s) &&
+    hdr->magic   == AD_PACK_MAGIC       &&
+    hdr->version == AD_PACK_VERSION     &&
+    hdr->index_offset <= length         &&
+    (hdr->index_offset & 0x7) == 0      &&
+    (length - hdr->index_offset) / sizeof (ad_pack_entry_s) >= hdr->count;
+
+  // Every blob has to lie inside the file, so find (...) never checks again
+  for (uint32_t i = 0; valid && i < hdr->count; i++) {
+    const ad_pack_entry_s& entry =
+      ((const ad_pack_entry_s *)(base + hdr->index_offset)) [i];
+
+    valid = entry.offset <= length && entry.size <= length - entry.offset &&
+            entry.size   <= entry.raw_size;
+
+    if (valid && i > 0)
+      valid = (&entry) [-1].hash < entry.hash;
+  }
+
+  if (! valid) {
+    close ();
+    return false;
+  }
+
+  header = hdr;
+  index  = (const ad_pack_entry_s *)(base + hdr->index_offset);
+
+  return true;
+}
+
+void
+ad_texture_pack_s::close (void)
+{
+#ifdef _WIN32
+  if (base    != nullptr) UnmapViewOfFile ((LPCVOID)base);
+  if (mapping != nullptr) CloseHandle     ((HANDLE)mapping);
+  if (file    != nullptr) CloseHandle     ((HANDLE)file);
+#else
+  if (base    != nullptr) munmap          ((void *)base, length);
+#endif
+
+  base    = nullptr;
+  length  = 0;
+  header  = nullptr;
+  index   = nullptr;
+  file    = nullptr;
+  mapping = nullptr;
+
+  scratch.clear ();
+}
+
+ad_texture_pack_s::~ad_texture_pack_s (void)
+{
+  close ();
+}
+
+bool
+ad_texture_pack_s::find (uint64_t hash, const uint8_t** ppData, size_t* pSize)
+{
+  if (index == nullptr)
+    return false;
+
+  size_t lo = 0,
+         hi = header->count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (index [mid].hash < hash)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == header->count || index [lo].hash != hash)
+    return false;
+
+  const ad_pack_entry_s& entry = index [lo];
+
+  if (entry.size == entry.raw_size) {
+    *ppData = base + entry.offset;
+    *pSize  = entry.size;
+
+    return true;
+  }
+
+  scratch.resize (entry.raw_size);
+
+  if ( AD_LZ_Decompress ( base + entry.offset, entry.size,
+                            scratch.data (), scratch.size () ) != entry.raw_size )
+    return false;
+
+  *ppData = scratch.data ();
+  *pSize  = scratch.size ();
+
+  return true;
+}
@@ -0,0 +1,119 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__TEXPACK_H__
+#define __AD__TEXPACK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+//
+// Texture replacement pack (AgDrag.texpack)
+//
+//   One file, memory-mapped read-only:
+//
+//     ad_pack_header_s
+//     ad_pack_entry_s [count]   sorted by hash (binary searched in place)
+//     blobs                     DDS files, stored or AD_LZ compressed
+//
+//   The key is the fingerprint of the texture the game uploads (the same
+//     name Render.DumpTextures gives it, e.g. textures/0123456789ABCDEF.dds),
+//       so a replacement is authored by editing a dump and packing it under
+//         its original name (tools/packtex, with --sampled for dumps made
+//           with Render.DumpTextures.Sampled).
+//
+//  * Stored blobs are used straight out of the mapping (zero-copy); only
+//      compressed ones are expanded, into a reused scratch buffer.
+//
+//  * Several keys may share one blob; the builder writes each unique
+//      replacement once.
+//
+//  * Portable (Win32 file mapping or POSIX mmap), so packs can be written
+//      and verified off-line.
+//
+#define AD_PACK_MAGIC   0x4B505441U  // "ATPK"
+#define AD_PACK_VERSION 1
+
+#define AD_PACK_SAMPLED 0x1          // Keyed by sampled fingerprints
+
+struct ad_pack_header_s {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;                // Index entries
+  uint32_t flags;
+  uint64_t index_offset;
+};
+
+struct ad_pack_entry_s {
+  uint64_t hash;                 // What the game uploaded
+  uint64_t offset;               // Of the blob, from the start of the file
+  uint32_t size;                 // In the file
+  uint32_t raw_size;             // Expanded; == size if the blob is stored
+};
+
+//
+// Byte-oriented LZ77 (LZ4-style sequences, 64 KiB window); fast to expand
+//   and simple enough to bounds-check every step of.
+//
+void   AD_LZ_Compress   (const uint8_t* src, size_t size, std::vector <uint8_t>& out);
+
+// Returns the number of bytes written, or 0 if the input is malformed
+size_t AD_LZ_Decompress (const uint8_t* src, size_t size, uint8_t* dst, size_t dst_size);
+
+struct ad_texture_pack_s {
+  bool enable = true;            // Render.ReplaceTextures
+
+  struct {
+    int hits       = 0;
+    int misses     = 0;
+    int mismatched = 0;          // Replacement has another size or format
+  } stats;
+
+  bool open   (const char* path);
+  void close  (void);
+
+  bool is_open (void) const { return index != nullptr; }
+  int  size    (void) const { return index != nullptr ? (int)header->count : 0; }
+  bool sampled (void) const { return index != nullptr && (header->flags & AD_PACK_SAMPLED); }
+
+  // The replacement for hash (a DDS file), or false; the pointer stays valid
+  //   until the next find (...) or close (...)
+  bool find   (uint64_t hash, const uint8_t** ppData, size_t* pSize);
+
+  ~ad_texture_pack_s (void);
+
+protected:
+  const uint8_t*          base   = nullptr;
+  size_t                  length = 0;
+  const ad_pack_header_s* header = nullptr;
+  const ad_pack_entry_s*  index  = nullptr;
+
+  std::vector <uint8_t>   scratch;      // Expanded blob
+
+  void*                   file    = nullptr;  // Win32 handles
+  void*                   mapping = nullptr;
+};
+
+extern ad_texture_pack_s texture_pack;
+
+#endif /* __AD__TEXPACK_H__ */
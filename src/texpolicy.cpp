@@ -0,0 +1,484 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "texpolicy.h"
+#include "ini.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+ad_texture_policy_s texture_policy;
+
+//
+// Written to AgDrag.textures.ini the first time the game is started; the
+//   examples are disabled until a profile shows they are worth it.
+//
+static const wchar_t* AD_DEFAULT_TEXTURE_POLICY =
+  L"[ShadowMapCap]\n"
+  L"Width=4096-16384\n"
+  L"Height=4096-16384\n"
+  L"Usage=DepthStencil\n"
+  L"MaxSize=2048\n"
+  L"Enable=false\n"
+  L"\n"
+  L"[UIAtlasMips]\n"
+  L"Width=2048\n"
+  L"Height=2048\n"
+  L"Format=A8R8G8B8\n"
+  L"Pool=Default\n"
+  L"Levels=0\n"
+  L"Enable=false\n";
+
+struct ad_texture_policy_s::rule_s {
+  std::wstring name;
+
+  // Match
+  UINT      min_width,  max_width;
+  UINT      min_height, max_height;
+  D3DFORMAT format;              // D3DFMT_UNKNOWN = Any
+  DWORD     usage;               // Every bit must be set
+  bool      usage_none;          // ... or none of RT / DS / Dynamic
+  int       pool;                // -1 = Any
+
+  // Override
+  UINT      max_size;            // 0 = Keep (render targets / depth only)
+  int       levels;              // -1 = Keep
+
+  // Totals
+  int       hits;
+  int       refusals;
+  int64_t   bytes_saved;         // Negative if the rule spends memory
+};
+
+static const struct {
+  const wchar_t* name;
+  D3DFORMAT      format;
+  UINT           bits;           // Per pixel (per texel of a 4x4 block for DXTn)
+} ad_texture_formats [] = {
+  { L"A8R8G8B8",      D3DFMT_A8R8G8B8,      32 },
+  { L"X8R8G8B8",      D3DFMT_X8R8G8B8,      32 },
+  { L"A8B8G8R8",      D3DFMT_A8B8G8R8,      32 },
+  { L"X8B8G8R8",      D3DFMT_X8B8G8R8,      32 },
+  { L"R5G6B5",        D3DFMT_R5G6B5,        16 },
+  { L"A1R5G5B5",      D3DFMT_A1R5G5B5,      16 },
+  { L"X1R5G5B5",      D3DFMT_X1R5G5B5,      16 },
+  { L"A4R4G4B4",      D3DFMT_A4R4G4B4,      16 },
+  { L"A2R10G10B10",   D3DFMT_A2R10G10B10,   32 },
+  { L"A2B10G10R10",   D3DFMT_A2B10G10R10,   32 },
+  { L"G16R16",        D3DFMT_G16R16,        32 },
+  { L"A16B16G16R16",  D3DFMT_A16B16G16R16,  64 },
+  { L"A8",            D3DFMT_A8,             8 },
+  { L"L8",            D3DFMT_L8,             8 },
+  { L"A8L8",          D3DFMT_A8L8,          16 },
+  { L"L16",           D3DFMT_L16,           16 },
+  { L"R16F",          D3DFMT_R16F,          16 },
+  { L"G16R16F",       D3DFMT_G16R16F,       32 },
+  { L"A16B16G16R16F", D3DFMT_A16B16G16R16F, 64 },
+  { L"R32F",          D3DFMT_R32F,          32 },
+  { L"G32R32F",       D3DFMT_G32R32F,       64 },
+  { L"A32B32G32R32F", D3DFMT_A32B32G32R32F, 128 },
+  { L"D16",           D3DFMT_D16,           16 },
+  { L"D24S8",         D3DFMT_D24S8,         32 },
+  { L"D24X8",         D3DFMT_D24X8,         32 },
+  { L"D32",           D3DFMT_D32,           32 },
+  { L"DXT1",          D3DFMT_DXT1,           4 },
+  { L"DXT2",          D3DFMT_DXT2,           8 },
+  { L"DXT3",          D3DFMT_DXT3,           8 },
+  { L"DXT4",          D3DFMT_DXT4,           8 },
+  { L"DXT5",          D3DFMT_DXT5,           8 },
+  { L"INTZ",          (D3DFORMAT)MAKEFOURCC ('I','N','T','Z'), 32 },
+  { L"DF24",          (D3DFORMAT)MAKEFOURCC ('D','F','2','4'), 32 },
+  { L"DF16",          (D3DFORMAT)MAKEFOURCC ('D','F','1','6'), 16 }
+};
+
+static const struct {
+  const wchar_t* name;
+  D3DPOOL        pool;
+} ad_texture_pools [] = {
+  { L"Default",   D3DPOOL_DEFAULT   },
+  { L"Managed",   D3DPOOL_MANAGED   },
+  { L"SystemMem", D3DPOOL_SYSTEMMEM }
+};
+
+static const DWORD AD_USAGE_CLASS_BITS =
+  D3DUSAGE_RENDERTARGET | D3DUSAGE_DEPTHSTENCIL | D3DUSAGE_DYNAMIC;
+
+static bool
+AD_IsBlockCompressed (D3DFORMAT format)
+{
+  return format == D3DFMT_DXT1 || format == D3DFMT_DXT2 || format == D3DFMT_DXT3 ||
+         format == D3DFMT_DXT4 || format == D3DFMT_DXT5;
+}
+
+uint64_t
+AD_TextureBytes (UINT width, UINT height, UINT levels, D3DFORMAT format)
+{
+  UINT bits = 32;                // Anything unknown is counted as 32-bit
+
+  for (size_t i = 0; i < sizeof (ad_texture_formats) / sizeof (ad_texture_formats [0]); i++) {
+    if (ad_texture_formats [i].format == format)
+      bits = ad_texture_formats [i].bits;
+  }
+
+  const bool blocks = AD_IsBlockCompressed (format);
+
+  uint64_t bytes = 0;
+
+  for (UINT level = 0; levels == 0 || level < levels; level++) {
+    UINT w = width, h = height;
+
+    if (blocks) {
+      w = (w + 3) & ~3U;
+      h = (h + 3) & ~3U;
+    }
+
+    bytes += ((uint64_t)w * h * bits) / 8;
+
+    if (width == 1 && height == 1)
+      break;
+
+    if (width  > 1) width  >>= 1;
+    if (height > 1) height >>= 1;
+  }
+
+  return bytes;
+}
+
+uint32_t
+ad_texture_policy_s::bucket (UINT width, DWORD usage)
+{
+  uint32_t log2 = 0;
+
+  while (log2 < 15 && (width >> (log2 + 1)) != 0)
+    ++log2;
+
+  uint32_t cls = (usage & D3DUSAGE_RENDERTARGET) ? 1 :
+                 (usage & D3DUSAGE_DEPTHSTENCIL) ? 2 :
+                 (usage & D3DUSAGE_DYNAMIC)      ? 3 : 0;
+
+  return (log2 << 2) | cls;
+}
+
+static bool
+AD_ParseRange (const std::wstring& str, UINT& lo, UINT& hi)
+{
+  const wchar_t* wszVal = str.c_str ();
+  wchar_t*       end    = nullptr;
+
+  lo = wcstoul (wszVal, &end, 10);
+
+  if (end == wszVal)
+    return false;
+
+  hi = lo;
+
+  if (*end == L'-') {
+    wszVal = end + 1;
+    hi     = wcstoul (wszVal, &end, 10);
+
+    if (end == wszVal || hi < lo)
+      return false;
+  }
+
+  return *end == L'\0';
+}
+
+static bool
+AD_ParseTextureRule (ad::INI::File::Section& section, ad_texture_policy_s::rule_s& rule)
+{
+  rule.min_width  = 0; rule.max_width  = UINT_MAX;
+  rule.min_height = 0; rule.max_height = UINT_MAX;
+  rule.format     = D3DFMT_UNKNOWN;
+  rule.usage      = 0;
+  rule.usage_none = false;
+  rule.pool       = -1;
+  rule.max_size   = 0;
+  rule.levels     = -1;
+
+  if (section.contains_key (L"Width") &&
+      (! AD_ParseRange (section.get_value (L"Width"),  rule.min_width,  rule.max_width)))
+    return false;
+
+  if (section.contains_key (L"Height") &&
+      (! AD_ParseRange (section.get_value (L"Height"), rule.min_height, rule.max_height)))
+    return false;
+
+  if (section.contains_key (L"Format")) {
+    for (size_t i = 0; i < sizeof (ad_texture_formats) / sizeof (ad_texture_formats [0]); i++) {
+      if (section.get_value (L"Format") == ad_texture_formats [i].name)
+        rule.format = ad_texture_formats [i].format;
+    }
+
+    if (rule.format == D3DFMT_UNKNOWN)
+      return false;
+  }
+
+  if (section.contains_key (L"Usage")) {
+    const std::wstring& usage = section.get_value (L"Usage");
+
+    if      (usage == L"RenderTarget") rule.usage      = D3DUSAGE_RENDERTARGET;
+    else if (usage == L"DepthStencil") rule.usage      = D3DUSAGE_DEPTHSTENCIL;
+    else if (usage == L"Dynamic")      rule.usage      = D3DUSAGE_DYNAMIC;
+    else if (usage == L"None")         rule.usage_none = true;
+    else
+      return false;
+  }
+
+  if (section.contains_key (L"Pool")) {
+    for (size_t i = 0; i < sizeof (ad_texture_pools) / sizeof (ad_texture_pools [0]); i++) {
+      if (section.get_value (L"Pool") == ad_texture_pools [i].name)
+        rule.pool = ad_texture_pools [i].pool;
+    }
+
+    if (rule.pool == -1)
+      return false;
+  }
+
+  if (section.contains_key (L"MaxSize"))
+    rule.max_size = (UINT)_wtoi (section.get_value (L"MaxSize").c_str ());
+
+  if (section.contains_key (L"Levels"))
+    rule.levels   = _wtoi (section.get_value (L"Levels").c_str ());
+
+  // A rule that changes nothing is a typo
+  return rule.max_size != 0 || rule.levels >= 0;
+}
+
+
+ad_texture_policy_s::ad_texture_policy_s (void)
+{
+  rules     = nullptr;
+  num_rules = 0;
+
+  memset (table, 0, sizeof (table));
+}
+
+ad_texture_policy_s::~ad_texture_policy_s (void)
+{
+  delete [] rules;
+}
+
+int
+ad_texture_policy_s::apply (ad_texture_request_s& req) const
+{
+  uint32_t candidates = table [bucket (req.width, req.usage)];
+
+  for (int i = 0; candidates != 0; i++, candidates >>= 1) {
+    if (! (candidates & 0x1))
+      continue;
+
+    const rule_s& rule = rules [i];
+
+    if ( req.width  < rule.min_width  || req.width  > rule.max_width  ||
+         req.height < rule.min_height || req.height > rule.max_height )
+      continue;
+
+    if (rule.format != D3DFMT_UNKNOWN && req.format != rule.format)
+      continue;
+
+    if ((req.usage & rule.usage) != rule.usage)
+      continue;
+
+    if (rule.usage_none && (req.usage & AD_USAGE_CLASS_BITS))
+      continue;
+
+    if (rule.pool != -1 && (int)req.pool != rule.pool)
+      continue;
+
+    // Only render targets and depth buffers can be smaller than the game
+    //   thinks (render_scale remaps every rect aimed at them); anything else
+    //     is locked or updated at the size the game asked for.
+    if (rule.max_size != 0 && (req.usage & (D3DUSAGE_RENDERTARGET | D3DUSAGE_DEPTHSTENCIL))) {
+      UINT larger = req.width > req.height ? req.width : req.height;
+
+      while (larger > rule.max_size) {
+        req.width  = req.width  > 1 ? req.width  >> 1 : 1;
+        req.height = req.height > 1 ? req.height >> 1 : 1;
+        larger   >>= 1;
+
+        // The dropped top level is one fewer mip
+        if (req.levels > 1)
+          --req.levels;
+      }
+    }
+
+    if (rule.levels >= 0) {
+      req.levels = (UINT)rule.levels;
+
+      // Nobody fills the extra levels otherwise
+      if (req.levels != 1 && req.pool != D3DPOOL_SYSTEMMEM)
+        req.usage |= D3DUSAGE_AUTOGENMIPMAP;
+    }
+
+    return i;
+  }
+
+  return -1;
+}
+
+void
+ad_texture_policy_s::account ( int                         rule,
+                               const ad_texture_request_s& orig,
+                               const ad_texture_request_s& req,
+                               UINT                        levels )
+{
+  if (rule < 0 || rule >= num_rules)
+    return;
+
+  rules [rule].hits        += 1;
+  rules [rule].bytes_saved += (int64_t)AD_TextureBytes (orig.width, orig.height, orig.levels, orig.format) -
+                              (int64_t)AD_TextureBytes (req.width,  req.height,  levels,      req.format);
+}
+
+void
+ad_texture_policy_s::refused (int rule)
+{
+  if (rule >= 0 && rule < num_rules)
+    rules [rule].refusals += 1;
+}
+
+void
+ad_texture_policy_s::report (void)
+{
+  dll_log.Log (L" [TexPolicy] %d rules:", num_rules);
+
+  for (int i = 0; i < num_rules; i++) {
+    dll_log.Log ( L"   %-24s %6d textures (%d refused), %9.2f MiB %s",
+                    rules [i].name.c_str (), rules [i].hits, rules [i].refusals,
+                      (double)(rules [i].bytes_saved < 0 ? -rules [i].bytes_saved :
+                                                            rules [i].bytes_saved) / 1048576.0,
+                        rules [i].bytes_saved < 0 ? L"spent" : L"saved" );
+  }
+}
+
+bool
+ad_texture_policy_s::load (const wchar_t* filename)
+{
+  ad::INI::File* policy_ini = new ad::INI::File ((wchar_t *)filename);
+
+  if (policy_ini->get_sections ().empty ()) {
+    policy_ini->import (AD_DEFAULT_TEXTURE_POLICY);
+    policy_ini->write  (filename);
+
+    dll_log.Log (L" [TexPolicy] Created %s from the built-in examples.", filename);
+  }
+
+  std::vector <rule_s> parsed;
+
+  const std::map <std::wstring, ad::INI::File::Section>& sections =
+    policy_ini->get_sections ();
+
+  for ( std::map <std::wstring, ad::INI::File::Section>::const_iterator it = sections.begin ();
+          it != sections.end ();
+            ++it ) {
+    ad::INI::File::Section& section = policy_ini->get_section (it->first);
+
+    if ( section.contains_key (L"Enable") &&
+         section.get_value    (L"Enable") != L"true" &&
+         section.get_value    (L"Enable") != L"1" )
+      continue;
+
+    if (parsed.size () >= MAX_RULES) {
+      dll_log.Log (L" [TexPolicy] More than %d rules; ignoring the rest.", MAX_RULES);
+      break;
+    }
+
+    // Each pool has its own fill path (Lock for Managed, UpdateTexture from
+    //   SystemMem into Default); moving a texture out of the pool the game
+    //     asked for breaks it.
+    if (section.contains_key (L"SetPool")) {
+      dll_log.Log ( L" [TexPolicy] Ignoring rule [%s]: SetPool is not supported",
+                      it->first.c_str () );
+      continue;
+    }
+
+    rule_s rule;
+
+    if (! AD_ParseTextureRule (section, rule)) {
+      dll_log.Log (L" [TexPolicy] Ignoring malformed rule [%s]", it->first.c_str ());
+      continue;
+    }
+
+    // A capped texture the game locks or updates gets written at its
+    //   original size, past the end of the smaller surface.
+    if ( rule.max_size != 0 && rule.usage != D3DUSAGE_RENDERTARGET &&
+                               rule.usage != D3DUSAGE_DEPTHSTENCIL ) {
+      dll_log.Log ( L" [TexPolicy] Ignoring rule [%s]: MaxSize needs "
+                    L"Usage=RenderTarget or Usage=DepthStencil", it->first.c_str () );
+      continue;
+    }
+
+    rule.name        = it->first;
+    rule.hits        = 0;
+    rule.refusals    = 0;
+    rule.bytes_saved = 0;
+
+    parsed.push_back (rule);
+  }
+
+  delete policy_ini;
+
+  uint32_t compiled [NUM_BUCKETS] = { 0 };
+
+  for (size_t i = 0; i < parsed.size (); i++) {
+    for (uint32_t b = 0; b < NUM_BUCKETS; b++) {
+      // Smallest and largest width that land in this bucket
+      const UINT lo = (b >> 2) == 0  ? 0        : (1U << (b >> 2));
+      const UINT hi = (b >> 2) == 15 ? UINT_MAX : (2U << (b >> 2)) - 1;
+
+      if (parsed [i].max_width < lo || parsed [i].min_width > hi)
+        continue;
+
+      const uint32_t cls = b & 0x3;
+
+      // A bucket's class is its most significant usage bit
+      if ( (parsed [i].usage == D3DUSAGE_RENDERTARGET && cls != 1)               ||
+           (parsed [i].usage == D3DUSAGE_DEPTHSTENCIL && cls != 2 && cls != 1)   ||
+           (parsed [i].usage == D3DUSAGE_DYNAMIC      && cls == 0)               ||
+           (parsed [i].usage_none                     && cls != 0) )
+        continue;
+
+      compiled [b] |= (1UL << i);
+    }
+  }
+
+  rule_s* table_rules = parsed.empty () ? nullptr : new rule_s [parsed.size ()];
+
+  for (size_t i = 0; i < parsed.size (); i++)
+    table_rules [i] = parsed [i];
+
+  delete [] rules;
+
+  rules     = table_rules;
+  num_rules = (int)parsed.size ();
+
+  memcpy (table, compiled, sizeof (table));
+
+  dll_log.Log ( L" [TexPolicy] Compiled %d texture creation rules from %s",
+                  num_rules, filename );
+
+  return num_rules > 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__TEXPOLICY_H__
+#define __AD__TEXPOLICY_H__
+
+#include <Windows.h>
+#include <d3d9.h>
+#include <stdint.h>
+
+//
+// Texture creation policy (AgDrag.textures.ini)
+//
+//   Every section overrides how matching CreateTexture requests are made, e.g.
+//
+//     [ShadowMapCap]
+//     Width=4096-16384
+//     Height=4096-16384
+//     Usage=DepthStencil
+//     MaxSize=2048
+//     Enable=true
+//
+//   Width / Height (exact or lo-hi), Format (D3DFMT name without the prefix,
+//     e.g. A8R8G8B8 or DXT5), Usage (RenderTarget, DepthStencil, Dynamic or
+//       None; all listed bits must be set) and Pool (Default, Managed or
+//         SystemMem) select requests; omitted keys match anything.
+//
+//   MaxSize caps the larger dimension of a render target or depth buffer
+//     (keeping the aspect ratio; it needs Usage=RenderTarget or DepthStencil,
+//       since the game would fill anything else at its original size),
+//         and Levels replaces the mip count (0 = full chain, generated by the
+//           driver for render targets and default pool textures; refused for
+//             formats it can't generate, e.g. DXTn). The pool always stays
+//               the one the game asked for, since that decides how it fills
+//                 the texture.
+//
+//  * Rules are compiled at load into a 64-entry table keyed on the width's
+//      power of two and the usage class; a request only tests the rules
+//        whose bit is set in its entry, and the first match (in section name
+//          order) wins.
+//
+struct ad_texture_request_s {
+  UINT      width;
+  UINT      height;
+  UINT      levels;
+  DWORD     usage;
+  D3DFORMAT format;
+  D3DPOOL   pool;
+};
+
+// Bytes a texture occupies (levels = 0 means the full chain)
+uint64_t AD_TextureBytes (UINT width, UINT height, UINT levels, D3DFORMAT format);
+
+struct ad_texture_policy_s {
+  enum { MAX_RULES = 32 };
+
+  // Rewrites req for the first rule that matches; returns its index, or -1
+  int  apply   (ad_texture_request_s& req) const;
+
+  // The texture was created (levels = what the driver actually gave it)
+  void account (int rule, const ad_texture_request_s& orig,
+                          const ad_texture_request_s& req, UINT levels);
+
+  // The driver refused the override; the original request was used instead
+  void refused (int rule);
+
+  // Logs every rule's totals (Render.TexturePolicyReport)
+  void report  (void);
+
+  bool load    (const wchar_t* filename);
+
+  int  size    (void) const { return num_rules; }
+
+  struct rule_s;
+
+  bool     log_report = false;
+
+   ad_texture_policy_s (void);
+  ~ad_texture_policy_s (void);
+
+protected:
+  enum { NUM_BUCKETS = 64 };     // 16 powers of two x 4 usage classes
+
+  static uint32_t bucket (UINT width, DWORD usage);
+
+  rule_s*  rules;
+  int      num_rules;
+  uint32_t table [NUM_BUCKETS];  // Bitmask of the rules worth testing
+};
+
+extern ad_texture_policy_s texture_policy;
+
+#endif /* __AD__TEXPOLICY_H__ */
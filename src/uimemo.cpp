@@ -0,0 +1,122 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "uimemo.h"
+
+#include <malloc.h>
+#include <string.h>
+
+ad_ui_memo_s ui_memo;
+
+static inline uint32_t
+AD_UIMemo_Hash (const float* block, const uint32_t* state)
+{
+  uint32_t words [ad_ui_memo_s::BLOCK_FLOATS];
+  memcpy (words, block, sizeof (words));
+
+  // FNV-1a over whole words, then a final avalanche so the low bits are usable
+  uint32_t h = 2166136261U;
+
+  for (int i = 0; i < ad_ui_memo_s::BLOCK_FLOATS; i++)
+    h = (h ^ words [i]) * 16777619U;
+
+  for (int i = 0; i < ad_ui_memo_s::STATE_WORDS; i++)
+    h = (h ^ state [i]) * 16777619U;
+
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+
+  return h;
+}
+
+ad_ui_memo_s::ad_ui_memo_s (void)
+{
+  entries = (entry_s *)_aligned_malloc (sizeof (entry_s) * NUM_ENTRIES, 64);
+
+  last_hash = 0;
+  lookups   = 0;
+  hits      = 0;
+
+  clear ();
+}
+
+ad_ui_memo_s::~ad_ui_memo_s (void)
+{
+  _aligned_free (entries);
+}
+
+bool
+ad_ui_memo_s::lookup (const float* block, const uint32_t* state, float* out)
+{
+  if (entries == nullptr)
+    return false;
+
+  ++lookups;
+
+  last_hash = AD_UIMemo_Hash (block, state);
+
+  const entry_s& entry = entries [last_hash & (NUM_ENTRIES - 1)];
+
+  if ( entry.valid && entry.hash == last_hash                          &&
+       memcmp (entry.state, state, sizeof (entry.state)) == 0          &&
+       memcmp (entry.in,    block, sizeof (entry.in))    == 0 ) {
+    memcpy (out, entry.out, sizeof (entry.out));
+
+    ++hits;
+
+    return true;
+  }
+
+  return false;
+}
+
+void
+ad_ui_memo_s::store (const float* block, const uint32_t* state, const float* out)
+{
+  if (entries == nullptr)
+    return;
+
+  entry_s& entry = entries [last_hash & (NUM_ENTRIES - 1)];
+
+  entry.hash  = last_hash;
+  entry.valid = 1;
+
+  memcpy (entry.state, state, sizeof (entry.state));
+  memcpy (entry.in,    block, sizeof (entry.in));
+  memcpy (entry.out,   out,   sizeof (entry.out));
+}
+
+void
+ad_ui_memo_s::clear (void)
+{
+  if (entries != nullptr)
+    memset (entries, 0, sizeof (entry_s) * NUM_ENTRIES);
+}
+
+void
+ad_ui_memo_s::publish (void)
+{
+  hits_        = hits > 0x7fffffffULL ? 0x7fffffff : (int)hits;
+  hit_rate_    = lookups > 0 ? (float)(100.0 * (double)hits / (double)lookups) : 0.0f;
+  bytes_saved_ = (float)((double)hits * (double)(sizeof (float) * BLOCK_FLOATS));
+}
@@ -0,0 +1,96 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__UIMEMO_H__
+#define __AD__UIMEMO_H__
+
+#include <stdint.h>
+
+//
+// Remembers the rewritten form of UI constant blocks (4x vec4) so that HUD
+//   elements re-uploading the same block frame after frame are served by a
+//     lookup instead of going through the whole rewrite again.
+//
+//  * The block alone does not determine the result; the caller supplies the
+//      rest of what does (classification flags, display geometry generation,
+//        tunables) as STATE_WORDS words that must match bit-for-bit as well.
+//
+//  * Direct-mapped; a colliding block simply replaces the previous one.
+//
+struct ad_ui_memo_s {
+  enum {
+    BLOCK_FLOATS = 16,
+    STATE_WORDS  = 7,
+    NUM_ENTRIES  = 512   // Power of two
+  };
+
+  // Flags for state [0]
+  enum {
+    STATE_CENTER        = 0x1,  // ui.center
+    STATE_MINIMAP       = 0x2,  // minimap->drawing
+    STATE_NAMETAGS      = 0x4,  // nametags->drawing
+    STATE_NAMETAG_FIX   = 0x8,  // Nametag aspect correction applies
+    STATE_UI            = 0x10, // ui.drawing
+    STATE_MENU          = 0x20, // ui.drawing_menu
+    STATE_MAIN_MAP      = 0x40  // minimap->main_map
+  };
+
+   ad_ui_memo_s (void);
+  ~ad_ui_memo_s (void);
+
+  // true (and out filled in) on a hit
+  bool lookup  (const float* block, const uint32_t* state, float* out);
+
+  // Must follow the lookup (...) that missed, with the same arguments
+  void store   (const float* block, const uint32_t* state, const float* out);
+
+  void clear   (void);
+
+  // Copies the counters into the console variables below (once per-frame)
+  void publish (void);
+
+  bool     enable       = true;   // UI.Memo
+
+  // Console-visible statistics
+  int      hits_        = 0;      // UI.Memo.Hits
+  float    hit_rate_    = 0.0f;   // UI.Memo.HitRate     (%)
+  float    bytes_saved_ = 0.0f;   // UI.Memo.BytesSaved  (rewritten bytes served)
+
+protected:
+  struct entry_s {
+    uint32_t hash;
+    uint32_t valid;
+    uint32_t state [STATE_WORDS];
+    float    in    [BLOCK_FLOATS];
+    float    out   [BLOCK_FLOATS];
+  };
+
+private:
+  entry_s* entries;
+  uint32_t last_hash;
+
+  uint64_t lookups;
+  uint64_t hits;
+};
+
+extern ad_ui_memo_s ui_memo;
+
+#endif /* __AD__UIMEMO_H__ */
@@ -25,6 +25,7 @@
 #include "window.h"
 #include "input.h"
 #include "render.h"
+#include "limiter.h"
 
 #include "config.h"
 #include "log.h"
@@ -246,22 +247,13 @@ DetourWindowProc ( _In_  HWND   hWnd,
     //   this opportunity to setup a special framerate limit.
     //
     if (window.active != last_active) {
-      eTB_CommandProcessor* pCommandProc =
-        SK_GetCommandProcessor           ();
-
-#if 0
-      eTB_CommandResult     result       =
-        pCommandProc->ProcessCommandLine ("TargetFPS");
-
-      eTB_VarStub <float>* pOriginalLimit = (eTB_VarStub <float>*)result.getVariable ();
-#endif
       // Went from active to inactive (enforce background limit)
       if (! window.active)
-        pCommandProc->ProcessCommandFormatted ("TargetFPS %f", config.render.background_fps);
+        frame_limiter.set_target (config.render.background_fps);
 
       // Went from inactive to active (restore foreground limit)
       else
-        pCommandProc->ProcessCommandFormatted ("TargetFPS %f", config.render.foreground_fps);
+        frame_limiter.set_target (config.render.foreground_fps);
     }
 
     // Unrestrict the mouse when the app is deactivated
@@ -376,15 +368,17 @@ ad::WindowManager::CommandProcessor::CommandProcessor (void)
   pCommandProc->AddVariable ("Window.BackgroundFPS", background_fps_);
   pCommandProc->AddVariable ("Window.ForegroundFPS", foreground_fps_);
 
+  // Framerate limiting is ours (frame_limiter); the injector's own limiter
+  //   would only fight it
+  pCommandProc->ProcessCommandLine ("TargetFPS 0");
+
   // If the user has an FPS limit preference, set it up now...
-  pCommandProc->ProcessCommandFormatted ("TargetFPS %f", config.render.foreground_fps);
+  frame_limiter.set_target (config.render.foreground_fps);
 }
 
 bool
 ad::WindowManager::CommandProcessor::OnVarChange (eTB_Variable* var, void* val)
 {
-  eTB_CommandProcessor* pCommandProc = SK_GetCommandProcessor ();
-
   bool known = false;
 
   if (var == background_fps_) {
@@ -397,7 +391,7 @@ ad::WindowManager::CommandProcessor::OnVarChange (eTB_Variable* var, void* val)
       // How this was changed while the window was inactive is a bit of a
       //   mystery, but whatever :P
       if ((! window.active))
-        pCommandProc->ProcessCommandFormatted ("TargetFPS %f", *(float *)val);
+        frame_limiter.set_target (*(float *)val);
 
       return true;
     }
@@ -412,7 +406,7 @@ ad::WindowManager::CommandProcessor::OnVarChange (eTB_Variable* var, void* val)
 
       // Immediately apply limiter changes
       if (window.active)
-        pCommandProc->ProcessCommandFormatted ("TargetFPS %f", *(float *)val);
+        frame_limiter.set_target (*(float *)val);
 
       return true;
     }
@@ -0,0 +1,532 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+#include "xform.h"
+
+#include <string.h>
+#include <chrono>
+#include <cmath>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+# define AD_TARGET_AVX
+#else
+# include <cpuid.h>
+# include <immintrin.h>
+# define AD_TARGET_AVX __attribute__ ((target ("avx")))
+#endif
+
+typedef void (*AD_Xform_DiagScale_pfn)      (float* out, const float* d, const float* m);
+typedef void (*AD_Xform_Translate_pfn)      (float* out, const float* m, const float* t);
+typedef void (*AD_Xform_ScaleTranslate_pfn) (float* out, const float* d, const float* t);
+
+struct ad_xform_kernels_s {
+  AD_Xform_DiagScale_pfn      diag_scale;
+  AD_Xform_Translate_pfn      translate;
+  AD_Xform_ScaleTranslate_pfn scale_translate;
+};
+
+
+void
+AD_Xform_Multiply (float* out, const float* a, const float* b)
+{
+  float ab [16];
+
+  for (int i = 0; i < 16; i += 4)
+    for (int j = 0; j < 4; j++)
+      ab [i+j] = a [i] * b [j] + a [i+1] * b [j+4] + a [i+2] * b [j+8] + a [i+3] * b [j+12];
+
+  memcpy (out, ab, sizeof (ab));
+}
+
+
+//
+// Every kernel below has to reproduce what the full product does with the
+//   terms it skips, and those only ever matter when a result is zero:
+//
+//    x + (+/-0) == x for any non-zero x, but a sum of zeros is -0 only if
+//      every one of its terms is -0, and a term (+0 * b) has the sign of b.
+//
+//  * Where a skipped term can only be +0 the result reduces to (x + 0.0f);
+//      otherwise the sign bits of the would-be terms are ANDed together.
+//
+
+
+//
+// Scalar
+//
+static void
+AD_Xform_DiagScale_Scalar (float* out, const float* d, const float* m)
+{
+  float dm [16];
+
+  for (int i = 0; i < 4; i++) {
+    for (int j = 0; j < 4; j++) {
+      float p = d [i] * m [i*4+j];
+
+      if (p == 0.0f) {
+        bool negative = std::signbit (p);
+
+        for (int k = 0; k < 4; k++) {
+          if (k != i)
+            negative &= std::signbit (m [k*4+j]);
+        }
+
+        p = negative ? -0.0f : 0.0f;
+      }
+
+      dm [i*4+j] = p;
+    }
+  }
+
+  memcpy (out, dm, sizeof (dm));
+}
+
+static void
+AD_Xform_Translate_Scalar (float* out, const float* m, const float* t)
+{
+  float mt [16];
+
+  for (int i = 0; i < 16; i += 4) {
+    const bool negative = std::signbit (m [i+0]) &&
+                          std::signbit (m [i+1]) &&
+                          std::signbit (m [i+2]);
+
+    for (int j = 0; j < 4; j++) {
+      float base = m [i+j];
+
+      if (base == 0.0f)
+        base = (negative && std::signbit (base)) ? -0.0f : 0.0f;
+
+      mt [i+j] = (j < 3) ? base + m [i+3] * t [j] : base;
+    }
+  }
+
+  memcpy (out, mt, sizeof (mt));
+}
+
+static void
+AD_Xform_ScaleTranslate_Scalar (float* out, const float* d, const float* t)
+{
+  memset (out, 0, sizeof (float) * 12);
+
+  out [ 0] = d [0] + 0.0f;
+  out [ 5] = d [1] + 0.0f;
+  out [10] = d [2] + 0.0f;
+
+  out [12] = d [3] * t [0] + 0.0f;
+  out [13] = d [3] * t [1] + 0.0f;
+  out [14] = d [3] * t [2] + 0.0f;
+  out [15] = d [3]         + 0.0f;
+}
+
+
+//
+// SSE  (constant blocks come straight from the game, so nothing is aligned)
+//
+
+// Keeps x, unless it is zero, in which case its sign bit is ANDed with sign's
+static inline __m128
+AD_Xform_ZeroSign_SSE (__m128 x, __m128 sign)
+{
+  return _mm_and_ps (x, _mm_or_ps (sign, _mm_cmpneq_ps (x, _mm_setzero_ps ())));
+}
+
+static void
+AD_Xform_DiagScale_SSE (float* out, const float* d, const float* m)
+{
+  __m128 r0 = _mm_loadu_ps (m +  0);
+  __m128 r1 = _mm_loadu_ps (m +  4);
+  __m128 r2 = _mm_loadu_ps (m +  8);
+  __m128 r3 = _mm_loadu_ps (m + 12);
+
+  __m128 r01 = _mm_and_ps (r0, r1);
+  __m128 r23 = _mm_and_ps (r2, r3);
+
+  _mm_storeu_ps (out +  0, AD_Xform_ZeroSign_SSE (_mm_mul_ps (r0, _mm_set1_ps (d [0])), _mm_and_ps (r1, r23)));
+  _mm_storeu_ps (out +  4, AD_Xform_ZeroSign_SSE (_mm_mul_ps (r1, _mm_set1_ps (d [1])), _mm_and_ps (r0, r23)));
+  _mm_storeu_ps (out +  8, AD_Xform_ZeroSign_SSE (_mm_mul_ps (r2, _mm_set1_ps (d [2])), _mm_and_ps (r3, r01)));
+  _mm_storeu_ps (out + 12, AD_Xform_ZeroSign_SSE (_mm_mul_ps (r3, _mm_set1_ps (d [3])), _mm_and_ps (r2, r01)));
+}
+
+static inline __m128
+AD_Xform_TranslateRow_SSE (__m128 row, __m128 txyz)
+{
+  __m128 w   = _mm_shuffle_ps (row, row, _MM_SHUFFLE (3, 3, 3, 3));
+
+  // x & y & z, in every lane
+  __m128 xyz = _mm_and_ps ( _mm_and_ps ( row,
+                              _mm_shuffle_ps (row, row, _MM_SHUFFLE (1, 1, 1, 1)) ),
+                                _mm_shuffle_ps (row, row, _MM_SHUFFLE (2, 2, 2, 2)) );
+         xyz = _mm_shuffle_ps (xyz, xyz, _MM_SHUFFLE (0, 0, 0, 0));
+
+  return _mm_add_ps (AD_Xform_ZeroSign_SSE (row, xyz), _mm_mul_ps (w, txyz));
+}
+
+static void
+AD_Xform_Translate_SSE (float* out, const float* m, const float* t)
+{
+  const __m128 txyz = _mm_setr_ps (t [0], t [1], t [2], 0.0f);
+
+  __m128 r0 = AD_Xform_TranslateRow_SSE (_mm_loadu_ps (m +  0), txyz);
+  __m128 r1 = AD_Xform_TranslateRow_SSE (_mm_loadu_ps (m +  4), txyz);
+  __m128 r2 = AD_Xform_TranslateRow_SSE (_mm_loadu_ps (m +  8), txyz);
+  __m128 r3 = AD_Xform_TranslateRow_SSE (_mm_loadu_ps (m + 12), txyz);
+
+  // Stores only after all loads, out may alias m
+  _mm_storeu_ps (out +  0, r0);
+  _mm_storeu_ps (out +  4, r1);
+  _mm_storeu_ps (out +  8, r2);
+  _mm_storeu_ps (out + 12, r3);
+}
+
+static void
+AD_Xform_ScaleTranslate_SSE (float* out, const float* d, const float* t)
+{
+  const __m128 zero = _mm_setzero_ps ();
+
+  _mm_storeu_ps (out +  0, _mm_add_ps (_mm_setr_ps (d [0], 0.0f,  0.0f,  0.0f), zero));
+  _mm_storeu_ps (out +  4, _mm_add_ps (_mm_setr_ps (0.0f,  d [1], 0.0f,  0.0f), zero));
+  _mm_storeu_ps (out +  8, _mm_add_ps (_mm_setr_ps (0.0f,  0.0f,  d [2], 0.0f), zero));
+  _mm_storeu_ps (out + 12, _mm_add_ps (_mm_mul_ps ( _mm_set1_ps (d [3]),
+                                                    _mm_setr_ps (t [0], t [1], t [2], 1.0f) ),
+                                       zero));
+}
+
+
+//
+// AVX  (two rows per register)
+//
+AD_TARGET_AVX
+static inline __m256
+AD_Xform_ZeroSign_AVX (__m256 x, __m256 sign)
+{
+  return _mm256_and_ps (x, _mm256_or_ps (sign, _mm256_cmp_ps (x, _mm256_setzero_ps (), _CMP_NEQ_UQ)));
+}
+
+AD_TARGET_AVX
+static void
+AD_Xform_DiagScale_AVX (float* out, const float* d, const float* m)
+{
+  __m256 r01 = _mm256_loadu_ps (m + 0);
+  __m256 r23 = _mm256_loadu_ps (m + 8);
+
+  // Row order (1,0) and (3,2)
+  __m256 r10 = _mm256_permute2f128_ps (r01, r01, 0x01);
+  __m256 r32 = _mm256_permute2f128_ps (r23, r23, 0x01);
+
+  __m256 d01 = _mm256_insertf128_ps ( _mm256_castps128_ps256 (_mm_set1_ps (d [0])),
+                                        _mm_set1_ps (d [1]), 1 );
+  __m256 d23 = _mm256_insertf128_ps ( _mm256_castps128_ps256 (_mm_set1_ps (d [2])),
+                                        _mm_set1_ps (d [3]), 1 );
+
+  // For rows 0 and 1, the other rows are {1 or 0} and {2, 3}; likewise for 2/3
+  __m256 r23_and = _mm256_and_ps (r23, r32);
+  __m256 r01_and = _mm256_and_ps (r01, r10);
+
+  __m256 lo = AD_Xform_ZeroSign_AVX (_mm256_mul_ps (r01, d01), _mm256_and_ps (r10, r23_and));
+  __m256 hi = AD_Xform_ZeroSign_AVX (_mm256_mul_ps (r23, d23), _mm256_and_ps (r32, r01_and));
+
+  _mm256_storeu_ps (out + 0, lo);
+  _mm256_storeu_ps (out + 8, hi);
+
+  _mm256_zeroupper ();
+}
+
+AD_TARGET_AVX
+static void
+AD_Xform_Translate_AVX (float* out, const float* m, const float* t)
+{
+  const __m256 txyz = _mm256_setr_ps ( t [0], t [1], t [2], 0.0f,
+                                       t [0], t [1], t [2], 0.0f );
+
+  __m256 mt [2];
+
+  for (int i = 0; i < 2; i++) {
+    __m256 rows = _mm256_loadu_ps (m + i*8);
+    __m256 w    = _mm256_permute_ps (rows, _MM_SHUFFLE (3, 3, 3, 3));
+
+    __m256 xyz  = _mm256_and_ps ( _mm256_and_ps ( rows,
+                                    _mm256_permute_ps (rows, _MM_SHUFFLE (1, 1, 1, 1)) ),
+                                      _mm256_permute_ps (rows, _MM_SHUFFLE (2, 2, 2, 2)) );
+           xyz  = _mm256_permute_ps (xyz, _MM_SHUFFLE (0, 0, 0, 0));
+
+    mt [i] = _mm256_add_ps (AD_Xform_ZeroSign_AVX (rows, xyz), _mm256_mul_ps (w, txyz));
+  }
+
+  _mm256_storeu_ps (out + 0, mt [0]);
+  _mm256_storeu_ps (out + 8, mt [1]);
+
+  _mm256_zeroupper ();
+}
+
+AD_TARGET_AVX
+static void
+AD_Xform_ScaleTranslate_AVX (float* out, const float* d, const float* t)
+{
+  const __m256 zero = _mm256_setzero_ps ();
+
+  __m256 row3 = _mm256_mul_ps ( _mm256_set1_ps (d [3]),
+                                _mm256_setr_ps ( 1.0f,  1.0f,  1.0f,  1.0f,
+                                                 t [0], t [1], t [2], 1.0f ) );
+
+  __m256 lo = _mm256_setr_ps ( d [0], 0.0f,  0.0f, 0.0f,
+                               0.0f,  d [1], 0.0f, 0.0f );
+  __m256 hi = _mm256_blend_ps ( _mm256_setr_ps ( 0.0f, 0.0f, d [2], 0.0f,
+                                                 0.0f, 0.0f, 0.0f,  0.0f ),
+                                row3, 0xF0 );
+
+  _mm256_storeu_ps (out + 0, _mm256_add_ps (lo, zero));
+  _mm256_storeu_ps (out + 8, _mm256_add_ps (hi, zero));
+
+  _mm256_zeroupper ();
+}
+
+
+static const ad_xform_kernels_s xform_kernels [] = {
+  { AD_Xform_DiagScale_Scalar, AD_Xform_Translate_Scalar, AD_Xform_ScaleTranslate_Scalar },
+  { AD_Xform_DiagScale_SSE,    AD_Xform_Translate_SSE,    AD_Xform_ScaleTranslate_SSE    },
+  { AD_Xform_DiagScale_AVX,    AD_Xform_Translate_AVX,    AD_Xform_ScaleTranslate_AVX    }
+};
+
+static struct ad_xform_engine_s {
+  bool               sse  = false;
+  bool               avx  = false;
+  ad_xform_kernel_t  best = AD_XFORM_SCALAR;
+  ad_xform_kernels_s kernels;
+
+  ad_xform_engine_s (void)
+  {
+    // CPUID.01h:EDX  -  Bit 25 = SSE
+    // CPUID.01h:ECX  -  Bit 27 = OSXSAVE, Bit 28 = AVX
+    uint32_t ecx = 0,
+             edx = 0;
+
+#ifdef _MSC_VER
+    int regs [4];
+    __cpuid (regs, 1);
+    ecx = (uint32_t)regs [2];
+    edx = (uint32_t)regs [3];
+#else
+    unsigned int eax_, ebx_, ecx_, edx_;
+    if (__get_cpuid (1, &eax_, &ebx_, &ecx_, &edx_)) {
+      ecx = ecx_;
+      edx = edx_;
+    }
+#endif
+
+    sse = (edx & (1UL << 25)) != 0;
+
+    // The OS must also be saving the upper halves of the YMM registers
+    if ( (ecx & (1UL << 27)) != 0 &&
+         (ecx & (1UL << 28)) != 0 ) {
+#ifdef _MSC_VER
+      uint64_t xcr0 = _xgetbv (0);
+#else
+      uint32_t eax, edx;
+      __asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+      uint64_t xcr0 = ((uint64_t)edx << 32) | eax;
+#endif
+      avx = (xcr0 & 0x6) == 0x6;
+    }
+
+    if (sse) best = AD_XFORM_SSE;
+
+    //
+    // A 4x4 matrix is only two YMM registers, so AVX has little to gain over
+    //   SSE here and any dirty upper state costs a transition penalty; it is
+    //     kept for AD_Xform_Benchmark to measure rather than as the default.
+    //
+    kernels = xform_kernels [best];
+  }
+} xform_engine;
+
+
+void
+AD_Xform_DiagScale (float* out, const float* d, const float* m)
+{
+  xform_engine.kernels.diag_scale (out, d, m);
+}
+
+void
+AD_Xform_Translate (float* out, const float* m, const float* t)
+{
+  xform_engine.kernels.translate (out, m, t);
+}
+
+void
+AD_Xform_ScaleTranslate (float* out, const float* d, const float* t)
+{
+  xform_engine.kernels.scale_translate (out, d, t);
+}
+
+bool
+AD_Xform_Supported (ad_xform_kernel_t kernel)
+{
+  switch (kernel) {
+    case AD_XFORM_SCALAR: return true;
+    case AD_XFORM_SSE:    return xform_engine.sse;
+    case AD_XFORM_AVX:    return xform_engine.avx;
+  }
+
+  return false;
+}
+
+ad_xform_kernel_t
+AD_Xform_Best (void)
+{
+  return xform_engine.best;
+}
+
+
+//
+// Benchmark
+//
+struct ad_xform_mismatch_s {
+  size_t bits  = 0; // Any bitwise difference
+  size_t value = 0; // ... other than +0 vs. -0
+};
+
+static void
+AD_Xform_Compare (ad_xform_mismatch_s& mismatch, const float* a, const float* b)
+{
+  for (int i = 0; i < 16; i++) {
+    if (memcmp (&a [i], &b [i], sizeof (float)) != 0) {
+      ++mismatch.bits;
+
+      if (a [i] != b [i])
+        ++mismatch.value;
+    }
+  }
+}
+
+// Builds the (diagonal / translation) operands the UI path uses for block
+static void
+AD_Xform_BenchParams ( const float* block, float ar_scale, float x_scale,
+                       float* d_ar,  float* d_st,  float* t,
+                       float* m_ar,  float* m_st,  float* m_t )
+{
+  const float inv_ar = 1.0f / ar_scale;
+
+  d_ar [0] = inv_ar;          d_ar [1] = inv_ar; d_ar [2] = inv_ar; d_ar [3] = 1.0f;
+  d_st [0] = 1.0f / x_scale;  d_st [1] = 1.0f;   d_st [2] = 1.0f;   d_st [3] = 1.0f;
+
+  t [0] = block [12] / x_scale;
+  t [1] = block [13];
+  t [2] = 0.0f;
+
+  memset (m_ar, 0, sizeof (float) * 16);
+  memset (m_st, 0, sizeof (float) * 16);
+
+  for (int i = 0; i < 4; i++) {
+    m_ar [i*5] = d_ar [i];
+    m_st [i*5] = d_st [i];
+  }
+
+  static const float identity [16] = { 1.0f, 0.0f, 0.0f, 0.0f,
+                                       0.0f, 1.0f, 0.0f, 0.0f,
+                                       0.0f, 0.0f, 1.0f, 0.0f,
+                                       0.0f, 0.0f, 0.0f, 1.0f };
+
+  memcpy (m_t, identity, sizeof (identity));
+
+  m_t [12] = t [0];
+  m_t [13] = t [1];
+  m_t [14] = t [2];
+}
+
+int
+AD_Xform_Benchmark ( const float*      blocks,
+                     size_t            count,
+                     float             ar_scale,
+                     float             x_scale,
+                     ad_xform_bench_s* results,
+                     int               max_results )
+{
+  typedef std::chrono::steady_clock clock;
+
+  // Enough repetitions to get past timer resolution on a few hundred blocks
+  const int passes = 256;
+
+  volatile float sink = 0.0f;
+
+  int results_count = 0;
+
+  for (int k = -1; k <= AD_XFORM_AVX && results_count < max_results; k++) {
+    const bool reference = (k < 0);
+
+    if ((! reference) && (! AD_Xform_Supported ((ad_xform_kernel_t)k)))
+      continue;
+
+    ad_xform_mismatch_s mismatch;
+
+    clock::time_point start = clock::now ();
+
+    for (int pass = 0; pass < passes; pass++) {
+      for (size_t i = 0; i < count; i++) {
+        const float* block = &blocks [i * 16];
+
+        float d_ar [4], d_st [4], t [3];
+        float m_ar [16], m_st [16], m_t [16];
+
+        AD_Xform_BenchParams ( block, ar_scale, x_scale,
+                                 d_ar, d_st, t, m_ar, m_st, m_t );
+
+        float out_ar [16], out_t [16], out_st [16];
+
+        if (reference) {
+          AD_Xform_Multiply (out_ar, m_ar,  block);
+          AD_Xform_Multiply (out_t,  block, m_t);
+          AD_Xform_Multiply (out_st, m_st,  m_t);
+        } else {
+          const ad_xform_kernels_s& kern = xform_kernels [k];
+
+          kern.diag_scale      (out_ar, d_ar,  block);
+          kern.translate       (out_t,  block, t);
+          kern.scale_translate (out_st, d_st,  t);
+
+          // Verify once, outside of the timed work as much as possible
+          if (pass == 0) {
+            float ref [16];
+
+            AD_Xform_Multiply (ref, m_ar,  block); AD_Xform_Compare (mismatch, ref, out_ar);
+            AD_Xform_Multiply (ref, block, m_t);   AD_Xform_Compare (mismatch, ref, out_t);
+            AD_Xform_Multiply (ref, m_st,  m_t);   AD_Xform_Compare (mismatch, ref, out_st);
+          }
+        }
+
+        sink = sink + out_ar [0] + out_t [12] + out_st [13];
+      }
+    }
+
+    ad_xform_bench_s& r = results [results_count++];
+
+    r.kernel         = k;
+    r.ns             = std::chrono::duration <double, std::nano> (clock::now () - start).count () /
+                         ((double)passes * (double)(count > 0 ? count : 1));
+    r.mismatch_bits  = mismatch.bits;
+    r.mismatch_value = mismatch.value;
+    r.active         = (! reference) && k == xform_engine.best;
+  }
+
+  return results_count;
+}
@@ -0,0 +1,81 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+#ifndef __AD__XFORM_H__
+#define __AD__XFORM_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Specialized 4x4 matrix kernels for the UI constant rewrite.
+//
+//   Matrices are row-major, exactly as the game uploads them as four vec4
+//     constants; the translation lives in the last row (D3D convention).
+//
+//  * Every kernel matches the equivalent full 4x4 product (AD_Xform_Multiply)
+//      bit-for-bit, signed zeros included, as long as the input is finite.
+//
+void AD_Xform_Multiply       (float* out, const float* a, const float* b);
+
+// out = diag (d) * m
+void AD_Xform_DiagScale      (float* out, const float* d, const float* m);
+
+// out = m * translate (t.xyz)
+void AD_Xform_Translate      (float* out, const float* m, const float* t);
+
+// out = diag (d) * translate (t.xyz)
+void AD_Xform_ScaleTranslate (float* out, const float* d, const float* t);
+
+
+enum ad_xform_kernel_t {
+  AD_XFORM_SCALAR = 0,
+  AD_XFORM_SSE    = 1,
+  AD_XFORM_AVX    = 2
+};
+
+bool              AD_Xform_Supported (ad_xform_kernel_t kernel);
+
+// The kernel the functions above dispatch to
+ad_xform_kernel_t AD_Xform_Best      (void);
+
+//
+// Runs recorded constant blocks (16 floats each) through the full 4x4
+//   product and every supported kernel; results[] is filled in (the product
+//     first) and the count returned.  Kernels are checked against the
+//       product on the first pass.
+//
+struct ad_xform_bench_s {
+  int    kernel;                 // ad_xform_kernel_t, -1 for the 4x4 product
+  double ns;                     // Per block (all three operations)
+  size_t mismatch_bits;          // Any bitwise difference
+  size_t mismatch_value;         // ... other than +0 vs. -0
+  bool   active;                 // AD_Xform_Best ()
+};
+
+int               AD_Xform_Benchmark ( const float*      blocks,
+                                       size_t            count,
+                                       float             ar_scale,
+                                       float             x_scale,
+                                       ad_xform_bench_s* results,
+                                       int               max_results );
+
+#endif /* __AD__XFORM_H__ */
@@ -0,0 +1,1592 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+//
+// adbench: self-tests and microbenchmarks for the parts of AgDrag that don't
+//   depend on Windows or Direct3D.
+//
+//     adbench [test ...]      (every test if none are named)
+//
+//   shaders   The Set*Shader detour's bind sequence replayed as it was (up to
+//               five vs_checksums lookups plus two on tracked_shader_map) and
+//               as it is now, and lock-free lookups racing a writer
+//   crc32     Every supported CRC-32 kernel against the bytewise (table)
+//               one, on unaligned, odd-length and chained inputs, then
+//               AD_CRC32_Benchmark: GiB/s per kernel on 256 B - 64 KiB blobs
+//   fingerprint
+//             AD_Fingerprint_Benchmark (what Render.FingerprintBench logs)
+//   xform     AD_Xform_Benchmark (what Render.XformBench logs) on synthetic
+//               UI constant blocks: every kernel must match the 4x4 product
+//               bit for bit
+//   mips      AD_Mip_Benchmark (what Render.CompleteMips logs at startup),
+//               and which formats are left to the CPU path
+//   dump      The texture dump queue: what an upload costs the render thread,
+//               how fast the workers drain it, and the DDS / PNG encoders
+//   limiter   ad_frame_limiter_s::wait on a fake clock: grid cadence, the
+//               grid restarting after a stall, missed / overslept counting
+//   scale     ad_render_scale_s target matching and rect / viewport remapping,
+//               with scaled targets bound through a fake surface
+//   texpack   AD_LZ round trips (overlapping matches, the 65535-byte window
+//               edge), truncated and corrupt streams, and packs open (...)
+//               must refuse
+//   blit      A recorded StretchRect stream replayed through ad_blit_cache_s
+//               and AD_Blit_Fit across display and AspectCorrection changes,
+//               then AD_Blit_Benchmark (what Render.BlitBench logs)
+//
+//   Every test prints its timings and exits non-zero if a result was wrong.
+//
+//   Build (Linux, any C++14 compiler):
+//
+//     g++ -O2 -std=c++14 -pthread -Icompat -I../../src -o adbench adbench.cpp
+//         ../../src/shader.cpp ../../src/crc32.cpp ../../src/fingerprint.cpp
+//         ../../src/texdump.cpp ../../src/limiter.cpp ../../src/scale.cpp
+//         ../../src/mipgen.cpp ../../src/xform.cpp ../../src/blit.cpp
+//         ../../src/display.cpp ../../src/texpack.cpp
+//
+//     (one command line; compat/ has the few Windows / D3D9 declarations
+//       the device-independent sources need)
+//
+
+#include "shader.h"
+#include "crc32.h"
+#include "fingerprint.h"
+#include "mipgen.h"
+#include "xform.h"
+#include "texdump.h"
+#include "texpack.h"
+#include "limiter.h"
+#include "scale.h"
+#include "blit.h"
+#include "display.h"
+#include "config.h"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+typedef std::chrono::steady_clock bench_clock;
+
+// What config.cpp defines (blit.cpp and display.cpp read the config)
+std::wstring AD_VER_STR = L"adbench";
+ad_config_s  config;
+
+// Best of three passes over items, in ns per item
+template <typename _T, typename _Fn>
+static double
+best_ns (const std::vector <_T>& items, _Fn fn)
+{
+  double best = 0.0;
+
+  for (int pass = 0; pass < 3; pass++) {
+    auto start = bench_clock::now ();
+
+    for (const _T& item : items)
+      fn (item);
+
+    const double ns =
+      std::chrono::duration <double, std::nano> (bench_clock::now () - start).count () /
+        (double)items.size ();
+
+    if (pass == 0 || ns < best)
+      best = ns;
+  }
+
+  return best;
+}
+
+// What a shader's record holds in these tests, so any torn read shows
+static uint32_t
+shader_crc (const void* pShader)
+{
+  return (uint32_t)((uintptr_t)pShader * 2654435761U) ^ 0xA5A5A5A5U;
+}
+
+//
+// A session's worth of shaders bound in a draw-call-like pattern: mostly
+//   the same few dozen, now and then any of them.
+//
+static int
+test_shaders (void)
+{
+  const int    num_shaders = 1500;
+  const size_t num_binds   = 4000000;
+
+  std::vector <uint8_t>      storage (num_shaders * 64);
+  std::vector <const void *> shaders;
+
+  for (int i = 0; i < num_shaders; i++)
+    shaders.push_back (&storage [i * 64]);
+
+  std::mt19937 rng (1234);
+
+  std::vector <const void *> binds (num_binds);
+
+  for (size_t i = 0; i < num_binds; i++) {
+    binds [i] = (rng () % 8 != 0) ? shaders [rng () % 48] :
+                                    shaders [rng () % num_shaders];
+  }
+
+  // Every 16th shader is one the game tracks (a dd_shader_s)
+  dd_shader_s* const tracked = (dd_shader_s *)&storage [0];
+
+  ad_shader_table_s                              table;
+  std::unordered_map <const void*, uint32_t>     checksums;
+  std::unordered_map <uint32_t,    dd_shader_s*> tracked_map;
+
+  table.begin_write ();
+
+  for (int i = 0; i < num_shaders; i++) {
+    const void*      pShader = shaders [i];
+    ad_shader_rec_s* rec     = table.insert (pShader);
+
+    rec->crc32   = shader_crc (pShader);
+    rec->tracked = (i % 16 == 0) ? tracked : nullptr;
+
+    checksums   [pShader]       = rec->crc32;
+    tracked_map [rec->crc32]    = rec->tracked;
+  }
+
+  table.end_write ();
+
+  int failures = 0;
+
+  // What a bind leaves behind: the bound shader, its checksum, how many
+  //   times the minimap was told it changed, and the tracked shader
+  struct bind_state_s {
+    const void*  bound    = nullptr;
+    uint32_t     checksum = 0;
+    uint32_t     changes  = 0;
+    uint32_t     sum      = 0;
+    dd_shader_s* current  = nullptr;
+    size_t       tracked  = 0;
+  } old_state, new_state;
+
+  //
+  // The SetVertexShader detour as it was: rebinding the bound shader was not
+  //   skipped, vs_checksums was searched three times to rebind it and four
+  //     or five times to bind any other shader, and tracked_shader_map twice
+  //       more either way.
+  //
+  const double old_ns =
+    best_ns (binds, [&] (const void* pShader) {
+      bind_state_s& s = old_state;
+
+      if (s.bound != pShader && pShader != nullptr) {
+        if (checksums.find (pShader) == checksums.end ())
+          checksums [pShader] = shader_crc (pShader);
+      }
+
+      if (s.checksum != checksums [pShader])
+        s.current = nullptr;             // ui.center = false
+
+      if (s.checksum != checksums [pShader]) {
+        ++s.changes;                     // minimap->notifyShaderChange (...)
+        s.sum += checksums [pShader];
+      }
+
+      s.checksum = checksums [pShader];
+
+      if (tracked_map.find (s.checksum) != tracked_map.end ())
+        s.current = tracked_map [s.checksum];
+      else
+        s.current = nullptr;
+
+      s.tracked += (s.current != nullptr);
+      s.bound    = pShader;
+    });
+
+  // The detour now: rebinding is skipped, everything else is one lookup
+  const double new_ns =
+    best_ns (binds, [&] (const void* pShader) {
+      bind_state_s& s = new_state;
+
+      if (pShader == s.bound && pShader != nullptr) {
+        s.tracked += (s.current != nullptr);
+        return;
+      }
+
+      ad_shader_rec_s rec;
+
+      const bool     known = table.lookup (pShader, rec);
+      const uint32_t crc   = known ? rec.crc32 : 0;
+
+      if (s.checksum != crc) {
+        ++s.changes;
+        s.sum += crc;
+      }
+
+      s.checksum = crc;
+      s.current  = known ? rec.tracked : nullptr;
+      s.tracked += (s.current != nullptr);
+      s.bound    = pShader;
+    });
+
+  if ( old_state.changes != new_state.changes ||
+       old_state.sum     != new_state.sum     ||
+       old_state.tracked != new_state.tracked ) {
+    printf ( "shaders: FAILED: old detour saw %u changes (sum %08X, %zu tracked), "
+             "new one %u (sum %08X, %zu tracked)\n",
+               old_state.changes, old_state.sum, old_state.tracked,
+                 new_state.changes, new_state.sum, new_state.tracked );
+    ++failures;
+  }
+
+  // The lookup alone, and the same lookup if readers had to take the
+  //   writers' lock instead of relying on the version counter
+  uint32_t   sums [2] = { };
+  std::mutex lock;
+
+  const double table_ns =
+    best_ns (binds, [&] (const void* pShader) {
+      ad_shader_rec_s rec;
+
+      if (table.lookup (pShader, rec))
+        sums [0] += rec.crc32;
+    });
+
+  const double locked_ns =
+    best_ns (binds, [&] (const void* pShader) {
+      std::lock_guard <std::mutex> hold (lock);
+
+      const ad_shader_rec_s* rec = table.find (pShader);
+
+      if (rec != nullptr)
+        sums [1] += rec->crc32;
+    });
+
+  if (sums [1] != sums [0])
+    ++failures;
+
+  printf ( "shaders: %d shaders, %zu binds: old detour %.2f ns, new detour %.2f ns "
+           "per bind; lookup %.2f ns, under a mutex %.2f ns\n",
+             num_shaders, num_binds, old_ns, new_ns, table_ns, locked_ns );
+
+  //
+  // A loading thread creating and releasing shaders (and growing the table)
+  //   while the render thread binds: every lookup must either miss or see a
+  //     whole record.
+  //
+  ad_shader_table_s  shared;
+  std::atomic <bool> done (false);
+
+  std::thread writer ([&] {
+    std::mt19937 wrng (99);
+
+    for (int round = 0; round < 50; round++) {
+      for (int i = 0; i < num_shaders; i++) {
+        shared.begin_write ();
+
+        ad_shader_rec_s* rec = shared.insert (shaders [i]);
+
+        if (rec != nullptr) {
+          rec->crc32 = shader_crc (shaders [i]);
+          rec->flags = ad_shader_rec_s::FLAG_PIXEL;
+        }
+
+        shared.end_write ();
+
+        // Give the reader a chance to see this table state
+        std::this_thread::yield ();
+      }
+
+      for (int i = 0; i < num_shaders / 2; i++) {
+        shared.begin_write ();
+        shared.erase       (shaders [wrng () % num_shaders]);
+        shared.end_write   ();
+      }
+    }
+
+    done = true;
+  });
+
+  size_t lookups = 0,
+         hits    = 0,
+         torn    = 0;
+
+  while (! done) {
+    const void*     pShader = shaders [rng () % num_shaders];
+    ad_shader_rec_s rec;
+
+    if (shared.lookup (pShader, rec)) {
+      ++hits;
+
+      if ( rec.key   != pShader                 ||
+           rec.crc32 != shader_crc (pShader)    ||
+           rec.flags != ad_shader_rec_s::FLAG_PIXEL )
+        ++torn;
+    }
+
+    // Single-core machines must still let the writer run
+    if ((++lookups & 63) == 0)
+      std::this_thread::yield ();
+  }
+
+  writer.join ();
+
+  printf ( "shaders: %zu lookups racing a writer, %zu hits, %zu torn\n",
+             lookups, hits, torn );
+
+  if (torn != 0)
+    ++failures;
+
+  return failures;
+}
+
+static const char* crc32_kernel_names [] = {
+  "bytewise", "slice-by-8", "slice-by-16", "pclmul"
+};
+
+static int
+test_crc32 (void)
+{
+  int failures = 0;
+
+  // The standard check value
+  if (crc32 (0, "123456789", 9) != 0xCBF43926U) {
+    printf ("crc32: check value is %08X\n", crc32 (0, "123456789", 9));
+    ++failures;
+  }
+
+  std::vector <uint8_t> data (1 << 20);
+  std::mt19937          rng  (5678);
+
+  for (uint8_t& byte : data)
+    byte = (uint8_t)rng ();
+
+  const ad_crc32_kernel_t kernels [] = {
+    AD_CRC32_SLICE8, AD_CRC32_SLICE16, AD_CRC32_PCLMUL
+  };
+
+  for (ad_crc32_kernel_t kernel : kernels) {
+    if (! AD_CRC32_Supported (kernel)) {
+      printf ("crc32: %s unsupported here\n", crc32_kernel_names [kernel]);
+      continue;
+    }
+
+    int mismatches = 0;
+
+    // Every alignment against every length around the kernels' block sizes
+    for (size_t offset = 0; offset < 16; offset++) {
+      for (size_t size = 0; size < 300; size++) {
+        const uint32_t seed = (uint32_t)(offset * 300 + size);
+
+        if ( AD_CRC32_Kernel (kernel,            seed, &data [offset], size) !=
+             AD_CRC32_Kernel (AD_CRC32_BYTEWISE, seed, &data [offset], size) )
+          ++mismatches;
+      }
+    }
+
+    // Long, odd-length buffers, hashed whole and in unaligned pieces
+    for (size_t size : { 4095UL, 65537UL, 1048573UL - 7UL }) {
+      const uint8_t* buf = &data [7];
+
+      const uint32_t whole =
+        AD_CRC32_Kernel (AD_CRC32_BYTEWISE, 0, buf, size);
+
+      if (AD_CRC32_Kernel (kernel, 0, buf, size) != whole)
+        ++mismatches;
+
+      uint32_t chained = 0;
+      size_t   done    = 0;
+
+      while (done < size) {
+        const size_t piece = std::min (size - done, (size_t)(rng () % 4099));
+
+        chained = AD_CRC32_Kernel (kernel, chained, buf + done, piece);
+        done   += piece;
+      }
+
+      if (chained != whole)
+        ++mismatches;
+    }
+
+    std::vector <int> block (1);
+
+    const double ns =
+      best_ns (block, [&] (int) {
+        for (int i = 0; i < 16; i++)
+          AD_CRC32_Kernel (kernel, 0, &data [1], data.size () - 1);
+      });
+
+    printf ( "crc32: %-11s %7.2f GiB/s, %d mismatches%s\n",
+               crc32_kernel_names [kernel],
+                 16.0 * (double)(data.size () - 1) / ns / 1.073741824,
+                   mismatches, kernel == AD_CRC32_Best () ? " (dispatched)" : "" );
+
+    if (mismatches != 0)
+      ++failures;
+  }
+
+  //
+  // Shader-sized blobs: every kernel at each size, and whether the one
+  //   crc32 (...) dispatches to is still the fastest there
+  //
+  ad_crc32_bench_s results [8];
+
+  const int count = AD_CRC32_Benchmark (results, 8);
+
+  for (int i = 0; i < count; i++) {
+    const ad_crc32_bench_s& r = results [i];
+
+    int fastest = AD_CRC32_BYTEWISE;
+
+    for (int k = AD_CRC32_BYTEWISE; k <= AD_CRC32_PCLMUL; k++) {
+      if (r.gibs [k] > r.gibs [fastest])
+        fastest = k;
+    }
+
+    printf ( "crc32: %6zu B  bytewise %6.2f  slice-by-8 %6.2f  slice-by-16 %6.2f  "
+             "pclmul %6.2f GiB/s%s%s\n",
+               r.size, r.gibs [AD_CRC32_BYTEWISE], r.gibs [AD_CRC32_SLICE8],
+                 r.gibs [AD_CRC32_SLICE16], r.gibs [AD_CRC32_PCLMUL],
+                   fastest == AD_CRC32_Best () ? "" : "  (dispatched kernel is not the fastest)",
+                     r.agree ? "" : "  DISAGREE" );
+
+    if (! r.agree)
+      ++failures;
+  }
+
+  if (count == 0)
+    ++failures;
+
+  return failures;
+}
+
+static const char*
+format_name (uint32_t format)
+{
+  switch (format) {
+    case 21:          return "A8R8G8B8";
+    case 0x31545844U: return "DXT1";
+    case 0x35545844U: return "DXT5";
+    default:          return "?";
+  }
+}
+
+static int
+test_fingerprint (void)
+{
+  ad_fingerprint_bench_s results [32];
+
+  const int count = AD_Fingerprint_Benchmark (results, 32);
+  int       fails = 0;
+
+  for (int i = 0; i < count; i++) {
+    const ad_fingerprint_bench_s& r = results [i];
+
+    printf ( "fingerprint: %-8s %4u  %8.2f MiB  scalar %9.1f us  sse2 %9.1f us  "
+             "sampled %7.1f us%s\n",
+               format_name (r.format), r.size, (double)r.bytes / 1048576.0,
+                 r.scalar_us, r.simd_us, r.sampled_us,
+                   r.agree ? "" : "  DISAGREE" );
+
+    if (! r.agree)
+      ++fails;
+  }
+
+  return count > 0 ? fails : 1;
+}
+
+//
+// Every kernel against the scalar one; completing a texture on a cache miss
+//   stalls the upload that caused it, which is why DXTn is never completed
+//     on the CPU (render.cpp, AD_PlanMipCompletion).
+//
+static int
+test_mips (void)
+{
+  ad_mip_bench_s results [16];
+
+  const int count = AD_Mip_Benchmark (results, 16);
+  int       fails = 0;
+
+  for (int i = 0; i < count; i++) {
+    const ad_mip_bench_s& r = results [i];
+
+    printf ( "mips: %-8s %4u  %8.2f MiB  scalar %9.1f us  sse2 %9.1f us%s%s\n",
+               format_name (r.format), r.size, (double)r.bytes / 1048576.0,
+                 r.scalar_us, r.simd_us,
+                   AD_MipFormatCompressed (r.format) ? "  (autogen only)" : "",
+                     r.agree ? "" : "  DISAGREE" );
+
+    if (! r.agree)
+      ++fails;
+  }
+
+  const uint32_t uncompressed [] = { 21, 22, 32, 33, 51, 50, 28 };
+  const uint32_t compressed   [] = { 0x31545844U, 0x32545844U, 0x33545844U,
+                                     0x34545844U, 0x35545844U };
+
+  for (uint32_t format : uncompressed) {
+    if ((! AD_MipFormatSupported (format)) || AD_MipFormatCompressed (format)) {
+      printf ("mips: FAILED: format %u should be completed on the CPU\n", format);
+      ++fails;
+    }
+  }
+
+  for (uint32_t format : compressed) {
+    if ((! AD_MipFormatSupported (format)) || (! AD_MipFormatCompressed (format))) {
+      printf ("mips: FAILED: format %08X should be left to the driver\n", format);
+      ++fails;
+    }
+  }
+
+  return count > 0 ? fails : 1;
+}
+
+//
+// UI blocks like the ones Render.XformBench records: scale and translation,
+//   a few with signed zeros and a few with every element populated, at the
+//     aspect ratios the fix is used with.
+//
+static int
+test_xform (void)
+{
+  const size_t num_blocks = 1024;
+
+  std::vector <float>                    blocks (num_blocks * 16);
+  std::mt19937                           rng    (4321);
+  std::uniform_real_distribution <float> value  (-2.0f, 2.0f);
+
+  for (size_t i = 0; i < num_blocks; i++) {
+    float* m = &blocks [i * 16];
+
+    memset (m, 0, sizeof (float) * 16);
+
+    if (i % 8 == 7) {
+      for (int j = 0; j < 16; j++)
+        m [j] = value (rng);
+    }
+
+    else {
+      m [0]  = value (rng);
+      m [5]  = value (rng);
+      m [10] = 1.0f;
+      m [12] = value (rng);
+      m [13] = value (rng);
+      m [15] = 1.0f;
+
+      if (i % 8 == 3) {
+        m [1]  = -0.0f;
+        m [14] = -0.0f;
+        m [12] = -m [12] * 0.0f;
+      }
+    }
+  }
+
+  // { ar_scale, x_scale }: 16:9 as-is, 21:9 and 32:9 against 16:9
+  static const float scales [][2] = {
+    { 1.0f, 1.0f }, { 1.3125f, 1.3125f }, { 2.0f, 1.7777778f }
+  };
+
+  static const char* names [] = { "scalar", "sse", "avx" };
+
+  int fails = 0;
+
+  for (const auto& scale : scales) {
+    ad_xform_bench_s results [4];
+
+    const int count =
+      AD_Xform_Benchmark ( blocks.data (), num_blocks, scale [0], scale [1],
+                             results, 4 );
+
+    if (count < 2) {
+      printf ("xform: FAILED: no kernel ran\n");
+      ++fails;
+    }
+
+    for (int i = 0; i < count; i++) {
+      const ad_xform_bench_s& r = results [i];
+
+      printf ( "xform: ar_scale %.4f x_scale %.4f  %-6s %6.2f ns/block  "
+               "mismatches %zu bitwise, %zu by value%s\n",
+                 scale [0], scale [1], r.kernel < 0 ? "4x4" : names [r.kernel],
+                   r.ns, r.mismatch_bits, r.mismatch_value,
+                     r.active ? "  (active)" : "" );
+
+      if (r.mismatch_bits != 0)
+        ++fails;
+    }
+  }
+
+  return fails;
+}
+
+//
+// A loading screen's worth of uploads (half of them seen before) pushed
+//   through the queue the way the upload detours do.
+//
+static int
+test_dump (void)
+{
+  char dir [] = "/tmp/adbench.XXXXXX";
+
+  if (mkdtemp (dir) == nullptr) {
+    printf ("dump: no temporary directory\n");
+    return 1;
+  }
+
+  struct upload_s {
+    uint32_t size, levels, format;
+    uint32_t content;            // Seed of the texels
+  };
+
+  std::vector <upload_s> uploads;
+
+  for (uint32_t i = 0; i < 240; i++) {
+    const uint32_t content = (i % 2 == 0) ? i : i / 4;
+
+    switch (i % 3) {
+      case 0:  uploads.push_back ({ 256,  9,  21,          content }); break;
+      case 1:  uploads.push_back ({ 512,  10, 0x31545844U, content }); break;
+      default: uploads.push_back ({ 1024, 11, 0x35545844U, content }); break;
+    }
+  }
+
+  // Uploads with the same seed and shape are identical
+  std::unordered_map <uint64_t, int> distinct;
+
+  for (const upload_s& up : uploads)
+    distinct [((uint64_t)up.format << 32) ^ ((uint64_t)up.size << 20) ^ up.content]++;
+
+  texture_dump.directory  = dir;
+  texture_dump.budget_mib = 1024;
+  texture_dump.png        = true;
+  texture_dump.start ();
+
+  double producer_us = 0.0;
+  size_t bytes       = 0;
+
+  const auto start = bench_clock::now ();
+
+  for (const upload_s& up : uploads) {
+    auto t0 = bench_clock::now ();
+
+    ad_dump_image_s* img =
+      texture_dump.begin (up.size, up.size, up.levels, up.format);
+
+    producer_us += std::chrono::duration <double, std::micro> (bench_clock::now () - t0).count ();
+
+    if (img == nullptr)
+      continue;
+
+    // What the detour copies out of the locked source
+    std::mt19937 texels (up.content);
+
+    for (size_t i = 0; i + 4 <= img->data.size (); i += 4) {
+      const uint32_t v = texels ();
+      memcpy (&img->data [i], &v, 4);
+    }
+
+    bytes += img->data.size ();
+
+    t0 = bench_clock::now ();
+    texture_dump.commit (img);
+    producer_us += std::chrono::duration <double, std::micro> (bench_clock::now () - t0).count ();
+  }
+
+  texture_dump.stop ();
+
+  const double total_ms =
+    std::chrono::duration <double, std::milli> (bench_clock::now () - start).count ();
+
+  int failures = 0;
+  int files    = 0;
+
+  if (DIR* d = opendir (dir)) {
+    while (dirent* ent = readdir (d)) {
+      if (ent->d_name [0] == '.')
+        continue;
+
+      unlink ((std::string (dir) + "/" + ent->d_name).c_str ());
+      ++files;
+    }
+
+    closedir (d);
+  }
+
+  rmdir (dir);
+
+  printf ( "dump: %zu uploads (%.1f MiB), %d queued, %d written, %d duplicates, "
+           "%d dropped, %d failed\n",
+             uploads.size (), (double)bytes / 1048576.0,
+               texture_dump.stats.queued,     texture_dump.stats.written,
+                 texture_dump.stats.duplicates, texture_dump.stats.dropped,
+                   texture_dump.stats.failed );
+  printf ( "dump: %.1f us per upload queued (begin + commit), "
+           "%.1f ms to drain everything\n",
+             producer_us / (double)uploads.size (), total_ms );
+
+  if ( texture_dump.stats.written    != (int)distinct.size ()                   ||
+       texture_dump.stats.duplicates != (int)(uploads.size () - distinct.size ()) ||
+       texture_dump.stats.failed     != 0                                        ||
+       files                         != (int)distinct.size () )
+    ++failures;
+
+  //
+  // The encoders alone, on one 1024x1024 A8R8G8B8 chain
+  //
+  ad_dump_image_s img;
+  img.init (1024, 1024, 11, 21);
+  img.data.resize (img.bytes ());
+
+  std::mt19937 texels (42);
+
+  for (uint8_t& byte : img.data)
+    byte = (uint8_t)(texels () & 0xF0);
+
+  std::vector <uint8_t> out;
+  std::vector <int>     once (1);
+
+  const double dds_ns = best_ns (once, [&] (int) { AD_EncodeDDS (img, out); });
+  const size_t dds_sz = out.size ();
+  const double png_ns = best_ns (once, [&] (int) { AD_EncodePNG (img, out); });
+
+  printf ( "dump: 1024x1024 A8R8G8B8: DDS %.2f ms (%zu bytes), PNG %.2f ms (%zu bytes)\n",
+             dds_ns / 1000000.0, dds_sz, png_ns / 1000000.0, out.size () );
+
+  return failures;
+}
+
+//
+// A clock that only moves when the limiter (or the "game") moves it:
+//   sleeps are exact unless an overshoot was armed, every spin iteration
+//     costs relax_ns.
+//
+struct fake_clock_s : ad_clock_s {
+  static const int64_t relax_ns = 250;
+
+  int64_t t         = 1000000000;
+  int64_t overshoot = 0;         // Added to the next sleep only
+
+  int64_t now   (void)       { return t; }
+  void    sleep (int64_t ns) { t += ns + overshoot; overshoot = 0; }
+  void    relax (void)       { t += relax_ns; }
+};
+
+static int
+test_limiter (void)
+{
+  const int64_t period = 20000000; // 50 fps
+  const int64_t ms     = 1000000;
+
+  fake_clock_s       clock;
+  ad_frame_limiter_s limiter (&clock);
+
+  limiter.window = 10;
+  limiter.set_target (50.0f);
+
+  int failures = 0;
+
+  auto check = [&] (bool ok, const char* what) {
+    if (! ok) {
+      printf ("limiter: FAILED: %s\n", what);
+      ++failures;
+    }
+  };
+
+  // Offset of a return from the grid that starts at origin
+  auto off_grid = [&] (int64_t origin) {
+    return ((clock.t - origin) % period + period) % period;
+  };
+
+  auto on_grid = [&] (int64_t origin) {
+    return off_grid (origin) < fake_clock_s::relax_ns;
+  };
+
+  // A frame that took work ns before asking for the next deadline
+  auto frame = [&] (int64_t work) {
+    clock.t += work;
+    return limiter.wait ();
+  };
+
+  //
+  // Cadence: whatever a frame costs (under the period), returns land on
+  //   origin + k * period and nothing is counted as missed
+  //
+  frame (5 * ms);
+
+  int64_t origin  = clock.t;
+  bool    cadence = true;
+
+  for (int i = 1; i <= 100; i++) {
+    frame ((3 + i % 7) * ms);
+    cadence &= on_grid (origin) && clock.t - origin < i * period + fake_clock_s::relax_ns;
+  }
+
+  check (cadence, "returns drift off the grid");
+  check (limiter.stats.missed == 0 && limiter.stats.overslept == 0, "on-time frames counted as missed");
+  check (fabs (limiter.stats.mean_ms - 20.0f) < 0.001f, "mean interval is not the period");
+  check (limiter.stats.stddev_ms < 0.001f, "intervals vary on an exact clock");
+
+  //
+  // A frame late by less than a period: counted as missed (not overslept),
+  //   returns at once, and the grid is kept
+  //
+  check (frame (period + 1 * ms) == 0, "late frame waited");
+  check (limiter.stats.missed == 1 && limiter.stats.overslept == 0, "late frame miscounted");
+
+  frame (5 * ms);
+  check (on_grid (origin), "grid not kept after a late frame");
+
+  //
+  // A stall of more than a whole period: counted once, and the grid restarts
+  //   from the stalled frame instead of rushing frames out to catch up
+  //
+  check (frame (period * 5 / 2) == 0, "stalled frame waited");
+  check (limiter.stats.missed == 2 && limiter.stats.overslept == 0, "stall miscounted");
+  check (! on_grid (origin), "stall did not move the grid");
+
+  origin = clock.t;
+
+  bool restarted = true;
+
+  for (int i = 1; i <= 20; i++) {
+    frame (4 * ms);
+    restarted &= on_grid (origin) && clock.t - origin < i * period + fake_clock_s::relax_ns;
+  }
+
+  check (restarted, "new grid not kept after a stall");
+  check (limiter.stats.missed == 2, "frames after a stall counted as missed");
+
+  //
+  // A sleep that overshoots the deadline is the limiter's fault: missed and
+  //   overslept.  The spin window then grows to cover that overshoot, so the
+  //     same overshoot again is absorbed.
+  //
+  clock.overshoot = 3 * ms;
+  frame (5 * ms);
+  check (limiter.stats.missed == 3 && limiter.stats.overslept == 1, "oversleep miscounted");
+
+  clock.overshoot = 3 * ms;
+  frame (5 * ms);
+  check (on_grid (origin), "overshoot not absorbed by the spin window");
+  check (limiter.stats.missed == 3 && limiter.stats.overslept == 1, "absorbed overshoot counted");
+
+  //
+  // Unlimited never waits
+  //
+  limiter.set_target (0.0f);
+  check (frame (1 * ms) == 0 && limiter.target () == 0.0f, "unlimited waited");
+
+  printf ( "limiter: %d frames, %d missed, %d overslept, %.4f ms mean (%.4f ms stddev) "
+           "over the last window\n",
+             limiter.stats.frames, limiter.stats.missed, limiter.stats.overslept,
+               limiter.stats.mean_ms, limiter.stats.stddev_ms );
+
+  return failures;
+}
+
+//
+// A surface that only keeps private data, which is all render_scale asks of
+//   one
+//
+struct fake_surface_s : IDirect3DSurface9 {
+  GUID                 guid = { };
+  std::vector <uint8_t> data;
+
+  HRESULT STDMETHODCALLTYPE SetPrivateData (REFGUID refguid, const void* pData, DWORD SizeOfData, DWORD)
+  {
+    guid = refguid;
+    data.assign ((const uint8_t *)pData, (const uint8_t *)pData + SizeOfData);
+    return S_OK;
+  }
+
+  HRESULT STDMETHODCALLTYPE GetPrivateData (REFGUID refguid, void* pData, DWORD* pSizeOfData)
+  {
+    if (data.empty () || (! (guid == refguid)) || *pSizeOfData < data.size ())
+      return E_FAIL;
+
+    memcpy (pData, data.data (), data.size ());
+    *pSizeOfData = (DWORD)data.size ();
+    return S_OK;
+  }
+};
+
+static int
+test_scale (void)
+{
+  int failures = 0;
+
+  auto check = [&] (bool ok, const char* what) {
+    if (! ok) {
+      printf ("scale: FAILED: %s\n", what);
+      ++failures;
+    }
+  };
+
+  ad_render_scale_s scale;
+  uint32_t          w = 0, h = 0;
+
+  //
+  // Which resources are scene targets
+  //
+  scale.scale = 0.5f;
+
+  check ( scale.match (1920, 1080, D3DUSAGE_RENDERTARGET, 1920, 1080, w, h) &&
+            w == 960 && h == 540, "backbuffer-sized render target not scaled" );
+  check ( ! scale.match (1920, 1080, D3DUSAGE_DEPTHSTENCIL, 1920, 1080, w, h),
+            "depth buffer scaled without Render.ScaleDepth" );
+  check ( ! scale.match (1920, 1080, 0, 1920, 1080, w, h),
+            "plain texture scaled" );
+  check ( ! scale.match (1024, 1024, D3DUSAGE_RENDERTARGET, 1920, 1080, w, h),
+            "off-size render target scaled" );
+
+  scale.scale_depth = true;
+  check ( scale.match (1920, 1080, D3DUSAGE_DEPTHSTENCIL, 1920, 1080, w, h) &&
+            w == 960 && h == 540, "depth buffer not scaled with Render.ScaleDepth" );
+
+  scale.scale = 0.1f;
+  check ( scale.match (2560, 1080, D3DUSAGE_RENDERTARGET, 2560, 1080, w, h) &&
+            w == 640 && h == 270, "scale not clamped to 0.25" );
+
+  scale.scale = 1.0f;
+  check ( ! scale.match (1920, 1080, D3DUSAGE_RENDERTARGET, 1920, 1080, w, h),
+            "scaled at 1.0" );
+
+  //
+  // Rects grow outward: whatever the game's rect covered, the mapped one
+  //   covers too, and never past the real target
+  //
+  const ad_scaled_target_s targets [] = {
+    { 1920, 1080,  960,  540 },
+    { 2560, 1080, 1707,  720 },
+    { 3440, 1440,  860,  360 },
+    { 1366,  768, 1025,  576 }
+  };
+
+  std::mt19937 rng (17);
+
+  int rects = 0;
+
+  for (const ad_scaled_target_s& t : targets) {
+    RECT full = { 0, 0, (LONG)t.width, (LONG)t.height };
+    ad_render_scale_s::map_rect (full, t);
+
+    check ( full.left == 0 && full.top == 0 && full.right  == (LONG)t.real_width &&
+                                               full.bottom == (LONG)t.real_height,
+              "full-target rect does not cover the real target" );
+
+    const double sx = (double)t.real_width  / t.width;
+    const double sy = (double)t.real_height / t.height;
+
+    bool covers = true;
+
+    for (int i = 0; i < 10000; i++, rects++) {
+      LONG x0 = (LONG)(rng () % t.width),  x1 = (LONG)(rng () % (t.width  + 1));
+      LONG y0 = (LONG)(rng () % t.height), y1 = (LONG)(rng () % (t.height + 1));
+
+      RECT rc = { std::min (x0, x1), std::min (y0, y1), std::max (x0, x1), std::max (y0, y1) };
+      RECT m  = rc;
+
+      ad_render_scale_s::map_rect (m, t);
+
+      covers &= m.left   <= rc.left   * sx + 1e-3 && m.top    <= rc.top    * sy + 1e-3 &&
+                m.right  >= std::min (rc.right  * sx, (double)t.real_width)  - 1e-3 &&
+                m.bottom >= std::min (rc.bottom * sy, (double)t.real_height) - 1e-3 &&
+                m.left   >= 0 && m.right  <= (LONG)t.real_width  &&
+                m.top    >= 0 && m.bottom <= (LONG)t.real_height;
+    }
+
+    check (covers, "mapped rect does not cover the game's rect");
+
+    D3DVIEWPORT9 vp = { 0, 0, t.width, t.height, 0.0f, 1.0f };
+    ad_render_scale_s::map_viewport (vp, t);
+
+    check ( vp.X == 0 && vp.Y == 0 && vp.Width == t.real_width && vp.Height == t.real_height &&
+            vp.MinZ == 0.0f && vp.MaxZ == 1.0f,
+              "full-target viewport does not cover the real target" );
+  }
+
+  //
+  // Binding: only tagged surfaces are remapped, and GetViewport hands back
+  //   exactly what the game set
+  //
+  fake_surface_s plain, scene;
+
+  ad_render_scale_s::tag (&scene, targets [1]);
+
+  ad_scaled_target_s found = { };
+
+  check ( ad_render_scale_s::lookup (&scene, found) &&
+            memcmp (&found, &targets [1], sizeof (found)) == 0, "tag did not round-trip" );
+  check ( ! ad_render_scale_s::lookup (&plain, found), "untagged surface looks scaled" );
+  check ( ! ad_render_scale_s::lookup (nullptr, found), "NULL surface looks scaled" );
+
+  D3DVIEWPORT9 game = { 333, 111, 1001, 501, 0.0f, 1.0f };
+  D3DVIEWPORT9 vp   = game;
+
+  scale.bind (&plain);
+  scale.map  (vp);
+  check (memcmp (&vp, &game, sizeof (vp)) == 0, "viewport remapped on an unscaled target");
+
+  RECT clear = { 10, 20, 30, 40 };
+  scale.map (clear);
+  check (clear.left == 10 && clear.bottom == 40, "rect remapped on an unscaled target");
+
+  scale.bind (&scene);
+  scale.map  (vp);
+  check (vp.Width < game.Width && vp.X < game.X, "viewport not remapped on a scaled target");
+
+  scale.unmap (vp);
+  check (memcmp (&vp, &game, sizeof (vp)) == 0, "GetViewport did not return the game's viewport");
+
+  // One the device has but we didn't map (e.g. SetRenderTarget's reset)
+  vp = { 0, 0, targets [1].real_width, targets [1].real_height, 0.0f, 1.0f };
+  scale.unmap (vp);
+  check ( vp.Width == targets [1].width && vp.Height == targets [1].height,
+            "device viewport not unmapped to game pixels" );
+
+  scale.reset ();
+  vp = game;
+  scale.map (vp);
+  check (memcmp (&vp, &game, sizeof (vp)) == 0, "viewport remapped after reset");
+
+  printf ("scale: %d random rects on %zu targets, %d failures\n",
+            rects, sizeof (targets) / sizeof (targets [0]), failures);
+
+  return failures;
+}
+
+//
+// Decompresses into an exactly-sized buffer followed by guard bytes, which
+//   must come out untouched whatever the input; returns the size written.
+//
+static size_t
+lz_expand (const std::vector <uint8_t>& packed, size_t dst_size, std::vector <uint8_t>& out, bool& overran)
+{
+  const size_t guard = 64;
+
+  out.assign (dst_size + guard, 0xCD);
+
+  const size_t written =
+    AD_LZ_Decompress (packed.data (), packed.size (), out.data (), dst_size);
+
+  overran = false;
+
+  for (size_t i = dst_size; i < out.size (); i++)
+    overran |= (out [i] != 0xCD);
+
+  out.resize (dst_size);
+
+  return written;
+}
+
+static int
+test_texpack (void)
+{
+  int failures = 0;
+
+  auto check = [&] (bool ok, const char* what) {
+    if (! ok) {
+      printf ("texpack: FAILED: %s\n", what);
+      ++failures;
+    }
+  };
+
+  std::mt19937 rng (2020);
+
+  auto random_bytes = [&] (size_t size) {
+    std::vector <uint8_t> v (size);
+
+    for (uint8_t& byte : v)
+      byte = (uint8_t)rng ();
+
+    return v;
+  };
+
+  //
+  // Round trips
+  //
+  std::vector < std::pair <const char*, std::vector <uint8_t>> > inputs;
+
+  inputs.push_back ({ "empty",        { } });
+  inputs.push_back ({ "3 bytes",      { 1, 2, 3 } });
+  inputs.push_back ({ "random",       random_bytes (100000) });
+  inputs.push_back ({ "zeros",        std::vector <uint8_t> (300000, 0) });   // Offset 1, long lengths
+
+  std::vector <uint8_t> pattern (70000);
+
+  for (size_t i = 0; i < pattern.size (); i++)
+    pattern [i] = "abc" [i % 3];                                            // Offset 3, overlapping
+
+  inputs.push_back ({ "abc...",       pattern });
+
+  // A DXT-like mix: runs, repeated blocks, noise
+  std::vector <uint8_t> mixed;
+
+  while (mixed.size () < 200000) {
+    switch (rng () % 3) {
+      case 0:  mixed.insert (mixed.end (), 8 + rng () % 300, (uint8_t)rng ()); break;
+      case 1:  if (mixed.size () > 64) {
+                 size_t from = rng () % (mixed.size () - 32);
+                 size_t len  = 4 + rng () % 28;
+                 for (size_t j = 0; j < len; j++)
+                   mixed.push_back (mixed [from + j]);
+               }
+               break;
+      default: for (int j = 0; j < 16; j++) mixed.push_back ((uint8_t)rng ());
+    }
+  }
+
+  inputs.push_back ({ "mixed",        mixed });
+
+  // A 1 KiB block seen again exactly 65535 bytes later (the farthest a match
+  //   can reach), and the same block 65536 bytes later (out of reach)
+  const std::vector <uint8_t> block = random_bytes (1024);
+
+  auto window_test = [&] (size_t distance) {
+    std::vector <uint8_t> v = block;
+    std::vector <uint8_t> gap = random_bytes (distance - block.size ());
+
+    v.insert (v.end (), gap.begin   (), gap.end   ());
+    v.insert (v.end (), block.begin (), block.end ());
+
+    return v;
+  };
+
+  inputs.push_back ({ "window 65535", window_test (65535) });
+  inputs.push_back ({ "window 65536", window_test (65536) });
+
+  size_t packed_sizes [2] = { };
+
+  for (const auto& input : inputs) {
+    std::vector <uint8_t> packed, out;
+
+    AD_LZ_Compress (input.second.data (), input.second.size (), packed);
+
+    bool         overran;
+    const size_t written = lz_expand (packed, input.second.size (), out, overran);
+
+    const bool ok = written == input.second.size () && (! overran) && out == input.second;
+
+    printf ( "texpack: LZ %-12s %7zu -> %7zu bytes%s\n",
+               input.first, input.second.size (), packed.size (), ok ? "" : "  MISMATCH" );
+
+    check (ok, "LZ round trip");
+
+    if      (strcmp (input.first, "window 65535") == 0) packed_sizes [0] = packed.size ();
+    else if (strcmp (input.first, "window 65536") == 0) packed_sizes [1] = packed.size ();
+  }
+
+  check ( packed_sizes [0] + 900 < packed_sizes [1],
+            "match at the 65535-byte window edge not taken" );
+
+  //
+  // Malformed input: every truncation of a stream and a few thousand single
+  //   byte corruptions must fail (or come up short), and nothing may be
+  //     written past the buffer
+  //
+  std::vector <uint8_t> packed, out;
+
+  AD_LZ_Compress (mixed.data (), 20000, packed);
+
+  const std::vector <uint8_t> original (mixed.begin (), mixed.begin () + 20000);
+
+  size_t accepted_truncations = 0,
+         overruns             = 0,
+         survived_corruption  = 0;
+
+  for (size_t len = 0; len < packed.size (); len++) {
+    std::vector <uint8_t> cut (packed.begin (), packed.begin () + len);
+
+    bool overran;
+
+    if (lz_expand (cut, original.size (), out, overran) == original.size ())
+      ++accepted_truncations;
+
+    overruns += overran;
+  }
+
+  for (int i = 0; i < 4000; i++) {
+    std::vector <uint8_t> bad = packed;
+
+    bad [rng () % bad.size ()] ^= (uint8_t)(1 + rng () % 255);
+
+    bool overran;
+
+    // A flipped literal still expands to the full size; only its content
+    //   differs, which is what the pack's DDS checks are for
+    if (lz_expand (bad, original.size (), out, overran) == original.size () && out == original)
+      ++survived_corruption;
+
+    overruns += overran;
+  }
+
+  // Hand-made streams that lie
+  const std::vector <uint8_t> lies [] = {
+    { 0x10, 'a', 0x00, 0x00 },              // Match offset 0
+    { 0x10, 'a', 0x02, 0x00 },              // Offset before the start
+    { 0x0F, 0xFF, 0xFF, 0xFF },             // Literal length runs off the end
+    { 0xF0, 0xFF, 0xFF, 0xFF, 0x10 },       // Literal length past the input
+    { 0x1F, 'a', 0x01, 0x00, 0xFF, 0xFF },  // Match length runs off the end
+    { 0x1F, 'a', 0x01, 0x00, 0xFF, 0x40 },  // Match past the output
+    { 0x10, 'a', 0x01 }                     // Half an offset
+  };
+
+  size_t accepted_lies = 0;
+
+  for (const std::vector <uint8_t>& lie : lies) {
+    bool overran;
+
+    if (lz_expand (lie, 64, out, overran) != 0)
+      ++accepted_lies;
+
+    overruns += overran;
+  }
+
+  printf ( "texpack: %zu truncations (%zu accepted), 4000 corruptions "
+           "(%zu harmless), %zu forged streams (%zu accepted), %zu overruns\n",
+             packed.size (), accepted_truncations, survived_corruption,
+               sizeof (lies) / sizeof (lies [0]), accepted_lies, overruns );
+
+  check (accepted_truncations == 0, "truncated stream expanded to the full size");
+  check (accepted_lies        == 0, "forged stream accepted");
+  check (overruns             == 0, "wrote past the output buffer");
+
+  //
+  // Packs: one valid (a stored and a compressed blob), then the same pack
+  //   with its header or index broken in ways open (...) must refuse
+  //
+  struct pack_s {
+    ad_pack_header_s               header;
+    std::vector <ad_pack_entry_s>  index;
+    std::vector <uint8_t>          blobs;
+  };
+
+  const std::vector <uint8_t> stored_blob = random_bytes (4096);
+
+  std::vector <uint8_t> compressed_blob;
+  AD_LZ_Compress (pattern.data (), pattern.size (), compressed_blob);
+
+  pack_s good;
+
+  good.header = { AD_PACK_MAGIC, AD_PACK_VERSION, 2, 0, sizeof (ad_pack_header_s) };
+
+  const uint64_t blobs_at =
+    sizeof (ad_pack_header_s) + 2 * sizeof (ad_pack_entry_s);
+
+  good.blobs = stored_blob;
+  good.blobs.insert (good.blobs.end (), compressed_blob.begin (), compressed_blob.end ());
+
+  good.index = {
+    { 0x1111, blobs_at,                      (uint32_t)stored_blob.size (),
+                                             (uint32_t)stored_blob.size () },
+    { 0x2222, blobs_at + stored_blob.size (), (uint32_t)compressed_blob.size (),
+                                             (uint32_t)pattern.size () }
+  };
+
+  const std::string path = "/tmp/adbench.texpack." + std::to_string (getpid ());
+
+  auto write_pack = [&] (const pack_s& pack, size_t truncate_to) {
+    std::vector <uint8_t> file ((const uint8_t *)&pack.header,
+                                (const uint8_t *)&pack.header + sizeof (pack.header));
+
+    file.insert ( file.end (), (const uint8_t *)pack.index.data (),
+                  (const uint8_t *)(pack.index.data () + pack.index.size ()) );
+    file.insert ( file.end (), pack.blobs.begin (), pack.blobs.end () );
+
+    if (truncate_to < file.size ())
+      file.resize (truncate_to);
+
+    FILE* fp = fopen (path.c_str (), "wb");
+
+    if (fp != nullptr) {
+      fwrite (file.data (), 1, file.size (), fp);
+      fclose (fp);
+    }
+  };
+
+  ad_texture_pack_s pack;
+
+  write_pack (good, SIZE_MAX);
+
+  const uint8_t* pData = nullptr;
+  size_t         size  = 0;
+
+  check (pack.open (path.c_str ()) && pack.size () == 2, "valid pack refused");
+  check ( pack.find (0x1111, &pData, &size) && size == stored_blob.size () &&
+            memcmp (pData, stored_blob.data (), size) == 0, "stored blob not found intact" );
+  check ( pack.find (0x2222, &pData, &size) && size == pattern.size () &&
+            memcmp (pData, pattern.data (), size) == 0, "compressed blob not expanded intact" );
+  check (! pack.find (0x1112, &pData, &size), "found a hash the pack doesn't have");
+
+  pack.close ();
+
+  struct broken_s {
+    const char* what;
+    void      (*breaks)(pack_s&, size_t&);
+  };
+
+  static const broken_s broken [] = {
+    { "unsorted index",         [] (pack_s& p, size_t&) { std::swap (p.index [0], p.index [1]); } },
+    { "duplicate hash",         [] (pack_s& p, size_t&) { p.index [1].hash = p.index [0].hash; } },
+    { "blob past the end",      [] (pack_s& p, size_t&) { p.index [1].offset += 1; } },
+    { "blob offset overflows",  [] (pack_s& p, size_t&) { p.index [0].offset = ~0ULL - 16; } },
+    { "size over raw size",     [] (pack_s& p, size_t&) { p.index [0].raw_size -= 1; } },
+    { "count past the file",    [] (pack_s& p, size_t&) { p.header.count = 1000; } },
+    { "index past the file",    [] (pack_s& p, size_t&) { p.header.index_offset = 1 << 30; } },
+    { "misaligned index",       [] (pack_s& p, size_t&) { p.header.index_offset += 4; } },
+    { "bad magic",              [] (pack_s& p, size_t&) { p.header.magic ^= 1; } },
+    { "bad version",            [] (pack_s& p, size_t&) { p.header.version += 1; } },
+    { "truncated file",         [] (pack_s&,   size_t& n) { n = sizeof (ad_pack_header_s) + 8; } },
+    { "empty file",             [] (pack_s&,   size_t& n) { n = 0; } }
+  };
+
+  int refused = 0;
+
+  for (const broken_s& b : broken) {
+    pack_s bad      = good;
+    size_t truncate = SIZE_MAX;
+
+    b.breaks (bad, truncate);
+    write_pack (bad, truncate);
+
+    if (pack.open (path.c_str ())) {
+      printf ("texpack: FAILED: opened a pack with a %s\n", b.what);
+      ++failures;
+      pack.close ();
+    }
+
+    else
+      ++refused;
+  }
+
+  unlink (path.c_str ());
+
+  printf ( "texpack: valid pack opened, %d of %zu broken packs refused\n",
+             refused, sizeof (broken) / sizeof (broken [0]) );
+
+  return failures;
+}
+
+//
+// What StretchRect sees over a session: movies and fades every frame, the
+//   odd blit that must be left alone, the display changing (and changing
+//     back, which gives back an earlier generation) and AspectCorrection
+//       toggled without any geometry change.
+//
+static int
+test_blit (void)
+{
+  int failures = 0;
+
+  auto check = [&] (bool ok, const char* what) {
+    if (! ok) {
+      printf ("blit: FAILED: %s\n", what);
+      ++failures;
+    }
+  };
+
+  struct event_s {
+    enum { BLIT, BACKBUFFER, CORRECTION } type;
+
+    uint32_t w, h;               // Source, or the new backbuffer
+    RECT     dest;               // BLIT: LONG_MAX marks "the whole backbuffer"
+    bool     correction;
+  };
+
+  const LONG whole = 0x7FFFFFFF;
+
+  // One frame's blits
+  const event_s frame [] = {
+    { event_s::BLIT, 1920, 1080, { 0, 0, whole, whole } },    // Movie
+    { event_s::BLIT, 1280,  720, { 0, 0, whole, whole } },    // Fade
+    { event_s::BLIT,  640,  480, { 0, 0, whole, whole } },    // 4:3, left alone
+    { event_s::BLIT, 1920, 1080, { 0, 0, 1024, 512 } },       // Off-shape target
+    { event_s::BLIT, 1920, 1080, { 0, 0, 0, 0 } },            // Empty
+    { event_s::BLIT, 1920, 1080, { 0, 0, whole, whole } }     // Movie again
+  };
+
+  std::vector <event_s> stream;
+
+  auto frames = [&] (int n) {
+    for (int i = 0; i < n; i++)
+      stream.insert (stream.end (), frame, frame + sizeof (frame) / sizeof (frame [0]));
+  };
+
+  auto backbuffer = [&] (uint32_t w, uint32_t h) {
+    stream.push_back ({ event_s::BACKBUFFER, w, h });
+  };
+
+  auto correction = [&] (bool on) {
+    stream.push_back ({ event_s::CORRECTION, 0, 0, { }, on });
+  };
+
+  backbuffer (2560, 1080); frames (8);
+  correction (false);      frames (4);
+  correction (true);       frames (4);
+  backbuffer (3440, 1440); frames (8);
+  backbuffer (1920, 1080); frames (8);
+  backbuffer (2560, 1080); frames (8);
+  correction (false);      frames (2);
+  backbuffer (3440, 1440); frames (2);
+  correction (true);       frames (4);
+
+  ad_blit_cache_s cache;
+
+  std::vector <ad_blit_call_s> calls; // As Render.BlitBench records them
+
+  size_t blits     = 0,
+         corrected = 0,
+         disagree  = 0,
+         wrong     = 0;
+
+  for (const event_s& ev : stream) {
+    if (ev.type == event_s::BACKBUFFER) {
+      AD_SetBackbufferGeometry (ev.w, ev.h);
+      AD_SetViewportGeometry   (ev.w, ev.h);
+      continue;
+    }
+
+    if (ev.type == event_s::CORRECTION) {
+      // Only the flag changes; the cache must not hand out the old answer
+      config.render.aspect_correction = ev.correction;
+      continue;
+    }
+
+    RECT dest = ev.dest;
+
+    if (dest.right == whole) {
+      dest.right  = (LONG)display.width;
+      dest.bottom = (LONG)display.height;
+    }
+
+    RECT direct = { }, cached = { };
+
+    const bool a = AD_Blit_Fit (ev.w, ev.h, dest, direct);
+    const bool b = cache.fit   (ev.w, ev.h, dest, cached);
+
+    ++blits;
+
+    if (a != b || (a && memcmp (&direct, &cached, sizeof (RECT)) != 0))
+      ++disagree;
+
+    // What the fit must be: a 16:9 source on a wider whole backbuffer is
+    //   pillarboxed, centered; nothing else is touched
+    const bool expect =
+      config.render.aspect_correction && ev.w * 9 == ev.h * 16 &&
+        ev.dest.right == whole && display.width * 9 > display.height * 16;
+
+    if (a != expect)
+      ++wrong;
+
+    else if (a) {
+      const LONG width = (LONG)(display.height * 16 + 4) / 9;
+      const LONG left  = ((LONG)display.width - width) / 2;
+
+      if ( direct.top   != 0    || direct.bottom != (LONG)display.height ||
+           direct.left  != left || direct.right - direct.left != width )
+        ++wrong;
+
+      ++corrected;
+    }
+
+    if (config.render.aspect_correction && display.width == 2560)
+      calls.push_back ({ ev.w, ev.h, dest });
+  }
+
+  check (disagree == 0, "cache disagrees with AD_Blit_Fit");
+  check (wrong    == 0, "AD_Blit_Fit letterboxed the wrong blits or got the rect wrong");
+  check (cache.hits > cache.misses, "cache never warmed up");
+
+  printf ( "blit: %zu blits over %zu events, %zu corrected, %zu disagree, %zu wrong; "
+           "cache %d hits / %d misses\n",
+             blits, stream.size (), corrected, disagree, wrong,
+               cache.hits, cache.misses );
+
+  AD_SetBackbufferGeometry (2560, 1080);
+  AD_SetViewportGeometry   (2560, 1080);
+
+  const ad_blit_bench_s r = AD_Blit_Benchmark (calls.data (), calls.size ());
+
+  check (r.mismatches == 0, "AD_Blit_Benchmark saw a mismatch");
+
+  printf ( "blit: %zu recorded blits (%zu corrected): %.2f ns/blit (math), "
+           "%.2f ns/blit (cached, %d hits / %d misses)\n",
+             calls.size (), r.corrected, r.math_ns, r.cached_ns, r.hits, r.misses );
+
+  return failures;
+}
+
+struct test_s {
+  const char* name;
+  int       (*run)(void);
+};
+
+static const test_s tests [] = {
+  { "shaders",     test_shaders     },
+  { "crc32",       test_crc32       },
+  { "fingerprint", test_fingerprint },
+  { "xform",       test_xform       },
+  { "mips",        test_mips        },
+  { "dump",        test_dump        },
+  { "limiter",     test_limiter     },
+  { "scale",       test_scale       },
+  { "texpack",     test_texpack     },
+  { "blit",        test_blit        }
+};
+
+int
+main (int argc, char** argv)
+{
+  int failures = 0;
+  int ran      = 0;
+
+  for (const test_s& test : tests) {
+    bool selected = (argc < 2);
+
+    for (int i = 1; i < argc; i++)
+      selected |= (strcmp (argv [i], test.name) == 0);
+
+    if (! selected)
+      continue;
+
+    const int failed = test.run ();
+
+    if (failed != 0)
+      printf ("%s: FAILED (%d)\n", test.name, failed);
+
+    failures += failed;
+    ++ran;
+  }
+
+  if (ran == 0) {
+    fprintf (stderr, "adbench: no such test\n");
+    return 2;
+  }
+
+  return failures != 0 ? 1 : 0;
+}
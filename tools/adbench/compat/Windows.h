@@ -0,0 +1,60 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+//
+// Just enough of <Windows.h> for the device-independent sources adbench
+//   builds (scale.cpp, blit.cpp, display.cpp), which Linux has no copy of.
+//
+#ifndef __ADBENCH_COMPAT_WINDOWS_H__
+#define __ADBENCH_COMPAT_WINDOWS_H__
+
+#include <stdint.h>
+#include <string.h>
+
+typedef uint32_t DWORD;
+typedef int32_t  LONG;
+typedef uint32_t UINT;
+typedef int32_t  HRESULT;
+
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)    (((HRESULT)(hr)) <  0)
+
+#define S_OK          ((HRESULT)0)
+#define E_FAIL        ((HRESULT)0x80004005)
+
+#define STDMETHODCALLTYPE
+
+struct RECT {
+  LONG left, top, right, bottom;
+};
+
+struct GUID {
+  uint32_t Data1;
+  uint16_t Data2;
+  uint16_t Data3;
+  uint8_t  Data4 [8];
+};
+
+typedef const GUID& REFGUID;
+
+inline bool operator == (const GUID& a, const GUID& b) { return memcmp (&a, &b, sizeof (GUID)) == 0; }
+
+#endif /* __ADBENCH_COMPAT_WINDOWS_H__ */
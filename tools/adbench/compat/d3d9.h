@@ -0,0 +1,51 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+//
+// Just enough of <d3d9.h> for the device-independent sources adbench builds.
+//
+//   IDirect3DSurface9 only has the private data methods scale.cpp uses; a
+//     test derives a fake surface from it.
+//
+#ifndef __ADBENCH_COMPAT_D3D9_H__
+#define __ADBENCH_COMPAT_D3D9_H__
+
+#include "Windows.h"
+
+#define D3DUSAGE_RENDERTARGET 0x00000001L
+#define D3DUSAGE_DEPTHSTENCIL 0x00000002L
+#define D3DUSAGE_DYNAMIC      0x00000200L
+
+typedef struct _D3DVIEWPORT9 {
+  DWORD X;
+  DWORD Y;
+  DWORD Width;
+  DWORD Height;
+  float MinZ;
+  float MaxZ;
+} D3DVIEWPORT9;
+
+struct IDirect3DSurface9 {
+  virtual HRESULT STDMETHODCALLTYPE SetPrivateData  (REFGUID refguid, const void* pData, DWORD SizeOfData, DWORD Flags) = 0;
+  virtual HRESULT STDMETHODCALLTYPE GetPrivateData  (REFGUID refguid, void* pData, DWORD* pSizeOfData) = 0;
+};
+
+#endif /* __ADBENCH_COMPAT_D3D9_H__ */
@@ -0,0 +1,394 @@
+/**
+ * This file is part of Agnostic Dragon.
+ *
+ * Agnostic Dragon is free software : you can redistribute it
+ * and/or modify it under the terms of the GNU General Public License
+ * as published by The Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * Agnostic Dragon is distributed in the hope that it will be
+ * useful,
+ *
+ * But WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Agnostic Dragon.
+ *
+ *   If not, see <http://www.gnu.org/licenses/>.
+ *
+**/
+
+//
+// packtex: builds AgDrag.texpack from a directory of replacement textures.
+//
+//   Every <hash>.dds in the directory (hash = the 16 hex digits a dump made
+//     with Render.DumpTextures was named) replaces the texture with that hash.
+//
+//     packtex [-j threads] [--store] [--sampled] <directory> <AgDrag.texpack>
+//
+//   --sampled marks the pack as keyed by sampled fingerprints, for dumps made
+//     with Render.DumpTextures.Sampled; the game then fingerprints uploads the
+//       same way.
+//
+//   Identical replacements are written once, and blobs are compressed (when
+//     that saves at least 1/8) in parallel; --store keeps every blob stored, so
+//       the game uses all of them straight out of the mapping.
+//
+//   The pack is re-opened and every entry compared with its source file
+//     before packtex reports success.
+//
+//   Build (Linux, any C++14 compiler):
+//
+//     g++ -O2 -std=c++14 -pthread -I../../src -o packtex packtex.cpp
+//         ../../src/texpack.cpp ../../src/texdump.cpp ../../src/fingerprint.cpp
+//         ../../src/crc32.cpp
+//
+//     (one command line)
+//
+
+#include "texpack.h"
+#include "texdump.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct source_s {
+  uint64_t              key;         // From the file name
+  std::string           path;
+  std::vector <uint8_t> data;
+
+  // Filled in by the workers
+  uint64_t              content;     // Hash of data
+  int                   same_as;     // Earlier source with identical data, or -1
+  std::vector <uint8_t> packed;      // Compressed; empty if stored
+};
+
+static bool
+parse_key (const char* name, uint64_t& key)
+{
+  if (strlen (name) != 20 || strcasecmp (name + 16, ".dds") != 0)
+    return false;
+
+  key = 0;
+
+  for (int i = 0; i < 16; i++) {
+    char c = name [i];
+    int  v = (c >= '0' && c <= '9') ? c - '0'      :
+             (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+             (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+
+    if (v < 0)
+      return false;
+
+    key = (key << 4) | (uint64_t)v;
+  }
+
+  return true;
+}
+
+static bool
+read_file (const std::string& path, std::vector <uint8_t>& data)
+{
+  FILE* f = fopen (path.c_str (), "rb");
+
+  if (f == nullptr)
+    return false;
+
+  fseek (f, 0, SEEK_END);
+  long size = ftell (f);
+  fseek (f, 0, SEEK_SET);
+
+  data.resize (size > 0 ? (size_t)size : 0);
+
+  bool ok = size > 0 && fread (data.data (), 1, data.size (), f) == data.size ();
+
+  fclose (f);
+
+  return ok;
+}
+
+// FNV-1a over 8-byte words; only has to separate distinct files, and any
+//   collision is caught by the byte comparison that follows.
+static uint64_t
+content_hash (const std::vector <uint8_t>& data)
+{
+  uint64_t h = 0xCBF29CE484222325ULL ^ data.size ();
+
+  size_t i = 0;
+
+  for (; i + 8 <= data.size (); i += 8) {
+    uint64_t v;
+    memcpy (&v, &data [i], 8);
+
+    h = (h ^ v) * 0x100000001B3ULL;
+  }
+
+  for (; i < data.size (); i++)
+    h = (h ^ data [i]) * 0x100000001B3ULL;
+
+  return h;
+}
+
+// Runs work (0 .. count - 1) on every thread
+template <typename F>
+static void
+parallel_for (size_t count, int threads, F work)
+{
+  std::atomic <size_t>      next (0);
+  std::vector <std::thread> pool;
+
+  for (int t = 0; t < threads; t++) {
+    pool.push_back (std::thread ([&] {
+      for (size_t i = next++; i < count; i = next++)
+        work (i);
+    }));
+  }
+
+  for (size_t t = 0; t < pool.size (); t++)
+    pool [t].join ();
+}
+
+static int
+usage (void)
+{
+  fprintf (stderr, "usage: packtex [-j threads] [--store] [--sampled] <directory> <AgDrag.texpack>\n");
+  return 2;
+}
+
+int
+main (int argc, char** argv)
+{
+  int         threads = (int)std::thread::hardware_concurrency ();
+  bool        store   = false;
+  bool        sampled = false;
+  const char* in_dir  = nullptr;
+  const char* out     = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if      (strcmp (argv [i], "-j") == 0 && i + 1 < argc) threads = atoi (argv [++i]);
+    else if (strcmp (argv [i], "--store") == 0)            store   = true;
+    else if (strcmp (argv [i], "--sampled") == 0)          sampled = true;
+    else if (in_dir == nullptr)                            in_dir  = argv [i];
+    else if (out    == nullptr)                            out     = argv [i];
+    else
+      return usage ();
+  }
+
+  if (in_dir == nullptr || out == nullptr)
+    return usage ();
+
+  if (threads < 1)
+    threads = 1;
+
+  //
+  // Gather
+  //
+  std::vector <source_s> sources;
+
+  DIR* dir = opendir (in_dir);
+
+  if (dir == nullptr) {
+    fprintf (stderr, "packtex: cannot open %s\n", in_dir);
+    return 1;
+  }
+
+  while (dirent* ent = readdir (dir)) {
+    source_s src;
+
+    if (! parse_key (ent->d_name, src.key)) {
+      if (ent->d_name [0] != '.')
+        fprintf (stderr, "packtex: skipping %s (not <16 hex digits>.dds)\n", ent->d_name);
+      continue;
+    }
+
+    src.path    = std::string (in_dir) + "/" + ent->d_name;
+    src.same_as = -1;
+
+    sources.push_back (std::move (src));
+  }
+
+  closedir (dir);
+
+  std::sort ( sources.begin (), sources.end (),
+                [] (const source_s& a, const source_s& b) { return a.key < b.key; } );
+
+  for (size_t i = 1; i < sources.size (); i++) {
+    if (sources [i].key == sources [i - 1].key) {
+      fprintf (stderr, "packtex: %s and %s have the same hash\n",
+                 sources [i - 1].path.c_str (), sources [i].path.c_str ());
+      return 1;
+    }
+  }
+
+  //
+  // Read, validate and hash (parallel)
+  //
+  std::atomic <int> bad (0);
+
+  parallel_for (sources.size (), threads, [&] (size_t i) {
+    source_s&       src = sources [i];
+    ad_dump_image_s img;
+    const uint8_t*  texels;
+
+    if ( (! read_file    (src.path, src.data)) ||
+         (! AD_DecodeDDS (src.data.data (), src.data.size (), img, &texels)) ) {
+      fprintf (stderr, "packtex: %s is not a DDS file the game can use\n", src.path.c_str ());
+      ++bad;
+      return;
+    }
+
+    src.content = content_hash (src.data);
+  });
+
+  if (bad > 0)
+    return 1;
+
+  //
+  // Dedupe (serial; cheap next to compression)
+  //
+  std::vector <size_t> unique;
+
+  {
+    std::vector <size_t> by_content (sources.size ());
+
+    for (size_t i = 0; i < sources.size (); i++)
+      by_content [i] = i;
+
+    std::sort ( by_content.begin (), by_content.end (),
+                  [&] (size_t a, size_t b) {
+                    return sources [a].content != sources [b].content ?
+                             sources [a].content <  sources [b].content : a < b;
+                  } );
+
+    for (size_t i = 0; i < by_content.size (); i++) {
+      source_s& src = sources [by_content [i]];
+
+      // Compare against every earlier file with the same hash
+      for (size_t j = i; j-- > 0 && sources [by_content [j]].content == src.content; ) {
+        const source_s& prior = sources [by_content [j]];
+
+        if (prior.same_as == -1 && prior.data == src.data) {
+          src.same_as = (int)by_content [j];
+          break;
+        }
+      }
+
+      if (src.same_as == -1)
+        unique.push_back (by_content [i]);
+    }
+  }
+
+  //
+  // Compress (parallel)
+  //
+  if (! store) {
+    parallel_for (unique.size (), threads, [&] (size_t u) {
+      source_s& src = sources [unique [u]];
+
+      AD_LZ_Compress (src.data.data (), src.data.size (), src.packed);
+
+      if (src.packed.size () > src.data.size () - src.data.size () / 8)
+        src.packed.clear ();
+    });
+  }
+
+  //
+  // Write: header, index, blobs (16-byte aligned)
+  //
+  ad_pack_header_s header = { AD_PACK_MAGIC, AD_PACK_VERSION, (uint32_t)sources.size (),
+                              sampled ? AD_PACK_SAMPLED : 0U, sizeof (ad_pack_header_s) };
+
+  std::vector <ad_pack_entry_s> index   (sources.size ());
+  std::vector <uint64_t>        offsets (sources.size (), 0);
+
+  uint64_t offset = header.index_offset + sizeof (ad_pack_entry_s) * index.size ();
+
+  for (size_t u = 0; u < unique.size (); u++) {
+    const source_s& src = sources [unique [u]];
+
+    offset                 = (offset + 15) & ~15ULL;
+    offsets [unique [u]]   = offset;
+    offset                += src.packed.empty () ? src.data.size () : src.packed.size ();
+  }
+
+  for (size_t i = 0; i < sources.size (); i++) {
+    const size_t    owner = sources [i].same_as == -1 ? i : (size_t)sources [i].same_as;
+    const source_s& blob  = sources [owner];
+
+    index [i].hash     = sources [i].key;
+    index [i].offset   = offsets [owner];
+    index [i].raw_size = (uint32_t)blob.data.size ();
+    index [i].size     = (uint32_t)(blob.packed.empty () ? blob.data.size () : blob.packed.size ());
+  }
+
+  FILE* f = fopen (out, "wb");
+
+  if (f == nullptr) {
+    fprintf (stderr, "packtex: cannot create %s\n", out);
+    return 1;
+  }
+
+  bool ok = fwrite (&header,       sizeof (header),          1,              f) == 1 &&
+            fwrite (index.data (), sizeof (ad_pack_entry_s), index.size (), f) == index.size ();
+
+  uint64_t pos   = header.index_offset + sizeof (ad_pack_entry_s) * index.size ();
+  uint64_t bytes = 0;
+
+  for (size_t u = 0; ok && u < unique.size (); u++) {
+    const source_s&              src  = sources [unique [u]];
+    const std::vector <uint8_t>& blob = src.packed.empty () ? src.data : src.packed;
+
+    static const uint8_t zeros [16] = { 0 };
+
+    ok    = fwrite (zeros, 1, (size_t)(offsets [unique [u]] - pos), f) == offsets [unique [u]] - pos &&
+            fwrite (blob.data (), 1, blob.size (), f) == blob.size ();
+    pos   = offsets [unique [u]] + blob.size ();
+    bytes += src.data.size ();
+  }
+
+  ok = (fclose (f) == 0) && ok;
+
+  if (! ok) {
+    fprintf (stderr, "packtex: writing %s failed\n", out);
+    return 1;
+  }
+
+  //
+  // Verify through the game's own reader
+  //
+  ad_texture_pack_s pack;
+
+  if (! pack.open (out)) {
+    fprintf (stderr, "packtex: %s does not open as a pack\n", out);
+    return 1;
+  }
+
+  for (size_t i = 0; i < sources.size (); i++) {
+    const uint8_t* data;
+    size_t         size;
+    const size_t   owner = sources [i].same_as == -1 ? i : (size_t)sources [i].same_as;
+
+    if ( (! pack.find (sources [i].key, &data, &size)) ||
+         size != sources [owner].data.size ()          ||
+         memcmp (data, sources [owner].data.data (), size) != 0 ) {
+      fprintf (stderr, "packtex: %s did not survive the round trip\n", sources [i].path.c_str ());
+      return 1;
+    }
+  }
+
+  printf ( "packtex: %zu replacements, %zu unique (%.2f MiB), %s is %.2f MiB\n",
+             sources.size (), unique.size (), (double)bytes / 1048576.0,
+               out, (double)pos / 1048576.0 );
+
+  return 0;
+}